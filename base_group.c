@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+/* _GNU_SOURCE, for pthread_setaffinity_np and the CPU_* macros, comes from
+ * evconfig-private.h. */
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <sys/types.h>
+#include <string.h>
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef EVENT__HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+#include "event2/base_group.h"
+#include "event2/event.h"
+#include "event2/listener.h"
+#include "event2/thread.h"
+#include "event2/util.h"
+#include "mm-internal.h"
+#include "log-internal.h"
+#include "evthread-internal.h"
+#include "event-internal.h"
+
+#if defined(EVENT__HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#define BASE_GROUP_CAN_STEER
+#endif
+#if defined(__linux__) && defined(CPU_SET)
+#define BASE_GROUP_CAN_PIN
+#endif
+
+struct base_group_worker {
+	struct event_base *base;
+	pthread_t thread;
+	unsigned started : 1;
+};
+
+struct event_base_group {
+	int n_bases;
+	unsigned flags;
+	struct base_group_worker *workers;
+	/* All of the bases, for work stealing. */
+	struct event_base **peers;
+	/* n_bases listeners for each call to event_base_group_listen(). */
+	struct evconnlistener **listeners;
+	int n_listeners;
+	/* The CPUs we were allowed to run on when the group was created, in
+	 * order.  Base i is pinned to cpus[i % n_cpus], and connections are
+	 * steered to match. */
+	int *cpus;
+	int n_cpus;
+};
+
+static void *
+base_group_thread(void *arg)
+{
+	struct event_base *base = arg;
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	return NULL;
+}
+
+static int
+base_group_n_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return (int)n;
+#endif
+	return 1;
+}
+
+#ifdef BASE_GROUP_CAN_PIN
+/* Fill in group->cpus with the CPUs that we are allowed to run on, or
+ * leave it empty if we can't tell. */
+static void
+base_group_get_cpus(struct event_base_group *group)
+{
+	cpu_set_t allowed;
+	int cpu, n;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+		return;
+	n = CPU_COUNT(&allowed);
+	if (n <= 0 || !(group->cpus = mm_calloc(n, sizeof(int))))
+		return;
+	for (cpu = 0; cpu < CPU_SETSIZE && group->n_cpus < n; ++cpu) {
+		if (CPU_ISSET(cpu, &allowed))
+			group->cpus[group->n_cpus++] = cpu;
+	}
+}
+
+/* Pin 'thread' to 'cpu'. */
+static void
+base_group_pin_thread(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+		event_warnx("%s: unable to pin a thread to CPU %d",
+		    __func__, cpu);
+}
+#endif
+
+#ifdef BASE_GROUP_CAN_STEER
+/* Attach a program to the SO_REUSEPORT group of 'fd' that hands each
+ * connection to the socket of the base pinned to the current CPU: for the
+ * k'th of group->cpus, that is socket k modulo the number of bases.  A CPU
+ * that is not in group->cpus, or every CPU if we don't know them, maps to
+ * its own number modulo the number of bases. */
+static void
+base_group_steer_by_cpu(evutil_socket_t fd,
+    const struct event_base_group *group)
+{
+	struct sock_filter *code, *pc;
+	struct sock_fprog prog;
+	ev_uint32_t n = (ev_uint32_t)group->n_bases;
+	int k, n_cpus = group->n_cpus;
+
+	/* If the k'th CPU is CPU k for every k, the plain modulo gives the
+	 * same answer without the table.  It is also what we fall back on
+	 * when the table would be too long for a BPF program. */
+	for (k = 0; k < n_cpus && group->cpus[k] == k; ++k)
+		;
+	if (k == n_cpus || 2 * n_cpus + 3 > BPF_MAXINSNS)
+		n_cpus = 0;
+
+	if (!(code = mm_calloc(2 * n_cpus + 3, sizeof(*code))))
+		return;
+	pc = code;
+	pc->code = BPF_LD | BPF_W | BPF_ABS;
+	pc->k = SKF_AD_OFF + SKF_AD_CPU;
+	++pc;
+	for (k = 0; k < n_cpus; ++k) {
+		/* if (A == cpus[k]) return k % n; */
+		pc->code = BPF_JMP | BPF_JEQ | BPF_K;
+		pc->jf = 1;
+		pc->k = (ev_uint32_t)group->cpus[k];
+		++pc;
+		pc->code = BPF_RET | BPF_K;
+		pc->k = (ev_uint32_t)k % n;
+		++pc;
+	}
+	pc->code = BPF_ALU | BPF_MOD | BPF_K;
+	pc->k = n;
+	++pc;
+	pc->code = BPF_RET | BPF_A;
+	++pc;
+
+	prog.len = (unsigned short)(pc - code);
+	prog.filter = code;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+		&prog, sizeof(prog)) < 0)
+		event_sock_warn(fd, "%s: SO_ATTACH_REUSEPORT_CBPF", __func__);
+	mm_free(code);
+}
+#endif
+
+struct event_base_group *
+event_base_group_new(int n_bases, const struct event_config *cfg,
+    unsigned flags)
+{
+	struct event_base_group *group;
+	int i;
+
+	if (!evthread_lock_fns_.alloc) {
+		event_warnx("%s: event_base groups need locking; call "
+		    "evthread_use_pthreads() first.", __func__);
+		return NULL;
+	}
+
+	if (n_bases <= 0)
+		n_bases = base_group_n_cpus();
+
+	if (!(group = mm_calloc(1, sizeof(struct event_base_group))))
+		return NULL;
+	group->flags = flags;
+	group->workers = mm_calloc(n_bases, sizeof(struct base_group_worker));
+	if (!group->workers)
+		goto err;
+	group->n_bases = n_bases;
+
+	for (i = 0; i < n_bases; ++i) {
+		struct event_base *base;
+		if (cfg)
+			base = event_base_new_with_config(cfg);
+		else
+			base = event_base_new();
+		if (!base)
+			goto err;
+		group->workers[i].base = base;
+	}
+
+#ifdef BASE_GROUP_CAN_PIN
+	/* without them we don't pin, and steer by plain CPU number */
+	if (flags & (EVENT_BASE_GROUP_PIN_THREADS|EVENT_BASE_GROUP_STEER_BY_CPU))
+		base_group_get_cpus(group);
+#endif
+
+	if (flags & EVENT_BASE_GROUP_WORK_STEALING) {
+		group->peers = mm_calloc(n_bases, sizeof(struct event_base *));
+		if (!group->peers)
+			goto err;
+		for (i = 0; i < n_bases; ++i)
+			group->peers[i] = group->workers[i].base;
+		for (i = 0; i < n_bases; ++i)
+			event_base_set_steal_peers_(group->peers[i],
+			    group->peers, n_bases);
+	}
+
+	for (i = 0; i < n_bases; ++i) {
+		struct base_group_worker *w = &group->workers[i];
+		if (pthread_create(&w->thread, NULL, base_group_thread,
+			w->base) != 0) {
+			event_warnx("%s: unable to start a thread", __func__);
+			goto err;
+		}
+		w->started = 1;
+#ifdef BASE_GROUP_CAN_PIN
+		if ((flags & EVENT_BASE_GROUP_PIN_THREADS) && group->n_cpus)
+			base_group_pin_thread(w->thread,
+			    group->cpus[i % group->n_cpus]);
+#endif
+	}
+
+	return group;
+err:
+	event_base_group_free(group);
+	return NULL;
+}
+
+void
+event_base_group_free(struct event_base_group *group)
+{
+	int i;
+
+	for (i = 0; i < group->n_bases; ++i) {
+		if (group->workers[i].started)
+			event_base_loopexit(group->workers[i].base, NULL);
+	}
+	for (i = 0; i < group->n_bases; ++i) {
+		if (group->workers[i].started)
+			pthread_join(group->workers[i].thread, NULL);
+	}
+
+	for (i = 0; i < group->n_listeners; ++i)
+		evconnlistener_free(group->listeners[i]);
+	if (group->listeners)
+		mm_free(group->listeners);
+
+	for (i = 0; i < group->n_bases; ++i) {
+		if (group->workers[i].base)
+			event_base_free(group->workers[i].base);
+	}
+	if (group->workers)
+		mm_free(group->workers);
+	if (group->peers)
+		mm_free(group->peers);
+	if (group->cpus)
+		mm_free(group->cpus);
+	mm_free(group);
+}
+
+int
+event_base_group_get_n_bases(const struct event_base_group *group)
+{
+	return group->n_bases;
+}
+
+struct event_base *
+event_base_group_get_base(const struct event_base_group *group, int i)
+{
+	if (i < 0 || i >= group->n_bases)
+		return NULL;
+	return group->workers[i].base;
+}
+
+int
+event_base_group_listen(struct event_base_group *group,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen,
+    struct evconnlistener **listeners_out)
+{
+	struct sockaddr_storage ss;
+	struct evconnlistener **lev;
+	int i;
+
+	if (socklen <= 0 || (size_t)socklen > sizeof(ss))
+		return -1;
+	memcpy(&ss, sa, socklen);
+
+	lev = mm_realloc(group->listeners,
+	    (group->n_listeners + group->n_bases) * sizeof(*lev));
+	if (!lev)
+		return -1;
+	group->listeners = lev;
+	lev += group->n_listeners;
+
+	flags |= LEV_OPT_REUSEABLE_PORT;
+	for (i = 0; i < group->n_bases; ++i) {
+		lev[i] = evconnlistener_new_bind(group->workers[i].base,
+		    cb, ptr, flags, backlog, (struct sockaddr *)&ss, socklen);
+		if (!lev[i])
+			goto err;
+		if (i == 0) {
+			/* If the caller let the kernel pick the port, the
+			 * rest of the listeners need to use the same one. */
+			ev_socklen_t len = sizeof(ss);
+			if (getsockname(evconnlistener_get_fd(lev[0]),
+				(struct sockaddr *)&ss, &len) < 0) {
+				++i;
+				goto err;
+			}
+		}
+	}
+
+#ifdef BASE_GROUP_CAN_STEER
+	if (group->flags & EVENT_BASE_GROUP_STEER_BY_CPU)
+		base_group_steer_by_cpu(evconnlistener_get_fd(lev[0]), group);
+#endif
+
+	group->n_listeners += group->n_bases;
+	if (listeners_out)
+		memcpy(listeners_out, lev, group->n_bases * sizeof(*lev));
+	return 0;
+err:
+	while (i-- > 0)
+		evconnlistener_free(lev[i]);
+	return -1;
+}
@@ -68,6 +68,13 @@
 #ifdef EVENT__HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
+#ifdef EVENT__HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+#ifdef EVENT__HAVE_LINUX_ERRQUEUE_H
+#include <time.h>
+#include <linux/errqueue.h>
+#endif
 
 
 #include <errno.h>
@@ -117,6 +124,16 @@
 #define SENDFILE_IS_SOLARIS	1
 #endif
 
+/* MSG_ZEROCOPY support */
+#if defined(EVENT__HAVE_LINUX_ERRQUEUE_H) && defined(EVENT__HAVE_SYS_UIO_H) && \
+    defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY) && defined(SO_EE_CODE_ZEROCOPY_COPIED)
+#define USE_ZEROCOPY		1
+/* Below this many bytes, pinning and completion handling cost more than
+ * the copy we save. */
+#define EVBUFFER_ZEROCOPY_MIN	16384
+#endif
+
 /* Mask of user-selectable callback flags. */
 #define EVBUFFER_CB_USER_FLAGS	    0xffff
 /* Mask of all internal-use-only flags. */
@@ -141,6 +158,7 @@
 } while (0)
 
 #define EVBUFFER_MAX_READ_DEFAULT	4096
+#define EVBUFFER_ADAPTIVE_READ_MIN	64
 
 static void evbuffer_chain_align(struct evbuffer_chain *chain);
 static int evbuffer_chain_should_realign(struct evbuffer_chain *chain,
@@ -154,18 +172,22 @@ static int evbuffer_ptr_subtract(struct evbuffer *buf, struct evbuffer_ptr *pos,
     size_t howfar);
 static int evbuffer_file_segment_materialize(struct evbuffer_file_segment *seg);
 static inline void evbuffer_chain_incref(struct evbuffer_chain *chain);
+#ifdef USE_ZEROCOPY
+static void evbuffer_zerocopy_release(struct evbuffer_zerocopy *zc,
+    ev_uint32_t upto);
+static void evbuffer_zerocopy_release_all(struct evbuffer_zerocopy *zc);
+static int evbuffer_zerocopy_settle(struct evbuffer_zerocopy *zc,
+    evutil_socket_t fd);
+static void evbuffer_zerocopy_orphan(struct evbuffer_zerocopy *zc);
+#endif
 
-static struct evbuffer_chain *
-evbuffer_chain_new(size_t size)
+/* Return how much memory to allocate for 'size' bytes of chain header and
+ * data. */
+static size_t
+evbuffer_chain_alloc_size(size_t size)
 {
-	struct evbuffer_chain *chain;
 	size_t to_alloc;
 
-	if (size > EVBUFFER_CHAIN_MAX - EVBUFFER_CHAIN_SIZE)
-		return (NULL);
-
-	size += EVBUFFER_CHAIN_SIZE;
-
 	/* get the next largest memory that can hold the buffer */
 	if (size < EVBUFFER_CHAIN_MAX / 2) {
 		to_alloc = MIN_BUFFER_SIZE;
@@ -175,14 +197,155 @@ evbuffer_chain_new(size_t size)
 	} else {
 		to_alloc = size;
 	}
+	return to_alloc;
+}
 
-	/* we get everything in one chunk */
-	if ((chain = mm_malloc(to_alloc)) == NULL)
-		return (NULL);
+/* Drop a reference to 'pool', whose lock we hold, and release the lock. */
+static void
+evbuffer_chain_pool_decref_and_unlock(struct evbuffer_chain_pool *pool)
+{
+	EVUTIL_ASSERT(pool->refcnt > 0);
+	if (--pool->refcnt > 0) {
+		EVLOCK_UNLOCK(pool->lock, 0);
+		return;
+	}
+	EVLOCK_UNLOCK(pool->lock, 0);
+	EVTHREAD_FREE_LOCK(pool->lock, 0);
+	if (pool->mem_ctx)
+		event_mem_ctx_decref_(pool->mem_ctx);
+	mm_free(pool);
+}
+
+/* Give the memory for a chain from 'pool' back to where it came from. */
+static void
+evbuffer_pooled_chain_release(struct evbuffer_chain_pool *pool,
+    struct evbuffer_pooled_chain *pc)
+{
+	if (pool->mem_ctx)
+		event_mem_ctx_release(pool->mem_ctx, pc, pc->alloc_size);
+	else
+		mm_free(pc);
+}
+
+/* Get a chain of 'to_alloc' bytes, including its evbuffer_pooled_chain
+ * header, from 'pool'.  Returns NULL if the pool doesn't do that size, or
+ * on allocation failure. */
+static struct evbuffer_chain *
+evbuffer_chain_pool_get(struct evbuffer_chain_pool *pool, size_t to_alloc)
+{
+	struct evbuffer_pooled_chain *pc = NULL;
+	struct evbuffer_chain *chain;
+	int size_class = 0;
+
+	if (to_alloc > pool->max_chain_size) {
+		/* Too big to cache, but a pool with an allocator context
+		 * still allocates it. */
+		if (!pool->mem_ctx)
+			return NULL;
+		size_class = -1;
+	} else {
+		while (((size_t)MIN_BUFFER_SIZE << size_class) < to_alloc)
+			++size_class;
+	}
+
+	EVLOCK_LOCK(pool->lock, 0);
+	if (size_class >= 0 &&
+	    (chain = pool->free_chains[size_class]) != NULL) {
+		pool->free_chains[size_class] = chain->next;
+		--pool->stats.cached_chains;
+		pool->stats.cached_bytes -= to_alloc;
+		++pool->stats.n_hits;
+		++pool->refcnt;
+		pc = EVUTIL_UPCAST(chain, struct evbuffer_pooled_chain, chain);
+	}
+	EVLOCK_UNLOCK(pool->lock, 0);
 
+	if (!pc) {
+		if (pool->mem_ctx)
+			pc = event_mem_ctx_alloc(pool->mem_ctx, to_alloc);
+		else
+			pc = mm_malloc(to_alloc);
+		if (pc == NULL)
+			return NULL;
+		pc->pool = pool;
+		pc->size_class = size_class;
+		pc->alloc_size = to_alloc;
+		EVLOCK_LOCK(pool->lock, 0);
+		++pool->stats.n_misses;
+		++pool->refcnt;
+		EVLOCK_UNLOCK(pool->lock, 0);
+	}
+
+	chain = &pc->chain;
 	memset(chain, 0, EVBUFFER_CHAIN_SIZE);
+	chain->buffer_len = to_alloc - sizeof(*pc);
+	chain->flags = EVBUFFER_POOLED;
+	return chain;
+}
+
+/* Give a chain from an evbuffer_chain_pool back to it. */
+static void
+evbuffer_chain_pool_put(struct evbuffer_chain *chain)
+{
+	struct evbuffer_pooled_chain *pc =
+	    EVUTIL_UPCAST(chain, struct evbuffer_pooled_chain, chain);
+	struct evbuffer_chain_pool *pool = pc->pool;
+	size_t size = pc->alloc_size;
+
+	EVLOCK_LOCK(pool->lock, 0);
+	if (pc->size_class >= 0 && !pool->owner_freed &&
+	    pool->stats.cached_bytes + size <= pool->max_cached_bytes) {
+		chain->next = pool->free_chains[pc->size_class];
+		pool->free_chains[pc->size_class] = chain;
+		++pool->stats.cached_chains;
+		pool->stats.cached_bytes += size;
+		++pool->stats.n_recycled;
+	} else {
+		++pool->stats.n_released;
+		evbuffer_pooled_chain_release(pool, pc);
+	}
+	evbuffer_chain_pool_decref_and_unlock(pool);
+}
+
+/* Release the memory for 'chain', which nothing refers to any more. */
+static void
+evbuffer_chain_dealloc(struct evbuffer_chain *chain)
+{
+	if (chain->flags & EVBUFFER_POOLED)
+		evbuffer_chain_pool_put(chain);
+	else
+		mm_free(chain);
+}
+
+static struct evbuffer_chain *
+evbuffer_chain_new(struct evbuffer *buf, size_t size)
+{
+	struct evbuffer_chain *chain = NULL;
+	size_t to_alloc;
+
+	if (size > EVBUFFER_CHAIN_MAX - EVBUFFER_CHAIN_SIZE)
+		return (NULL);
+
+	size += EVBUFFER_CHAIN_SIZE;
+
+	if (buf->chain_pool && (size <= buf->chain_pool->max_chain_size ||
+		buf->chain_pool->mem_ctx)) {
+		to_alloc = evbuffer_chain_alloc_size(size +
+		    evutil_offsetof(struct evbuffer_pooled_chain, chain));
+		chain = evbuffer_chain_pool_get(buf->chain_pool, to_alloc);
+	}
+
+	if (chain == NULL) {
+		to_alloc = evbuffer_chain_alloc_size(size);
+
+		/* we get everything in one chunk */
+		if ((chain = mm_malloc(to_alloc)) == NULL)
+			return (NULL);
 
-	chain->buffer_len = to_alloc - EVBUFFER_CHAIN_SIZE;
+		memset(chain, 0, EVBUFFER_CHAIN_SIZE);
+
+		chain->buffer_len = to_alloc - EVBUFFER_CHAIN_SIZE;
+	}
 
 	/* this way we can manipulate the buffer to different addresses,
 	 * which is required for mmap for example.
@@ -194,6 +357,27 @@ evbuffer_chain_new(size_t size)
 	return (chain);
 }
 
+/* Return how much of our memory 'chain' holds, for buf->total_alloc.
+ * Chains that point at memory we don't own only cost us their header. */
+static inline size_t
+evbuffer_chain_cost_(const struct evbuffer_chain *chain)
+{
+	if (chain->flags & (EVBUFFER_REFERENCE|EVBUFFER_FILESEGMENT|
+		EVBUFFER_MULTICAST|EVBUFFER_SEGMENT))
+		return EVBUFFER_CHAIN_SIZE;
+	return EVBUFFER_CHAIN_SIZE + chain->buffer_len;
+}
+
+/* Return the total cost of 'chain' and every chain after it. */
+static size_t
+evbuffer_chains_cost_(const struct evbuffer_chain *chain)
+{
+	size_t total = 0;
+	for (; chain; chain = chain->next)
+		total += evbuffer_chain_cost_(chain);
+	return total;
+}
+
 static inline void
 evbuffer_chain_free(struct evbuffer_chain *chain)
 {
@@ -235,6 +419,13 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 			evbuffer_file_segment_free(info->segment);
 		}
 	}
+	if (chain->flags & EVBUFFER_SEGMENT) {
+		struct evbuffer_chain_segment *info =
+		    EVBUFFER_CHAIN_EXTRA(
+			    struct evbuffer_chain_segment,
+			    chain);
+		evbuffer_segment_free(info->segment);
+	}
 	if (chain->flags & EVBUFFER_MULTICAST) {
 		struct evbuffer_multicast_parent *info =
 		    EVBUFFER_CHAIN_EXTRA(
@@ -251,7 +442,7 @@ evbuffer_chain_free(struct evbuffer_chain *chain)
 		evbuffer_decref_and_unlock_(info->source);
 	}
 
-	mm_free(chain);
+	evbuffer_chain_dealloc(chain);
 }
 
 static void
@@ -298,6 +489,7 @@ evbuffer_free_trailing_empty_chains(struct evbuffer *buf)
 		ch = &(*ch)->next;
 	if (*ch) {
 		EVUTIL_ASSERT(evbuffer_chains_all_empty(*ch));
+		buf->total_alloc -= evbuffer_chains_cost_(*ch);
 		evbuffer_free_all_chains(*ch);
 		*ch = NULL;
 	}
@@ -326,13 +518,14 @@ evbuffer_chain_insert(struct evbuffer *buf,
 		buf->last = chain;
 	}
 	buf->total_len += chain->off;
+	buf->total_alloc += evbuffer_chain_cost_(chain);
 }
 
 static inline struct evbuffer_chain *
 evbuffer_chain_insert_new(struct evbuffer *buf, size_t datlen)
 {
 	struct evbuffer_chain *chain;
-	if ((chain = evbuffer_chain_new(datlen)) == NULL)
+	if ((chain = evbuffer_chain_new(buf, datlen)) == NULL)
 		return NULL;
 	evbuffer_chain_insert(buf, chain);
 	return chain;
@@ -580,6 +773,23 @@ evbuffer_decref_and_unlock_(struct evbuffer *buffer)
 	evbuffer_remove_all_callbacks(buffer);
 	if (buffer->deferred_cbs)
 		event_deferred_cb_cancel_(buffer->cb_queue, &buffer->deferred);
+#ifdef USE_ZEROCOPY
+	if (buffer->zerocopy) {
+		struct evbuffer_zerocopy *zc = buffer->zerocopy;
+		/* The kernel may still be sending from our chains. */
+		evbuffer_zerocopy_settle(zc, EVUTIL_INVALID_SOCKET);
+		if (zc->done_seq == zc->next_seq) {
+			mm_free(zc->pins);
+			mm_free(zc);
+		} else {
+			evbuffer_zerocopy_orphan(zc);
+		}
+	}
+#endif
+	if (buffer->chain_pool) {
+		EVLOCK_LOCK(buffer->chain_pool->lock, 0);
+		evbuffer_chain_pool_decref_and_unlock(buffer->chain_pool);
+	}
 
 	EVBUFFER_UNLOCK(buffer);
 	if (buffer->own_lock)
@@ -614,6 +824,196 @@ size_t evbuffer_get_max_read(struct evbuffer *buf)
 	return result;
 }
 
+int
+evbuffer_set_adaptive_read(struct evbuffer *buf, size_t min, size_t max)
+{
+	if (max > INT_MAX)
+		return -1;
+	if (min == 0)
+		min = EVBUFFER_ADAPTIVE_READ_MIN;
+	if (max && min > max)
+		return -1;
+
+	EVBUFFER_LOCK(buf);
+	buf->read_min = min;
+	buf->read_max = max;
+	buf->read_next = EVBUFFER_MAX_READ_DEFAULT;
+	if (buf->read_next < min)
+		buf->read_next = min;
+	if (buf->read_next > max)
+		buf->read_next = max;
+	buf->n_small_reads = 0;
+	EVBUFFER_UNLOCK(buf);
+	return 0;
+}
+
+/* Return true iff 'chain' is a plain chain whose data we may move into a
+ * smaller one: it owns its memory, nothing else refers to it, and it would
+ * fit in an allocation at least a size class smaller. */
+static int
+evbuffer_chain_should_shrink(const struct evbuffer_chain *chain)
+{
+	if ((chain->flags & ~EVBUFFER_POOLED) || chain->refcnt != 1)
+		return 0;
+	if (chain->off == 0)
+		return 0;
+	return evbuffer_chain_alloc_size(chain->off + EVBUFFER_CHAIN_SIZE) <
+	    chain->buffer_len + EVBUFFER_CHAIN_SIZE;
+}
+
+size_t
+evbuffer_shrink(struct evbuffer *buf)
+{
+	struct evbuffer_chain **chp, *chain, *nchain;
+	size_t released = 0;
+
+	EVBUFFER_LOCK(buf);
+
+	/* First, drop the empty chains after the last one with data, as
+	 * left behind by a drain or an expand that was never filled.  A
+	 * pinned one may be about to be read into, so it stays. */
+	chp = buf->last_with_datap;
+	while ((chain = *chp) != NULL) {
+		if (chain->off != 0 || CHAIN_PINNED(chain)) {
+			chp = &chain->next;
+			continue;
+		}
+		*chp = chain->next;
+		released += chain->buffer_len;
+		buf->total_alloc -= evbuffer_chain_cost_(chain);
+		evbuffer_chain_free(chain);
+	}
+	if (chp == &buf->first)
+		buf->last = NULL;
+	else
+		buf->last = EVUTIL_UPCAST(chp, struct evbuffer_chain, next);
+
+	/* Then move data out of chains that are mostly empty space. */
+	for (chp = &buf->first; (chain = *chp) != NULL; chp = &nchain->next) {
+		nchain = chain;
+		if (!evbuffer_chain_should_shrink(chain))
+			continue;
+		if ((nchain = evbuffer_chain_new(buf, chain->off)) == NULL) {
+			nchain = chain;
+			break;
+		}
+		memcpy(nchain->buffer, chain->buffer + chain->misalign,
+		    chain->off);
+		nchain->off = chain->off;
+		nchain->next = chain->next;
+		*chp = nchain;
+		if (buf->last == chain)
+			buf->last = nchain;
+		if (buf->last_with_datap == &chain->next)
+			buf->last_with_datap = &nchain->next;
+		released += chain->buffer_len - nchain->buffer_len;
+		buf->total_alloc -= chain->buffer_len - nchain->buffer_len;
+		++buf->chain_gen;
+		evbuffer_chain_free(chain);
+	}
+
+	EVBUFFER_UNLOCK(buf);
+	return released;
+}
+
+size_t
+evbuffer_get_allocated_(struct evbuffer *buf)
+{
+	size_t total;
+
+	EVBUFFER_LOCK(buf);
+	total = buf->total_alloc;
+	EVBUFFER_UNLOCK(buf);
+	return total;
+}
+
+struct evbuffer_chain_pool *
+evbuffer_chain_pool_new(size_t max_cached_bytes, size_t max_chain_size)
+{
+	struct evbuffer_chain_pool *pool;
+	const size_t largest =
+	    (size_t)MIN_BUFFER_SIZE << (EVBUFFER_CHAIN_POOL_CLASSES - 1);
+
+	if ((pool = mm_calloc(1, sizeof(*pool))) == NULL)
+		return NULL;
+	EVTHREAD_ALLOC_LOCK(pool->lock, 0);
+	pool->refcnt = 1;
+	pool->max_cached_bytes = max_cached_bytes;
+	if (max_chain_size == 0 || max_chain_size > largest)
+		max_chain_size = largest;
+	pool->max_chain_size = max_chain_size;
+	return pool;
+}
+
+struct evbuffer_chain_pool *
+evbuffer_chain_pool_new_with_mem_ctx(size_t max_cached_bytes,
+    size_t max_chain_size, struct event_mem_ctx *ctx)
+{
+	struct evbuffer_chain_pool *pool;
+
+	if (!ctx)
+		return NULL;
+	pool = evbuffer_chain_pool_new(max_cached_bytes, max_chain_size);
+	if (pool) {
+		event_mem_ctx_incref_(ctx);
+		pool->mem_ctx = ctx;
+	}
+	return pool;
+}
+
+void
+evbuffer_chain_pool_free(struct evbuffer_chain_pool *pool)
+{
+	struct evbuffer_chain *chains[EVBUFFER_CHAIN_POOL_CLASSES];
+	struct evbuffer_chain *chain, *next;
+	int i;
+
+	EVLOCK_LOCK(pool->lock, 0);
+	EVUTIL_ASSERT(!pool->owner_freed);
+	pool->owner_freed = 1;
+	memcpy(chains, pool->free_chains, sizeof(chains));
+	memset(pool->free_chains, 0, sizeof(pool->free_chains));
+	pool->stats.cached_chains = 0;
+	pool->stats.cached_bytes = 0;
+
+	for (i = 0; i < EVBUFFER_CHAIN_POOL_CLASSES; ++i) {
+		for (chain = chains[i]; chain; chain = next) {
+			next = chain->next;
+			evbuffer_pooled_chain_release(pool, EVUTIL_UPCAST(chain,
+				struct evbuffer_pooled_chain, chain));
+		}
+	}
+	evbuffer_chain_pool_decref_and_unlock(pool);
+}
+
+int
+evbuffer_set_chain_pool(struct evbuffer *buf,
+    struct evbuffer_chain_pool *pool)
+{
+	EVBUFFER_LOCK(buf);
+	if (pool) {
+		EVLOCK_LOCK(pool->lock, 0);
+		++pool->refcnt;
+		EVLOCK_UNLOCK(pool->lock, 0);
+	}
+	if (buf->chain_pool) {
+		EVLOCK_LOCK(buf->chain_pool->lock, 0);
+		evbuffer_chain_pool_decref_and_unlock(buf->chain_pool);
+	}
+	buf->chain_pool = pool;
+	EVBUFFER_UNLOCK(buf);
+	return 0;
+}
+
+void
+evbuffer_chain_pool_get_stats(struct evbuffer_chain_pool *pool,
+    struct evbuffer_chain_pool_stats *stats)
+{
+	EVLOCK_LOCK(pool->lock, 0);
+	*stats = pool->stats;
+	EVLOCK_UNLOCK(pool->lock, 0);
+}
+
 void
 evbuffer_lock(struct evbuffer *buf)
 {
@@ -823,6 +1223,7 @@ ZERO_CHAIN(struct evbuffer *dst)
 	dst->last = NULL;
 	dst->last_with_datap = &(dst)->first;
 	dst->total_len = 0;
+	dst->total_alloc = 0;
 }
 
 /* Prepares the contents of src to be moved to another buffer by removing
@@ -855,7 +1256,7 @@ PRESERVE_PINNED(struct evbuffer *src, struct evbuffer_chain **first,
 		struct evbuffer_chain *tmp;
 
 		EVUTIL_ASSERT(pinned == src->last_with_datap);
-		tmp = evbuffer_chain_new(chain->off);
+		tmp = evbuffer_chain_new(src, chain->off);
 		if (!tmp)
 			return -1;
 		memcpy(tmp->buffer, chain->buffer + chain->misalign,
@@ -863,12 +1264,16 @@ PRESERVE_PINNED(struct evbuffer *src, struct evbuffer_chain **first,
 		tmp->off = chain->off;
 		*src->last_with_datap = tmp;
 		src->last = tmp;
+		src->total_alloc += evbuffer_chain_cost_(tmp);
+		++src->chain_gen;
 		chain->misalign += chain->off;
 		chain->off = 0;
 	} else {
 		src->last = *src->last_with_datap;
 		*pinned = NULL;
 	}
+	/* The pinned chains are no longer part of what moves. */
+	src->total_alloc -= evbuffer_chains_cost_(*first);
 
 	return 0;
 }
@@ -888,6 +1293,7 @@ RESTORE_PINNED(struct evbuffer *src, struct evbuffer_chain *pinned,
 	src->last = last;
 	src->last_with_datap = &src->first;
 	src->total_len = 0;
+	src->total_alloc = evbuffer_chains_cost_(pinned);
 }
 
 static inline void
@@ -902,6 +1308,7 @@ COPY_CHAIN(struct evbuffer *dst, struct evbuffer *src)
 		dst->last_with_datap = src->last_with_datap;
 	dst->last = src->last;
 	dst->total_len = src->total_len;
+	dst->total_alloc = src->total_alloc;
 }
 
 static void
@@ -921,6 +1328,7 @@ APPEND_CHAIN(struct evbuffer *dst, struct evbuffer *src)
 		dst->last_with_datap = src->last_with_datap;
 	dst->last = src->last;
 	dst->total_len += src->total_len;
+	dst->total_alloc += src->total_alloc;
 }
 
 static inline void
@@ -939,7 +1347,8 @@ APPEND_CHAIN_MULTICAST(struct evbuffer *dst, struct evbuffer *src)
 			continue;
 		}
 
-		tmp = evbuffer_chain_new(sizeof(struct evbuffer_multicast_parent));
+		tmp = evbuffer_chain_new(dst,
+		    sizeof(struct evbuffer_multicast_parent));
 		if (!tmp) {
 			event_warn("%s: out of memory", __func__);
 			return;
@@ -971,6 +1380,7 @@ PREPEND_CHAIN(struct evbuffer *dst, struct evbuffer *src)
 	src->last->next = dst->first;
 	dst->first = src->first;
 	dst->total_len += src->total_len;
+	dst->total_alloc += src->total_alloc;
 	if (*dst->last_with_datap == NULL) {
 		if (src->last_with_datap == &(src)->first)
 			dst->last_with_datap = &dst->first;
@@ -1059,6 +1469,7 @@ evbuffer_add_buffer_reference(struct evbuffer *outbuf, struct evbuffer *inbuf)
 		/* There might be an empty chain at the start of outbuf; free
 		 * it. */
 		evbuffer_free_all_chains(outbuf->first);
+		ZERO_CHAIN(outbuf);
 	}
 	APPEND_CHAIN_MULTICAST(outbuf, inbuf);
 
@@ -1165,8 +1576,10 @@ evbuffer_drain(struct evbuffer *buf, size_t len)
 				chain->misalign += chain->off;
 				chain->off = 0;
 				break;
-			} else
+			} else {
+				buf->total_alloc -= evbuffer_chain_cost_(chain);
 				evbuffer_chain_free(chain);
+			}
 		}
 
 		buf->first = chain;
@@ -1283,7 +1696,7 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 
 	/*XXX can fail badly on sendfile case. */
 	struct evbuffer_chain *chain, *previous;
-	size_t nread = 0;
+	size_t nread = 0, nalloc = 0;
 	int result;
 
 	EVBUFFER_LOCK2(src, dst);
@@ -1315,6 +1728,7 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 		 * block above */
 		EVUTIL_ASSERT(chain != *src->last_with_datap);
 		nread += chain->off;
+		nalloc += evbuffer_chain_cost_(chain);
 		datlen -= chain->off;
 		previous = chain;
 		if (src->last_with_datap == &chain->next)
@@ -1338,6 +1752,8 @@ evbuffer_remove_buffer(struct evbuffer *src, struct evbuffer *dst,
 		advance_last_with_data(dst);
 
 		dst->total_len += nread;
+		dst->total_alloc += nalloc;
+		src->total_alloc -= nalloc;
 		dst->n_add_for_cb += nread;
 	}
 
@@ -1424,16 +1840,18 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 		size -= old_off;
 		chain = chain->next;
 	} else {
-		if ((tmp = evbuffer_chain_new(size)) == NULL) {
+		if ((tmp = evbuffer_chain_new(buf, size)) == NULL) {
 			event_warn("%s: out of memory", __func__);
 			goto done;
 		}
 		buffer = tmp->buffer;
 		tmp->off = size;
 		buf->first = tmp;
+		buf->total_alloc += evbuffer_chain_cost_(tmp);
 	}
 
 	/* TODO(niels): deal with buffers that point to NULL like sendfile */
+	++buf->chain_gen;
 
 	/* Copy and free every chunk that will be entirely pulled into tmp */
 	last_with_data = *buf->last_with_datap;
@@ -1448,6 +1866,7 @@ evbuffer_pullup(struct evbuffer *buf, ev_ssize_t size)
 		if (&chain->next == buf->last_with_datap)
 			removed_last_with_datap = 1;
 
+		buf->total_alloc -= evbuffer_chain_cost_(chain);
 		evbuffer_chain_free(chain);
 	}
 
@@ -1509,41 +1928,15 @@ evbuffer_strchr(struct evbuffer_ptr *it, const char chr)
 	return (-1);
 }
 
-static inline char *
-find_eol_char(char *s, size_t len)
-{
-#define CHUNK_SZ 128
-	/* Lots of benchmarking found this approach to be faster in practice
-	 * than doing two memchrs over the whole buffer, doin a memchr on each
-	 * char of the buffer, or trying to emulate memchr by hand. */
-	char *s_end, *cr, *lf;
-	s_end = s+len;
-	while (s < s_end) {
-		size_t chunk = (s + CHUNK_SZ < s_end) ? CHUNK_SZ : (s_end - s);
-		cr = memchr(s, '\r', chunk);
-		lf = memchr(s, '\n', chunk);
-		if (cr) {
-			if (lf && lf < cr)
-				return lf;
-			return cr;
-		} else if (lf) {
-			return lf;
-		}
-		s += CHUNK_SZ;
-	}
-
-	return NULL;
-#undef CHUNK_SZ
-}
-
 static ev_ssize_t
 evbuffer_find_eol_char(struct evbuffer_ptr *it)
 {
 	struct evbuffer_chain *chain = it->internal_.chain;
 	size_t i = it->internal_.pos_in_chain;
 	while (chain != NULL) {
-		char *buffer = (char *)chain->buffer + chain->misalign;
-		char *cp = find_eol_char(buffer+i, chain->off-i);
+		const unsigned char *buffer = chain->buffer + chain->misalign;
+		const unsigned char *cp =
+		    evbuffer_find_eol_char_(buffer+i, chain->off-i);
 		if (cp) {
 			it->internal_.chain = chain;
 			it->internal_.pos_in_chain = cp - buffer;
@@ -1770,7 +2163,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 	/* If there are no chains allocated for this buffer, allocate one
 	 * big enough to hold all the data. */
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
@@ -1812,7 +2205,7 @@ evbuffer_add(struct evbuffer *buf, const void *data_in, size_t datlen)
 		to_alloc <<= 1;
 	if (datlen > to_alloc)
 		to_alloc = datlen;
-	tmp = evbuffer_chain_new(to_alloc);
+	tmp = evbuffer_chain_new(buf, to_alloc);
 	if (tmp == NULL)
 		goto done;
 
@@ -1862,14 +2255,15 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	chain = buf->first;
 
 	if (chain == NULL) {
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (!chain)
 			goto done;
 		evbuffer_chain_insert(buf, chain);
 	}
 
-	/* we cannot touch immutable buffers */
-	if ((chain->flags & EVBUFFER_IMMUTABLE) == 0) {
+	/* we cannot touch immutable buffers, or the space in front of data
+	 * that the kernel may still be sending from */
+	if ((chain->flags & (EVBUFFER_IMMUTABLE|EVBUFFER_MEM_PINNED_ZC)) == 0) {
 		/* Always true for mutable buffers */
 		EVUTIL_ASSERT(chain->misalign >= 0 &&
 		    (ev_uint64_t)chain->misalign <= EVBUFFER_CHAIN_MAX);
@@ -1902,9 +2296,10 @@ evbuffer_prepend(struct evbuffer *buf, const void *data, size_t datlen)
 	}
 
 	/* we need to add another chain */
-	if ((tmp = evbuffer_chain_new(datlen)) == NULL)
+	if ((tmp = evbuffer_chain_new(buf, datlen)) == NULL)
 		goto done;
 	buf->first = tmp;
+	buf->total_alloc += evbuffer_chain_cost_(tmp);
 	if (buf->last_with_datap == &buf->first && chain->off)
 		buf->last_with_datap = &tmp->next;
 
@@ -2031,7 +2426,7 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 		 * MAX_TO_COPY_IN_EXPAND bytes. */
 		/* figure out how much space we need */
 		size_t length = chain->off + datlen;
-		struct evbuffer_chain *tmp = evbuffer_chain_new(length);
+		struct evbuffer_chain *tmp = evbuffer_chain_new(buf, length);
 		if (tmp == NULL)
 			goto err;
 
@@ -2047,6 +2442,9 @@ evbuffer_expand_singlechain(struct evbuffer *buf, size_t datlen)
 			buf->last = tmp;
 
 		tmp->next = chain->next;
+		buf->total_alloc += evbuffer_chain_cost_(tmp);
+		buf->total_alloc -= evbuffer_chain_cost_(chain);
+		++buf->chain_gen;
 		evbuffer_chain_free(chain);
 		goto ok;
 	}
@@ -2077,7 +2475,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 	if (chain == NULL || (chain->flags & EVBUFFER_IMMUTABLE)) {
 		/* There is no last chunk, or we can't touch the last chunk.
 		 * Just add a new chunk. */
-		chain = evbuffer_chain_new(datlen);
+		chain = evbuffer_chain_new(buf, datlen);
 		if (chain == NULL)
 			return (-1);
 
@@ -2120,12 +2518,13 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		 * chains; we can add another. */
 		EVUTIL_ASSERT(chain == NULL);
 
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new(buf, datlen - avail);
 		if (tmp == NULL)
 			return (-1);
 
 		buf->last->next = tmp;
 		buf->last = tmp;
+		buf->total_alloc += evbuffer_chain_cost_(tmp);
 		/* (we would only set last_with_data if we added the first
 		 * chain. But if the buffer had no chains, we would have
 		 * just allocated a new chain earlier) */
@@ -2149,10 +2548,11 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 		for (; chain; chain = next) {
 			next = chain->next;
 			EVUTIL_ASSERT(chain->off == 0);
+			buf->total_alloc -= evbuffer_chain_cost_(chain);
 			evbuffer_chain_free(chain);
 		}
 		EVUTIL_ASSERT(datlen >= avail);
-		tmp = evbuffer_chain_new(datlen - avail);
+		tmp = evbuffer_chain_new(buf, datlen - avail);
 		if (tmp == NULL) {
 			if (rmv_all) {
 				ZERO_CHAIN(buf);
@@ -2170,6 +2570,7 @@ evbuffer_expand_fast_(struct evbuffer *buf, size_t datlen, int n)
 			(*buf->last_with_datap)->next = tmp;
 			buf->last = tmp;
 		}
+		buf->total_alloc += evbuffer_chain_cost_(tmp);
 		return (0);
 	}
 }
@@ -2293,6 +2694,34 @@ get_n_bytes_readable_on_socket(evutil_socket_t fd)
 #endif
 }
 
+/* Helper for adaptive reads: adjust buf->read_next after a read of 'n'
+ * bytes that asked for 'asked'. */
+static void
+evbuffer_read_adapt(struct evbuffer *buf, int asked, int n)
+{
+	if (n >= asked) {
+		buf->n_small_reads = 0;
+		/* We filled the whole budget, so there is probably more
+		 * waiting.  (If the caller asked for less than the budget,
+		 * this tells us nothing.) */
+		if ((size_t)asked == buf->read_next) {
+			if (buf->read_next > buf->read_max / 4)
+				buf->read_next = buf->read_max;
+			else
+				buf->read_next <<= 2;
+		}
+	} else if ((size_t)n <= buf->read_next / 2) {
+		if (++buf->n_small_reads >= 2) {
+			buf->n_small_reads = 0;
+			buf->read_next /= 2;
+			if (buf->read_next < buf->read_min)
+				buf->read_next = buf->read_min;
+		}
+	} else {
+		buf->n_small_reads = 0;
+	}
+}
+
 /* TODO(niels): should this function return ev_ssize_t and take ev_ssize_t
  * as howmuch? */
 int
@@ -2316,9 +2745,13 @@ evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 		goto done;
 	}
 
-	n = get_n_bytes_readable_on_socket(fd);
-	if (n <= 0 || n > (int)buf->max_read)
-		n = (int)buf->max_read;
+	if (buf->read_max) {
+		n = (int)buf->read_next;
+	} else {
+		n = get_n_bytes_readable_on_socket(fd);
+		if (n <= 0 || n > (int)buf->max_read)
+			n = (int)buf->max_read;
+	}
 	if (howmuch < 0 || howmuch > n)
 		howmuch = n;
 
@@ -2418,6 +2851,9 @@ evbuffer_read(struct evbuffer *buf, evutil_socket_t fd, int howmuch)
 	buf->total_len += n;
 	buf->n_add_for_cb += n;
 
+	if (buf->read_max)
+		evbuffer_read_adapt(buf, howmuch, n);
+
 	/* Tell someone about changes in this buffer */
 	evbuffer_invoke_callbacks_(buf);
 	result = n;
@@ -2427,16 +2863,14 @@ done:
 }
 
 #ifdef USE_IOVEC_IMPL
+/* Helper: point the iovecs in 'iov' at up to 'howmuch' bytes from the front
+ * of 'buffer', and return the number of iovecs used. */
 static inline int
-evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
+evbuffer_write_iovec_setup(struct evbuffer *buffer, IOV_TYPE *iov,
     ev_ssize_t howmuch)
 {
-	IOV_TYPE iov[NUM_WRITE_IOVEC];
 	struct evbuffer_chain *chain = buffer->first;
-	int n, i = 0;
-
-	if (howmuch < 0)
-		return -1;
+	int i = 0;
 
 	ASSERT_EVBUFFER_LOCKED(buffer);
 	/* XXX make this top out at some maximal data length?  if the
@@ -2460,6 +2894,20 @@ evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
 		}
 		chain = chain->next;
 	}
+	return i;
+}
+
+static inline int
+evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
+    ev_ssize_t howmuch)
+{
+	IOV_TYPE iov[NUM_WRITE_IOVEC];
+	int n, i;
+
+	if (howmuch < 0)
+		return -1;
+
+	i = evbuffer_write_iovec_setup(buffer, iov, howmuch);
 	if (! i)
 		return 0;
 
@@ -2478,57 +2926,379 @@ evbuffer_write_iovec(struct evbuffer *buffer, evutil_socket_t fd,
 }
 #endif
 
-#ifdef USE_SENDFILE
-static inline int
-evbuffer_write_sendfile(struct evbuffer *buffer, evutil_socket_t dest_fd,
-    ev_ssize_t howmuch)
+#ifdef USE_ZEROCOPY
+/* Unpin every chain whose last zerocopy send is before 'upto'. */
+static void
+evbuffer_zerocopy_release(struct evbuffer_zerocopy *zc, ev_uint32_t upto)
 {
-	struct evbuffer_chain *chain = buffer->first;
-	struct evbuffer_chain_file_segment *info =
-	    EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_file_segment,
-		chain);
-	const int source_fd = info->segment->fd;
-#if defined(SENDFILE_IS_MACOSX) || defined(SENDFILE_IS_FREEBSD)
-	int res;
-	ev_off_t len = chain->off;
-#elif defined(SENDFILE_IS_LINUX) || defined(SENDFILE_IS_SOLARIS)
-	ev_ssize_t res;
-	off_t offset = chain->misalign;
-#endif
-
-	ASSERT_EVBUFFER_LOCKED(buffer);
+	while (zc->pins_head < zc->n_pins) {
+		struct evbuffer_zerocopy_pin *pin = &zc->pins[zc->pins_head];
+		if ((ev_int32_t)(pin->seq - upto) >= 0)
+			break;
+		++zc->pins_head;
+		evbuffer_chain_unpin_(pin->chain, EVBUFFER_MEM_PINNED_ZC);
+	}
+	if (zc->pins_head == zc->n_pins)
+		zc->pins_head = zc->n_pins = 0;
+	zc->done_seq = upto;
+}
 
-#if defined(SENDFILE_IS_MACOSX)
-	res = sendfile(source_fd, dest_fd, chain->misalign, &len, NULL, 0);
-	if (res == -1 && !EVUTIL_ERR_RW_RETRIABLE(errno))
-		return (-1);
+static void
+evbuffer_zerocopy_release_all(struct evbuffer_zerocopy *zc)
+{
+	evbuffer_zerocopy_release(zc, zc->next_seq);
+}
 
-	return (len);
-#elif defined(SENDFILE_IS_FREEBSD)
-	res = sendfile(source_fd, dest_fd, chain->misalign, chain->off, NULL, &len, 0);
-	if (res == -1 && !EVUTIL_ERR_RW_RETRIABLE(errno))
-		return (-1);
+/* Make room on zc->pins for 'n' more chains.  Returns 0 on success, -1 on
+ * failure. */
+static int
+evbuffer_zerocopy_reserve(struct evbuffer_zerocopy *zc, size_t n)
+{
+	struct evbuffer_zerocopy_pin *pins;
+	size_t alloc;
 
-	return (len);
-#elif defined(SENDFILE_IS_LINUX)
-	/* TODO(niels): implement splice */
-	res = sendfile(dest_fd, source_fd, &offset, chain->off);
-	if (res == -1 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
-		/* if this is EAGAIN or EINTR return 0; otherwise, -1 */
-		return (0);
+	if (zc->pins_alloc - zc->n_pins >= n)
+		return 0;
+	if (zc->pins_head) {
+		memmove(zc->pins, zc->pins + zc->pins_head,
+		    (zc->n_pins - zc->pins_head) * sizeof(*zc->pins));
+		zc->n_pins -= zc->pins_head;
+		zc->pins_head = 0;
+		if (zc->pins_alloc - zc->n_pins >= n)
+			return 0;
 	}
-	return (res);
-#elif defined(SENDFILE_IS_SOLARIS)
-	{
-		const off_t offset_orig = offset;
-		res = sendfile(dest_fd, source_fd, &offset, chain->off);
-		if (res == -1 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
-			if (offset - offset_orig)
-				return offset - offset_orig;
-			/* if this is EAGAIN or EINTR and no bytes were
-			 * written, return 0 */
-			return (0);
-		}
+	alloc = zc->pins_alloc ? zc->pins_alloc : 16;
+	while (alloc - zc->n_pins < n)
+		alloc <<= 1;
+	pins = mm_realloc(zc->pins, alloc * sizeof(*pins));
+	if (!pins)
+		return -1;
+	zc->pins = pins;
+	zc->pins_alloc = alloc;
+	return 0;
+}
+
+/* Set *ino to the inode of socket 'fd'.  Returns 0 on success, -1 if 'fd'
+ * is not open. */
+static int
+evbuffer_zerocopy_sock_ino(evutil_socket_t fd, ev_uint64_t *ino)
+{
+	struct stat st;
+
+	if (fd == EVUTIL_INVALID_SOCKET || fstat(fd, &st) < 0)
+		return -1;
+	*ino = (ev_uint64_t)st.st_ino;
+	return 0;
+}
+
+/* Collect every completion report waiting on zc->fd.  Returns the number of
+ * reports, or -1 on error. */
+static int
+evbuffer_zerocopy_collect(struct evbuffer_zerocopy *zc)
+{
+	int r = 0;
+
+	while (zc->done_seq != zc->next_seq) {
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EBADF || errno == ENOTSOCK) {
+				/* Closed: the kernel is done with us. */
+				evbuffer_zerocopy_release_all(zc);
+			} else if (!EVUTIL_ERR_RW_RETRIABLE(errno)) {
+				r = -1;
+			}
+			break;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *serr;
+			if (!(cm->cmsg_level == SOL_IP &&
+				cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+				cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr->ee_errno != 0)
+				continue;
+			/* The kernel reports sends ee_info..ee_data, in
+			 * order, so everything up to ee_data is done. */
+			evbuffer_zerocopy_release(zc, serr->ee_data + 1);
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				zc->disabled = 1;
+			++r;
+		}
+	}
+	return r;
+}
+
+/* Collect the completions for the sends in 'zc', or release everything if
+ * their socket has been closed.  'fd' is the socket the caller is using
+ * now; if it isn't zc->fd, we check that zc->fd still refers to the same
+ * socket before reading from it.  Returns the number of reports collected,
+ * or -1 on error, and leaves zc->done_seq == zc->next_seq if nothing is
+ * pinned any more. */
+static int
+evbuffer_zerocopy_settle(struct evbuffer_zerocopy *zc, evutil_socket_t fd)
+{
+	ev_uint64_t ino;
+
+	if (zc->done_seq == zc->next_seq)
+		return 0;
+	if (zc->fd != fd &&
+	    (evbuffer_zerocopy_sock_ino(zc->fd, &ino) < 0 ||
+		ino != zc->sock_ino)) {
+		evbuffer_zerocopy_release_all(zc);
+		return 0;
+	}
+	return evbuffer_zerocopy_collect(zc);
+}
+
+/* Zerocopy state whose evbuffer has been freed while the kernel still had
+ * some of its chains. */
+static struct evbuffer_zerocopy *zerocopy_orphans = NULL;
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+static void *zerocopy_orphans_lock = NULL;
+#endif
+
+static void
+evbuffer_zerocopy_orphan(struct evbuffer_zerocopy *zc)
+{
+	EVLOCK_LOCK(zerocopy_orphans_lock, 0);
+	zc->next_orphan = zerocopy_orphans;
+	zerocopy_orphans = zc;
+	EVLOCK_UNLOCK(zerocopy_orphans_lock, 0);
+}
+
+/* Settle every orphan, and free the ones that have nothing pinned any
+ * more. */
+static void
+evbuffer_zerocopy_reap_orphans(void)
+{
+	struct evbuffer_zerocopy *zc, *next, *keep = NULL;
+
+	/* Freeing a chain can take other locks, so work on the list
+	 * without holding ours. */
+	EVLOCK_LOCK(zerocopy_orphans_lock, 0);
+	zc = zerocopy_orphans;
+	zerocopy_orphans = NULL;
+	EVLOCK_UNLOCK(zerocopy_orphans_lock, 0);
+
+	for (; zc; zc = next) {
+		next = zc->next_orphan;
+		evbuffer_zerocopy_settle(zc, EVUTIL_INVALID_SOCKET);
+		if (zc->done_seq == zc->next_seq) {
+			mm_free(zc->pins);
+			mm_free(zc);
+		} else {
+			zc->next_orphan = keep;
+			keep = zc;
+		}
+	}
+
+	for (zc = keep; zc; zc = next) {
+		next = zc->next_orphan;
+		evbuffer_zerocopy_orphan(zc);
+	}
+}
+
+/* Return the zerocopy state for sending from 'buffer' to 'fd', setting it
+ * up if needed, or NULL if we should copy instead. */
+static struct evbuffer_zerocopy *
+evbuffer_zerocopy_get(struct evbuffer *buffer, evutil_socket_t fd)
+{
+	struct evbuffer_zerocopy *zc = buffer->zerocopy;
+	int on = 1;
+
+	if (!zc) {
+		if (!(zc = mm_calloc(1, sizeof(*zc))))
+			return NULL;
+		zc->fd = EVUTIL_INVALID_SOCKET;
+		buffer->zerocopy = zc;
+	}
+	if (zc->fd != fd) {
+		/* Sends are numbered per socket, so we can't start on a new
+		 * one until the kernel is done with the old one; copy until
+		 * then. */
+		evbuffer_zerocopy_settle(zc, fd);
+		if (zc->done_seq != zc->next_seq)
+			return NULL;
+		zc->fd = fd;
+		zc->next_seq = zc->done_seq = 0;
+		zc->disabled = evbuffer_zerocopy_sock_ino(fd,
+		    &zc->sock_ino) < 0 ||
+		    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY,
+			&on, sizeof(on)) < 0;
+	}
+	return zc->disabled ? NULL : zc;
+}
+
+/* As evbuffer_write_iovec, but with MSG_ZEROCOPY.  On success, pins every
+ * chain that we sent from. */
+static int
+evbuffer_write_zerocopy(struct evbuffer *buffer, evutil_socket_t fd,
+    struct evbuffer_zerocopy *zc, ev_ssize_t howmuch)
+{
+	IOV_TYPE iov[NUM_WRITE_IOVEC];
+	struct msghdr msg;
+	struct evbuffer_chain *chain;
+	size_t left;
+	int n, i;
+
+	i = evbuffer_write_iovec_setup(buffer, iov, howmuch);
+	if (! i)
+		return 0;
+	/* Make sure we can pin whatever we send before sending it. */
+	if (evbuffer_zerocopy_reserve(zc, i) < 0)
+		return writev(fd, iov, i);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = i;
+	n = sendmsg(fd, &msg, MSG_ZEROCOPY);
+	if (n < 0 && errno == ENOBUFS) {
+		/* We have too much pinned memory for the socket's option
+		 * memory limit; copy this one. */
+		return writev(fd, iov, i);
+	}
+	if (n <= 0)
+		return n;
+
+	for (chain = buffer->first, left = n; left; chain = chain->next) {
+		size_t j;
+		if (!chain->off)
+			continue;
+		left -= chain->off < left ? chain->off : left;
+		if (!(chain->flags & EVBUFFER_MEM_PINNED_ZC)) {
+			zc->pins[zc->n_pins].chain = chain;
+			zc->pins[zc->n_pins++].seq = zc->next_seq;
+			evbuffer_chain_pin_(chain, EVBUFFER_MEM_PINNED_ZC);
+			continue;
+		}
+		/* We sent the start of this chain last time; it's one of
+		 * the newest pins. */
+		for (j = zc->n_pins; j > zc->pins_head; --j) {
+			if (zc->pins[j-1].chain == chain) {
+				zc->pins[j-1].seq = zc->next_seq;
+				break;
+			}
+		}
+		EVUTIL_ASSERT(j > zc->pins_head);
+	}
+	++zc->next_seq;
+	return n;
+}
+#endif
+
+int
+evbuffer_zerocopy_reap(struct evbuffer *buffer, evutil_socket_t fd)
+{
+#ifdef USE_ZEROCOPY
+	int r = 0;
+
+	EVBUFFER_LOCK(buffer);
+	if (buffer->zerocopy)
+		r = evbuffer_zerocopy_settle(buffer->zerocopy, fd);
+	EVBUFFER_UNLOCK(buffer);
+
+	evbuffer_zerocopy_reap_orphans();
+	return r;
+#else
+	(void)buffer;
+	(void)fd;
+	return 0;
+#endif
+}
+
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+int
+evbuffer_global_setup_locks_(const int enable_locks)
+{
+#ifdef USE_ZEROCOPY
+	EVTHREAD_SETUP_GLOBAL_LOCK(zerocopy_orphans_lock, 0);
+#endif
+	return 0;
+}
+#endif
+
+void
+evbuffer_free_globals_(void)
+{
+#ifdef USE_ZEROCOPY
+	struct evbuffer_zerocopy *zc, *next;
+
+	for (zc = zerocopy_orphans; zc; zc = next) {
+		next = zc->next_orphan;
+		evbuffer_zerocopy_release_all(zc);
+		mm_free(zc->pins);
+		mm_free(zc);
+	}
+	zerocopy_orphans = NULL;
+#ifndef EVENT__DISABLE_THREAD_SUPPORT
+	if (zerocopy_orphans_lock) {
+		EVTHREAD_FREE_LOCK(zerocopy_orphans_lock, 0);
+		zerocopy_orphans_lock = NULL;
+	}
+#endif
+#endif
+}
+
+#ifdef USE_SENDFILE
+static inline int
+evbuffer_write_sendfile(struct evbuffer *buffer, evutil_socket_t dest_fd,
+    ev_ssize_t howmuch)
+{
+	struct evbuffer_chain *chain = buffer->first;
+	struct evbuffer_chain_file_segment *info =
+	    EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_file_segment,
+		chain);
+	const int source_fd = info->segment->fd;
+#if defined(SENDFILE_IS_MACOSX) || defined(SENDFILE_IS_FREEBSD)
+	int res;
+	ev_off_t len = chain->off;
+#elif defined(SENDFILE_IS_LINUX) || defined(SENDFILE_IS_SOLARIS)
+	ev_ssize_t res;
+	off_t offset = chain->misalign;
+#endif
+
+	ASSERT_EVBUFFER_LOCKED(buffer);
+
+#if defined(SENDFILE_IS_MACOSX)
+	res = sendfile(source_fd, dest_fd, chain->misalign, &len, NULL, 0);
+	if (res == -1 && !EVUTIL_ERR_RW_RETRIABLE(errno))
+		return (-1);
+
+	return (len);
+#elif defined(SENDFILE_IS_FREEBSD)
+	res = sendfile(source_fd, dest_fd, chain->misalign, chain->off, NULL, &len, 0);
+	if (res == -1 && !EVUTIL_ERR_RW_RETRIABLE(errno))
+		return (-1);
+
+	return (len);
+#elif defined(SENDFILE_IS_LINUX)
+	/* TODO(niels): implement splice */
+	res = sendfile(dest_fd, source_fd, &offset, chain->off);
+	if (res == -1 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
+		/* if this is EAGAIN or EINTR return 0; otherwise, -1 */
+		return (0);
+	}
+	return (res);
+#elif defined(SENDFILE_IS_SOLARIS)
+	{
+		const off_t offset_orig = offset;
+		res = sendfile(dest_fd, source_fd, &offset, chain->off);
+		if (res == -1 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
+			if (offset - offset_orig)
+				return offset - offset_orig;
+			/* if this is EAGAIN or EINTR and no bytes were
+			 * written, return 0 */
+			return (0);
+		}
 		return (res);
 	}
 #endif
@@ -2557,6 +3327,15 @@ evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 			n = evbuffer_write_sendfile(buffer, fd, howmuch);
 		else {
 #endif
+#ifdef USE_ZEROCOPY
+		struct evbuffer_zerocopy *zc = NULL;
+		if ((buffer->flags & EVBUFFER_FLAG_ZEROCOPY) &&
+		    howmuch >= EVBUFFER_ZEROCOPY_MIN)
+			zc = evbuffer_zerocopy_get(buffer, fd);
+		if (zc)
+			n = evbuffer_write_zerocopy(buffer, fd, zc, howmuch);
+		else
+#endif
 #ifdef USE_IOVEC_IMPL
 		n = evbuffer_write_iovec(buffer, fd, howmuch);
 #elif defined(_WIN32)
@@ -2763,34 +3542,49 @@ evbuffer_search_range(struct evbuffer *buffer, const char *what, size_t len, con
 		const unsigned char *start_at =
 		    chain->buffer + chain->misalign +
 		    pos.internal_.pos_in_chain;
-		p = memchr(start_at, first,
-		    chain->off - pos.internal_.pos_in_chain);
+		size_t avail = chain->off - pos.internal_.pos_in_chain;
+
+		/* First look for a match that fits inside this chain... */
+		p = evbuffer_find_needle_(start_at, avail,
+		    (const unsigned char *)what, len);
 		if (p) {
 			pos.pos += p - start_at;
 			pos.internal_.pos_in_chain += p - start_at;
-			if (!evbuffer_ptr_memcmp(buffer, &pos, what, len)) {
-				if (end && pos.pos + (ev_ssize_t)len > end->pos)
-					goto not_found;
-				else
-					goto done;
-			}
+			goto found;
+		}
+
+		/* ... then for one that starts in the last len-1 bytes of
+		 * it and runs on into the next chains. */
+		if (avail >= len) {
+			pos.pos += avail - len + 1;
+			pos.internal_.pos_in_chain += avail - len + 1;
+			start_at += avail - len + 1;
+			avail = len - 1;
+		}
+		while ((p = memchr(start_at, first, avail)) != NULL) {
+			pos.pos += p - start_at;
+			pos.internal_.pos_in_chain += p - start_at;
+			if (!evbuffer_ptr_memcmp(buffer, &pos, what, len))
+				goto found;
 			++pos.pos;
 			++pos.internal_.pos_in_chain;
-			if (pos.internal_.pos_in_chain == chain->off) {
-				chain = pos.internal_.chain = chain->next;
-				pos.internal_.pos_in_chain = 0;
-			}
-		} else {
-			if (chain == last_chain)
-				goto not_found;
-			pos.pos += chain->off - pos.internal_.pos_in_chain;
-			chain = pos.internal_.chain = chain->next;
-			pos.internal_.pos_in_chain = 0;
+			avail -= p - start_at + 1;
+			start_at = p + 1;
 		}
+
+		if (chain == last_chain)
+			goto not_found;
+		pos.pos += avail;
+		chain = pos.internal_.chain = chain->next;
+		pos.internal_.pos_in_chain = 0;
 	}
 
 not_found:
 	PTR_NOT_FOUND(&pos);
+	goto done;
+found:
+	if (end && pos.pos + (ev_ssize_t)len > end->pos)
+		PTR_NOT_FOUND(&pos);
 done:
 	EVBUFFER_UNLOCK(buffer);
 	return pos;
@@ -2854,6 +3648,225 @@ evbuffer_peek(struct evbuffer *buffer, ev_ssize_t len,
 	return idx;
 }
 
+void
+evbuffer_cursor_init(struct evbuffer_cursor *cur, struct evbuffer *buf)
+{
+	cur->buffer = buf;
+	EVBUFFER_LOCK(buf);
+	evbuffer_ptr_set(buf, &cur->ptr, 0, EVBUFFER_PTR_SET);
+	cur->chain_gen_ = buf->chain_gen;
+	EVBUFFER_UNLOCK(buf);
+}
+
+/* A cursor at the end of the buffer has no chain.  If data has been added
+ * since, or the data after the cursor has moved to another chain, find the
+ * chain it now points into.  Return the number of bytes after the
+ * cursor. */
+static size_t
+evbuffer_cursor_sync_(struct evbuffer_cursor *cur)
+{
+	struct evbuffer *buf = cur->buffer;
+
+	ASSERT_EVBUFFER_LOCKED(buf);
+	EVUTIL_ASSERT(cur->ptr.pos >= 0 &&
+	    (size_t)cur->ptr.pos <= buf->total_len);
+
+	if (cur->chain_gen_ != buf->chain_gen ||
+	    (cur->ptr.internal_.chain == NULL &&
+		(size_t)cur->ptr.pos < buf->total_len)) {
+		evbuffer_ptr_set(buf, &cur->ptr, cur->ptr.pos,
+		    EVBUFFER_PTR_SET);
+		cur->chain_gen_ = buf->chain_gen;
+	}
+	return buf->total_len - cur->ptr.pos;
+}
+
+size_t
+evbuffer_cursor_get_length(struct evbuffer_cursor *cur)
+{
+	size_t n;
+
+	EVBUFFER_LOCK(cur->buffer);
+	n = evbuffer_cursor_sync_(cur);
+	EVBUFFER_UNLOCK(cur->buffer);
+	return n;
+}
+
+int
+evbuffer_cursor_peek(struct evbuffer_cursor *cur, void *data_out, size_t len)
+{
+	int result = -1;
+
+	EVBUFFER_LOCK(cur->buffer);
+	if (evbuffer_cursor_sync_(cur) < len)
+		goto done;
+	if (len && evbuffer_copyout_from(cur->buffer, &cur->ptr, data_out,
+		len) != (ev_ssize_t)len)
+		goto done;
+	result = 0;
+done:
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+int
+evbuffer_cursor_skip(struct evbuffer_cursor *cur, size_t len)
+{
+	int result = -1;
+
+	EVBUFFER_LOCK(cur->buffer);
+	if (evbuffer_cursor_sync_(cur) >= len)
+		result = evbuffer_ptr_set(cur->buffer, &cur->ptr, len,
+		    EVBUFFER_PTR_ADD);
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+int
+evbuffer_cursor_read(struct evbuffer_cursor *cur, void *data_out, size_t len)
+{
+	int result;
+
+	EVBUFFER_LOCK(cur->buffer);
+	result = evbuffer_cursor_peek(cur, data_out, len);
+	if (result == 0)
+		result = evbuffer_cursor_skip(cur, len);
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+const unsigned char *
+evbuffer_cursor_get_contiguous(struct evbuffer_cursor *cur, size_t *len_out)
+{
+	struct evbuffer_chain *chain;
+	const unsigned char *result = NULL;
+
+	*len_out = 0;
+	EVBUFFER_LOCK(cur->buffer);
+	if (evbuffer_cursor_sync_(cur)) {
+		chain = cur->ptr.internal_.chain;
+		result = chain->buffer + chain->misalign +
+		    cur->ptr.internal_.pos_in_chain;
+		*len_out = chain->off - cur->ptr.internal_.pos_in_chain;
+	}
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+int
+evbuffer_cursor_read_u8(struct evbuffer_cursor *cur, ev_uint8_t *out)
+{
+	return evbuffer_cursor_read(cur, out, 1);
+}
+
+int
+evbuffer_cursor_read_u16(struct evbuffer_cursor *cur, ev_uint16_t *out)
+{
+	unsigned char b[2];
+
+	if (evbuffer_cursor_read(cur, b, sizeof(b)) < 0)
+		return -1;
+	*out = ((ev_uint16_t)b[0] << 8) | b[1];
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u32(struct evbuffer_cursor *cur, ev_uint32_t *out)
+{
+	unsigned char b[4];
+
+	if (evbuffer_cursor_read(cur, b, sizeof(b)) < 0)
+		return -1;
+	*out = ((ev_uint32_t)b[0] << 24) | ((ev_uint32_t)b[1] << 16) |
+	    ((ev_uint32_t)b[2] << 8) | b[3];
+	return 0;
+}
+
+int
+evbuffer_cursor_read_u64(struct evbuffer_cursor *cur, ev_uint64_t *out)
+{
+	unsigned char b[8];
+	ev_uint64_t v = 0;
+	int i;
+
+	if (evbuffer_cursor_read(cur, b, sizeof(b)) < 0)
+		return -1;
+	for (i = 0; i < 8; ++i)
+		v = (v << 8) | b[i];
+	*out = v;
+	return 0;
+}
+
+int
+evbuffer_cursor_read_varint(struct evbuffer_cursor *cur, ev_uint64_t *out)
+{
+	struct evbuffer_chain *chain;
+	size_t pos_in_chain;
+	ev_uint64_t v = 0;
+	int n = 0, result = 0;
+
+	EVBUFFER_LOCK(cur->buffer);
+	evbuffer_cursor_sync_(cur);
+	chain = cur->ptr.internal_.chain;
+	pos_in_chain = cur->ptr.internal_.pos_in_chain;
+	while (chain) {
+		unsigned char b;
+		if (pos_in_chain == chain->off) {
+			chain = chain->next;
+			pos_in_chain = 0;
+			continue;
+		}
+		b = chain->buffer[chain->misalign + pos_in_chain++];
+		/* The 10th byte holds only the top bit of a 64-bit value. */
+		if (n == 9 && b > 1) {
+			result = -1;
+			break;
+		}
+		v |= (ev_uint64_t)(b & 0x7f) << (7 * n);
+		++n;
+		if (!(b & 0x80)) {
+			evbuffer_ptr_set(cur->buffer, &cur->ptr, n,
+			    EVBUFFER_PTR_ADD);
+			*out = v;
+			result = n;
+			break;
+		}
+	}
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+ev_ssize_t
+evbuffer_cursor_find(struct evbuffer_cursor *cur, const char *what,
+    size_t len)
+{
+	struct evbuffer_ptr p;
+	ev_ssize_t result = -1;
+
+	EVBUFFER_LOCK(cur->buffer);
+	if (evbuffer_cursor_sync_(cur) >= len && len) {
+		p = evbuffer_search(cur->buffer, what, len, &cur->ptr);
+		if (p.pos >= 0)
+			result = p.pos - cur->ptr.pos;
+	}
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
+int
+evbuffer_cursor_commit(struct evbuffer_cursor *cur)
+{
+	int result = 0;
+
+	EVBUFFER_LOCK(cur->buffer);
+	if (cur->ptr.pos > 0)
+		result = evbuffer_drain(cur->buffer, cur->ptr.pos);
+	evbuffer_ptr_set(cur->buffer, &cur->ptr, 0, EVBUFFER_PTR_SET);
+	cur->chain_gen_ = cur->buffer->chain_gen;
+	EVBUFFER_UNLOCK(cur->buffer);
+	return result;
+}
+
 
 int
 evbuffer_add_vprintf(struct evbuffer *buf, const char *fmt, va_list ap)
@@ -2941,9 +3954,11 @@ evbuffer_add_reference(struct evbuffer *outbuf,
 	struct evbuffer_chain_reference *info;
 	int result = -1;
 
-	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_reference));
+	EVBUFFER_LOCK(outbuf);
+	chain = evbuffer_chain_new(outbuf,
+	    sizeof(struct evbuffer_chain_reference));
 	if (!chain)
-		return (-1);
+		goto done;
 	chain->flags |= EVBUFFER_REFERENCE | EVBUFFER_IMMUTABLE;
 	chain->buffer = (unsigned char *)data;
 	chain->buffer_len = datlen;
@@ -2953,11 +3968,10 @@ evbuffer_add_reference(struct evbuffer *outbuf,
 	info->cleanupfn = cleanupfn;
 	info->extra = extra;
 
-	EVBUFFER_LOCK(outbuf);
 	if (outbuf->freeze_end) {
 		/* don't call chain_free; we do not want to actually invoke
 		 * the cleanup function */
-		mm_free(chain);
+		evbuffer_chain_dealloc(chain);
 		goto done;
 	}
 	evbuffer_chain_insert(outbuf, chain);
@@ -3242,7 +4256,8 @@ evbuffer_add_file_segment(struct evbuffer *buf,
 	if (offset+length > seg->length)
 		goto err;
 
-	chain = evbuffer_chain_new(sizeof(struct evbuffer_chain_file_segment));
+	chain = evbuffer_chain_new(buf,
+	    sizeof(struct evbuffer_chain_file_segment));
 	if (!chain)
 		goto err;
 	extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_file_segment, chain);
@@ -3272,7 +4287,7 @@ evbuffer_add_file_segment(struct evbuffer *buf,
 			offset_rounded & 0xfffffffful,
 			length + offset_remaining);
 		if (data == NULL) {
-			mm_free(chain);
+			evbuffer_chain_dealloc(chain);
 			goto err;
 		}
 		chain->buffer = (unsigned char*) data;
@@ -3321,6 +4336,137 @@ evbuffer_add_file(struct evbuffer *buf, int fd, ev_off_t offset, ev_off_t length
 	return r;
 }
 
+static struct evbuffer_segment *
+evbuffer_segment_alloc_(size_t extra, unsigned flags)
+{
+	struct evbuffer_segment *seg;
+
+	if (extra > EVBUFFER_CHAIN_MAX ||
+	    (seg = mm_calloc(1, sizeof(struct evbuffer_segment) + extra)) == NULL)
+		return NULL;
+	seg->refcnt = 1;
+	seg->data = (const unsigned char *)(seg + 1);
+	if (!(flags & EVBUF_SEG_DISABLE_LOCKING)) {
+		EVTHREAD_ALLOC_LOCK(seg->lock, 0);
+	}
+	return seg;
+}
+
+struct evbuffer_segment *
+evbuffer_segment_new(const void *data, size_t datlen, unsigned flags)
+{
+	struct evbuffer_segment *seg;
+
+	if ((seg = evbuffer_segment_alloc_(datlen, flags)) == NULL)
+		return NULL;
+	if (datlen)
+		memcpy(seg + 1, data, datlen);
+	seg->length = datlen;
+	return seg;
+}
+
+struct evbuffer_segment *
+evbuffer_segment_new_reference(const void *data, size_t datlen,
+    evbuffer_ref_cleanup_cb cleanupfn, void *cleanupfn_arg, unsigned flags)
+{
+	struct evbuffer_segment *seg;
+
+	if (datlen > EVBUFFER_CHAIN_MAX ||
+	    (seg = evbuffer_segment_alloc_(0, flags)) == NULL)
+		return NULL;
+	seg->data = data;
+	seg->length = datlen;
+	seg->cleanupfn = cleanupfn;
+	seg->cleanupfn_arg = cleanupfn_arg;
+	return seg;
+}
+
+struct evbuffer_segment *
+evbuffer_segment_new_from_buffer(struct evbuffer *buf, unsigned flags)
+{
+	struct evbuffer_segment *seg = NULL;
+	size_t len;
+
+	EVBUFFER_LOCK(buf);
+	len = buf->total_len;
+	if (buf->freeze_start)
+		goto done;
+	if ((seg = evbuffer_segment_alloc_(len, flags)) == NULL)
+		goto done;
+	if (evbuffer_copyout_from(buf, NULL, seg + 1, len) != (ev_ssize_t)len) {
+		evbuffer_segment_free(seg);
+		seg = NULL;
+		goto done;
+	}
+	seg->length = len;
+	evbuffer_drain(buf, len);
+done:
+	EVBUFFER_UNLOCK(buf);
+	return seg;
+}
+
+size_t
+evbuffer_segment_get_length(const struct evbuffer_segment *seg)
+{
+	return seg->length;
+}
+
+void
+evbuffer_segment_free(struct evbuffer_segment *seg)
+{
+	int refcnt;
+	EVLOCK_LOCK(seg->lock, 0);
+	refcnt = --seg->refcnt;
+	EVLOCK_UNLOCK(seg->lock, 0);
+	if (refcnt > 0)
+		return;
+	EVUTIL_ASSERT(refcnt == 0);
+
+	if (seg->cleanupfn)
+		(*seg->cleanupfn)(seg->data, seg->length, seg->cleanupfn_arg);
+
+	EVTHREAD_FREE_LOCK(seg->lock, 0);
+	mm_free(seg);
+}
+
+int
+evbuffer_add_segment(struct evbuffer *buf, struct evbuffer_segment *seg)
+{
+	struct evbuffer_chain *chain;
+	struct evbuffer_chain_segment *extra;
+	int result = -1;
+
+	EVBUFFER_LOCK(buf);
+	if (buf->freeze_end)
+		goto done;
+	if (seg->length == 0) {
+		result = 0;
+		goto done;
+	}
+
+	chain = evbuffer_chain_new(buf, sizeof(struct evbuffer_chain_segment));
+	if (!chain)
+		goto done;
+	EVLOCK_LOCK(seg->lock, 0);
+	++seg->refcnt;
+	EVLOCK_UNLOCK(seg->lock, 0);
+
+	chain->flags |= EVBUFFER_IMMUTABLE|EVBUFFER_SEGMENT;
+	chain->buffer = (unsigned char *)seg->data;
+	chain->buffer_len = seg->length;
+	chain->off = seg->length;
+	extra = EVBUFFER_CHAIN_EXTRA(struct evbuffer_chain_segment, chain);
+	extra->segment = seg;
+
+	buf->n_add_for_cb += seg->length;
+	evbuffer_chain_insert(buf, chain);
+	evbuffer_invoke_callbacks_(buf);
+	result = 0;
+done:
+	EVBUFFER_UNLOCK(buf);
+	return result;
+}
+
 void
 evbuffer_setcb(struct evbuffer *buffer, evbuffer_cb cb, void *cbarg)
 {
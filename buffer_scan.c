@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+  Scanning kernels for evbuffer_search() and evbuffer_search_eol().  Each
+  one looks at a single contiguous run of bytes; the callers in buffer.c
+  deal with matches that span chains.
+
+  On x86 with GCC or Clang we have SSE2 versions, plus AVX2 versions that
+  we only use if the CPU supports them.  Everywhere else we use memchr().
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+#include "event2/buffer_compat.h"
+#include "evbuffer-internal.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define SCAN_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || __GNUC__ >= 5
+#define SCAN_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+static const unsigned char *
+find_eol_char_scalar(const unsigned char *s, size_t len)
+{
+#define CHUNK_SZ 128
+	/* Lots of benchmarking found this approach to be faster in practice
+	 * than doing two memchrs over the whole buffer, doin a memchr on each
+	 * char of the buffer, or trying to emulate memchr by hand. */
+	const unsigned char *s_end, *cr, *lf;
+	s_end = s+len;
+	while (s < s_end) {
+		size_t chunk = (s + CHUNK_SZ < s_end) ? CHUNK_SZ : (s_end - s);
+		cr = memchr(s, '\r', chunk);
+		lf = memchr(s, '\n', chunk);
+		if (cr) {
+			if (lf && lf < cr)
+				return lf;
+			return cr;
+		} else if (lf) {
+			return lf;
+		}
+		s += CHUNK_SZ;
+	}
+
+	return NULL;
+#undef CHUNK_SZ
+}
+
+static const unsigned char *
+find_needle_scalar(const unsigned char *s, size_t n,
+    const unsigned char *what, size_t len)
+{
+	const unsigned char *p = s, *last;
+
+	if (n < len)
+		return NULL;
+	last = s + n - len;
+	while ((p = memchr(p, what[0], last - p + 1)) != NULL) {
+		if (!memcmp(p + 1, what + 1, len - 1))
+			return p;
+		if (p++ == last)
+			break;
+	}
+	return NULL;
+}
+
+#ifdef SCAN_SSE2
+static const unsigned char *
+find_eol_char_sse2(const unsigned char *s, size_t len)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+			_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (mask)
+			return s + i + __builtin_ctz(mask);
+	}
+	for (; i < len; ++i) {
+		if (s[i] == '\r' || s[i] == '\n')
+			return s + i;
+	}
+	return NULL;
+}
+
+/* Compare the first and last bytes of the needle against 16 positions at
+ * once, and only memcmp() where both match. */
+static const unsigned char *
+find_needle_sse2(const unsigned char *s, size_t n,
+    const unsigned char *what, size_t len)
+{
+	const __m128i first = _mm_set1_epi8((char)what[0]);
+	const __m128i last = _mm_set1_epi8((char)what[len - 1]);
+	size_t i;
+
+	for (i = 0; n >= len && i + len - 1 + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + i + len - 1));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (mask) {
+			unsigned bit = __builtin_ctz(mask);
+			if (!memcmp(s + i + bit + 1, what + 1, len - 2))
+				return s + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_needle_scalar(s + i, n - i, what, len);
+}
+#endif
+
+#ifdef SCAN_AVX2
+__attribute__((target("avx2")))
+static const unsigned char *
+find_eol_char_avx2(const unsigned char *s, size_t len)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+			_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+		if (mask)
+			return s + i + __builtin_ctz(mask);
+	}
+	return find_eol_char_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char *
+find_needle_avx2(const unsigned char *s, size_t n,
+    const unsigned char *what, size_t len)
+{
+	const __m256i first = _mm256_set1_epi8((char)what[0]);
+	const __m256i last = _mm256_set1_epi8((char)what[len - 1]);
+	size_t i;
+
+	for (i = 0; n >= len && i + len - 1 + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i b = _mm256_loadu_si256(
+			(const __m256i *)(s + i + len - 1));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+			    _mm256_cmpeq_epi8(b, last)));
+		while (mask) {
+			unsigned bit = __builtin_ctz(mask);
+			if (!memcmp(s + i + bit + 1, what + 1, len - 2))
+				return s + i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return find_needle_sse2(s + i, n - i, what, len);
+}
+#endif
+
+/* Which kernels to use; one of EVBUFFER_SCAN_*, or -1 if we haven't
+ * checked the CPU yet.  Racing threads all store the same value. */
+static int scan_level = -1;
+
+static int
+scan_level_supported(void)
+{
+#if defined(SCAN_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return EVBUFFER_SCAN_AVX2;
+#endif
+#if defined(SCAN_SSE2)
+	return EVBUFFER_SCAN_SSE2;
+#else
+	return EVBUFFER_SCAN_SCALAR;
+#endif
+}
+
+int
+evbuffer_scan_set_level_(int level)
+{
+	int supported = scan_level_supported();
+	if (level < 0 || level > supported)
+		level = supported;
+	scan_level = level;
+	return level;
+}
+
+static inline int
+get_scan_level(void)
+{
+	if (EVUTIL_UNLIKELY(scan_level < 0))
+		scan_level = scan_level_supported();
+	return scan_level;
+}
+
+const unsigned char *
+evbuffer_find_eol_char_(const unsigned char *s, size_t len)
+{
+	switch (get_scan_level()) {
+#ifdef SCAN_AVX2
+	case EVBUFFER_SCAN_AVX2:
+		return find_eol_char_avx2(s, len);
+#endif
+#ifdef SCAN_SSE2
+	case EVBUFFER_SCAN_SSE2:
+		return find_eol_char_sse2(s, len);
+#endif
+	default:
+		return find_eol_char_scalar(s, len);
+	}
+}
+
+const unsigned char *
+evbuffer_find_needle_(const unsigned char *s, size_t n,
+    const unsigned char *what, size_t len)
+{
+	if (len == 1)
+		return memchr(s, what[0], n);
+	switch (get_scan_level()) {
+#ifdef SCAN_AVX2
+	case EVBUFFER_SCAN_AVX2:
+		return find_needle_avx2(s, n, what, len);
+#endif
+#ifdef SCAN_SSE2
+	case EVBUFFER_SCAN_SSE2:
+		return find_needle_sse2(s, n, what, len);
+#endif
+	default:
+		return find_needle_scalar(s, n, what, len);
+	}
+}
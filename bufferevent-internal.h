@@ -149,6 +149,51 @@ struct bufferevent_rate_limit {
 	struct event refill_bucket_event;
 };
 
+/** A shared budget for the buffer memory of a set of bufferevents. */
+struct bufferevent_mem_budget {
+	/** List of all members of the budget. */
+	LIST_HEAD(mem_budget_member_list, bufferevent_private) members;
+	/** How much memory we would like the members to hold. */
+	size_t limit;
+	/** How much memory the members held when last measured. */
+	size_t used;
+	/** The number of bufferevents in the budget. */
+	int n_members;
+	/** The number of members that have been told to shrink and have not
+	 * done so yet.  We don't start another round until it is 0. */
+	int n_pending;
+
+	/** Lock to protect the budget.  Like the rate-limit group lock, this
+	 * nests within every bufferevent lock. */
+	void *lock;
+};
+
+/** Fields for shrinking the buffers of an idle bufferevent. */
+struct bufferevent_shrink {
+	/* Linked-list elements for storing this bufferevent_private in a
+	 * memory budget.  Protected by the budget lock, as are 'charged'
+	 * and 'pending'. */
+	LIST_ENTRY(bufferevent_private) next_in_budget;
+	/** The memory budget for this bufferevent, or NULL. */
+	struct bufferevent_mem_budget *budget;
+	/** How much buffer memory we last counted against the budget. */
+	size_t charged;
+	/** True iff the budget told us to shrink and we haven't yet. */
+	unsigned pending : 1;
+
+	/** How long to wait without reads or writes before shrinking, or
+	 * zero not to shrink on a timer. */
+	struct timeval idle;
+	/** True iff shrink_event is waiting for 'idle' to pass.  Protected,
+	 * like 'touched', by the bufferevent lock. */
+	unsigned armed : 1;
+	/** True iff data has moved since shrink_event was armed. */
+	unsigned touched : 1;
+	/** Timeout event that goes off when we have been idle for 'idle',
+	 * or when the budget wants us to shrink. */
+	struct event shrink_event;
+};
+
 /** Parts of the bufferevent structure that are shared among all bufferevent
  * types, but not exposed in bufferevent_struct.h. */
 struct bufferevent_private {
@@ -217,6 +262,10 @@ struct bufferevent_private {
 	/** Rate-limiting information for this bufferevent */
 	struct bufferevent_rate_limit *rate_limiting;
 
+	/** Idle-shrink and memory budget information, or NULL if neither
+	 * was ever set. */
+	struct bufferevent_shrink *shrink;
+
 	/* Saved conn_addr, to extract IP address from it.
 	 *
 	 * Because some servers may reset/close connection without waiting clients,
@@ -148,6 +148,29 @@ bufferevent_inbuf_wm_cb(struct evbuffer *buf,
 		bufferevent_wm_unsuspend_read(bufev);
 }
 
+static void bufferevent_mem_budget_charge_(struct bufferevent_private *bev,
+    int shrunk);
+
+/* Called when data has moved through bufev and its callback, if any, has
+ * run: note that it is not idle, and count its buffers against its memory
+ * budget.  Rather than pushing back the idle-shrink timer every time, we
+ * let it go off and re-arm it then if we were touched in the meantime. */
+static inline void
+bufferevent_shrink_touch_(struct bufferevent_private *p)
+{
+	struct bufferevent_shrink *s = p->shrink;
+	if (!s)
+		return;
+	if (s->armed) {
+		s->touched = 1;
+	} else if (evutil_timerisset(&s->idle)) {
+		s->armed = 1;
+		event_add(&s->shrink_event, &s->idle);
+	}
+	if (s->budget)
+		bufferevent_mem_budget_charge_(p, 0);
+}
+
 static void
 bufferevent_run_deferred_callbacks_locked(struct event_callback *cb, void *arg)
 {
@@ -166,10 +189,12 @@ bufferevent_run_deferred_callbacks_locked(struct event_callback *cb, void *arg)
 		bufev_private->readcb_pending = 0;
 		bufev->readcb(bufev, bufev->cbarg);
 		bufferevent_inbuf_wm_check(bufev);
+		bufferevent_shrink_touch_(bufev_private);
 	}
 	if (bufev_private->writecb_pending && bufev->writecb) {
 		bufev_private->writecb_pending = 0;
 		bufev->writecb(bufev, bufev->cbarg);
+		bufferevent_shrink_touch_(bufev_private);
 	}
 	if (bufev_private->eventcb_pending && bufev->errorcb) {
 		short what = bufev_private->eventcb_pending;
@@ -207,12 +232,14 @@ bufferevent_run_deferred_callbacks_unlocked(struct event_callback *cb, void *arg
 		bufev_private->readcb_pending = 0;
 		UNLOCKED(readcb(bufev, cbarg));
 		bufferevent_inbuf_wm_check(bufev);
+		bufferevent_shrink_touch_(bufev_private);
 	}
 	if (bufev_private->writecb_pending && bufev->writecb) {
 		bufferevent_data_cb writecb = bufev->writecb;
 		void *cbarg = bufev->cbarg;
 		bufev_private->writecb_pending = 0;
 		UNLOCKED(writecb(bufev, cbarg));
+		bufferevent_shrink_touch_(bufev_private);
 	}
 	if (bufev_private->eventcb_pending && bufev->errorcb) {
 		bufferevent_event_cb errorcb = bufev->errorcb;
@@ -236,20 +263,22 @@ bufferevent_run_deferred_callbacks_unlocked(struct event_callback *cb, void *arg
 			bufferevent_incref_(&(bevp)->bev);		\
 	} while (0)
 
-
 void
 bufferevent_run_readcb_(struct bufferevent *bufev, int options)
 {
 	/* Requires that we hold the lock and a reference */
 	struct bufferevent_private *p = BEV_UPCAST(bufev);
-	if (bufev->readcb == NULL)
+	if (bufev->readcb == NULL) {
+		bufferevent_shrink_touch_(p);
 		return;
+	}
 	if ((p->options|options) & BEV_OPT_DEFER_CALLBACKS) {
 		p->readcb_pending = 1;
 		SCHEDULE_DEFERRED(p);
 	} else {
 		bufev->readcb(bufev, bufev->cbarg);
 		bufferevent_inbuf_wm_check(bufev);
+		bufferevent_shrink_touch_(p);
 	}
 }
 
@@ -258,13 +287,16 @@ bufferevent_run_writecb_(struct bufferevent *bufev, int options)
 {
 	/* Requires that we hold the lock and a reference */
 	struct bufferevent_private *p = BEV_UPCAST(bufev);
-	if (bufev->writecb == NULL)
+	if (bufev->writecb == NULL) {
+		bufferevent_shrink_touch_(p);
 		return;
+	}
 	if ((p->options|options) & BEV_OPT_DEFER_CALLBACKS) {
 		p->writecb_pending = 1;
 		SCHEDULE_DEFERRED(p);
 	} else {
 		bufev->writecb(bufev, bufev->cbarg);
+		bufferevent_shrink_touch_(p);
 	}
 }
 
@@ -313,14 +345,33 @@ bufferevent_init_common_(struct bufferevent_private *bufev_private,
 {
 	struct bufferevent *bufev = &bufev_private->bev;
 
+	int new_input = 0, new_output = 0;
+
 	if (!bufev->input) {
 		if ((bufev->input = evbuffer_new()) == NULL)
 			goto err;
+		new_input = 1;
 	}
 
 	if (!bufev->output) {
 		if ((bufev->output = evbuffer_new()) == NULL)
 			goto err;
+		new_output = 1;
+	}
+
+	/* Buffers we made get their memory the way the base says.  Hold the
+	 * base lock so the pool can't go away before they reference it. */
+	if (base) {
+		EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+		if (base->chain_pool) {
+			if (new_input)
+				evbuffer_set_chain_pool(bufev->input,
+				    base->chain_pool);
+			if (new_output)
+				evbuffer_set_chain_pool(bufev->output,
+				    base->chain_pool);
+		}
+		EVBASE_RELEASE_LOCK(base, th_base_lock);
 	}
 
 	bufev_private->refcnt = 1;
@@ -731,6 +782,12 @@ bufferevent_decref_and_unlock_(struct bufferevent *bufev)
 		if (event_initialized(e))
 			cbs[n_cbs++] = &e->ev_evcallback;
 	}
+	if (bufev_private->shrink) {
+		/* Leave the budget first, so that it can't activate our
+		 * shrink event while we finalize it. */
+		bufferevent_remove_from_mem_budget(bufev);
+		cbs[n_cbs++] = &bufev_private->shrink->shrink_event.ev_evcallback;
+	}
 	n_cbs += evbuffer_get_callbacks_(bufev->input, cbs+n_cbs, MAX_CBS-n_cbs);
 	n_cbs += evbuffer_get_callbacks_(bufev->output, cbs+n_cbs, MAX_CBS-n_cbs);
 
@@ -771,6 +828,11 @@ bufferevent_finalize_cb_(struct event_callback *evcb, void *arg_)
 		bufev_private->rate_limiting = NULL;
 	}
 
+	if (bufev_private->shrink) {
+		mm_free(bufev_private->shrink);
+		bufev_private->shrink = NULL;
+	}
+
 
 	BEV_UNLOCK(bufev);
 
@@ -1034,3 +1096,210 @@ bufferevent_unlock(struct bufferevent *bev)
 {
 	bufferevent_decref_and_unlock_(bev);
 }
+
+#define LOCK_BUDGET(g) EVLOCK_LOCK((g)->lock, 0)
+#define UNLOCK_BUDGET(g) EVLOCK_UNLOCK((g)->lock, 0)
+
+static void
+bufferevent_shrink_cb_(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_private *bevp = arg;
+	struct bufferevent *bev = &bevp->bev;
+	struct bufferevent_shrink *s;
+	int pending = 0;
+
+	BEV_LOCK(bev);
+	s = bevp->shrink;
+	if (s->budget) {
+		LOCK_BUDGET(s->budget);
+		pending = s->pending;
+		UNLOCK_BUDGET(s->budget);
+	}
+	s->armed = 0;
+	if (s->touched && !pending && evutil_timerisset(&s->idle)) {
+		/* We weren't idle for all of it; wait some more. */
+		s->touched = 0;
+		s->armed = 1;
+		event_add(&s->shrink_event, &s->idle);
+		BEV_UNLOCK(bev);
+		return;
+	}
+	s->touched = 0;
+	evbuffer_shrink(bev->input);
+	evbuffer_shrink(bev->output);
+	bufferevent_mem_budget_charge_(bevp, 1);
+	BEV_UNLOCK(bev);
+}
+
+/* Return bev's shrink state, creating it if needed.  Requires lock. */
+static struct bufferevent_shrink *
+bufferevent_get_shrink_(struct bufferevent_private *bevp)
+{
+	struct bufferevent_shrink *s = bevp->shrink;
+	if (s)
+		return s;
+	if ((s = mm_calloc(1, sizeof(struct bufferevent_shrink))) == NULL)
+		return NULL;
+	event_assign(&s->shrink_event, bevp->bev.ev_base, -1,
+	    EV_FINALIZE|EV_LAZY_TIMEOUT, bufferevent_shrink_cb_, bevp);
+	bevp->shrink = s;
+	return s;
+}
+
+/* Count bev's buffer memory against its budget, and if our buffers grew
+ * while the budget is over its limit, tell every member to shrink.  If
+ * 'shrunk' is set, we have just shrunk our buffers.  Requires lock. */
+static void
+bufferevent_mem_budget_charge_(struct bufferevent_private *bevp, int shrunk)
+{
+	struct bufferevent_shrink *s = bevp->shrink;
+	struct bufferevent_mem_budget *g = s->budget;
+	struct bufferevent_private *member;
+	size_t now, before;
+
+	if (!g)
+		return;
+	now = evbuffer_get_allocated_(bevp->bev.input) +
+	    evbuffer_get_allocated_(bevp->bev.output);
+	/* 'charged' only changes under our own lock, so we may look at it
+	 * without the budget lock. */
+	if (!shrunk && now == s->charged)
+		return;
+
+	LOCK_BUDGET(g);
+	before = s->charged;
+	g->used = g->used - before + now;
+	s->charged = now;
+	if (shrunk && s->pending) {
+		s->pending = 0;
+		--g->n_pending;
+	}
+	/* Only growth starts a round.  If we are still over the limit after
+	 * everyone has shrunk, the memory is in use and another round right
+	 * away would only spin. */
+	if (!shrunk && now > before && g->used > g->limit &&
+	    g->n_pending == 0) {
+		LIST_FOREACH(member, &g->members, shrink->next_in_budget) {
+			member->shrink->pending = 1;
+			++g->n_pending;
+			event_active(&member->shrink->shrink_event,
+			    EV_TIMEOUT, 1);
+		}
+	}
+	UNLOCK_BUDGET(g);
+}
+
+int
+bufferevent_set_idle_shrink(struct bufferevent *bev,
+    const struct timeval *idle)
+{
+	struct bufferevent_private *bevp = BEV_UPCAST(bev);
+	struct bufferevent_shrink *s;
+	int r = 0;
+
+	BEV_LOCK(bev);
+	if (!idle || !evutil_timerisset(idle)) {
+		if ((s = bevp->shrink)) {
+			evutil_timerclear(&s->idle);
+			if (s->armed && !s->pending)
+				event_del(&s->shrink_event);
+			s->armed = s->touched = 0;
+		}
+	} else if ((s = bufferevent_get_shrink_(bevp)) != NULL) {
+		s->idle = *idle;
+		s->touched = 0;
+		s->armed = 1;
+		r = event_add(&s->shrink_event, &s->idle);
+	} else {
+		r = -1;
+	}
+	BEV_UNLOCK(bev);
+	return r;
+}
+
+struct bufferevent_mem_budget *
+bufferevent_mem_budget_new(size_t limit)
+{
+	struct bufferevent_mem_budget *g;
+
+	if ((g = mm_calloc(1, sizeof(struct bufferevent_mem_budget))) == NULL)
+		return NULL;
+	LIST_INIT(&g->members);
+	g->limit = limit;
+	EVTHREAD_ALLOC_LOCK(g->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	return g;
+}
+
+void
+bufferevent_mem_budget_free(struct bufferevent_mem_budget *g)
+{
+	LOCK_BUDGET(g);
+	EVUTIL_ASSERT(0 == g->n_members);
+	UNLOCK_BUDGET(g);
+	EVTHREAD_FREE_LOCK(g->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	mm_free(g);
+}
+
+size_t
+bufferevent_mem_budget_get_used(struct bufferevent_mem_budget *g)
+{
+	size_t used;
+	LOCK_BUDGET(g);
+	used = g->used;
+	UNLOCK_BUDGET(g);
+	return used;
+}
+
+int
+bufferevent_add_to_mem_budget(struct bufferevent *bev,
+    struct bufferevent_mem_budget *g)
+{
+	struct bufferevent_private *bevp = BEV_UPCAST(bev);
+	struct bufferevent_shrink *s;
+
+	BEV_LOCK(bev);
+	if ((s = bufferevent_get_shrink_(bevp)) == NULL) {
+		BEV_UNLOCK(bev);
+		return -1;
+	}
+	if (s->budget == g) {
+		BEV_UNLOCK(bev);
+		return 0;
+	}
+	if (s->budget)
+		bufferevent_remove_from_mem_budget(bev);
+
+	LOCK_BUDGET(g);
+	s->budget = g;
+	++g->n_members;
+	LIST_INSERT_HEAD(&g->members, bevp, shrink->next_in_budget);
+	UNLOCK_BUDGET(g);
+
+	bufferevent_mem_budget_charge_(bevp, 0);
+	BEV_UNLOCK(bev);
+	return 0;
+}
+
+int
+bufferevent_remove_from_mem_budget(struct bufferevent *bev)
+{
+	struct bufferevent_private *bevp = BEV_UPCAST(bev);
+	struct bufferevent_shrink *s;
+	struct bufferevent_mem_budget *g;
+
+	BEV_LOCK(bev);
+	if ((s = bevp->shrink) && (g = s->budget)) {
+		LOCK_BUDGET(g);
+		LIST_REMOVE(bevp, shrink->next_in_budget);
+		--g->n_members;
+		g->used -= s->charged;
+		if (s->pending)
+			--g->n_pending;
+		UNLOCK_BUDGET(g);
+		s->budget = NULL;
+		s->charged = 0;
+		s->pending = 0;
+	}
+	BEV_UNLOCK(bev);
+	return 0;
+}
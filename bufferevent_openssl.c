@@ -67,6 +67,10 @@
 #include <openssl/err.h>
 #include "openssl-compat.h"
 
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+#define USE_KTLS
+#endif
+
 /*
  * Define an OpenSSL bio that targets a bufferevent.
  */
@@ -308,6 +312,12 @@ struct bufferevent_openssl {
 	 * and we need to try it again with this many bytes. */
 	ev_ssize_t last_write;
 
+	/* If nonzero, we copy output chains smaller than this into
+	 * record_buf, so that we make one TLS record of up to this many bytes
+	 * out of them, not one per chain. */
+	size_t record_size;
+	unsigned char *record_buf;
+
 #define NUM_ERRORS 3
 	ev_uint32_t errors[NUM_ERRORS];
 
@@ -319,6 +329,11 @@ struct bufferevent_openssl {
 	unsigned write_blocked_on_read : 1;
 	/* Treat TCP close before SSL close on SSL >= v3 as clean EOF. */
 	unsigned allow_dirty_shutdown : 1;
+	/* Ask OpenSSL to hand the session keys to the kernel. */
+	unsigned ktls : 1;
+	/* The kernel encrypts what we send, so we write plaintext straight
+	 * to the socket instead of going through SSL_write. */
+	unsigned ktls_send : 1;
 	/* XXX */
 	unsigned n_errors : 2;
 
@@ -648,6 +663,61 @@ do_read(struct bufferevent_openssl *bev_ssl, int n_to_read) {
 	return result;
 }
 
+#ifdef USE_KTLS
+/* Like do_write, for when the kernel does the encryption: write plaintext
+ * from the output buffer straight to the socket, with sendfile for file
+ * segments. */
+static int
+do_write_ktls(struct bufferevent_openssl *bev_ssl)
+{
+	struct bufferevent *bev = &bev_ssl->bev.bev;
+	evutil_socket_t fd = event_get_fd(&bev->ev_write);
+	ev_ssize_t atmost;
+	int r;
+
+	if (bev_ssl->bev.write_suspended)
+		return 0;
+
+	atmost = bufferevent_get_write_max_(&bev_ssl->bev);
+	r = evbuffer_write_atmost(bev->output, fd, atmost);
+	if (r < 0) {
+		int err = evutil_socket_geterror(fd);
+		if (EVUTIL_ERR_RW_RETRIABLE(err))
+			return OP_BLOCKED;
+		stop_reading(bev_ssl);
+		stop_writing(bev_ssl);
+		bufferevent_run_eventcb_(bev,
+		    BEV_EVENT_WRITING|BEV_EVENT_ERROR, 0);
+		return OP_ERR;
+	}
+	if (r == 0)
+		return OP_BLOCKED;
+
+	bufferevent_decrement_write_buckets_(&bev_ssl->bev, r);
+	bufferevent_trigger_nolock_(bev, EV_WRITE, BEV_OPT_DEFER_CALLBACKS);
+	return OP_MADE_PROGRESS;
+}
+
+/* Called once the handshake is done: find out whether OpenSSL managed to
+ * hand the keys for outgoing data to the kernel. */
+static void
+ktls_check(struct bufferevent_openssl *bev_ssl)
+{
+	BIO *wbio;
+
+	bev_ssl->ktls_send = 0;
+	if (!bev_ssl->ktls || bev_ssl->underlying)
+		return;
+	wbio = SSL_get_wbio(bev_ssl->ssl);
+	if (wbio && BIO_get_ktls_send(wbio)) {
+		bev_ssl->ktls_send = 1;
+		/* From now on, file segments can go out with sendfile. */
+		evbuffer_set_flags(bev_ssl->bev.bev.output,
+		    EVBUFFER_FLAG_DRAINS_TO_FD);
+	}
+}
+#endif
+
 /* Return a bitmask of OP_MADE_PROGRESS (if we wrote anything); OP_BLOCKED (if
    we're now blocked); and OP_ERR (if an error occurred). */
 static int
@@ -659,6 +729,11 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 	struct evbuffer_iovec space[8];
 	int result = 0;
 
+#ifdef USE_KTLS
+	if (bev_ssl->ktls_send && bev_ssl->last_write <= 0)
+		return do_write_ktls(bev_ssl);
+#endif
+
 	if (bev_ssl->last_write > 0)
 		atmost = bev_ssl->last_write;
 	else
@@ -668,6 +743,24 @@ do_write(struct bufferevent_openssl *bev_ssl, int atmost)
 	if (n < 0)
 		return OP_ERR | result;
 
+	/* If the first chain would make a short record and there is more
+	 * after it, write one record's worth of the output in one go.  When
+	 * we retry after blocking, atmost is the length we asked for before,
+	 * so we make the same decision and copy the same bytes. */
+	if (n > 1 && space[0].iov_len < bev_ssl->record_size &&
+	    (bev_ssl->record_buf ||
+		(bev_ssl->record_buf = mm_malloc(bev_ssl->record_size)))) {
+		size_t len = bev_ssl->record_size;
+		if ((size_t)atmost < len)
+			len = atmost;
+		n = (int)evbuffer_copyout(output, bev_ssl->record_buf, len);
+		if (n < 0)
+			return OP_ERR | result;
+		space[0].iov_base = bev_ssl->record_buf;
+		space[0].iov_len = n;
+		n = 1;
+	}
+
 	if (n > 8)
 		n = 8;
 	for (i=0; i < n; ++i) {
@@ -1037,6 +1130,9 @@ do_handshake(struct bufferevent_openssl *bev_ssl)
 		evutil_socket_t fd = event_get_fd(&bev_ssl->bev.bev.ev_read);
 		/* We're done! */
 		bev_ssl->state = BUFFEREVENT_SSL_OPEN;
+#ifdef USE_KTLS
+		ktls_check(bev_ssl);
+#endif
 		set_open_callbacks(bev_ssl, fd); /* XXXX handle failure */
 		/* Call do_read and do_write as needed */
 		bufferevent_enable(&bev_ssl->bev.bev, bev_ssl->bev.bev.enabled);
@@ -1241,6 +1337,7 @@ be_openssl_destruct(struct bufferevent *bev)
 		}
 		SSL_free(bev_ssl->ssl);
 	}
+	mm_free(bev_ssl->record_buf);
 }
 
 static int
@@ -1268,6 +1365,7 @@ be_openssl_set_fd(struct bufferevent_openssl *bev_ssl,
     enum bufferevent_ssl_state state, evutil_socket_t fd)
 {
 	bev_ssl->state = state;
+	bev_ssl->ktls_send = 0;
 
 	switch (state) {
 	case BUFFEREVENT_SSL_ACCEPTING:
@@ -1285,6 +1383,9 @@ be_openssl_set_fd(struct bufferevent_openssl *bev_ssl,
 			return -1;
 		break;
 	case BUFFEREVENT_SSL_OPEN:
+#ifdef USE_KTLS
+		ktls_check(bev_ssl);
+#endif
 		if (set_open_callbacks(bev_ssl, fd) < 0)
 			return -1;
 		break;
@@ -1384,6 +1485,7 @@ bufferevent_openssl_new_impl(struct event_base *base,
 
 	bev_ssl->old_state = state;
 	bev_ssl->last_write = -1;
+	bev_ssl->record_size = SSL3_RT_MAX_PLAIN_LENGTH;
 
 	init_bio_counts(bev_ssl);
 
@@ -1509,6 +1611,76 @@ bufferevent_openssl_set_allow_dirty_shutdown(struct bufferevent *bev,
 	BEV_UNLOCK(bev);
 }
 
+int
+bufferevent_openssl_set_record_size(struct bufferevent *bev, size_t size)
+{
+	int r = -1;
+	struct bufferevent_openssl *bev_ssl;
+	BEV_LOCK(bev);
+	bev_ssl = upcast(bev);
+	/* Don't change the record we might have to retry. */
+	if (bev_ssl && size <= SSL3_RT_MAX_PLAIN_LENGTH &&
+	    bev_ssl->last_write <= 0) {
+		if (size != bev_ssl->record_size) {
+			mm_free(bev_ssl->record_buf);
+			bev_ssl->record_buf = NULL;
+			bev_ssl->record_size = size;
+		}
+		r = 0;
+	}
+	BEV_UNLOCK(bev);
+	return r;
+}
+
+int
+bufferevent_openssl_set_ktls(struct bufferevent *bev, int enable)
+{
+	int r = -1;
+#ifdef USE_KTLS
+	struct bufferevent_openssl *bev_ssl;
+	BEV_LOCK(bev);
+	bev_ssl = upcast(bev);
+	if (bev_ssl && !bev_ssl->underlying) {
+		bev_ssl->ktls = !!enable;
+		if (enable)
+			SSL_set_options(bev_ssl->ssl, SSL_OP_ENABLE_KTLS);
+		else
+			SSL_clear_options(bev_ssl->ssl, SSL_OP_ENABLE_KTLS);
+		if (bev_ssl->state == BUFFEREVENT_SSL_OPEN)
+			ktls_check(bev_ssl);
+		r = 0;
+	}
+	BEV_UNLOCK(bev);
+#else
+	(void)bev;
+	(void)enable;
+#endif
+	return r;
+}
+
+int
+bufferevent_openssl_get_ktls(struct bufferevent *bev)
+{
+	int r = -1;
+	struct bufferevent_openssl *bev_ssl;
+	BEV_LOCK(bev);
+	bev_ssl = upcast(bev);
+	if (bev_ssl) {
+		r = 0;
+#ifdef USE_KTLS
+		if (bev_ssl->ktls_send)
+			r |= EV_WRITE;
+		if (bev_ssl->ktls && !bev_ssl->underlying &&
+		    bev_ssl->state == BUFFEREVENT_SSL_OPEN &&
+		    SSL_get_rbio(bev_ssl->ssl) &&
+		    BIO_get_ktls_recv(SSL_get_rbio(bev_ssl->ssl)))
+			r |= EV_READ;
+#endif
+	}
+	BEV_UNLOCK(bev);
+	return r;
+}
+
 unsigned long
 bufferevent_get_openssl_error(struct bufferevent *bev)
 {
@@ -0,0 +1,489 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#ifdef EVENT__HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef EVENT__HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include "event2/util.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/bufferevent_struct.h"
+#include "event2/event.h"
+#include "bufferevent-internal.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+
+#define PROXY_DEFAULT_HIGHMARK 65536
+
+/* One direction of a proxy: everything read from src gets written to dst. */
+struct bufferevent_proxy_dir {
+	struct bufferevent_proxy *proxy;
+	struct bufferevent *src;
+	struct bufferevent *dst;
+
+	/** The pipe we splice through, or -1 if we move data with evbuffers
+	 * instead. */
+	evutil_socket_t pipe[2];
+	/** How many bytes we have spliced into the pipe and not yet out. */
+	size_t in_pipe;
+	/** Readable event on src's socket; only used when splicing. */
+	struct event read_ev;
+	/** Writable event on dst's socket; only used when splicing. */
+	struct event write_ev;
+
+	/** How many bytes we have passed on from src to dst. */
+	ev_uint64_t n_moved;
+
+	/** True iff we stopped reading from src because dst fell behind. */
+	unsigned choked : 1;
+	/** True iff src has sent EOF. */
+	unsigned eof : 1;
+	/** True iff we have passed the EOF on to dst. */
+	unsigned shut : 1;
+};
+
+struct bufferevent_proxy {
+	/** dir[0] goes from a to b, dir[1] from b to a. */
+	struct bufferevent_proxy_dir dir[2];
+	size_t highmark;
+	bufferevent_proxy_event_cb cb;
+	void *ctx;
+};
+
+#define DIR_SPLICING(d) ((d)->pipe[0] != EVUTIL_INVALID_SOCKET)
+
+static void proxy_readcb(struct bufferevent *bev, void *arg);
+static void proxy_writecb(struct bufferevent *bev, void *arg);
+static void proxy_eventcb(struct bufferevent *bev, short what, void *arg);
+
+/* Stop moving data in both directions and tell the user why.  The user
+ * may free the proxy from the callback, so don't touch it afterwards. */
+static void
+proxy_stop_(struct bufferevent_proxy *proxy, struct bufferevent *bev,
+    short what)
+{
+	int i;
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_proxy_dir *d = &proxy->dir[i];
+		if (DIR_SPLICING(d)) {
+			event_del(&d->read_ev);
+			event_del(&d->write_ev);
+		}
+		bufferevent_disable(d->src, EV_READ);
+	}
+	if (proxy->cb)
+		proxy->cb(proxy, bev, what, proxy->ctx);
+}
+
+/* Pass src's EOF on to dst, now that all of its data has been written.
+ * Like proxy_stop_(), this may end with the proxy freed. */
+static void
+proxy_shut_(struct bufferevent_proxy_dir *d)
+{
+	struct bufferevent_proxy *proxy = d->proxy;
+	struct bufferevent_proxy_dir *other = &proxy->dir[d == &proxy->dir[0]];
+	evutil_socket_t fd = bufferevent_getfd(d->dst);
+
+	d->shut = 1;
+	if (BEV_IS_SOCKET(d->dst) && fd != EVUTIL_INVALID_SOCKET)
+		shutdown(fd, EVUTIL_SHUT_WR);
+	else
+		bufferevent_flush(d->dst, EV_WRITE, BEV_FINISHED);
+
+	if (other->shut && proxy->cb)
+		proxy->cb(proxy, NULL, BEV_EVENT_EOF, proxy->ctx);
+}
+
+/* Move whatever src has read into dst's output buffer, and stop reading
+ * if dst has too much to write already. */
+static void
+proxy_move_(struct bufferevent_proxy_dir *d)
+{
+	struct evbuffer *input = bufferevent_get_input(d->src);
+	struct evbuffer *output = bufferevent_get_output(d->dst);
+
+	d->n_moved += evbuffer_get_length(input);
+	evbuffer_add_buffer(output, input);
+	if (!d->choked &&
+	    evbuffer_get_length(output) >= d->proxy->highmark) {
+		d->choked = 1;
+		bufferevent_disable(d->src, EV_READ);
+	}
+}
+
+#ifdef EVENT__HAVE_SPLICE
+static void proxy_unsplice_(struct bufferevent_proxy_dir *d);
+
+/* Splice as much as we can from the pipe into dst, then decide whether
+ * to keep reading from src. */
+static void
+proxy_pump_(struct bufferevent_proxy_dir *d)
+{
+	struct bufferevent_proxy *proxy = d->proxy;
+	struct evbuffer *output = bufferevent_get_output(d->dst);
+	evutil_socket_t fd = bufferevent_getfd(d->dst);
+	ev_ssize_t n;
+
+	/* Whatever the bufferevent still has queued must go out first; its
+	 * write callback will bring us back here once it has. */
+	if (evbuffer_get_length(output))
+		return;
+
+	while (d->in_pipe) {
+		n = splice(d->pipe[0], NULL, fd, NULL, d->in_pipe,
+		    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if (n > 0) {
+			d->in_pipe -= n;
+			d->n_moved += n;
+			continue;
+		}
+		if (n < 0 && EVUTIL_ERR_RW_RETRIABLE(errno)) {
+			event_add(&d->write_ev, NULL);
+			return;
+		}
+		if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+			proxy_unsplice_(d);
+			return;
+		}
+		proxy_stop_(proxy, d->dst, BEV_EVENT_ERROR|BEV_EVENT_WRITING);
+		return;
+	}
+
+	event_del(&d->write_ev);
+	if (d->eof) {
+		if (!d->shut)
+			proxy_shut_(d);
+		return;
+	}
+	event_add(&d->read_ev, NULL);
+}
+
+static void
+proxy_splice_read_(evutil_socket_t fd, struct bufferevent_proxy_dir *d)
+{
+	struct bufferevent_proxy *proxy = d->proxy;
+	ev_ssize_t n;
+
+	n = splice(fd, NULL, d->pipe[1], NULL, proxy->highmark - d->in_pipe,
+	    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+	if (n > 0) {
+		d->in_pipe += n;
+		if (d->in_pipe >= proxy->highmark)
+			event_del(&d->read_ev);
+	} else if (n == 0) {
+		event_del(&d->read_ev);
+		d->eof = 1;
+	} else if (EVUTIL_ERR_RW_RETRIABLE(errno)) {
+		/* With data in the pipe, this can mean that the pipe is
+		 * full rather than that the socket is empty.  Either way,
+		 * wait until we have written some of it out. */
+		if (d->in_pipe)
+			event_del(&d->read_ev);
+		return;
+	} else if (errno == EINVAL || errno == ENOSYS) {
+		proxy_unsplice_(d);
+		return;
+	} else {
+		proxy_stop_(proxy, d->src, BEV_EVENT_ERROR|BEV_EVENT_READING);
+		return;
+	}
+	proxy_pump_(d);
+}
+
+/* The splice events run outside the bufferevents, so they take src's lock
+ * themselves: everything the proxy keeps for a direction is protected by
+ * its src's lock, as it is when moving data with evbuffers.  We hold a
+ * reference as well, since the user may free src from the proxy's
+ * callback. */
+static void
+proxy_splice_readcb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_proxy_dir *d = arg;
+	struct bufferevent *src = d->src;
+
+	bufferevent_incref_and_lock_(src);
+	proxy_splice_read_(fd, d);
+	bufferevent_decref_and_unlock_(src);
+}
+
+static void
+proxy_splice_writecb(evutil_socket_t fd, short what, void *arg)
+{
+	struct bufferevent_proxy_dir *d = arg;
+	struct bufferevent *src = d->src;
+
+	bufferevent_incref_and_lock_(src);
+	proxy_pump_(d);
+	bufferevent_decref_and_unlock_(src);
+}
+
+/* Set up d to splice from src to dst.  Return 0 on success, -1 if we
+ * should move data with evbuffers instead. */
+static int
+proxy_splice_(struct bufferevent_proxy_dir *d)
+{
+	struct event_base *base = bufferevent_get_base(d->src);
+	evutil_socket_t src_fd = bufferevent_getfd(d->src);
+	evutil_socket_t dst_fd = bufferevent_getfd(d->dst);
+
+	if (!BEV_IS_SOCKET(d->src) || !BEV_IS_SOCKET(d->dst) ||
+	    src_fd == EVUTIL_INVALID_SOCKET ||
+	    dst_fd == EVUTIL_INVALID_SOCKET)
+		return -1;
+	/* Rate limits are enforced as bufferevents read and write, which
+	 * they won't be doing. */
+	if (BEV_UPCAST(d->src)->rate_limiting ||
+	    BEV_UPCAST(d->dst)->rate_limiting)
+		return -1;
+	if (evutil_make_internal_pipe_(d->pipe) < 0) {
+		d->pipe[0] = d->pipe[1] = EVUTIL_INVALID_SOCKET;
+		return -1;
+	}
+#ifdef F_SETPIPE_SZ
+	/* Best effort: a pipe is only 64 KiB by default. */
+	if (d->proxy->highmark <= INT_MAX)
+		(void)fcntl(d->pipe[1], F_SETPIPE_SZ, (int)d->proxy->highmark);
+#endif
+	event_assign(&d->read_ev, base, src_fd, EV_READ|EV_PERSIST,
+	    proxy_splice_readcb, d);
+	event_assign(&d->write_ev, base, dst_fd, EV_WRITE|EV_PERSIST,
+	    proxy_splice_writecb, d);
+	return 0;
+}
+
+/* Stop splicing in direction d, and move data with evbuffers instead.
+ * We get here when the kernel won't splice between these sockets. */
+static void
+proxy_unsplice_(struct bufferevent_proxy_dir *d)
+{
+	struct evbuffer *output = bufferevent_get_output(d->dst);
+	int n;
+
+	event_del(&d->read_ev);
+	event_del(&d->write_ev);
+	while (d->in_pipe) {
+		n = evbuffer_read(output, d->pipe[0], (int)d->in_pipe);
+		if (n <= 0)
+			break;
+		d->in_pipe -= n;
+		d->n_moved += n;
+	}
+	evutil_closesocket(d->pipe[0]);
+	evutil_closesocket(d->pipe[1]);
+	d->pipe[0] = d->pipe[1] = EVUTIL_INVALID_SOCKET;
+
+	bufferevent_setwatermark(d->dst, EV_WRITE, d->proxy->highmark / 2, 0);
+	if (d->eof) {
+		if (!d->shut && !evbuffer_get_length(output))
+			proxy_shut_(d);
+	} else if (evbuffer_get_length(output) >= d->proxy->highmark) {
+		d->choked = 1;
+	} else {
+		bufferevent_enable(d->src, EV_READ);
+	}
+}
+#endif
+
+static struct bufferevent_proxy_dir *
+proxy_dir_from_(struct bufferevent_proxy *proxy, struct bufferevent *bev)
+{
+	return &proxy->dir[bev == proxy->dir[0].src ? 0 : 1];
+}
+
+static struct bufferevent_proxy_dir *
+proxy_dir_to_(struct bufferevent_proxy *proxy, struct bufferevent *bev)
+{
+	return &proxy->dir[bev == proxy->dir[0].dst ? 0 : 1];
+}
+
+static void
+proxy_readcb(struct bufferevent *bev, void *arg)
+{
+	proxy_move_(proxy_dir_from_(arg, bev));
+}
+
+static void
+proxy_writecb(struct bufferevent *bev, void *arg)
+{
+	struct bufferevent_proxy_dir *d = proxy_dir_to_(arg, bev);
+	size_t len = evbuffer_get_length(bufferevent_get_output(bev));
+
+#ifdef EVENT__HAVE_SPLICE
+	if (DIR_SPLICING(d)) {
+		/* We hold dst's lock; d belongs to src's. */
+		struct bufferevent *src = d->src;
+		bufferevent_incref_and_lock_(src);
+		proxy_pump_(d);
+		bufferevent_decref_and_unlock_(src);
+		return;
+	}
+#endif
+	if (d->choked && len < d->proxy->highmark) {
+		d->choked = 0;
+		if (!d->eof)
+			bufferevent_enable(d->src, EV_READ);
+	}
+	if (d->eof && !d->shut && !len)
+		proxy_shut_(d);
+}
+
+static void
+proxy_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct bufferevent_proxy *proxy = arg;
+	struct bufferevent_proxy_dir *d;
+
+	if (what & BEV_EVENT_CONNECTED)
+		return;
+	if ((what & BEV_EVENT_EOF) && !(what & BEV_EVENT_ERROR)) {
+		d = proxy_dir_from_(proxy, bev);
+		if (d->eof)
+			return;
+		proxy_move_(d);
+		d->eof = 1;
+		/* From now on, we want to hear when dst has written
+		 * everything. */
+		bufferevent_setwatermark(d->dst, EV_WRITE, 0, 0);
+		if (!d->shut &&
+		    !evbuffer_get_length(bufferevent_get_output(d->dst)))
+			proxy_shut_(d);
+		return;
+	}
+	proxy_stop_(proxy, bev, what);
+}
+
+struct bufferevent_proxy *
+bufferevent_proxy_new(struct bufferevent *a, struct bufferevent *b,
+    size_t highmark, int flags, bufferevent_proxy_event_cb cb, void *ctx)
+{
+	struct bufferevent_proxy *proxy;
+	int i;
+
+	if (a == b || bufferevent_get_base(a) != bufferevent_get_base(b))
+		return NULL;
+	if ((proxy = mm_calloc(1, sizeof(struct bufferevent_proxy))) == NULL)
+		return NULL;
+	proxy->highmark = highmark ? highmark : PROXY_DEFAULT_HIGHMARK;
+	proxy->cb = cb;
+	proxy->ctx = ctx;
+	proxy->dir[0].src = proxy->dir[1].dst = a;
+	proxy->dir[0].dst = proxy->dir[1].src = b;
+
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_proxy_dir *d = &proxy->dir[i];
+		d->proxy = proxy;
+		d->pipe[0] = d->pipe[1] = EVUTIL_INVALID_SOCKET;
+#ifdef EVENT__HAVE_SPLICE
+		if (!(flags & BEV_PROXY_NO_SPLICE))
+			proxy_splice_(d);
+#endif
+	}
+
+	bufferevent_setcb(a, proxy_readcb, proxy_writecb, proxy_eventcb, proxy);
+	bufferevent_setcb(b, proxy_readcb, proxy_writecb, proxy_eventcb, proxy);
+
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_proxy_dir *d = &proxy->dir[i];
+		if (DIR_SPLICING(d)) {
+			bufferevent_disable(d->src, EV_READ);
+			bufferevent_setwatermark(d->dst, EV_WRITE, 0, 0);
+			d->n_moved += evbuffer_get_length(
+				bufferevent_get_input(d->src));
+			evbuffer_add_buffer(bufferevent_get_output(d->dst),
+			    bufferevent_get_input(d->src));
+			event_add(&d->read_ev, NULL);
+		} else {
+			bufferevent_setwatermark(d->dst, EV_WRITE,
+			    proxy->highmark / 2, 0);
+			bufferevent_enable(d->src, EV_READ);
+			proxy_move_(d);
+		}
+	}
+
+	return proxy;
+}
+
+void
+bufferevent_proxy_free(struct bufferevent_proxy *proxy)
+{
+	int i;
+	for (i = 0; i < 2; ++i) {
+		struct bufferevent_proxy_dir *d = &proxy->dir[i];
+		if (DIR_SPLICING(d)) {
+			event_del(&d->read_ev);
+			event_del(&d->write_ev);
+			evutil_closesocket(d->pipe[0]);
+			evutil_closesocket(d->pipe[1]);
+		}
+		bufferevent_setcb(d->src, NULL, NULL, NULL, NULL);
+	}
+	mm_free(proxy);
+}
+
+void
+bufferevent_proxy_get_counts(struct bufferevent_proxy *proxy,
+    ev_uint64_t *a_to_b, ev_uint64_t *b_to_a)
+{
+	int i;
+	ev_uint64_t n[2];
+
+	for (i = 0; i < 2; ++i) {
+		BEV_LOCK(proxy->dir[i].src);
+		n[i] = proxy->dir[i].n_moved;
+		BEV_UNLOCK(proxy->dir[i].src);
+	}
+	if (a_to_b)
+		*a_to_b = n[0];
+	if (b_to_a)
+		*b_to_a = n[1];
+}
+
+short
+bufferevent_proxy_get_splicing(struct bufferevent_proxy *proxy)
+{
+	short what = 0;
+	if (DIR_SPLICING(&proxy->dir[0]))
+		what |= EV_WRITE;
+	if (DIR_SPLICING(&proxy->dir[1]))
+		what |= EV_READ;
+	return what;
+}
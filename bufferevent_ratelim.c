@@ -881,6 +881,24 @@ bufferevent_set_max_single_write(struct bufferevent *bev, size_t size)
 	return 0;
 }
 
+int
+bufferevent_set_adaptive_read(struct bufferevent *bev, size_t min,
+    size_t max)
+{
+	struct bufferevent_private *bevp;
+	int ret;
+	BEV_LOCK(bev);
+	bevp = BEV_UPCAST(bev);
+	ret = evbuffer_set_adaptive_read(bev->input, min, max);
+	if (ret == 0) {
+		bevp->max_single_read =
+		    max ? (ev_ssize_t)max : MAX_SINGLE_READ_DEFAULT;
+		ret = evbuffer_set_max_read(bev->input, bevp->max_single_read);
+	}
+	BEV_UNLOCK(bev);
+	return ret;
+}
+
 ev_ssize_t
 bufferevent_get_max_single_read(struct bufferevent *bev)
 {
@@ -70,6 +70,7 @@
 #include "log-internal.h"
 #include "mm-internal.h"
 #include "bufferevent-internal.h"
+#include "evbuffer-internal.h"
 #include "util-internal.h"
 #ifdef _WIN32
 #include "iocp-internal.h"
@@ -165,6 +166,11 @@ bufferevent_readcb(evutil_socket_t fd, short event, void *arg)
 		goto error;
 	}
 
+	/* Completions for MSG_ZEROCOPY sends from the output buffer also make
+	 * the socket readable. */
+	if (bufev->output->zerocopy)
+		evbuffer_zerocopy_reap(bufev->output, fd);
+
 	input = bufev->input;
 
 	/*
@@ -285,6 +291,9 @@ bufferevent_writecb(evutil_socket_t fd, short event, void *arg)
 		}
 	}
 
+	if (bufev->output->zerocopy)
+		evbuffer_zerocopy_reap(bufev->output, fd);
+
 	atmost = bufferevent_get_write_max_(bufev_p);
 
 	if (bufev_p->write_suspended)
@@ -364,9 +373,11 @@ bufferevent_socket_new(struct event_base *base, evutil_socket_t fd,
 	evbuffer_set_flags(bufev->output, EVBUFFER_FLAG_DRAINS_TO_FD);
 
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|EV_PERSIST|EV_FINALIZE|EV_LAZY_TIMEOUT,
+	    bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|EV_PERSIST|EV_FINALIZE|EV_LAZY_TIMEOUT,
+	    bufferevent_writecb, bufev);
 
 	evbuffer_add_cb(bufev->output, bufferevent_socket_outbuf_cb, bufev);
 
@@ -421,7 +432,8 @@ bufferevent_socket_connect(struct bufferevent *bev,
 	 * on a non-blocking connect() when ConnectEx() is unavailable. */
 	if (BEV_IS_ASYNC(bev)) {
 		event_assign(&bev->ev_write, bev->ev_base, fd,
-		    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bev);
+		    EV_WRITE|EV_PERSIST|EV_FINALIZE|EV_LAZY_TIMEOUT,
+		    bufferevent_writecb, bev);
 	}
 #endif
 	bufferevent_setfd(bev, fd);
@@ -640,10 +652,17 @@ be_socket_setfd(struct bufferevent *bufev, evutil_socket_t fd)
 	evbuffer_unfreeze(bufev->input, 0);
 	evbuffer_unfreeze(bufev->output, 1);
 
+	/* Collect what we can for zerocopy sends on the old socket; the rest
+	 * is released once it is closed. */
+	if (bufev->output->zerocopy)
+		evbuffer_zerocopy_reap(bufev->output, fd);
+
 	event_assign(&bufev->ev_read, bufev->ev_base, fd,
-	    EV_READ|EV_PERSIST|EV_FINALIZE, bufferevent_readcb, bufev);
+	    EV_READ|EV_PERSIST|EV_FINALIZE|EV_LAZY_TIMEOUT,
+	    bufferevent_readcb, bufev);
 	event_assign(&bufev->ev_write, bufev->ev_base, fd,
-	    EV_WRITE|EV_PERSIST|EV_FINALIZE, bufferevent_writecb, bufev);
+	    EV_WRITE|EV_PERSIST|EV_FINALIZE|EV_LAZY_TIMEOUT,
+	    bufferevent_writecb, bufev);
 
 	if (fd >= 0)
 		bufferevent_enable(bufev, bufev->enabled);
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include <errno.h>
+#include <string.h>
+#ifdef EVENT__HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#include "event2/dgram.h"
+#include "event2/util.h"
+#include "event2/event.h"
+#include "event2/event_struct.h"
+#include "mm-internal.h"
+#include "util-internal.h"
+#include "log-internal.h"
+#include "evthread-internal.h"
+
+struct evdgram {
+	struct event read_ev;
+	struct event write_ev;
+	void *lock;
+	evdgram_read_cb readcb;
+	evdgram_error_cb errorcb;
+	void *cbarg;
+	unsigned flags;
+	short refcnt;
+	int batch_size;
+	size_t max_size;
+	/** batch_size slots to read into, and the view of them that we hand
+	 * to the read callback. */
+	struct evutil_datagram_ *recv;
+	struct evdgram_msg *msgs;
+	/** A ring of batch_size slots of datagrams waiting to be sent. */
+	struct evutil_datagram_ *send;
+	int send_head;
+	int n_send;
+	/** The payloads of recv and send, max_size bytes each. */
+	char *bufs;
+	unsigned enabled : 1;
+	unsigned writing : 1;
+};
+
+#define LOCK(dg) EVLOCK_LOCK((dg)->lock, 0)
+#define UNLOCK(dg) EVLOCK_UNLOCK((dg)->lock, 0)
+
+/* Batch size and datagram size to use if the user doesn't pick them. */
+#define EVDGRAM_DEFAULT_BATCH 32
+#define EVDGRAM_DEFAULT_SIZE 2048
+/* Largest number of batches we read each time the socket is readable, so
+ * that one busy socket can't starve the rest of the loop. */
+#define EVDGRAM_MAX_READ_BATCHES 4
+
+static void evdgram_read_cb_(evutil_socket_t, short, void *);
+static void evdgram_write_cb_(evutil_socket_t, short, void *);
+
+static void
+evdgram_destroy(struct evdgram *dg)
+{
+	event_del(&dg->read_ev);
+	event_del(&dg->write_ev);
+	if (dg->flags & EVDGRAM_OPT_CLOSE_ON_FREE)
+		evutil_closesocket(event_get_fd(&dg->read_ev));
+	event_debug_unassign(&dg->read_ev);
+	event_debug_unassign(&dg->write_ev);
+	mm_free(dg->recv);
+	mm_free(dg->msgs);
+	mm_free(dg->send);
+	mm_free(dg->bufs);
+}
+
+static int
+evdgram_decref_and_unlock(struct evdgram *dg)
+{
+	int refcnt = --dg->refcnt;
+	if (refcnt == 0) {
+		evdgram_destroy(dg);
+		UNLOCK(dg);
+		EVTHREAD_FREE_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+		mm_free(dg);
+		return 1;
+	} else {
+		UNLOCK(dg);
+		return 0;
+	}
+}
+
+struct evdgram *
+evdgram_new(struct event_base *base, evutil_socket_t fd, unsigned flags,
+    int batch_size, size_t max_size)
+{
+	struct evdgram *dg;
+	int i;
+
+	if (batch_size <= 0)
+		batch_size = EVDGRAM_DEFAULT_BATCH;
+	if (max_size == 0)
+		max_size = EVDGRAM_DEFAULT_SIZE;
+	if (max_size > EV_SIZE_MAX / 2 / (size_t)batch_size)
+		return NULL;
+	if (evutil_make_socket_nonblocking(fd) < 0)
+		return NULL;
+
+	dg = mm_calloc(1, sizeof(struct evdgram));
+	if (!dg)
+		return NULL;
+	dg->recv = mm_calloc(batch_size, sizeof(struct evutil_datagram_));
+	dg->msgs = mm_calloc(batch_size, sizeof(struct evdgram_msg));
+	dg->send = mm_calloc(batch_size, sizeof(struct evutil_datagram_));
+	dg->bufs = mm_malloc(2 * (size_t)batch_size * max_size);
+	if (!dg->recv || !dg->msgs || !dg->send || !dg->bufs) {
+		mm_free(dg->recv);
+		mm_free(dg->msgs);
+		mm_free(dg->send);
+		mm_free(dg->bufs);
+		mm_free(dg);
+		return NULL;
+	}
+	for (i = 0; i < batch_size; ++i) {
+		dg->recv[i].buf = dg->bufs + (size_t)i * max_size;
+		dg->recv[i].buflen = max_size;
+		dg->send[i].buf = dg->bufs + (size_t)(batch_size + i) * max_size;
+		dg->send[i].buflen = max_size;
+	}
+
+	dg->flags = flags;
+	dg->refcnt = 1;
+	dg->batch_size = batch_size;
+	dg->max_size = max_size;
+
+	if (flags & EVDGRAM_OPT_THREADSAFE) {
+		EVTHREAD_ALLOC_LOCK(dg->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	}
+
+	event_assign(&dg->read_ev, base, fd, EV_READ|EV_PERSIST,
+	    evdgram_read_cb_, dg);
+	event_assign(&dg->write_ev, base, fd, EV_WRITE,
+	    evdgram_write_cb_, dg);
+
+	return dg;
+}
+
+/* Send as much of the queue as the socket will take.  Return the number of
+ * datagrams still queued.  If we had to drop any because of an error, set
+ * *errp to the error. */
+static int
+evdgram_flush_locked(struct evdgram *dg, int *errp)
+{
+	evutil_socket_t fd = event_get_fd(&dg->write_ev);
+
+	while (dg->n_send) {
+		int n = dg->n_send, r;
+		if (dg->send_head + n > dg->batch_size)
+			n = dg->batch_size - dg->send_head;
+		r = evutil_send_datagrams_(fd, &dg->send[dg->send_head], n);
+		if (r < 0) {
+			int err = evutil_socket_geterror(fd);
+			if (EVUTIL_ERR_RW_RETRIABLE(err))
+				break;
+			/* Drop the datagram that failed, and go on with the
+			 * rest. */
+			*errp = err;
+			r = 1;
+		}
+		dg->send_head = (dg->send_head + r) % dg->batch_size;
+		dg->n_send -= r;
+	}
+
+	if (dg->n_send && !dg->writing) {
+		if (event_add(&dg->write_ev, NULL) == 0)
+			dg->writing = 1;
+	} else if (!dg->n_send && dg->writing) {
+		event_del(&dg->write_ev);
+		dg->writing = 0;
+	}
+	return dg->n_send;
+}
+
+/* Hand the socket error err to the error callback.  Called with the lock
+ * held.  Return 1 if the callback freed dg, in which case the lock is gone
+ * too. */
+static int
+evdgram_report_error(struct evdgram *dg, short what, int err)
+{
+	evdgram_error_cb cb = dg->errorcb;
+	void *arg = dg->cbarg;
+
+	if (!cb)
+		return 0;
+	++dg->refcnt;
+	UNLOCK(dg);
+	EVUTIL_SET_SOCKET_ERROR(err);
+	cb(dg, what, arg);
+	LOCK(dg);
+	if (dg->refcnt == 1) {
+		int freed = evdgram_decref_and_unlock(dg);
+		EVUTIL_ASSERT(freed);
+		return 1;
+	}
+	--dg->refcnt;
+	return 0;
+}
+
+static void
+evdgram_read_cb_(evutil_socket_t fd, short what, void *p)
+{
+	struct evdgram *dg = p;
+	int round, i, n, read_err = 0, write_err = 0;
+
+	LOCK(dg);
+	for (round = 0; round < EVDGRAM_MAX_READ_BATCHES; ++round) {
+		evdgram_read_cb cb = dg->readcb;
+		void *arg = dg->cbarg;
+
+		if (!cb || !dg->enabled)
+			break;
+		n = evutil_recv_datagrams_(fd, dg->recv, dg->batch_size);
+		if (n < 0) {
+			int err = evutil_socket_geterror(fd);
+			if (!EVUTIL_ERR_RW_RETRIABLE(err))
+				read_err = err;
+			break;
+		}
+		for (i = 0; i < n; ++i) {
+			struct evutil_datagram_ *d = &dg->recv[i];
+			dg->msgs[i].data = d->buf;
+			dg->msgs[i].len = d->len;
+			dg->msgs[i].addr =
+			    d->addrlen ? (struct sockaddr *)&d->addr : NULL;
+			dg->msgs[i].socklen = (int)d->addrlen;
+		}
+
+		++dg->refcnt;
+		UNLOCK(dg);
+		cb(dg, dg->msgs, n, arg);
+		LOCK(dg);
+		if (dg->refcnt == 1) {
+			int freed = evdgram_decref_and_unlock(dg);
+			EVUTIL_ASSERT(freed);
+			return;
+		}
+		--dg->refcnt;
+		if (n < dg->batch_size)
+			break;
+	}
+
+	/* Send any replies the callback queued in one go. */
+	if (dg->n_send)
+		evdgram_flush_locked(dg, &write_err);
+
+	if (read_err && evdgram_report_error(dg, EV_READ, read_err))
+		return;
+	if (write_err && evdgram_report_error(dg, EV_WRITE, write_err))
+		return;
+	UNLOCK(dg);
+}
+
+static void
+evdgram_write_cb_(evutil_socket_t fd, short what, void *p)
+{
+	struct evdgram *dg = p;
+	int err = 0;
+
+	LOCK(dg);
+	dg->writing = 0;
+	evdgram_flush_locked(dg, &err);
+	if (err && evdgram_report_error(dg, EV_WRITE, err))
+		return;
+	UNLOCK(dg);
+}
+
+void
+evdgram_free(struct evdgram *dg)
+{
+	int err = 0;
+
+	LOCK(dg);
+	dg->readcb = NULL;
+	dg->errorcb = NULL;
+	evdgram_flush_locked(dg, &err);
+	evdgram_decref_and_unlock(dg);
+}
+
+void
+evdgram_setcb(struct evdgram *dg, evdgram_read_cb readcb,
+    evdgram_error_cb errorcb, void *arg)
+{
+	LOCK(dg);
+	if (dg->enabled) {
+		if (readcb && !dg->readcb)
+			event_add(&dg->read_ev, NULL);
+		else if (!readcb && dg->readcb)
+			event_del(&dg->read_ev);
+	}
+	dg->readcb = readcb;
+	dg->errorcb = errorcb;
+	dg->cbarg = arg;
+	UNLOCK(dg);
+}
+
+int
+evdgram_enable(struct evdgram *dg)
+{
+	int r = 0;
+
+	LOCK(dg);
+	dg->enabled = 1;
+	if (dg->readcb)
+		r = event_add(&dg->read_ev, NULL);
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_disable(struct evdgram *dg)
+{
+	int r;
+
+	LOCK(dg);
+	dg->enabled = 0;
+	r = event_del(&dg->read_ev);
+	UNLOCK(dg);
+	return r;
+}
+
+int
+evdgram_send(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *addr, int socklen)
+{
+	struct evutil_datagram_ *d;
+	int err = 0;
+
+	if (len > dg->max_size)
+		return -1;
+	if (addr && (socklen <= 0 ||
+		(size_t)socklen > sizeof(struct sockaddr_storage)))
+		return -1;
+
+	LOCK(dg);
+	if (dg->n_send == dg->batch_size) {
+		/* make room, reporting any datagram we had to drop as the
+		 * write callback would */
+		evdgram_flush_locked(dg, &err);
+		if (err && evdgram_report_error(dg, EV_WRITE, err)) {
+			EVUTIL_SET_SOCKET_ERROR(err);
+			return -1;
+		}
+		if (dg->n_send == dg->batch_size) {
+			UNLOCK(dg);
+			EVUTIL_SET_SOCKET_ERROR(EAGAIN);
+			return -1;
+		}
+	}
+	d = &dg->send[(dg->send_head + dg->n_send) % dg->batch_size];
+	memcpy(d->buf, data, len);
+	d->len = len;
+	if (addr) {
+		memcpy(&d->addr, addr, socklen);
+		d->addrlen = (ev_socklen_t)socklen;
+	} else {
+		d->addrlen = 0;
+	}
+	++dg->n_send;
+	if (!dg->writing && event_add(&dg->write_ev, NULL) == 0)
+		dg->writing = 1;
+	UNLOCK(dg);
+	return 0;
+}
+
+int
+evdgram_flush(struct evdgram *dg)
+{
+	int r, err = 0;
+
+	LOCK(dg);
+	r = evdgram_flush_locked(dg, &err);
+	UNLOCK(dg);
+	if (err) {
+		EVUTIL_SET_SOCKET_ERROR(err);
+		return -1;
+	}
+	return r;
+}
+
+evutil_socket_t
+evdgram_get_fd(struct evdgram *dg)
+{
+	evutil_socket_t fd;
+	LOCK(dg);
+	fd = event_get_fd(&dg->read_ev);
+	UNLOCK(dg);
+	return fd;
+}
+
+struct event_base *
+evdgram_get_base(struct evdgram *dg)
+{
+	struct event_base *base;
+	LOCK(dg);
+	base = event_get_base(&dg->read_ev);
+	UNLOCK(dg);
+	return base;
+}
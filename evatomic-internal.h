@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVATOMIC_INTERNAL_H_INCLUDED_
+#define EVATOMIC_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include "event2/util.h"
+
+/*
+  A handful of sequentially consistent atomic operations on pointers,
+  ints and 64-bit counters.  EVATOMIC_ENABLED is defined when the compiler
+  gives us real ones; otherwise these are plain loads and stores, and
+  callers must fall back to doing the same work under a lock.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define EVATOMIC_ENABLED
+
+static inline void *
+evatomic_ptr_load_(void *volatile *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void *
+evatomic_ptr_exchange_(void *volatile *p, void *v)
+{
+	return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+/* Set *p to 'desired' if it is '*expected' and return 1; otherwise set
+ * *expected to the current value of *p and return 0. */
+static inline int
+evatomic_ptr_cas_(void *volatile *p, void **expected, void *desired)
+{
+	return __atomic_compare_exchange_n(p, expected, desired, 0,
+	    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+static inline int
+evatomic_int_load_(volatile int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void
+evatomic_int_store_(volatile int *p, int v)
+{
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+static inline int
+evatomic_int_exchange_(volatile int *p, int v)
+{
+	return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+static inline ev_uint64_t
+evatomic_u64_load_(volatile ev_uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+static inline void
+evatomic_u64_add_(volatile ev_uint64_t *p, ev_uint64_t v)
+{
+	__atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+#elif defined(_MSC_VER)
+#define EVATOMIC_ENABLED
+#include <intrin.h>
+
+static inline void *
+evatomic_ptr_load_(void *volatile *p)
+{
+	return InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+static inline void *
+evatomic_ptr_exchange_(void *volatile *p, void *v)
+{
+	return InterlockedExchangePointer(p, v);
+}
+static inline int
+evatomic_ptr_cas_(void *volatile *p, void **expected, void *desired)
+{
+	void *old = InterlockedCompareExchangePointer(p, desired, *expected);
+	if (old == *expected)
+		return 1;
+	*expected = old;
+	return 0;
+}
+static inline int
+evatomic_int_load_(volatile int *p)
+{
+	return (int)InterlockedCompareExchange((volatile long *)p, 0, 0);
+}
+static inline void
+evatomic_int_store_(volatile int *p, int v)
+{
+	InterlockedExchange((volatile long *)p, v);
+}
+static inline int
+evatomic_int_exchange_(volatile int *p, int v)
+{
+	return (int)InterlockedExchange((volatile long *)p, v);
+}
+static inline ev_uint64_t
+evatomic_u64_load_(volatile ev_uint64_t *p)
+{
+	return (ev_uint64_t)InterlockedCompareExchange64(
+	    (volatile __int64 *)p, 0, 0);
+}
+static inline void
+evatomic_u64_add_(volatile ev_uint64_t *p, ev_uint64_t v)
+{
+	InterlockedExchangeAdd64((volatile __int64 *)p, (__int64)v);
+}
+
+#else
+
+static inline void *
+evatomic_ptr_load_(void *volatile *p)
+{
+	return *p;
+}
+static inline void *
+evatomic_ptr_exchange_(void *volatile *p, void *v)
+{
+	void *old = *p;
+	*p = v;
+	return old;
+}
+static inline int
+evatomic_ptr_cas_(void *volatile *p, void **expected, void *desired)
+{
+	if (*p == *expected) {
+		*p = desired;
+		return 1;
+	}
+	*expected = *p;
+	return 0;
+}
+static inline int
+evatomic_int_load_(volatile int *p)
+{
+	return *p;
+}
+static inline void
+evatomic_int_store_(volatile int *p, int v)
+{
+	*p = v;
+}
+static inline int
+evatomic_int_exchange_(volatile int *p, int v)
+{
+	int old = *p;
+	*p = v;
+	return old;
+}
+static inline ev_uint64_t
+evatomic_u64_load_(volatile ev_uint64_t *p)
+{
+	return *p;
+}
+static inline void
+evatomic_u64_add_(volatile ev_uint64_t *p, ev_uint64_t v)
+{
+	*p += v;
+}
+
+#endif
+
+#endif /* EVATOMIC_INTERNAL_H_INCLUDED_ */
@@ -35,6 +35,7 @@ extern "C" {
 #include "evconfig-private.h"
 #include "event2/util.h"
 #include "event2/event_struct.h"
+#include "event2/buffer_compat.h"
 #include "util-internal.h"
 #include "defer-internal.h"
 
@@ -77,6 +78,8 @@ struct evbuffer_cb_entry {
 
 struct bufferevent;
 struct evbuffer_chain;
+struct evbuffer_zerocopy;
+struct evbuffer_chain_pool;
 struct evbuffer {
 	/** The first chain in this buffer's linked list of chains. */
 	struct evbuffer_chain *first;
@@ -100,8 +103,22 @@ struct evbuffer {
 
 	/** Total amount of bytes stored in all chains.*/
 	size_t total_len;
+	/** Total amount of chain memory held by this buffer, as counted by
+	 * evbuffer_chain_cost_(). */
+	size_t total_alloc;
+	/** Changes whenever data is moved from one chain to another, so that
+	 * a cursor into the old chain knows to find its place again. */
+	unsigned chain_gen;
 	/** Maximum bytes per one read */
 	size_t max_read;
+	/** If read_max is nonzero, evbuffer_read() reads read_next bytes,
+	 * and adapts read_next between read_min and read_max. */
+	size_t read_min;
+	size_t read_max;
+	size_t read_next;
+	/** Number of reads in a row that would have fit in half of
+	 * read_next. */
+	int n_small_reads;
 
 	/** Number of bytes we have added to the buffer since we last tried to
 	 * invoke callbacks. */
@@ -155,6 +172,13 @@ struct evbuffer {
 	/** The parent bufferevent object this evbuffer belongs to.
 	 * NULL if the evbuffer stands alone. */
 	struct bufferevent *parent;
+
+	/** If set, the pool that new chains for this buffer come from. */
+	struct evbuffer_chain_pool *chain_pool;
+
+	/** State for EVBUFFER_FLAG_ZEROCOPY, allocated the first time we
+	 * try a zerocopy send.  NULL otherwise. */
+	struct evbuffer_zerocopy *zerocopy;
 };
 
 #if EVENT__SIZEOF_OFF_T < EVENT__SIZEOF_SIZE_T
@@ -196,12 +220,22 @@ struct evbuffer_chain {
 	 * memmoved, until the chain is un-pinned. */
 #define EVBUFFER_MEM_PINNED_R	0x0010
 #define EVBUFFER_MEM_PINNED_W	0x0020
-#define EVBUFFER_MEM_PINNED_ANY (EVBUFFER_MEM_PINNED_R|EVBUFFER_MEM_PINNED_W)
+	/** a chain the kernel may still be reading from after a MSG_ZEROCOPY
+	 * send; see struct evbuffer_zerocopy. */
+#define EVBUFFER_MEM_PINNED_ZC	0x0100
+#define EVBUFFER_MEM_PINNED_ANY \
+	(EVBUFFER_MEM_PINNED_R|EVBUFFER_MEM_PINNED_W|EVBUFFER_MEM_PINNED_ZC)
 	/** a chain that should be freed, but can't be freed until it is
 	 * un-pinned. */
 #define EVBUFFER_DANGLING	0x0040
 	/** a chain that is a referenced copy of another chain */
 #define EVBUFFER_MULTICAST	0x0080
+	/** a chain allocated from an evbuffer_chain_pool; see
+	 * struct evbuffer_pooled_chain */
+#define EVBUFFER_POOLED		0x0200
+	/** a chain pointing into an evbuffer_segment; see
+	 * struct evbuffer_chain_segment */
+#define EVBUFFER_SEGMENT	0x0400
 
 	/** number of references to this chain */
 	int refcnt;
@@ -267,6 +301,27 @@ struct evbuffer_file_segment {
 	void *cleanup_cb_arg;
 };
 
+/** Shared segment for a segment chain.  Lives at the end of an
+ * evbuffer_chain with the EVBUFFER_SEGMENT flag set.  */
+struct evbuffer_chain_segment {
+	struct evbuffer_segment *segment;
+};
+
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_segment {
+	void *lock; /**< lock prevent concurrent access to refcnt */
+	int refcnt; /**< Reference count for this segment */
+	/** The contents of the segment; for copied data, this points just
+	 * past the end of this structure. */
+	const unsigned char *data;
+	/** The length of this segment. */
+	size_t length;
+	/** Called when the last reference goes away, for referenced data. */
+	evbuffer_ref_cleanup_cb cleanupfn;
+	/** Argument to be passed to cleanupfn. */
+	void *cleanupfn_arg;
+};
+
 /** Information about the multicast parent of a chain.  Lives at the
  * end of an evbuffer_chain with the EVBUFFER_MULTICAST flag set.  */
 struct evbuffer_multicast_parent {
@@ -276,6 +331,83 @@ struct evbuffer_multicast_parent {
 	struct evbuffer_chain *parent;
 };
 
+/** A chain sent with MSG_ZEROCOPY, and the sequence number of the last send
+ * that covered it. */
+struct evbuffer_zerocopy_pin {
+	struct evbuffer_chain *chain;
+	ev_uint32_t seq;
+};
+
+/** Zerocopy send state for an evbuffer.
+ *
+ * The kernel numbers the MSG_ZEROCOPY sends on each socket, and reports
+ * ranges of them as completed on the socket's error queue.  Until then it
+ * may still read from the memory we sent, so every chain we sent from gets
+ * EVBUFFER_MEM_PINNED_ZC and a place on 'pins'.  Draining such a chain leaves
+ * it dangling rather than freeing it, and nothing moves or overwrites the
+ * data in it.
+ *
+ * The chains stay pinned until the kernel reports the sends, or until the
+ * socket is closed.  If the evbuffer is freed first, this structure lives on
+ * as an orphan that later reaps on other buffers look after. */
+struct evbuffer_zerocopy {
+	/** The socket we enabled SO_ZEROCOPY on, or EVUTIL_INVALID_SOCKET. */
+	evutil_socket_t fd;
+	/** The inode of that socket, so we can tell when fd has been closed,
+	 * even if its number has been reused. */
+	ev_uint64_t sock_ino;
+	/** The kernel's number for our next zerocopy send on fd. */
+	ev_uint32_t next_seq;
+	/** The number of the oldest send not yet reported as completed. */
+	ev_uint32_t done_seq;
+	/** True if zerocopy is not working, or not helping, on fd. */
+	unsigned disabled : 1;
+	/** Pinned chains, oldest first, in pins[pins_head..n_pins). */
+	struct evbuffer_zerocopy_pin *pins;
+	size_t pins_head;
+	size_t n_pins;
+	size_t pins_alloc;
+	/** Next on the list of orphans, once our evbuffer is gone. */
+	struct evbuffer_zerocopy *next_orphan;
+};
+
+/** Number of size classes in an evbuffer_chain_pool.  Class i holds
+ * allocations of MIN_BUFFER_SIZE << i bytes. */
+#define EVBUFFER_CHAIN_POOL_CLASSES 8
+
+/* Declared in event2/buffer.h; defined here. */
+struct evbuffer_chain_pool {
+	/** Lock for everything below. */
+	void *lock;
+	/** One reference for the owner until evbuffer_chain_pool_free(), one
+	 * for each evbuffer using the pool, and one for each chain allocated
+	 * from it that is not on a free list. */
+	int refcnt;
+	/** True once the owner has freed the pool; from then on, chains are
+	 * released rather than kept. */
+	unsigned owner_freed : 1;
+	/** Most bytes we keep on the free lists. */
+	size_t max_cached_bytes;
+	/** Largest allocation we keep on the free lists. */
+	size_t max_chain_size;
+	/** Free chains, linked through their next pointers, per size class. */
+	struct evbuffer_chain *free_chains[EVBUFFER_CHAIN_POOL_CLASSES];
+	struct evbuffer_chain_pool_stats stats;
+	/** Where we get memory from, or NULL for mm_malloc. */
+	struct event_mem_ctx *mem_ctx;
+};
+
+/** A chain allocated from an evbuffer_chain_pool, with the header that
+ * tells us where to return it.  The chain's data follows it as usual. */
+struct evbuffer_pooled_chain {
+	struct evbuffer_chain_pool *pool;
+	/** Size class of this chain, or -1 if it is too big to cache. */
+	int size_class;
+	/** Size of the whole allocation, header included. */
+	size_t alloc_size;
+	struct evbuffer_chain chain;
+};
+
 #define EVBUFFER_CHAIN_SIZE sizeof(struct evbuffer_chain)
 /** Return a pointer to extra data allocated along with an evbuffer. */
 #define EVBUFFER_CHAIN_EXTRA(t, c) (t *)((struct evbuffer_chain *)(c) + 1)
@@ -346,6 +478,31 @@ int evbuffer_get_callbacks_(struct evbuffer *buffer,
     struct event_callback **cbs,
     int max_cbs);
 
+/** Return how many bytes of chain memory buf is holding, whether or not
+ * they contain data. */
+size_t evbuffer_get_allocated_(struct evbuffer *buf);
+
+/** Scanning kernels in buffer_scan.c; see evbuffer_scan_set_level_(). */
+#define EVBUFFER_SCAN_SCALAR 0
+#define EVBUFFER_SCAN_SSE2 1
+#define EVBUFFER_SCAN_AVX2 2
+
+/** Return a pointer to the first '\r' or '\n' in the len bytes at s, or
+ * NULL if there is none. */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_find_eol_char_(const unsigned char *s,
+    size_t len);
+/** Return a pointer to the first place where all len bytes of what occur
+ * in the n bytes at s, or NULL if there is none.  len must be nonzero. */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_find_needle_(const unsigned char *s, size_t n,
+    const unsigned char *what, size_t len);
+/** For testing: use the EVBUFFER_SCAN_* kernels given by level, or the
+ * best ones the CPU supports if level is negative or more than that.
+ * Return the level we picked. */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_scan_set_level_(int level);
+
 #ifdef __cplusplus
 }
 #endif
@@ -141,6 +141,9 @@
 #define MAX_V4_ADDRS 32
 #define MAX_V6_ADDRS 32
 
+/* number of UDP packets we read with one system call */
+#define EVDNS_READ_BATCH 8
+
 
 #define TYPE_A	       EVDNS_TYPE_A
 #define TYPE_CNAME     5
@@ -1383,17 +1386,20 @@ nameserver_pick(struct evdns_base *base) {
 /* this is called when a namesever socket is ready for reading */
 static void
 nameserver_read(struct nameserver *ns) {
-	struct sockaddr_storage ss;
-	ev_socklen_t addrlen = sizeof(ss);
-	u8 packet[1500];
+	struct evutil_datagram_ dgrams[EVDNS_READ_BATCH];
+	u8 packets[EVDNS_READ_BATCH][1500];
 	char addrbuf[128];
+	int i, n;
 	ASSERT_LOCKED(ns->base);
 
+	for (i = 0; i < EVDNS_READ_BATCH; ++i) {
+		dgrams[i].buf = packets[i];
+		dgrams[i].buflen = sizeof(packets[i]);
+	}
 	for (;;) {
-		const int r = recvfrom(ns->socket, (void*)packet,
-		    sizeof(packet), 0,
-		    (struct sockaddr*)&ss, &addrlen);
-		if (r < 0) {
+		n = evutil_recv_datagrams_(ns->socket, dgrams,
+		    EVDNS_READ_BATCH);
+		if (n < 0) {
 			int err = evutil_socket_geterror(ns->socket);
 			if (EVUTIL_ERR_RW_RETRIABLE(err))
 				return;
@@ -1401,18 +1407,24 @@ nameserver_read(struct nameserver *ns) {
 			    evutil_socket_error_to_string(err));
 			return;
 		}
-		if (evutil_sockaddr_cmp((struct sockaddr*)&ss,
-			(struct sockaddr*)&ns->address, 0)) {
-			log(EVDNS_LOG_WARN, "Address mismatch on received "
-			    "DNS packet.  Apparent source was %s",
-			    evutil_format_sockaddr_port_(
-				    (struct sockaddr *)&ss,
-				    addrbuf, sizeof(addrbuf)));
-			return;
-		}
+		for (i = 0; i < n; ++i) {
+			if (evutil_sockaddr_cmp(
+				(struct sockaddr*)&dgrams[i].addr,
+				(struct sockaddr*)&ns->address, 0)) {
+				log(EVDNS_LOG_WARN, "Address mismatch on "
+				    "received DNS packet.  Apparent source "
+				    "was %s",
+				    evutil_format_sockaddr_port_(
+					    (struct sockaddr *)&dgrams[i].addr,
+					    addrbuf, sizeof(addrbuf)));
+				continue;
+			}
 
-		ns->timedout = 0;
-		reply_parse(ns->base, packet, r);
+			ns->timedout = 0;
+			reply_parse(ns->base, packets[i], (int)dgrams[i].len);
+		}
+		if (n < EVDNS_READ_BATCH)
+			return;
 	}
 }
 
@@ -1420,17 +1432,19 @@ nameserver_read(struct nameserver *ns) {
 /* act accordingly. */
 static void
 server_port_read(struct evdns_server_port *s) {
-	u8 packet[1500];
-	struct sockaddr_storage addr;
-	ev_socklen_t addrlen;
-	int r;
+	struct evutil_datagram_ dgrams[EVDNS_READ_BATCH];
+	u8 packets[EVDNS_READ_BATCH][1500];
+	int i, n;
 	ASSERT_LOCKED(s);
 
+	for (i = 0; i < EVDNS_READ_BATCH; ++i) {
+		dgrams[i].buf = packets[i];
+		dgrams[i].buflen = sizeof(packets[i]);
+	}
 	for (;;) {
-		addrlen = sizeof(struct sockaddr_storage);
-		r = recvfrom(s->socket, (void*)packet, sizeof(packet), 0,
-					 (struct sockaddr*) &addr, &addrlen);
-		if (r < 0) {
+		n = evutil_recv_datagrams_(s->socket, dgrams,
+		    EVDNS_READ_BATCH);
+		if (n < 0) {
 			int err = evutil_socket_geterror(s->socket);
 			if (EVUTIL_ERR_RW_RETRIABLE(err))
 				return;
@@ -1439,7 +1453,12 @@ server_port_read(struct evdns_server_port *s) {
 			    evutil_socket_error_to_string(err), err);
 			return;
 		}
-		request_parse(packet, r, s, (struct sockaddr*) &addr, addrlen);
+		for (i = 0; i < n; ++i)
+			request_parse(packets[i], (int)dgrams[i].len, s,
+			    (struct sockaddr*) &dgrams[i].addr,
+			    dgrams[i].addrlen);
+		if (n < EVDNS_READ_BATCH)
+			return;
 	}
 }
 
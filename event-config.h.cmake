@@ -163,6 +163,9 @@
 /* Define to 1 if you have the `inet_pton' function. */
 #cmakedefine EVENT__HAVE_INET_PTON 1
 
+/* Define if your system supports io_uring */
+#cmakedefine EVENT__HAVE_IO_URING 1
+
 /* Define to 1 if you have the <inttypes.h> header file. */
 #cmakedefine EVENT__HAVE_INTTYPES_H 1
 
@@ -235,6 +238,9 @@
 /* Define to 1 if you have the `putenv' function. */
 #cmakedefine EVENT__HAVE_PUTENV 1
 
+/* Define to 1 if you have the `recvmmsg' function. */
+#cmakedefine EVENT__HAVE_RECVMMSG 1
+
 /* Define to 1 if the system has the type `sa_family_t'. */
 #cmakedefine EVENT__HAVE_SA_FAMILY_T 1
 
@@ -253,6 +259,9 @@
 /* Define to 1 if you have the `sendfile' function. */
 #cmakedefine EVENT__HAVE_SENDFILE 1
 
+/* Define to 1 if you have the `sendmmsg' function. */
+#cmakedefine EVENT__HAVE_SENDMMSG 1
+
 /* Define to 1 if you have the `sigaction' function. */
 #cmakedefine EVENT__HAVE_SIGACTION 1
 
@@ -334,6 +343,15 @@
 /* Define to 1 if you have the `sysctl' function. */
 #cmakedefine EVENT__HAVE_SYSCTL 1
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#cmakedefine EVENT__HAVE_LINUX_IO_URING_H 1
+
+/* Define to 1 if you have the <linux/errqueue.h> header file. */
+#cmakedefine EVENT__HAVE_LINUX_ERRQUEUE_H 1
+
+/* Define to 1 if you have the <linux/filter.h> header file. */
+#cmakedefine EVENT__HAVE_LINUX_FILTER_H 1
+
 /* Define to 1 if you have the <sys/epoll.h> header file. */
 #cmakedefine EVENT__HAVE_SYS_EPOLL_H 1
 
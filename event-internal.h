@@ -39,6 +39,7 @@ extern "C" {
 #include <sys/queue.h>
 #include "event2/event_struct.h"
 #include "minheap-internal.h"
+#include "timerwheel-internal.h"
 #include "evsignal-internal.h"
 #include "mm-internal.h"
 #include "defer-internal.h"
@@ -333,6 +334,13 @@ struct event_base {
 
 	/** Priority queue of events with timeouts. */
 	struct min_heap timeheap;
+	/** Timing wheel of events with timeouts; used instead of timeheap
+	 * if EVENT_BASE_FLAG_TIMER_WHEEL is set, NULL otherwise. */
+	struct timer_wheel *timewheel;
+	/** Real deadlines of EV_LAZY_TIMEOUT events that were re-added with
+	 * a later timeout than the one they are queued for.  NULL until the
+	 * first such re-add. */
+	struct event_lazy_map *lazy_deadlines;
 
 	/** Stored timeval: used to avoid calling gettimeofday/clock_gettime
 	 * too often. */
@@ -375,8 +383,13 @@ struct event_base {
 
 	/* Notify main thread to wake up break, etc. */
 	/** True if the base already has a pending notify, and we don't need
-	 * to add any more. */
-	int is_notify_pending;
+	 * to add any more.  Set and cleared with atomic operations, so that
+	 * deciding whether to notify does not need th_base_lock. */
+	volatile int is_notify_pending;
+	/** How many notifies we have sent, and how many we skipped because
+	 * one was already pending. */
+	volatile ev_uint64_t n_notify_sent;
+	volatile ev_uint64_t n_notify_coalesced;
 	/** A socketpair used by some th_notify functions to wake up the main
 	 * thread. */
 	evutil_socket_t th_notify_fd[2];
@@ -386,6 +399,19 @@ struct event_base {
 	/** A function used to wake up the main thread from another thread. */
 	int (*th_notify_fn)(struct event_base *base);
 
+	/** Callbacks posted with event_base_post(), newest first.  Other
+	 * threads push onto these without taking th_base_lock; the loop
+	 * takes everything off at once. */
+	void *volatile posted;
+	/** As 'posted', for callbacks posted with EV_POST_STEALABLE. */
+	void *volatile posted_stealable;
+	/** True while the loop is about to wait with nothing to do; only kept
+	 * up to date if steal_peers is set. */
+	volatile int is_idle;
+	/** Bases whose stealable callbacks this base may run, or NULL. */
+	struct event_base **steal_peers;
+	int n_steal_peers;
+
 	/** Saved seed for weak random number generator. Some backends use
 	 * this to produce fairness among sockets. Protected by th_base_lock. */
 	struct evutil_weakrand_state weakrand_seed;
@@ -395,6 +421,12 @@ struct event_base {
 
 	/** "Prepare" and "check" watchers. */
 	struct evwatch_list watchers[EVWATCH_MAX];
+
+	/** Allocator context set with event_base_set_mem_ctx(), and a pool
+	 * over it for the buffers of bufferevents on this base; both NULL by
+	 * default. */
+	struct event_mem_ctx *mem_ctx;
+	struct evbuffer_chain_pool *chain_pool;
 };
 
 struct event_config_entry {
@@ -496,6 +528,14 @@ int event_callback_cancel_nolock_(struct event_base *base,
 void event_callback_init_(struct event_base *base,
     struct event_callback *cb);
 
+/** Let 'base' run the stealable posted callbacks (see event_base_post()) of
+    the 'n' bases in 'peers' when it has nothing else to do.  'peers' may
+    include 'base' itself.  Must be called before any of their loops start,
+    and 'peers' must outlive them. */
+EVENT2_EXPORT_SYMBOL
+void event_base_set_steal_peers_(struct event_base *base,
+    struct event_base **peers, int n);
+
 /* FIXME document. */
 EVENT2_EXPORT_SYMBOL
 void event_base_add_virtual_(struct event_base *base);
@@ -530,6 +570,10 @@ int event_base_foreach_event_nolock_(struct event_base *base,
  */
 void event_disable_debug_mode(void);
 
+/* Release the zerocopy state that freed evbuffers left behind; see
+ * struct evbuffer_zerocopy.  Called during shutdown. */
+void evbuffer_free_globals_(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -60,9 +60,11 @@
 #include "event2/event_struct.h"
 #include "event2/event_compat.h"
 #include "event2/watch.h"
+#include "event2/buffer.h"
 #include "event-internal.h"
 #include "defer-internal.h"
 #include "evthread-internal.h"
+#include "evatomic-internal.h"
 #include "event2/thread.h"
 #include "event2/util.h"
 #include "log-internal.h"
@@ -90,6 +92,9 @@ extern const struct eventop pollops;
 #ifdef EVENT__HAVE_EPOLL
 extern const struct eventop epollops;
 #endif
+#ifdef EVENT__HAVE_IO_URING
+extern const struct eventop uringops;
+#endif
 #ifdef EVENT__HAVE_WORKING_KQUEUE
 extern const struct eventop kqops;
 #endif
@@ -111,6 +116,9 @@ static const struct eventop *eventops[] = {
 #ifdef EVENT__HAVE_EPOLL
 	&epollops,
 #endif
+#ifdef EVENT__HAVE_IO_URING
+	&uringops,
+#endif
 #ifdef EVENT__HAVE_DEVPOLL
 	&devpollops,
 #endif
@@ -166,9 +174,107 @@ static inline void	event_persist_closure(struct event_base *, struct event *ev);
 
 static int	evthread_notify_base(struct event_base *base);
 
+/* A callback posted with event_base_post(). */
+struct event_posted_cb {
+	struct event_callback evcb;
+	/* The next older callback in the queue. */
+	struct event_posted_cb *next;
+	event_post_callback_fn fn;
+	void *arg;
+};
+
+static int	event_base_drain_posted(struct event_base *base);
+static int	event_base_steal_posted(struct event_base *base);
+static void	event_base_free_posted(void *volatile *head);
+static void	event_posted_cb_run(struct event_callback *evcb, void *arg);
+
 static void insert_common_timeout_inorder(struct common_timeout_list *ctl,
     struct event *ev);
 
+/* The real deadline of an EV_LAZY_TIMEOUT event that has been pushed back
+ * past the timeout it is queued for.  We keep these in a table on the base
+ * rather than in struct event, whose layout is part of the ABI. */
+struct event_lazy_entry {
+	HT_ENTRY(event_lazy_entry) node;
+	const struct event *ptr;
+	struct timeval deadline;
+};
+
+static inline unsigned
+hash_lazy_entry(const struct event_lazy_entry *e)
+{
+	/* As for hash_debug_entry. */
+	unsigned u = (unsigned) ((ev_uintptr_t) e->ptr);
+	return (u >> 6);
+}
+
+static inline int
+eq_lazy_entry(const struct event_lazy_entry *a,
+    const struct event_lazy_entry *b)
+{
+	return a->ptr == b->ptr;
+}
+
+HT_HEAD(event_lazy_map, event_lazy_entry);
+HT_PROTOTYPE(event_lazy_map, event_lazy_entry, node, hash_lazy_entry,
+    eq_lazy_entry)
+HT_GENERATE(event_lazy_map, event_lazy_entry, node, hash_lazy_entry,
+    eq_lazy_entry, 0.5, mm_malloc, mm_realloc, mm_free)
+
+/* Return the deadline recorded for 'ev' by a lazy re-add, or NULL if its
+ * deadline is its ev_timeout. */
+static const struct timeval *
+event_lazy_deadline_(const struct event_base *base, const struct event *ev)
+{
+	struct event_lazy_entry find, *ent;
+
+	if (!base->lazy_deadlines || HT_EMPTY(base->lazy_deadlines))
+		return NULL;
+	find.ptr = ev;
+	ent = HT_FIND(event_lazy_map, base->lazy_deadlines, &find);
+	return ent ? &ent->deadline : NULL;
+}
+
+/* Record 'deadline' as the real deadline of 'ev'.  Returns -1 if we are out
+ * of memory, in which case the caller should requeue 'ev' instead. */
+static int
+event_lazy_set_(struct event_base *base, const struct event *ev,
+    const struct timeval *deadline)
+{
+	struct event_lazy_entry find, *ent;
+
+	if (!base->lazy_deadlines) {
+		if (!(base->lazy_deadlines =
+			mm_malloc(sizeof(struct event_lazy_map))))
+			return -1;
+		HT_INIT(event_lazy_map, base->lazy_deadlines);
+	}
+	find.ptr = ev;
+	if ((ent = HT_FIND(event_lazy_map, base->lazy_deadlines, &find))) {
+		ent->deadline = *deadline;
+		return 0;
+	}
+	if (!(ent = mm_malloc(sizeof(*ent))))
+		return -1;
+	ent->ptr = ev;
+	ent->deadline = *deadline;
+	HT_INSERT(event_lazy_map, base->lazy_deadlines, ent);
+	return 0;
+}
+
+/* Forget the lazy deadline of 'ev', if it has one. */
+static void
+event_lazy_clear_(struct event_base *base, const struct event *ev)
+{
+	struct event_lazy_entry find, *ent;
+
+	if (!base->lazy_deadlines || HT_EMPTY(base->lazy_deadlines))
+		return;
+	find.ptr = ev;
+	if ((ent = HT_REMOVE(event_lazy_map, base->lazy_deadlines, &find)))
+		mm_free(ent);
+}
+
 #ifndef EVENT__DISABLE_DEBUG_MODE
 /* These functions implement a hashtable of which 'struct event *' structures
  * have been setup or added.  We don't want to trust the content of the struct
@@ -639,6 +745,19 @@ event_base_new_with_config(const struct event_config *cfg)
 		evutil_configure_monotonic_time_(&base->monotonic_timer, flags);
 
 		gettime(base, &tmp);
+
+		if (should_check_environment &&
+		    evutil_getenv_("EVENT_TIMER_WHEEL") != NULL)
+			base->flags |= EVENT_BASE_FLAG_TIMER_WHEEL;
+		if (base->flags & EVENT_BASE_FLAG_TIMER_WHEEL) {
+			base->timewheel = mm_malloc(sizeof(struct timer_wheel));
+			if (base->timewheel == NULL) {
+				event_warn("%s: malloc", __func__);
+				mm_free(base);
+				return NULL;
+			}
+			timer_wheel_ctor_(base->timewheel, &tmp);
+		}
 	}
 
 	min_heap_ctor_(&base->timeheap);
@@ -794,6 +913,14 @@ event_base_cancel_single_callback_(struct event_base *base,
 		event_callback_cancel_nolock_(base, evcb, 1);
 		EVBASE_RELEASE_LOCK(base, th_base_lock);
 		result = 1;
+		if (evcb->evcb_closure == EV_CLOSURE_CB_SELF &&
+		    evcb->evcb_cb_union.evcb_selfcb == event_posted_cb_run) {
+			/* A posted callback that never ran; nobody else
+			 * owns it. */
+			mm_free(EVUTIL_UPCAST(evcb, struct event_posted_cb,
+				evcb));
+			return result;
+		}
 	}
 
 	if (run_finalizers && (evcb->evcb_flags & EVLIST_FINALIZING)) {
@@ -882,6 +1009,12 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		event_del(ev);
 		++n_deleted;
 	}
+	if (base->timewheel) {
+		while ((ev = timer_wheel_any_(base->timewheel)) != NULL) {
+			event_del(ev);
+			++n_deleted;
+		}
+	}
 	for (i = 0; i < base->n_common_timeouts; ++i) {
 		struct common_timeout_list *ctl =
 		    base->common_timeout_queues[i];
@@ -901,6 +1034,9 @@ event_base_free_(struct event_base *base, int run_finalizers)
 	if (base->common_timeout_queues)
 		mm_free(base->common_timeout_queues);
 
+	event_base_free_posted(&base->posted);
+	event_base_free_posted(&base->posted_stealable);
+
 	for (;;) {
 		/* For finalizers we can register yet another finalizer out from
 		 * finalizer, and iff finalizer will be in active_later_queue we can
@@ -936,6 +1072,15 @@ event_base_free_(struct event_base *base, int run_finalizers)
 
 	EVUTIL_ASSERT(min_heap_empty_(&base->timeheap));
 	min_heap_dtor_(&base->timeheap);
+	if (base->timewheel) {
+		EVUTIL_ASSERT(timer_wheel_empty_(base->timewheel));
+		mm_free(base->timewheel);
+	}
+	if (base->lazy_deadlines) {
+		EVUTIL_ASSERT(HT_EMPTY(base->lazy_deadlines));
+		HT_CLEAR(event_lazy_map, base->lazy_deadlines);
+		mm_free(base->lazy_deadlines);
+	}
 
 	mm_free(base->activequeues);
 
@@ -955,12 +1100,57 @@ event_base_free_(struct event_base *base, int run_finalizers)
 		}
 	}
 
+	if (base->chain_pool)
+		evbuffer_chain_pool_free(base->chain_pool);
+	if (base->mem_ctx)
+		event_mem_ctx_decref_(base->mem_ctx);
+
 	/* If we're freeing current_base, there won't be a current_base. */
 	if (base == current_base)
 		current_base = NULL;
 	mm_free(base);
 }
 
+int
+event_base_set_mem_ctx(struct event_base *base, struct event_mem_ctx *ctx)
+{
+	struct evbuffer_chain_pool *pool = NULL, *old_pool;
+	struct event_mem_ctx *old_ctx;
+
+	/* The context keeps freed chains itself, so the pool doesn't need
+	 * to cache any. */
+	if (ctx &&
+	    (pool = evbuffer_chain_pool_new_with_mem_ctx(0, 0, ctx)) == NULL)
+		return -1;
+	if (ctx)
+		event_mem_ctx_incref_(ctx);
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	old_pool = base->chain_pool;
+	old_ctx = base->mem_ctx;
+	base->chain_pool = pool;
+	base->mem_ctx = ctx;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	/* Buffers that already use the old pool keep it alive. */
+	if (old_pool)
+		evbuffer_chain_pool_free(old_pool);
+	if (old_ctx)
+		event_mem_ctx_decref_(old_ctx);
+	return 0;
+}
+
+struct event_mem_ctx *
+event_base_get_mem_ctx(struct event_base *base)
+{
+	struct event_mem_ctx *ctx;
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	ctx = base->mem_ctx;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	return ctx;
+}
+
 void
 event_base_free_nofinalize(struct event_base *base)
 {
@@ -1357,12 +1547,25 @@ event_base_get_max_events(struct event_base *base, unsigned int type, int clear)
 	return r;
 }
 
-/* Returns true iff we're currently watching any events. */
+void
+event_base_get_wakeup_counts(struct event_base *base, ev_uint64_t *sent,
+    ev_uint64_t *coalesced)
+{
+	if (sent)
+		*sent = evatomic_u64_load_(&base->n_notify_sent);
+	if (coalesced)
+		*coalesced = evatomic_u64_load_(&base->n_notify_coalesced);
+}
+
+/* Returns true iff we're currently watching any events, or have callbacks
+ * posted with event_base_post() that we haven't made active yet. */
 static int
 event_haveevents(struct event_base *base)
 {
 	/* Caller must hold th_base_lock */
-	return (base->virtual_event_count > 0 || base->event_count > 0);
+	return (base->virtual_event_count > 0 || base->event_count > 0 ||
+	    evatomic_ptr_load_(&base->posted) != NULL ||
+	    evatomic_ptr_load_(&base->posted_stealable) != NULL);
 }
 
 /* "closure" function called when processing active signal events */
@@ -1460,6 +1663,37 @@ common_timeout_ok(const struct timeval *tv,
 }
 #endif
 
+/* Called when the timeout of 'ev' has been reached.  If 'ev' was given a
+ * later deadline by a lazy re-add (see EV_LAZY_TIMEOUT) and that deadline
+ * hasn't passed yet, move 'ev' to its deadline and return 1.  Otherwise
+ * return 0: the caller should make 'ev' active. */
+static int
+event_timeout_extended_(struct event_base *base, struct event *ev,
+    const struct timeval *now)
+{
+	const struct timeval *ent;
+	struct timeval deadline, cmp;
+
+	if (!(ent = event_lazy_deadline_(base, ev)))
+		return 0;
+	deadline = *ent;
+	event_lazy_clear_(base, ev);
+
+	cmp = deadline;
+	cmp.tv_usec &= MICROSECONDS_MASK;
+	if (evutil_timercmp(&cmp, now, >)) {
+		event_queue_remove_timeout(base, ev);
+		ev->ev_timeout = deadline;
+		event_queue_insert_timeout(base, ev);
+		return 1;
+	}
+
+	/* The deadline has passed as well, so we fire now.  Remember the
+	 * real deadline so that persistent events reschedule from it. */
+	ev->ev_timeout = deadline;
+	return 0;
+}
+
 /* Add the timeout for the first event in given common timeout list to the
  * event_base's minheap. */
 static void
@@ -1489,6 +1723,8 @@ common_timeout_callback(evutil_socket_t fd, short what, void *arg)
 		    (ev->ev_timeout.tv_sec == now.tv_sec &&
 			(ev->ev_timeout.tv_usec&MICROSECONDS_MASK) > now.tv_usec))
 			break;
+		if (event_timeout_extended_(base, ev, &now))
+			continue;
 		event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
 		event_active_nolock_(ev, EV_TIMEOUT, 1);
 	}
@@ -1985,6 +2221,18 @@ event_base_loop(struct event_base *base, int flags)
 			break;
 		}
 
+		/* Pick up callbacks posted from other threads, and if we are
+		 * about to wait with nothing to do, see if a busy peer has
+		 * any we can take. */
+		event_base_drain_posted(base);
+		if (base->steal_peers && !N_ACTIVE_CALLBACKS(base) &&
+		    !(flags & EVLOOP_NONBLOCK)) {
+			evatomic_int_store_(&base->is_idle, 1);
+			if (event_base_drain_posted(base) ||
+			    event_base_steal_posted(base))
+				evatomic_int_store_(&base->is_idle, 0);
+		}
+
 		tv_p = &tv;
 		if (!N_ACTIVE_CALLBACKS(base) && !(flags & EVLOOP_NONBLOCK)) {
 			timeout_next(base, &tv_p);
@@ -2027,6 +2275,10 @@ event_base_loop(struct event_base *base, int flags)
 
 		update_time_cache(base);
 
+		if (base->steal_peers)
+			evatomic_int_store_(&base->is_idle, 0);
+		event_base_drain_posted(base);
+
 		/* Invoke check watchers after polling for events, and before
 		 * processing them */
 		TAILQ_FOREACH(watcher, &base->watchers[EVWATCH_CHECK], next) {
@@ -2141,6 +2393,151 @@ event_base_once(struct event_base *base, evutil_socket_t fd, short events,
 	return (0);
 }
 
+static void
+event_posted_cb_run(struct event_callback *evcb, void *arg)
+{
+	struct event_posted_cb *pcb =
+	    EVUTIL_UPCAST(evcb, struct event_posted_cb, evcb);
+	pcb->fn(arg, pcb->arg);
+	mm_free(pcb);
+}
+
+/* Push 'pcb' onto the posted queue at 'head'.  Return true if the queue
+ * was empty. */
+static int
+event_posted_push(void *volatile *head, struct event_posted_cb *pcb)
+{
+	void *old = evatomic_ptr_load_(head);
+	do {
+		pcb->next = old;
+	} while (!evatomic_ptr_cas_(head, &old, pcb));
+	return old == NULL;
+}
+
+/* Take every callback off the posted queue at 'head' and make them active
+ * in 'base', oldest first.  Return the number of callbacks.  Requires
+ * th_base_lock on 'base'. */
+static int
+event_base_take_posted(struct event_base *base, void *volatile *head)
+{
+	struct event_posted_cb *pcb, *next, *oldest = NULL;
+	int n = 0;
+
+	EVENT_BASE_ASSERT_LOCKED(base);
+
+	if (!evatomic_ptr_load_(head))
+		return 0;
+	pcb = evatomic_ptr_exchange_(head, NULL);
+	while (pcb) {
+		next = pcb->next;
+		pcb->next = oldest;
+		oldest = pcb;
+		pcb = next;
+	}
+	for (pcb = oldest; pcb; pcb = next) {
+		next = pcb->next;
+		pcb->evcb.evcb_arg = base;
+		pcb->evcb.evcb_pri = base->nactivequeues / 2;
+		event_callback_activate_nolock_(base, &pcb->evcb);
+		++n;
+	}
+	return n;
+}
+
+/* Move the callbacks that have been posted to 'base' onto its active
+ * queues.  Return the number of callbacks.  Requires th_base_lock. */
+static int
+event_base_drain_posted(struct event_base *base)
+{
+	return event_base_take_posted(base, &base->posted) +
+	    event_base_take_posted(base, &base->posted_stealable);
+}
+
+/* Take the stealable callbacks of the first peer of 'base' that has any.
+ * Return the number of callbacks.  Requires th_base_lock. */
+static int
+event_base_steal_posted(struct event_base *base)
+{
+#ifdef EVATOMIC_ENABLED
+	int i, n;
+	for (i = 0; i < base->n_steal_peers; ++i) {
+		struct event_base *peer = base->steal_peers[i];
+		if (peer == base)
+			continue;
+		n = event_base_take_posted(base, &peer->posted_stealable);
+		if (n)
+			return n;
+	}
+#endif
+	return 0;
+}
+
+/* Free the callbacks on the posted queue at 'head' without running them. */
+static void
+event_base_free_posted(void *volatile *head)
+{
+	struct event_posted_cb *pcb, *next;
+	for (pcb = evatomic_ptr_exchange_(head, NULL); pcb; pcb = next) {
+		next = pcb->next;
+		mm_free(pcb);
+	}
+}
+
+void
+event_base_set_steal_peers_(struct event_base *base,
+    struct event_base **peers, int n)
+{
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	base->steal_peers = peers;
+	base->n_steal_peers = n;
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+}
+
+int
+event_base_post(struct event_base *base, event_post_callback_fn cb,
+    void *arg, int flags)
+{
+	struct event_posted_cb *pcb;
+	int stealable = (flags & EV_POST_STEALABLE) != 0;
+	int was_empty;
+
+	if (!(pcb = mm_calloc(1, sizeof(struct event_posted_cb))))
+		return -1;
+	pcb->evcb.evcb_closure = EV_CLOSURE_CB_SELF;
+	pcb->evcb.evcb_cb_union.evcb_selfcb = event_posted_cb_run;
+	pcb->fn = cb;
+	pcb->arg = arg;
+
+#ifdef EVATOMIC_ENABLED
+	was_empty = event_posted_push(
+	    stealable ? &base->posted_stealable : &base->posted, pcb);
+	if (stealable && base->steal_peers &&
+	    !evatomic_int_load_(&base->is_idle)) {
+		/* 'base' is busy: wake up an idle peer to take this. */
+		int i;
+		for (i = 0; i < base->n_steal_peers; ++i) {
+			struct event_base *peer = base->steal_peers[i];
+			if (peer != base &&
+			    evatomic_int_exchange_(&peer->is_idle, 0)) {
+				evthread_notify_base(peer);
+				break;
+			}
+		}
+	}
+	if (was_empty)
+		evthread_notify_base(base);
+#else
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	was_empty = event_posted_push(
+	    stealable ? &base->posted_stealable : &base->posted, pcb);
+	if (was_empty && EVBASE_NEED_NOTIFY(base))
+		evthread_notify_base(base);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+#endif
+
+	return 0;
+}
+
 int
 event_assign(struct event *ev, struct event_base *base, evutil_socket_t fd, short events, void (*callback)(evutil_socket_t, short, void *), void *arg)
 {
@@ -2427,7 +2824,9 @@ event_pending(const struct event *ev, short event, struct timeval *tv)
 
 	/* See if there is a timeout that we should report */
 	if (tv != NULL && (flags & event & EV_TIMEOUT)) {
-		struct timeval tmp = ev->ev_timeout;
+		const struct timeval *deadline =
+		    event_lazy_deadline_(ev->ev_base, ev);
+		struct timeval tmp = deadline ? *deadline : ev->ev_timeout;
 		tmp.tv_usec &= MICROSECONDS_MASK;
 		/* correctly remamp to real time */
 		evutil_timeradd(&ev->ev_base->tv_clock_diff, &tmp, tv);
@@ -2568,16 +2967,18 @@ evthread_notify_base_eventfd(struct event_base *base)
 
 /** Tell the thread currently running the event_loop for base (if any) that it
  * needs to stop waiting in its dispatch function (if it is) and process all
- * active callbacks. */
+ * active callbacks.  If a notify is already pending, this one is coalesced
+ * into it.  With EVATOMIC_ENABLED this does not need th_base_lock. */
 static int
 evthread_notify_base(struct event_base *base)
 {
-	EVENT_BASE_ASSERT_LOCKED(base);
 	if (!base->th_notify_fn)
 		return -1;
-	if (base->is_notify_pending)
+	if (evatomic_int_exchange_(&base->is_notify_pending, 1)) {
+		evatomic_u64_add_(&base->n_notify_coalesced, 1);
 		return 0;
-	base->is_notify_pending = 1;
+	}
+	evatomic_u64_add_(&base->n_notify_sent, 1);
 	return base->th_notify_fn(base);
 }
 
@@ -2657,7 +3058,8 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 	 * prepare for timeout insertion further below, if we get a
 	 * failure on any step, we should not change any state.
 	 */
-	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT)) {
+	if (tv != NULL && !(ev->ev_flags & EVLIST_TIMEOUT) &&
+	    !base->timewheel) {
 		if (min_heap_reserve_(&base->timeheap,
 			1 + min_heap_size_(&base->timeheap)) == -1)
 			return (-1);  /* ENOMEM == errno */
@@ -2696,8 +3098,10 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 	 * addition succeeded.
 	 */
 	if (res != -1 && tv != NULL) {
-		struct timeval now;
+		struct timeval now, when;
 		int common_timeout;
+		struct timeval wheel_next;
+		int need_wheel_check = 0, had_wheel_next = 0;
 #ifdef USE_REINSERT_TIMEOUT
 		int was_common;
 		int old_timeout_idx;
@@ -2712,6 +3116,38 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 		if (ev->ev_closure == EV_CLOSURE_EVENT_PERSIST && !tv_is_absolute)
 			ev->ev_io_timeout = *tv;
 
+		gettime(base, &now);
+
+		common_timeout = is_common_timeout(tv, base);
+
+		if (tv_is_absolute) {
+			when = *tv;
+		} else if (common_timeout) {
+			struct timeval tmp = *tv;
+			tmp.tv_usec &= MICROSECONDS_MASK;
+			evutil_timeradd(&now, &tmp, &when);
+			when.tv_usec |= (tv->tv_usec & ~MICROSECONDS_MASK);
+		} else {
+			evutil_timeradd(&now, tv, &when);
+		}
+
+		/* With EV_LAZY_TIMEOUT, pushing a pending timeout back only
+		 * records the new deadline; the event gets moved when its
+		 * old timeout is reached.  See event_timeout_extended_(). */
+		if ((ev->ev_events & EV_LAZY_TIMEOUT) &&
+		    (ev->ev_flags & EVLIST_TIMEOUT) &&
+		    !((ev->ev_flags & EVLIST_ACTIVE) &&
+			(ev->ev_res & EV_TIMEOUT)) &&
+		    is_same_common_timeout(&when, &ev->ev_timeout) &&
+		    !evutil_timercmp(&when, &ev->ev_timeout, <)) {
+			if (evutil_timercmp(&when, &ev->ev_timeout, ==)) {
+				event_lazy_clear_(base, ev);
+				goto done;
+			}
+			if (event_lazy_set_(base, ev, &when) == 0)
+				goto done;
+		}
+
 #ifndef USE_REINSERT_TIMEOUT
 		if (ev->ev_flags & EVLIST_TIMEOUT) {
 			event_queue_remove_timeout(base, ev);
@@ -2736,30 +3172,26 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 			event_queue_remove_active(base, event_to_event_callback(ev));
 		}
 
-		gettime(base, &now);
-
-		common_timeout = is_common_timeout(tv, base);
 #ifdef USE_REINSERT_TIMEOUT
 		was_common = is_common_timeout(&ev->ev_timeout, base);
 		old_timeout_idx = COMMON_TIMEOUT_IDX(&ev->ev_timeout);
 #endif
 
-		if (tv_is_absolute) {
-			ev->ev_timeout = *tv;
-		} else if (common_timeout) {
-			struct timeval tmp = *tv;
-			tmp.tv_usec &= MICROSECONDS_MASK;
-			evutil_timeradd(&now, &tmp, &ev->ev_timeout);
-			ev->ev_timeout.tv_usec |=
-			    (tv->tv_usec & ~MICROSECONDS_MASK);
-		} else {
-			evutil_timeradd(&now, tv, &ev->ev_timeout);
-		}
+		ev->ev_timeout = when;
 
 		event_debug((
 			 "event_add: event %p, timeout in %d seconds %d useconds, call %p",
 			 ev, (int)tv->tv_sec, (int)tv->tv_usec, ev->ev_callback));
 
+		/* The wheel can't tell whether 'ev' is its earliest event,
+		 * so remember when it would have woken up before. */
+		if (base->timewheel && !common_timeout &&
+		    EVBASE_NEED_NOTIFY(base)) {
+			need_wheel_check = 1;
+			had_wheel_next = timer_wheel_next_(base->timewheel,
+			    &wheel_next) == 0;
+		}
+
 #ifdef USE_REINSERT_TIMEOUT
 		event_queue_reinsert_timeout(base, ev, was_common, common_timeout, old_timeout_idx);
 #else
@@ -2772,6 +3204,15 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 			if (ev == TAILQ_FIRST(&ctl->events)) {
 				common_timeout_schedule(ctl, &now, ev);
 			}
+		} else if (base->timewheel) {
+			/* As below: wake the main thread if this moved the
+			 * time it needs to wake up earlier. */
+			struct timeval next;
+			if (need_wheel_check &&
+			    timer_wheel_next_(base->timewheel, &next) == 0 &&
+			    (!had_wheel_next ||
+				evutil_timercmp(&next, &wheel_next, <)))
+				notify = 1;
 		} else {
 			struct event* top = NULL;
 			/* See if the earliest timeout is now earlier than it
@@ -2788,6 +3229,7 @@ event_add_nolock_(struct event *ev, const struct timeval *tv,
 		}
 	}
 
+done:
 	/* if we are not in the right thread, we need to wake up the loop */
 	if (res != -1 && notify && EVBASE_NEED_NOTIFY(base))
 		evthread_notify_base(base);
@@ -3180,6 +3622,23 @@ timeout_next(struct event_base *base, struct timeval **tv_p)
 	struct timeval *tv = *tv_p;
 	int res = 0;
 
+	if (base->timewheel) {
+		struct timeval next;
+		if (timer_wheel_next_(base->timewheel, &next) < 0) {
+			*tv_p = NULL;
+			goto out;
+		}
+		if (gettime(base, &now) == -1) {
+			res = -1;
+			goto out;
+		}
+		if (evutil_timercmp(&next, &now, <=))
+			evutil_timerclear(tv);
+		else
+			evutil_timersub(&next, &now, tv);
+		goto out;
+	}
+
 	ev = min_heap_top_(&base->timeheap);
 
 	if (ev == NULL) {
@@ -3216,6 +3675,24 @@ timeout_process(struct event_base *base)
 	struct timeval now;
 	struct event *ev;
 
+	if (base->timewheel) {
+		if (timer_wheel_empty_(base->timewheel))
+			return;
+		gettime(base, &now);
+		while ((ev = timer_wheel_top_expired_(base->timewheel, &now))) {
+			if (event_timeout_extended_(base, ev, &now))
+				continue;
+
+			/* delete this event from the I/O queues */
+			event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
+
+			event_debug(("timeout_process: event: %p, call %p",
+				 ev, ev->ev_callback));
+			event_active_nolock_(ev, EV_TIMEOUT, 1);
+		}
+		return;
+	}
+
 	if (min_heap_empty_(&base->timeheap)) {
 		return;
 	}
@@ -3225,6 +3702,8 @@ timeout_process(struct event_base *base)
 	while ((ev = min_heap_top_(&base->timeheap))) {
 		if (evutil_timercmp(&ev->ev_timeout, &now, >))
 			break;
+		if (event_timeout_extended_(base, ev, &now))
+			continue;
 
 		/* delete this event from the I/O queues */
 		event_del_nolock_(ev, EVENT_DEL_NOBLOCK);
@@ -3306,12 +3785,15 @@ event_queue_remove_timeout(struct event_base *base, struct event *ev)
 	}
 	DECR_EVENT_COUNT(base, ev->ev_flags);
 	ev->ev_flags &= ~EVLIST_TIMEOUT;
+	event_lazy_clear_(base, ev);
 
 	if (is_common_timeout(&ev->ev_timeout, base)) {
 		struct common_timeout_list *ctl =
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
+	} else if (base->timewheel) {
+		timer_wheel_erase_(base->timewheel, ev);
 	} else {
 		min_heap_erase_(&base->timeheap, ev);
 	}
@@ -3328,6 +3810,7 @@ event_queue_reinsert_timeout(struct event_base *base, struct event *ev,
 		event_queue_insert_timeout(base, ev);
 		return;
 	}
+	event_lazy_clear_(base, ev);
 
 	switch ((was_common<<1) | is_common) {
 	case 3: /* Changing from one common timeout to another */
@@ -3341,15 +3824,24 @@ event_queue_reinsert_timeout(struct event_base *base, struct event *ev,
 		ctl = base->common_timeout_queues[old_timeout_idx];
 		TAILQ_REMOVE(&ctl->events, ev,
 		    ev_timeout_pos.ev_next_with_common_timeout);
-		min_heap_push_(&base->timeheap, ev);
+		if (base->timewheel)
+			timer_wheel_push_(base->timewheel, ev);
+		else
+			min_heap_push_(&base->timeheap, ev);
 		break;
 	case 1: /* Wasn't common; has become common. */
-		min_heap_erase_(&base->timeheap, ev);
+		if (base->timewheel)
+			timer_wheel_erase_(base->timewheel, ev);
+		else
+			min_heap_erase_(&base->timeheap, ev);
 		ctl = get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
 		break;
 	case 0: /* was in heap; is still on heap. */
-		min_heap_adjust_(&base->timeheap, ev);
+		if (base->timewheel)
+			timer_wheel_adjust_(base->timewheel, ev);
+		else
+			min_heap_adjust_(&base->timeheap, ev);
 		break;
 	default:
 		EVUTIL_ASSERT(0); /* unreachable */
@@ -3462,6 +3954,8 @@ event_queue_insert_timeout(struct event_base *base, struct event *ev)
 		struct common_timeout_list *ctl =
 		    get_common_timeout_list(base, &ev->ev_timeout);
 		insert_common_timeout_inorder(ctl, ev);
+	} else if (base->timewheel) {
+		timer_wheel_push_(base->timewheel, ev);
 	} else {
 		min_heap_push_(&base->timeheap, ev);
 	}
@@ -3610,6 +4104,22 @@ event_set_mem_functions(void *(*malloc_fn)(size_t sz),
 }
 #endif
 
+/* Called once the notification fd has been drained; see
+ * evthread_notify_base(). */
+static void
+evthread_notify_drained(struct event_base *base)
+{
+#ifdef EVATOMIC_ENABLED
+	evatomic_int_store_(&base->is_notify_pending, 0);
+#else
+	/* The fallback "atomics" are plain loads and stores, which only
+	 * th_base_lock keeps apart; we are called without it. */
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+	evatomic_int_store_(&base->is_notify_pending, 0);
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+#endif
+}
+
 #ifdef EVENT__HAVE_EVENTFD
 static void
 evthread_notify_drain_eventfd(evutil_socket_t fd, short what, void *arg)
@@ -3622,9 +4132,9 @@ evthread_notify_drain_eventfd(evutil_socket_t fd, short what, void *arg)
 	if (r<0 && errno != EAGAIN) {
 		event_sock_warn(fd, "Error reading from eventfd");
 	}
-	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
-	base->is_notify_pending = 0;
-	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	/* Clear this only after draining: a notify that arrives in between
+	 * is coalesced, but the loop goes around again before it blocks. */
+	evthread_notify_drained(base);
 }
 #endif
 
@@ -3641,9 +4151,7 @@ evthread_notify_drain_default(evutil_socket_t fd, short what, void *arg)
 		;
 #endif
 
-	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
-	base->is_notify_pending = 0;
-	EVBASE_RELEASE_LOCK(base, th_base_lock);
+	evthread_notify_drained(base);
 }
 
 int
@@ -3708,6 +4216,25 @@ evthread_make_base_notifiable_nolock_(struct event_base *base)
 	return event_add_nolock_(&base->th_notify, NULL, 0);
 }
 
+/* Helper type for event_base_foreach_event_nolock_: adapts an
+ * event_base_foreach_event_cb to a timer_wheel_foreach_ callback. */
+struct event_base_foreach_timer_helper {
+	struct event_base *base;
+	event_base_foreach_event_cb fn;
+	void *arg;
+};
+
+static int
+event_base_foreach_timer_fn(struct event *ev, void *arg)
+{
+	struct event_base_foreach_timer_helper *h = arg;
+	if (ev->ev_flags & EVLIST_INSERTED) {
+		/* we already processed this one */
+		return 0;
+	}
+	return h->fn(h->base, ev, h->arg);
+}
+
 int
 event_base_foreach_event_nolock_(struct event_base *base,
     event_base_foreach_event_cb fn, void *arg)
@@ -3732,6 +4259,17 @@ event_base_foreach_event_nolock_(struct event_base *base,
 			return r;
 	}
 
+	/* ... or in the timing wheel. */
+	if (base->timewheel) {
+		struct event_base_foreach_timer_helper h;
+		h.base = base;
+		h.fn = fn;
+		h.arg = arg;
+		if ((r = timer_wheel_foreach_(base->timewheel,
+			    event_base_foreach_timer_fn, &h)))
+			return r;
+	}
+
 	/* Now for the events in one of the timeout queues.
 	 * the min-heap. */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
@@ -3790,9 +4328,10 @@ dump_inserted_event_fn(const struct event_base *base, const struct event *e, voi
 	    (e->ev_events&EV_ET)?" ET":"",
 	    (e->ev_flags&EVLIST_INTERNAL)?" Internal":"");
 	if (e->ev_flags & EVLIST_TIMEOUT) {
-		struct timeval tv;
-		tv.tv_sec = e->ev_timeout.tv_sec;
-		tv.tv_usec = e->ev_timeout.tv_usec & MICROSECONDS_MASK;
+		const struct timeval *deadline =
+		    event_lazy_deadline_(base, e);
+		struct timeval tv = deadline ? *deadline : e->ev_timeout;
+		tv.tv_usec &= MICROSECONDS_MASK;
 		evutil_timeradd(&tv, &base->tv_clock_diff, &tv);
 		fprintf(output, " Timeout=%ld.%06d",
 		    (long)tv.tv_sec, (int)(tv.tv_usec & MICROSECONDS_MASK));
@@ -3854,6 +4393,16 @@ event_base_dump_events(struct event_base *base, FILE *output)
 	EVBASE_RELEASE_LOCK(base, th_base_lock);
 }
 
+/* Helper for event_base_active_by_fd: activate 'ev' if it is on the fd that
+ * 'arg' points to. */
+static int
+event_base_active_timer_by_fd_fn(struct event *ev, void *arg)
+{
+	if (ev->ev_fd == *(evutil_socket_t *)arg)
+		event_active_nolock_(ev, EV_TIMEOUT, 1);
+	return 0;
+}
+
 void
 event_base_active_by_fd(struct event_base *base, evutil_socket_t fd, short events)
 {
@@ -3876,6 +4425,10 @@ event_base_active_by_fd(struct event_base *base, evutil_socket_t fd, short event
 			}
 		}
 
+		if (base->timewheel)
+			timer_wheel_foreach_(base->timewheel,
+			    event_base_active_timer_by_fd_fn, &fd);
+
 		for (i = 0; i < base->n_common_timeouts; ++i) {
 			struct common_timeout_list *ctl = base->common_timeout_queues[i];
 			TAILQ_FOREACH(ev, &ctl->events,
@@ -3958,6 +4511,7 @@ event_free_globals(void)
 	event_free_debug_globals();
 	event_free_evsig_globals();
 	event_free_evutil_globals();
+	evbuffer_free_globals_();
 }
 
 void
@@ -3980,6 +4534,8 @@ event_global_setup_locks_(const int enable_locks)
 		return -1;
 	if (evutil_secure_rng_global_setup_locks_(enable_locks) < 0)
 		return -1;
+	if (evbuffer_global_setup_locks_(enable_locks) < 0)
+		return -1;
 	return 0;
 }
 #endif
@@ -4012,6 +4568,8 @@ event_base_assert_ok_nolock_(struct event_base *base)
 		EVUTIL_ASSERT(evutil_timercmp(&p_ev->ev_timeout, &ev->ev_timeout, <=));
 		EVUTIL_ASSERT(ev->ev_timeout_pos.min_heap_idx == u);
 	}
+	if (base->timewheel)
+		timer_wheel_assert_ok_(base->timewheel);
 
 	/* Check that the common timeouts are fine */
 	for (i = 0; i < base->n_common_timeouts; ++i) {
@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+  Allocator contexts (struct event_mem_ctx) for evbuffer chain memory.
+
+  A context either wraps a pair of user functions, or is one of our own
+  arenas.  An arena maps memory in 2MB pieces, optionally backed by huge
+  pages and bound to a NUMA node, and carves them into power-of-two blocks
+  with a free list per size.  Blocks are never given back to the kernel
+  until the context goes away; anything too big for an arena gets its own
+  mapping, which is unmapped as soon as it is released.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <sys/types.h>
+#ifdef EVENT__HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#include <string.h>
+
+#include "event2/event.h"
+#include "event2/util.h"
+#include "log-internal.h"
+#include "mm-internal.h"
+#include "evthread-internal.h"
+#include "util-internal.h"
+
+#if defined(EVENT__HAVE_MMAP) && defined(EVENT__HAVE_SYS_MMAN_H)
+#define USE_MMAP
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+/** Size of one arena, and of a huge page on x86 and arm64. */
+#define EVMEM_ARENA_SIZE (2*1024*1024)
+/** Smallest block we hand out, as a power of two. */
+#define EVMEM_MIN_SHIFT 6
+/** Number of block sizes; the largest is half an arena. */
+#define EVMEM_N_CLASSES 15
+
+/** The Linux MPOL_PREFERRED memory policy, for mbind(). */
+#define EVMEM_MPOL_PREFERRED 1
+/** Most NUMA nodes we can bind to. */
+#define EVMEM_MAX_NODES 1024
+
+/** A piece of memory mapped by an arena.  Lives at its start. */
+struct evmem_arena {
+	struct evmem_arena *next;
+	size_t size;
+};
+
+struct event_mem_ctx {
+	/** Lock for everything below. */
+	void *lock;
+	/** One reference for the owner until event_mem_ctx_free(), and one
+	 * for each evbuffer_chain_pool that allocates from us. */
+	int refcnt;
+
+	/** For contexts from event_mem_ctx_new(). */
+	event_mem_alloc_cb alloc_fn;
+	event_mem_release_cb release_fn;
+	void *cb_arg;
+
+	/** For arenas: what we were asked for. */
+	unsigned want_flags;
+	int want_node;
+	/** All the pieces we've mapped. */
+	struct evmem_arena *arenas;
+	/** Unused space at the end of the newest arena. */
+	char *cur;
+	size_t cur_left;
+	/** Released blocks, linked through their first word, per size. */
+	void *free_blocks[EVMEM_N_CLASSES];
+
+	struct event_mem_ctx_stats stats;
+};
+
+static struct event_mem_ctx *
+evmem_ctx_alloc(void)
+{
+	struct event_mem_ctx *ctx;
+
+	if ((ctx = mm_calloc(1, sizeof(*ctx))) == NULL)
+		return NULL;
+	EVTHREAD_ALLOC_LOCK(ctx->lock, 0);
+	ctx->refcnt = 1;
+	ctx->want_node = -1;
+	ctx->stats.numa_node = -1;
+	return ctx;
+}
+
+struct event_mem_ctx *
+event_mem_ctx_new(event_mem_alloc_cb alloc_fn,
+    event_mem_release_cb release_fn, void *arg)
+{
+	struct event_mem_ctx *ctx;
+
+	if (!alloc_fn || !release_fn)
+		return NULL;
+	if ((ctx = evmem_ctx_alloc()) == NULL)
+		return NULL;
+	ctx->alloc_fn = alloc_fn;
+	ctx->release_fn = release_fn;
+	ctx->cb_arg = arg;
+	return ctx;
+}
+
+#ifdef USE_MMAP
+/* Make the kernel allocate the pages of [p, p+size) on 'node' if it can.
+ * Return 0 on success, -1 if we can't. */
+static int
+evmem_bind_node(void *p, size_t size, int node)
+{
+#if defined(__linux__) && defined(__NR_mbind)
+	unsigned long mask[EVMEM_MAX_NODES / (8 * sizeof(unsigned long))];
+	const size_t bits = 8 * sizeof(unsigned long);
+
+	memset(mask, 0, sizeof(mask));
+	mask[node / bits] |= 1UL << (node % bits);
+	/* The kernel wants one more than the number of bits in the mask. */
+	if (syscall(__NR_mbind, p, size, EVMEM_MPOL_PREFERRED, mask,
+		(unsigned long)EVMEM_MAX_NODES + 1, 0) < 0)
+		return -1;
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Map 'size' bytes, which is a multiple of EVMEM_ARENA_SIZE, the way the
+ * arena wants them.  Returns NULL on failure. */
+static void *
+evmem_map(struct event_mem_ctx *ctx, size_t size)
+{
+	const int prot = PROT_READ|PROT_WRITE;
+	const int flags = MAP_PRIVATE|MAP_ANONYMOUS;
+	char *p = MAP_FAILED;
+	int huge = 0;
+
+#ifdef MAP_HUGETLB
+	if (ctx->want_flags & EVENT_MEM_HUGEPAGES) {
+		/* Only works if the administrator has reserved huge pages. */
+		p = mmap(NULL, size, prot, flags|MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			huge = 1;
+	}
+#endif
+	if (p == MAP_FAILED && (ctx->want_flags & EVENT_MEM_HUGEPAGES)) {
+		/* Otherwise, ask for transparent huge pages, which need the
+		 * mapping to be aligned: map an extra arena's worth and trim
+		 * both ends. */
+		char *raw = mmap(NULL, size + EVMEM_ARENA_SIZE, prot, flags,
+		    -1, 0);
+		if (raw == MAP_FAILED)
+			return NULL;
+		p = (char *)(((ev_uintptr_t)raw + EVMEM_ARENA_SIZE - 1) &
+		    ~(ev_uintptr_t)(EVMEM_ARENA_SIZE - 1));
+		if (p != raw)
+			munmap(raw, p - raw);
+		if (p + size != raw + size + EVMEM_ARENA_SIZE)
+			munmap(p + size, raw + EVMEM_ARENA_SIZE - p);
+#ifdef MADV_HUGEPAGE
+		if (madvise(p, size, MADV_HUGEPAGE) == 0)
+			huge = 1;
+#endif
+	}
+	if (p == MAP_FAILED) {
+		p = mmap(NULL, size, prot, flags, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+	}
+
+	if (ctx->want_node >= 0) {
+		if (evmem_bind_node(p, size, ctx->want_node) < 0) {
+			munmap(p, size);
+			return NULL;
+		}
+		ctx->stats.numa_node = ctx->want_node;
+	}
+	if (huge)
+		ctx->stats.flags |= EVENT_MEM_HUGEPAGES;
+	ctx->stats.mapped_bytes += size;
+	return p;
+}
+
+static void
+evmem_unmap(struct event_mem_ctx *ctx, void *p, size_t size)
+{
+	if (munmap(p, size) < 0)
+		event_warn("%s: munmap failed", __func__);
+	ctx->stats.mapped_bytes -= size;
+}
+#else
+static void *
+evmem_map(struct event_mem_ctx *ctx, size_t size)
+{
+	void *p;
+
+	/* No mmap: we can't pin anything, so just use the heap. */
+	if (ctx->want_node >= 0)
+		return NULL;
+	if ((p = mm_malloc(size)) != NULL)
+		ctx->stats.mapped_bytes += size;
+	return p;
+}
+
+static void
+evmem_unmap(struct event_mem_ctx *ctx, void *p, size_t size)
+{
+	mm_free(p);
+	ctx->stats.mapped_bytes -= size;
+}
+#endif
+
+/* Return the size of the mapping for a block too big for an arena. */
+static size_t
+evmem_large_size(size_t size)
+{
+	return (size + EVMEM_ARENA_SIZE - 1) & ~(size_t)(EVMEM_ARENA_SIZE - 1);
+}
+
+/* Return the size class for 'size' bytes, or -1 if they don't fit in an
+ * arena. */
+static int
+evmem_size_class(size_t size)
+{
+	int cls = 0;
+
+	while (((size_t)1 << (cls + EVMEM_MIN_SHIFT)) < size) {
+		if (++cls == EVMEM_N_CLASSES)
+			return -1;
+	}
+	return cls;
+}
+
+/* Get a new arena, and make it the one we carve blocks from.  Whatever is
+ * left in the old one is split into blocks for the free lists. */
+static int
+evmem_new_arena(struct event_mem_ctx *ctx)
+{
+	struct evmem_arena *arena;
+	int cls;
+
+	if ((arena = evmem_map(ctx, EVMEM_ARENA_SIZE)) == NULL)
+		return -1;
+	for (cls = EVMEM_N_CLASSES - 1; cls >= 0; --cls) {
+		size_t sz = (size_t)1 << (cls + EVMEM_MIN_SHIFT);
+		while (ctx->cur_left >= sz) {
+			*(void **)ctx->cur = ctx->free_blocks[cls];
+			ctx->free_blocks[cls] = ctx->cur;
+			ctx->cur += sz;
+			ctx->cur_left -= sz;
+		}
+	}
+	arena->next = ctx->arenas;
+	arena->size = EVMEM_ARENA_SIZE;
+	ctx->arenas = arena;
+	/* Keep blocks aligned to the smallest block size. */
+	ctx->cur = (char *)arena + (1 << EVMEM_MIN_SHIFT);
+	ctx->cur_left = EVMEM_ARENA_SIZE - (1 << EVMEM_MIN_SHIFT);
+	return 0;
+}
+
+struct event_mem_ctx *
+event_mem_ctx_new_arena(int numa_node, unsigned flags)
+{
+	struct event_mem_ctx *ctx;
+
+	if (numa_node >= EVMEM_MAX_NODES || numa_node < -1)
+		return NULL;
+	if ((ctx = evmem_ctx_alloc()) == NULL)
+		return NULL;
+	ctx->want_node = numa_node;
+	ctx->want_flags = flags;
+	/* Map the first arena now, so that we find out right away if we
+	 * can't do what we were asked. */
+	if (evmem_new_arena(ctx) < 0) {
+		event_mem_ctx_decref_(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+void *
+event_mem_ctx_alloc(struct event_mem_ctx *ctx, size_t size)
+{
+	void *p = NULL;
+	int cls;
+
+	if (size == 0)
+		return NULL;
+	if (ctx->alloc_fn) {
+		if ((p = ctx->alloc_fn(size, ctx->cb_arg)) != NULL) {
+			EVLOCK_LOCK(ctx->lock, 0);
+			ctx->stats.allocated_bytes += size;
+			EVLOCK_UNLOCK(ctx->lock, 0);
+		}
+		return p;
+	}
+
+	EVLOCK_LOCK(ctx->lock, 0);
+	if ((cls = evmem_size_class(size)) < 0) {
+		if (size <= EV_SIZE_MAX - EVMEM_ARENA_SIZE)
+			p = evmem_map(ctx, evmem_large_size(size));
+		if (p)
+			ctx->stats.allocated_bytes += evmem_large_size(size);
+		goto done;
+	}
+	size = (size_t)1 << (cls + EVMEM_MIN_SHIFT);
+	if ((p = ctx->free_blocks[cls]) != NULL) {
+		ctx->free_blocks[cls] = *(void **)p;
+	} else {
+		if (ctx->cur_left < size && evmem_new_arena(ctx) < 0)
+			goto done;
+		p = ctx->cur;
+		ctx->cur += size;
+		ctx->cur_left -= size;
+	}
+	ctx->stats.allocated_bytes += size;
+done:
+	EVLOCK_UNLOCK(ctx->lock, 0);
+	if (!p)
+		errno = ENOMEM;
+	return p;
+}
+
+void
+event_mem_ctx_release(struct event_mem_ctx *ctx, void *ptr, size_t size)
+{
+	int cls;
+
+	if (!ptr)
+		return;
+	if (ctx->release_fn) {
+		ctx->release_fn(ptr, size, ctx->cb_arg);
+		EVLOCK_LOCK(ctx->lock, 0);
+		ctx->stats.allocated_bytes -= size;
+		EVLOCK_UNLOCK(ctx->lock, 0);
+		return;
+	}
+
+	EVLOCK_LOCK(ctx->lock, 0);
+	if ((cls = evmem_size_class(size)) < 0) {
+		evmem_unmap(ctx, ptr, evmem_large_size(size));
+		ctx->stats.allocated_bytes -= evmem_large_size(size);
+	} else {
+		*(void **)ptr = ctx->free_blocks[cls];
+		ctx->free_blocks[cls] = ptr;
+		ctx->stats.allocated_bytes -= (size_t)1 << (cls + EVMEM_MIN_SHIFT);
+	}
+	EVLOCK_UNLOCK(ctx->lock, 0);
+}
+
+void
+event_mem_ctx_get_stats(struct event_mem_ctx *ctx,
+    struct event_mem_ctx_stats *stats)
+{
+	EVLOCK_LOCK(ctx->lock, 0);
+	*stats = ctx->stats;
+	EVLOCK_UNLOCK(ctx->lock, 0);
+}
+
+void
+event_mem_ctx_incref_(struct event_mem_ctx *ctx)
+{
+	EVLOCK_LOCK(ctx->lock, 0);
+	++ctx->refcnt;
+	EVLOCK_UNLOCK(ctx->lock, 0);
+}
+
+void
+event_mem_ctx_decref_(struct event_mem_ctx *ctx)
+{
+	struct evmem_arena *arena, *next;
+	int refcnt;
+
+	EVLOCK_LOCK(ctx->lock, 0);
+	refcnt = --ctx->refcnt;
+	EVLOCK_UNLOCK(ctx->lock, 0);
+	if (refcnt > 0)
+		return;
+	EVUTIL_ASSERT(refcnt == 0);
+
+	for (arena = ctx->arenas; arena; arena = next) {
+		next = arena->next;
+		evmem_unmap(ctx, arena, arena->size);
+	}
+	EVTHREAD_FREE_LOCK(ctx->lock, 0);
+	mm_free(ctx);
+}
+
+void
+event_mem_ctx_free(struct event_mem_ctx *ctx)
+{
+	event_mem_ctx_decref_(ctx);
+}
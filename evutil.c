@@ -2617,6 +2617,116 @@ evutil_accept4_(evutil_socket_t sockfd, struct sockaddr *addr,
 	return result;
 }
 
+#if defined(EVENT__HAVE_RECVMMSG) && defined(EVENT__HAVE_SENDMMSG)
+#define USE_MMSG
+#endif
+
+int
+evutil_recv_datagrams_(evutil_socket_t fd, struct evutil_datagram_ *dgrams,
+    int n)
+{
+	int i = 0;
+#ifdef USE_MMSG
+	struct mmsghdr msgs[EVUTIL_DATAGRAM_BATCH_MAX];
+	struct iovec iov[EVUTIL_DATAGRAM_BATCH_MAX];
+
+	while (i < n) {
+		int j, r, batch = n - i;
+		if (batch > EVUTIL_DATAGRAM_BATCH_MAX)
+			batch = EVUTIL_DATAGRAM_BATCH_MAX;
+		memset(msgs, 0, sizeof(struct mmsghdr) * batch);
+		for (j = 0; j < batch; ++j) {
+			struct evutil_datagram_ *d = &dgrams[i + j];
+			iov[j].iov_base = d->buf;
+			iov[j].iov_len = d->buflen;
+			msgs[j].msg_hdr.msg_iov = &iov[j];
+			msgs[j].msg_hdr.msg_iovlen = 1;
+			msgs[j].msg_hdr.msg_name = &d->addr;
+			msgs[j].msg_hdr.msg_namelen = sizeof(d->addr);
+		}
+		r = recvmmsg(fd, msgs, batch, 0, NULL);
+		if (r < 0) {
+			if (errno == ENOSYS && i == 0)
+				goto fallback;
+			break;
+		}
+		for (j = 0; j < r; ++j) {
+			struct evutil_datagram_ *d = &dgrams[i + j];
+			d->len = msgs[j].msg_len;
+			d->addrlen = msgs[j].msg_hdr.msg_namelen;
+		}
+		i += r;
+		if (r < batch)
+			break;
+	}
+	return i ? i : -1;
+fallback:
+#endif
+	for (i = 0; i < n; ++i) {
+		struct evutil_datagram_ *d = &dgrams[i];
+		ev_ssize_t r;
+		d->addrlen = sizeof(d->addr);
+		r = recvfrom(fd, d->buf, (int)d->buflen, 0,
+		    (struct sockaddr *)&d->addr, &d->addrlen);
+		if (r < 0)
+			break;
+		d->len = (size_t)r;
+	}
+	return i ? i : -1;
+}
+
+int
+evutil_send_datagrams_(evutil_socket_t fd,
+    const struct evutil_datagram_ *dgrams, int n)
+{
+	int i = 0;
+#ifdef USE_MMSG
+	struct mmsghdr msgs[EVUTIL_DATAGRAM_BATCH_MAX];
+	struct iovec iov[EVUTIL_DATAGRAM_BATCH_MAX];
+
+	while (i < n) {
+		int j, r, batch = n - i;
+		if (batch > EVUTIL_DATAGRAM_BATCH_MAX)
+			batch = EVUTIL_DATAGRAM_BATCH_MAX;
+		memset(msgs, 0, sizeof(struct mmsghdr) * batch);
+		for (j = 0; j < batch; ++j) {
+			const struct evutil_datagram_ *d = &dgrams[i + j];
+			iov[j].iov_base = d->buf;
+			iov[j].iov_len = d->len;
+			msgs[j].msg_hdr.msg_iov = &iov[j];
+			msgs[j].msg_hdr.msg_iovlen = 1;
+			if (d->addrlen) {
+				msgs[j].msg_hdr.msg_name = (void *)&d->addr;
+				msgs[j].msg_hdr.msg_namelen = d->addrlen;
+			}
+		}
+		r = sendmmsg(fd, msgs, batch, 0);
+		if (r < 0) {
+			if (errno == ENOSYS && i == 0)
+				goto fallback;
+			break;
+		}
+		i += r;
+		if (r < batch)
+			break;
+	}
+	return i ? i : -1;
+fallback:
+#endif
+	for (i = 0; i < n; ++i) {
+		const struct evutil_datagram_ *d = &dgrams[i];
+		ev_ssize_t r;
+		if (d->addrlen)
+			r = sendto(fd, d->buf, (int)d->len, 0,
+			    (const struct sockaddr *)&d->addr, d->addrlen);
+		else
+			r = send(fd, d->buf, (int)d->len, 0);
+		if (r < 0)
+			break;
+	}
+	return i ? i : -1;
+}
+
 /* Internal function: Set fd[0] and fd[1] to a pair of fds such that writes on
  * fd[1] get read from fd[0].  Make both fds nonblocking and close-on-exec.
  * Return 0 on success, -1 on failure.
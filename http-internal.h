@@ -11,8 +11,11 @@
 #define HTTP_INTERNAL_H_INCLUDED_
 
 #include "event2/event_struct.h"
+#include "event2/keyvalq_struct.h"
+#include "event2/http_struct.h"
 #include "util-internal.h"
 #include "defer-internal.h"
+#include "ht-internal.h"
 
 #define HTTP_CONNECT_TIMEOUT	45
 #define HTTP_WRITE_TIMEOUT	50
@@ -30,6 +33,8 @@ enum message_read_status {
 struct evbuffer;
 struct addrinfo;
 struct evhttp_request;
+struct evhttp_h2;
+struct evhttp_client_host;
 
 enum evhttp_connection_state {
 	EVCON_DISCONNECTED,	/**< not currently connected not trying either*/
@@ -48,7 +53,7 @@ struct event_base;
 /* A client or server connection. */
 struct evhttp_connection {
 	/* we use this tailq only if this connection was created for an http
-	 * server */
+	 * server, or by an evhttp_client */
 	TAILQ_ENTRY(evhttp_connection) next;
 
 	evutil_socket_t fd;
@@ -65,6 +70,9 @@ struct evhttp_connection {
 	size_t max_headers_size;
 	ev_uint64_t max_body_size;
 
+	/* number of requests we may read ahead of the one being answered */
+	int max_pipelined;
+
 	int flags;
 #define EVHTTP_CON_INCOMING	0x0001       /* only one request on it ever */
 #define EVHTTP_CON_OUTGOING	0x0002       /* multiple requests possible */
@@ -76,6 +84,14 @@ struct evhttp_connection {
 #define EVHTTP_CON_READING_ERROR	(EVHTTP_CON_AUTOFREE << 1)
 /* Timeout is not default */
 #define EVHTTP_CON_TIMEOUT_ADJUSTED	(EVHTTP_CON_READING_ERROR << 1)
+/* The peer stopped sending while pipelined responses were still pending;
+ * close once they have been written */
+#define EVHTTP_CON_PIPELINE_EOF	(EVHTTP_CON_TIMEOUT_ADJUSTED << 1)
+/* A request has been read; too late to switch to HTTP/2 */
+#define EVHTTP_CON_SEEN_REQUEST	(EVHTTP_CON_PIPELINE_EOF << 1)
+/* An earlier request went over this connection, which we kept open; the
+ * server may have closed its end since */
+#define EVHTTP_CON_REUSED	(EVHTTP_CON_SEEN_REQUEST << 1)
 
 	struct timeval timeout_connect;		/* timeout for connect phase */
 	struct timeval timeout_read;		/* timeout for read */
@@ -92,6 +108,12 @@ struct evhttp_connection {
 	/* for server connections, the http server they are connected with */
 	struct evhttp *http_server;
 
+	/* for connections of an evhttp_client, the pool they are in */
+	struct evhttp_client_host *pool;
+	/* frees such a connection once it has been closed and unused for
+	 * its read timeout */
+	struct event expire_ev;
+
 	TAILQ_HEAD(evcon_requestq, evhttp_request) requests;
 
 	void (*cb)(struct evhttp_connection *, void *);
@@ -102,6 +124,9 @@ struct evhttp_connection {
 
 	struct event_callback read_more_deferred_cb;
 
+	/* set once the connection has switched to HTTP/2 */
+	struct evhttp_h2 *h2;
+
 	struct event_base *base;
 	struct evdns_base *dns_base;
 	int ai_family;
@@ -112,16 +137,88 @@ struct evhttp_connection {
 /* A callback for an http server */
 struct evhttp_cb {
 	TAILQ_ENTRY(evhttp_cb) next;
+	/* in evhttp.exact_callbacks, unless this is a prefix callback */
+	HT_ENTRY(evhttp_cb) map_node;
 
 	char *what;
+	int is_prefix;
 
 	void (*cb)(struct evhttp_request *req, void *);
 	void *cbarg;
 };
 
+HT_HEAD(evhttp_cb_map, evhttp_cb);
+
+/* radix tree of prefix callbacks, see http.c */
+struct evhttp_route_node;
+
 /* both the http server as well as the rpc system need to queue connections */
 TAILQ_HEAD(evconq, evhttp_connection);
 
+/* Headers that the parser indexes as it reads them. */
+enum evhttp_known_header {
+	EVHTTP_HDR_CONNECTION,
+	EVHTTP_HDR_CONTENT_LENGTH,
+	EVHTTP_HDR_EXPECT,
+	EVHTTP_HDR_HOST,
+	EVHTTP_HDR_PROXY_CONNECTION,
+	EVHTTP_HDR_TRANSFER_ENCODING,
+	EVHTTP_HDR_UPGRADE,
+	EVHTTP_HDR_MAX_
+};
+
+struct evhttp_header_index;
+
+#define EVHTTP_HEADER_MAGIC 0x68647231U
+
+/* A header as allocated by evhttp_add_header(): the list entry, the name
+ * and the value all live in one block. */
+struct evhttp_header {
+	struct evkeyval kv;	/* must be first */
+	/* hash of the lower-cased name */
+	unsigned hash;
+	/* EVHTTP_HEADER_MAGIC, set only when we allocate the header */
+	unsigned magic;
+	/* the index that has a slot pointing at us, if any */
+	struct evhttp_header_index *index;
+	/* followed by one unused byte, then the name and the value,
+	 * NUL-terminated; the value moves to its own allocation if it grows.
+	 * The unused byte puts the name at an odd address, where no name
+	 * allocated on its own can start. */
+};
+#define EVHTTP_HEADER_NAME(h) ((char *)((h) + 1) + 1)
+
+/* What req->input_headers points to: the header list, plus a slot for the
+ * first occurrence of each known header. */
+struct evhttp_header_index {
+	struct evkeyvalq headers;	/* must be first */
+	struct evhttp_header *known[EVHTTP_HDR_MAX_];
+	/* headers.tqh_last as of the last header we indexed; if the list
+	 * has grown behind our back, the slots are incomplete. */
+	struct evkeyval **indexed_tail;
+	/* set once an indexed header is removed */
+	int stale;
+};
+
+/* A write callback given with a chunk of a reply; it runs once the chunk
+ * has been written */
+struct evhttp_chunk_cb {
+	TAILQ_ENTRY(evhttp_chunk_cb) next;
+	void (*cb)(struct evhttp_connection *, void *);
+	void *arg;
+};
+TAILQ_HEAD(evhttp_chunk_cbq, evhttp_chunk_cb);
+
+/* What evhttp_request_new() allocates: the request, plus the state that
+ * users of http_struct.h have no business seeing. */
+struct evhttp_request_private {
+	struct evhttp_request req;	/* must be first */
+	/* callbacks of the reply chunks that are still being written,
+	 * oldest first */
+	struct evhttp_chunk_cbq chunk_cbs;
+};
+#define REQ_UPCAST(r) EVUTIL_UPCAST((r), struct evhttp_request_private, req)
+
 /* each bound socket is stored in one of these */
 struct evhttp_bound_socket {
 	TAILQ_ENTRY(evhttp_bound_socket) next;
@@ -144,6 +241,9 @@ struct evhttp {
 	TAILQ_HEAD(boundq, evhttp_bound_socket) sockets;
 
 	TAILQ_HEAD(httpcbq, evhttp_cb) callbacks;
+	/* the callbacks from above, indexed for dispatch */
+	struct evhttp_cb_map exact_callbacks;
+	struct evhttp_route_node *prefix_callbacks;
 
 	/* All live connections on this host. */
 	struct evconq connections;
@@ -160,6 +260,7 @@ struct evhttp {
 
 	size_t default_max_headers_size;
 	ev_uint64_t default_max_body_size;
+	int max_pipelined_requests;
 	int flags;
 	const char *default_content_type;
 
@@ -181,6 +282,33 @@ struct evhttp {
 	evhttp_ext_method_cb ext_method_cmp;
 };
 
+/* the connections of an evhttp_client to one host:port */
+struct evhttp_client_host {
+	TAILQ_ENTRY(evhttp_client_host) next;
+	struct evhttp_client *client;
+
+	char *host;
+	ev_uint16_t port;
+
+	struct evconq connections;
+	int n_connections;
+};
+
+struct evhttp_client {
+	struct event_base *base;
+	struct evdns_base *dns_base;
+
+	TAILQ_HEAD(evhttp_client_hostq, evhttp_client_host) hosts;
+
+	int max_connections_per_host;
+	/* for new connections; not set means the defaults */
+	struct timeval timeout;
+
+	struct bufferevent *(*bevcb)(struct event_base *, const char *,
+	    ev_uint16_t, void *);
+	void *bevcbarg;
+};
+
 /* XXX most of these functions could be static. */
 
 /* resets the connection; can be reused for more requests */
@@ -202,9 +330,35 @@ enum message_read_status evhttp_parse_firstline_(struct evhttp_request *, struct
 EVENT2_EXPORT_SYMBOL
 enum message_read_status evhttp_parse_headers_(struct evhttp_request *, struct evbuffer*);
 
+/* adds a header to req->input_headers, keeping the index up to date */
+int evhttp_add_input_header_(struct evhttp_request *,
+    const char *key, size_t key_len, const char *value, size_t value_len);
+
+/* looks up one of the known input headers of req, via its index while
+ * that is still good */
+EVENT2_EXPORT_SYMBOL
+const char *evhttp_find_input_header_(struct evhttp_request *,
+    enum evhttp_known_header);
+
 void evhttp_start_read_(struct evhttp_connection *);
 void evhttp_start_write_(struct evhttp_connection *);
 
+/* the parts of parsing a request line that HTTP/2 needs too */
+enum evhttp_cmd_type evhttp_parse_method_(struct evhttp_connection *,
+    const char *method, size_t method_len);
+int evhttp_parse_request_target_(struct evhttp_request *,
+    const char *uri, size_t uri_len);
+
+/* a request for the user to handle, arriving on evcon; NULL if the
+ * server's newreqcb refused it */
+struct evhttp_request *evhttp_new_incoming_request_(
+    struct evhttp_connection *evcon);
+
+/* adds the Date, Content-Length and Content-Type headers of a reply;
+ * streaming says that the body is not all in req->output_buffer.  Returns
+ * true iff the reply has a body. */
+int evhttp_add_reply_headers_(struct evhttp_request *, int streaming);
+
 /* response sending HTML the data in the buffer */
 void evhttp_response_code_(struct evhttp_request *, int, const char *);
 void evhttp_send_page_(struct evhttp_request *, struct evbuffer *);
@@ -213,4 +367,57 @@ EVENT2_EXPORT_SYMBOL
 int evhttp_decode_uri_internal(const char *uri, size_t length,
     char *ret, int decode_plus);
 
+/* http2.c */
+
+/* Returns 1 if input starts with the HTTP/2 client connection preface, 0
+ * if it does not, or -1 if there is not enough of it to tell. */
+int evhttp_h2_check_preface_(struct evbuffer *input);
+/* Returns true iff req asks to switch to HTTP/2 in a way we can honor. */
+int evhttp_h2_wants_upgrade_(struct evhttp_request *req);
+/* Switches the incoming connection evcon to HTTP/2; if upgrade is set,
+ * it becomes stream 1.  Returns -1 on failure, with nothing taken over. */
+int evhttp_h2_start_(struct evhttp_connection *evcon,
+    struct evhttp_request *upgrade);
+/* Tears down the HTTP/2 state of evcon before it is freed. */
+void evhttp_h2_free_(struct evhttp_connection *evcon);
+
+/* The HTTP/2 ends of evhttp_send_reply() and friends. */
+void evhttp_h2_send_reply_(struct evhttp_request *req, int streaming);
+void evhttp_h2_send_chunk_(struct evhttp_request *req,
+    struct evbuffer *databuf,
+    void (*cb)(struct evhttp_connection *, void *), void *arg);
+void evhttp_h2_send_end_(struct evhttp_request *req);
+
+/* HPACK header compression, RFC 7541 */
+struct evhttp_hpack_entry;
+struct evhttp_hpack {
+	/* the dynamic table, newest entry first */
+	struct evhttp_hpack_entry **entries;
+	size_t n_entries;
+	size_t n_alloc;
+	/* size of the entries, as defined in RFC 7541 section 4.1 */
+	size_t size;
+	size_t max_size;
+	/* the most that a dynamic table size update may ask for */
+	size_t max_size_limit;
+};
+
+EVENT2_EXPORT_SYMBOL
+void evhttp_hpack_init_(struct evhttp_hpack *, size_t max_size);
+EVENT2_EXPORT_SYMBOL
+void evhttp_hpack_clear_(struct evhttp_hpack *);
+/* Decodes a whole header block, calling cb for each header in it.
+ * Returns 0 on success, or -1 on a compression error; the decoder cannot
+ * be used after that. */
+EVENT2_EXPORT_SYMBOL
+int evhttp_hpack_decode_(struct evhttp_hpack *,
+    const unsigned char *block, size_t len,
+    void (*cb)(void *, const char *name, size_t name_len,
+	const char *value, size_t value_len),
+    void *arg);
+/* Encodes one header, without touching any dynamic table. */
+EVENT2_EXPORT_SYMBOL
+void evhttp_hpack_encode_(struct evbuffer *out,
+    const char *name, const char *value);
+
 #endif /* HTTP_INTERNAL_H_INCLUDED_ */
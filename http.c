@@ -193,12 +193,16 @@ static void evhttp_read_firstline(struct evhttp_connection *evcon,
 static void evhttp_read_header(struct evhttp_connection *evcon,
     struct evhttp_request *req);
 static int evhttp_add_header_internal(struct evkeyvalq *headers,
-    const char *key, const char *value);
+    const char *key, size_t key_len, const char *value, size_t value_len);
+static int evhttp_add_header_n(struct evkeyvalq *headers,
+    const char *key, size_t key_len, const char *value, size_t value_len);
 static const char *evhttp_response_phrase_internal(int code);
 static void evhttp_get_request(struct evhttp *, evutil_socket_t, struct sockaddr *, ev_socklen_t);
 static void evhttp_write_buffer(struct evhttp_connection *,
     void (*)(struct evhttp_connection *, void *), void *);
-static void evhttp_make_header(struct evhttp_connection *, struct evhttp_request *);
+static void evhttp_make_header(struct evhttp_connection *, struct evhttp_request *,
+    struct evbuffer *);
+static int evhttp_connection_reads_ahead(struct evhttp_connection *);
 static int evhttp_method_may_have_body_(struct evhttp_connection *, enum evhttp_cmd_type);
 
 /* callbacks for bufferevent */
@@ -436,14 +440,18 @@ evhttp_write_buffer(struct evhttp_connection *evcon,
 
 	/* Disable the read callback: we don't actually care about data;
 	 * we only care about close detection. (We don't disable reading --
-	 * EV_READ, since we *do* want to learn about any close events.) */
+	 * EV_READ, since we *do* want to learn about any close events.)
+	 * The exception is a pipelined request that we are still reading. */
 	bufferevent_setcb(evcon->bufev,
-	    NULL, /*read*/
+	    evhttp_connection_reads_ahead(evcon) ? evhttp_read_cb : NULL,
 	    evhttp_write_cb,
 	    evhttp_error_cb,
 	    evcon);
 
-	bufferevent_enable(evcon->bufev, EV_READ|EV_WRITE);
+	if (evcon->flags & EVHTTP_CON_PIPELINE_EOF)
+		bufferevent_enable(evcon->bufev, EV_WRITE);
+	else
+		bufferevent_enable(evcon->bufev, EV_READ|EV_WRITE);
 }
 
 static void
@@ -488,13 +496,50 @@ evhttp_connected(struct evhttp_connection *evcon)
 	}
 }
 
+/** Helper: returns true iff evcon is reading a request or a response. */
+static int
+evhttp_connection_is_reading(struct evhttp_connection *evcon)
+{
+	switch (evcon->state) {
+	case EVCON_READING_FIRSTLINE:
+	case EVCON_READING_HEADERS:
+	case EVCON_READING_BODY:
+	case EVCON_READING_TRAILER:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/** Helper: returns the request that evcon is currently working on.  An
+ * incoming connection that reads pipelined requests works on the newest
+ * one; the older ones are waiting for their replies. */
+static struct evhttp_request *
+evhttp_connection_current_request(struct evhttp_connection *evcon)
+{
+	if ((evcon->flags & EVHTTP_CON_INCOMING) &&
+	    evhttp_connection_is_reading(evcon))
+		return (TAILQ_LAST(&evcon->requests, evcon_requestq));
+	return (TAILQ_FIRST(&evcon->requests));
+}
+
+/** Helper: returns true iff evcon is reading a pipelined request while
+ * replies to earlier requests are still outstanding. */
+static int
+evhttp_connection_reads_ahead(struct evhttp_connection *evcon)
+{
+	return ((evcon->flags & EVHTTP_CON_INCOMING) &&
+	    evhttp_connection_is_reading(evcon) &&
+	    TAILQ_FIRST(&evcon->requests) !=
+	    TAILQ_LAST(&evcon->requests, evcon_requestq));
+}
+
 /* Create the headers needed for an outgoing HTTP request, adds them to
- * the request's header list, and writes the request line to the
- * connection's output buffer.
+ * the request's header list, and writes the request line to output.
  */
 static void
 evhttp_make_header_request(struct evhttp_connection *evcon,
-    struct evhttp_request *req)
+    struct evhttp_request *req, struct evbuffer *output)
 {
 	const char *method;
 	ev_uint16_t flags;
@@ -506,7 +551,7 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
 		method = "NULL";
 	}
 
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
+	evbuffer_add_printf(output,
 	    "%s %s HTTP/%d.%d\r\n",
 	    method, req->uri, req->major, req->minor);
 
@@ -527,30 +572,44 @@ evhttp_make_header_request(struct evhttp_connection *evcon,
  * to flags, means that we should send a "connection: close" when the request
  * is done. */
 static int
-evhttp_is_connection_close(int flags, struct evkeyvalq* headers)
+evhttp_is_connection_close_value(int flags, const char *connection)
 {
 	if (flags & EVHTTP_PROXY_REQUEST) {
 		/* proxy connection */
-		const char *connection = evhttp_find_header(headers, "Proxy-Connection");
 		return (connection == NULL || evutil_ascii_strcasecmp(connection, "keep-alive") != 0);
 	} else {
-		const char *connection = evhttp_find_header(headers, "Connection");
 		return (connection != NULL && evutil_ascii_strcasecmp(connection, "close") == 0);
 	}
 }
 static int
+evhttp_is_connection_close(int flags, struct evkeyvalq* headers)
+{
+	return evhttp_is_connection_close_value(flags,
+	    evhttp_find_header(headers, (flags & EVHTTP_PROXY_REQUEST) ?
+		"Proxy-Connection" : "Connection"));
+}
+/* Same as evhttp_is_connection_close() on req->input_headers. */
+static int
+evhttp_is_input_connection_close(struct evhttp_request *req)
+{
+	return evhttp_is_connection_close_value(req->flags,
+	    evhttp_find_input_header_(req, (req->flags & EVHTTP_PROXY_REQUEST) ?
+		EVHTTP_HDR_PROXY_CONNECTION : EVHTTP_HDR_CONNECTION));
+}
+static int
 evhttp_is_request_connection_close(struct evhttp_request *req)
 {
 	return
-		evhttp_is_connection_close(req->flags, req->input_headers) ||
+		evhttp_is_input_connection_close(req) ||
 		evhttp_is_connection_close(req->flags, req->output_headers);
 }
 
-/* Return true iff 'headers' contains 'Connection: keep-alive' */
+/* Return true iff the input headers of req contain 'Connection: keep-alive' */
 static int
-evhttp_is_connection_keepalive(struct evkeyvalq* headers)
+evhttp_is_connection_keepalive(struct evhttp_request *req)
 {
-	const char *connection = evhttp_find_header(headers, "Connection");
+	const char *connection =
+	    evhttp_find_input_header_(req, EVHTTP_HDR_CONNECTION);
 	return (connection != NULL
 	    && evutil_ascii_strncasecmp(connection, "keep-alive", 10) == 0);
 }
@@ -584,14 +643,14 @@ evhttp_maybe_add_content_length_header(struct evkeyvalq *headers,
 
 /*
  * Create the headers needed for an HTTP reply in req->output_headers,
- * and write the first HTTP response for req line to evcon.
+ * and write the first HTTP response for req line to output.
  */
 static void
 evhttp_make_header_response(struct evhttp_connection *evcon,
-    struct evhttp_request *req)
+    struct evhttp_request *req, struct evbuffer *output)
 {
-	int is_keepalive = evhttp_is_connection_keepalive(req->input_headers);
-	evbuffer_add_printf(bufferevent_get_output(evcon->bufev),
+	int is_keepalive = evhttp_is_connection_keepalive(req);
+	evbuffer_add_printf(output,
 	    "HTTP/%d.%d %d %s\r\n",
 	    req->major, req->minor, req->response_code,
 	    req->response_code_line);
@@ -633,7 +692,7 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 	}
 
 	/* if the request asked for a close, we send a close, too */
-	if (evhttp_is_connection_close(req->flags, req->input_headers)) {
+	if (evhttp_is_input_connection_close(req)) {
 		evhttp_remove_header(req->output_headers, "Connection");
 		if (!(req->flags & EVHTTP_PROXY_REQUEST))
 		    evhttp_add_header(req->output_headers, "Connection", "close");
@@ -641,40 +700,85 @@ evhttp_make_header_response(struct evhttp_connection *evcon,
 	}
 }
 
+int
+evhttp_add_reply_headers_(struct evhttp_request *req, int streaming)
+{
+	evhttp_maybe_add_date_header(req->output_headers);
+	if (!evhttp_response_needs_body(req))
+		return (0);
+	if (!streaming)
+		evhttp_maybe_add_content_length_header(req->output_headers,
+		    evbuffer_get_length(req->output_buffer));
+	if (evhttp_find_header(req->output_headers, "Content-Type") == NULL &&
+	    req->evcon->http_server->default_content_type) {
+		evhttp_add_header(req->output_headers, "Content-Type",
+		    req->evcon->http_server->default_content_type);
+	}
+	return (1);
+}
+
 enum expect { NO, CONTINUE, OTHER };
 static enum expect evhttp_have_expect(struct evhttp_request *req, int input)
 {
 	const char *expect;
-	struct evkeyvalq *h = input ? req->input_headers : req->output_headers;
 
 	if (!(req->kind == EVHTTP_REQUEST) || !REQ_VERSION_ATLEAST(req, 1, 1))
 		return NO;
 
-	expect = evhttp_find_header(h, "Expect");
+	expect = input ? evhttp_find_input_header_(req, EVHTTP_HDR_EXPECT) :
+	    evhttp_find_header(req->output_headers, "Expect");
 	if (!expect)
 		return NO;
 
 	return !evutil_ascii_strcasecmp(expect, "100-continue") ? CONTINUE : OTHER;
 }
 
+/* RFC 9110, section 9.2.2 */
+static int
+evhttp_method_is_idempotent(enum evhttp_cmd_type type)
+{
+	switch (type) {
+	case EVHTTP_REQ_GET:
+	case EVHTTP_REQ_HEAD:
+	case EVHTTP_REQ_PUT:
+	case EVHTTP_REQ_DELETE:
+	case EVHTTP_REQ_OPTIONS:
+	case EVHTTP_REQ_TRACE:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/* Returns true iff we would send req again if evcon turned out to be
+ * stale; only the pools of evhttp_client do that. */
+static int
+evhttp_connection_may_resend(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	return (evcon->pool != NULL &&
+	    (evcon->flags & EVHTTP_CON_REUSED) &&
+	    !(req->flags & EVHTTP_REQ_RETRIED) &&
+	    evhttp_method_is_idempotent(req->type));
+}
 
 /** Generate all headers appropriate for sending the http request in req (or
  * the response, if we're sending a response), and write them to evcon's
  * bufferevent. Also writes all data from req->output_buffer */
 static void
-evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
+evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req,
+    struct evbuffer *output)
 {
 	struct evkeyval *header;
-	struct evbuffer *output = bufferevent_get_output(evcon->bufev);
 
 	/*
 	 * Depending if this is a HTTP request or response, we might need to
 	 * add some new headers or remove existing headers.
 	 */
 	if (req->kind == EVHTTP_REQUEST) {
-		evhttp_make_header_request(evcon, req);
+		evhttp_make_header_request(evcon, req, output);
 	} else {
-		evhttp_make_header_response(evcon, req);
+		evhttp_make_header_response(evcon, req, output);
 	}
 
 	TAILQ_FOREACH(header, req->output_headers, next) {
@@ -687,9 +791,14 @@ evhttp_make_header(struct evhttp_connection *evcon, struct evhttp_request *req)
 		evbuffer_get_length(req->output_buffer)) {
 		/*
 		 * For a request, we add the POST data, for a reply, this
-		 * is the regular data.
+		 * is the regular data.  A request that we may have to send
+		 * again keeps its copy.
 		 */
-		evbuffer_add_buffer(output, req->output_buffer);
+		if (req->kind == EVHTTP_REQUEST &&
+		    evhttp_connection_may_resend(evcon, req))
+			evbuffer_add_buffer_reference(output, req->output_buffer);
+		else
+			evbuffer_add_buffer(output, req->output_buffer);
 	}
 }
 
@@ -712,6 +821,23 @@ evhttp_connection_set_max_body_size(struct evhttp_connection* evcon,
 		evcon->max_body_size = new_max_body_size;
 }
 
+/* Detaches the requests on evcon that the user has not replied to yet, so
+ * that freeing evcon does not free them under the user's feet.  Replying
+ * to a detached request just frees it. */
+static void
+evhttp_connection_orphan_requests(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req, *next;
+
+	for (req = TAILQ_FIRST(&evcon->requests); req != NULL; req = next) {
+		next = TAILQ_NEXT(req, next);
+		if (req->userdone)
+			continue;
+		TAILQ_REMOVE(&evcon->requests, req, next);
+		req->evcon = NULL;
+	}
+}
+
 static int
 evhttp_connection_incoming_fail(struct evhttp_request *req,
     enum evhttp_request_error error)
@@ -733,16 +859,10 @@ evhttp_connection_incoming_fail(struct evhttp_request *req,
 		 * case may happen when a browser keeps a persistent
 		 * connection open and we timeout on the read.  when
 		 * the request is still being used for sending, we
-		 * need to disassociated it from the connection here.
+		 * need to disassociated it from the connection here;
+		 * the same goes for pipelined requests awaiting replies.
 		 */
-		if (!req->userdone) {
-			/* remove it so that it will not be freed */
-			TAILQ_REMOVE(&req->evcon->requests, req, next);
-			/* indicate that this request no longer has a
-			 * connection object
-			 */
-			req->evcon = NULL;
-		}
+		evhttp_connection_orphan_requests(req->evcon);
 		return (-1);
 	case EVREQ_HTTP_INVALID_HEADER:
 	case EVREQ_HTTP_BUFFER_ERROR:
@@ -826,14 +946,18 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
     enum evhttp_request_error error)
 {
 	const int errsave = EVUTIL_SOCKET_ERROR();
-	struct evhttp_request* req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request* req = evhttp_connection_current_request(evcon);
 	void (*cb)(struct evhttp_request *, void *);
 	void *cb_arg;
 	void (*error_cb)(enum evhttp_request_error, void *);
 	void *error_cb_arg;
 	EVUTIL_ASSERT(req != NULL);
 
-	bufferevent_disable(evcon->bufev, EV_READ|EV_WRITE);
+	/* keep writing the replies to earlier pipelined requests */
+	if (evhttp_connection_reads_ahead(evcon))
+		bufferevent_disable(evcon->bufev, EV_READ);
+	else
+		bufferevent_disable(evcon->bufev, EV_READ|EV_WRITE);
 
 	if (evcon->flags & EVHTTP_CON_INCOMING) {
 		/*
@@ -849,6 +973,22 @@ evhttp_connection_fail_(struct evhttp_connection *evcon,
 		return;
 	}
 
+	/* The server closed a kept-alive connection before any of its reply
+	 * arrived; it may not even have seen the request.  Try it on a new
+	 * connection instead. */
+	if ((error == EVREQ_HTTP_EOF || error == EVREQ_HTTP_BUFFER_ERROR) &&
+	    evhttp_connection_may_resend(evcon, req) &&
+	    (evcon->state == EVCON_WRITING ||
+		evcon->state == EVCON_READING_FIRSTLINE) &&
+	    evbuffer_get_length(bufferevent_get_input(evcon->bufev)) == 0) {
+		event_debug(("%s: sending %s again on a new connection",
+			__func__, req->uri));
+		req->flags |= EVHTTP_REQ_RETRIED;
+		req->kind = EVHTTP_REQUEST;
+		if (evhttp_connection_connect_(evcon) == 0)
+			return;
+	}
+
 	error_cb = req->error_cb;
 	error_cb_arg = req->cb_arg;
 	/* when the request was canceled, the callback is not executed */
@@ -899,17 +1039,51 @@ evhttp_write_cb(struct bufferevent *bufev, void *arg)
 		(*evcon->cb)(evcon, evcon->cb_arg);
 }
 
+/* Returns true iff the connection has to be closed once the reply to the
+ * incoming request req has been sent. */
+static int
+evhttp_is_last_incoming_request(struct evhttp_request *req)
+{
+	return ((REQ_VERSION_BEFORE(req, 1, 1) &&
+	    !evhttp_is_connection_keepalive(req)) ||
+	    evhttp_is_request_connection_close(req));
+}
+
+/* Returns true iff we may read another request from the incoming
+ * connection evcon before the ones queued on it have been answered. */
+static int
+evhttp_connection_may_read_ahead(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req, *last;
+	int n = 0;
+
+	if (evcon->flags & EVHTTP_CON_PIPELINE_EOF)
+		return (0);
+	if ((last = TAILQ_LAST(&evcon->requests, evcon_requestq)) == NULL)
+		return (1);
+
+	/* whatever follows these is not meant for us */
+	if (last->type == EVHTTP_REQ_CONNECT ||
+	    evhttp_find_input_header_(last, EVHTTP_HDR_UPGRADE) != NULL ||
+	    evhttp_is_last_incoming_request(last))
+		return (0);
+
+	TAILQ_FOREACH(req, &evcon->requests, next)
+		++n;
+	return (n < evcon->max_pipelined);
+}
+
 /**
  * Advance the connection state.
  * - If this is an outgoing connection, we've just processed the response;
  *   idle or close the connection.
  * - If this is an incoming connection, we've just processed the request;
- *   respond.
+ *   respond, and start reading the next one if the client may pipeline.
  */
 static void
 evhttp_connection_done(struct evhttp_connection *evcon)
 {
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_current_request(evcon);
 	int con_outgoing = evcon->flags & EVHTTP_CON_OUTGOING;
 	int free_evcon = 0;
 
@@ -924,6 +1098,8 @@ evhttp_connection_done(struct evhttp_connection *evcon)
 		/* check if we got asked to close the connection */
 		if (need_close)
 			evhttp_connection_reset_(evcon);
+		else
+			evcon->flags |= EVHTTP_CON_REUSED;
 
 		if (TAILQ_FIRST(&evcon->requests) != NULL) {
 			/*
@@ -948,11 +1124,20 @@ evhttp_connection_done(struct evhttp_connection *evcon)
 			 free_evcon = 1;
 		}
 	} else {
+		/* a pipelined request was answered before we finished
+		 * reading it */
+		if (!evhttp_connection_is_reading(evcon))
+			return;
+
 		/*
 		 * incoming connection - we need to leave the request on the
 		 * connection so that we can reply to it.
 		 */
 		evcon->state = EVCON_WRITING;
+
+		/* If this fails we try again once the reply has been sent. */
+		if (evhttp_connection_may_read_ahead(evcon))
+			evhttp_associate_new_request_with_connection(evcon);
 	}
 
 	/* notify the user of the request */
@@ -1218,7 +1403,7 @@ static void
 evhttp_read_cb(struct bufferevent *bufev, void *arg)
 {
 	struct evhttp_connection *evcon = arg;
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_current_request(evcon);
 
 	/* Cancel if it's pending. */
 	event_deferred_cb_cancel_(get_deferred_queue(evcon),
@@ -1315,6 +1500,9 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 			(*evcon->closecb)(evcon, evcon->closecb_arg);
 	}
 
+	if (evcon->h2 != NULL)
+		evhttp_h2_free_(evcon);
+
 	/* remove all requests that might be queued on this
 	 * connection.  for server connections, this should be empty.
 	 * because it gets dequeued either in evhttp_connection_done or
@@ -1329,6 +1517,13 @@ evhttp_connection_free(struct evhttp_connection *evcon)
 		TAILQ_REMOVE(&http->connections, evcon, next);
 	}
 
+	if (evcon->pool != NULL) {
+		TAILQ_REMOVE(&evcon->pool->connections, evcon, next);
+		--evcon->pool->n_connections;
+		event_del(&evcon->expire_ev);
+		event_debug_unassign(&evcon->expire_ev);
+	}
+
 	if (event_initialized(&evcon->retry_ev)) {
 		event_del(&evcon->retry_ev);
 		event_debug_unassign(&evcon->retry_ev);
@@ -1405,7 +1600,7 @@ evhttp_request_dispatch(struct evhttp_connection* evcon)
 	evcon->state = EVCON_WRITING;
 
 	/* Create the header from the store arguments */
-	evhttp_make_header(evcon, req);
+	evhttp_make_header(evcon, req, bufferevent_get_output(evcon->bufev));
 
 	evhttp_write_buffer(evcon, evhttp_write_connectioncb, NULL);
 }
@@ -1456,9 +1651,14 @@ evhttp_connection_reset_(struct evhttp_connection *evcon)
 	err = evbuffer_drain(tmp, -1);
 	EVUTIL_ASSERT(!err && "drain input");
 
-	evcon->flags &= ~EVHTTP_CON_READING_ERROR;
+	evcon->flags &= ~(EVHTTP_CON_READING_ERROR|EVHTTP_CON_REUSED);
 
 	evcon->state = EVCON_DISCONNECTED;
+
+	/* a pool keeps a closed connection around for a while, in case it
+	 * gets another request; evhttp_connection_connect_ stops this */
+	if (evcon->pool != NULL)
+		evtimer_add(&evcon->expire_ev, &evcon->timeout_read);
 }
 
 static void
@@ -1565,11 +1765,28 @@ static void
 evhttp_error_cb(struct bufferevent *bufev, short what, void *arg)
 {
 	struct evhttp_connection *evcon = arg;
-	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+	struct evhttp_request *req = evhttp_connection_current_request(evcon);
 
 	if (evcon->fd == -1)
 		evcon->fd = bufferevent_getfd(bufev);
 
+	/* The client is done sending, or went idle, between pipelined
+	 * requests: finish the replies we owe it before closing. */
+	if (evcon->state == EVCON_READING_FIRSTLINE &&
+	    evhttp_connection_reads_ahead(evcon) &&
+	    (what & BEV_EVENT_READING) &&
+	    (what & (BEV_EVENT_EOF|BEV_EVENT_TIMEOUT))) {
+		event_deferred_cb_cancel_(get_deferred_queue(evcon),
+		    &evcon->read_more_deferred_cb);
+		evhttp_request_free_(evcon, req);
+		evcon->state = EVCON_WRITING;
+		evcon->flags |= EVHTTP_CON_PIPELINE_EOF;
+		bufferevent_disable(bufev, EV_READ);
+		bufferevent_setcb(bufev, NULL, evhttp_write_cb,
+		    evhttp_error_cb, evcon);
+		return;
+	}
+
 	switch (evcon->state) {
 	case EVCON_CONNECTING:
 		if (what & BEV_EVENT_TIMEOUT) {
@@ -1741,15 +1958,35 @@ evhttp_valid_response_code(int code)
 	return (1);
 }
 
+/* Parse a decimal number of at most four digits from *p, up to end. */
 static int
-evhttp_parse_http_version(const char *version, struct evhttp_request *req)
-{
-	int major, minor;
-	char ch;
-	int n = sscanf(version, "HTTP/%d.%d%c", &major, &minor, &ch);
-	if (n != 2 || major > 1) {
-		event_debug(("%s: bad version %s on message %p from %s",
-			__func__, version, req, req->remote_host));
+evhttp_parse_version_number(const char **p, const char *end)
+{
+	int n = 0, digits = 0;
+
+	while (*p < end && EVUTIL_ISDIGIT_(**p)) {
+		if (++digits > 4)
+			return (-1);
+		n = n * 10 + (**p - '0');
+		++*p;
+	}
+	return (digits ? n : -1);
+}
+
+static int
+evhttp_parse_http_version(const char *version, size_t len,
+    struct evhttp_request *req)
+{
+	const char *p = version + 5, *end = version + len;
+	int major = -1, minor = -1;
+
+	if (len > 5 && !memcmp(version, "HTTP/", 5) &&
+	    (major = evhttp_parse_version_number(&p, end)) >= 0 &&
+	    p < end && *p++ == '.')
+		minor = evhttp_parse_version_number(&p, end);
+	if (minor < 0 || p != end || major > 1) {
+		event_debug(("%s: bad version %.*s on message %p from %s",
+			__func__, (int)len, version, req, req->remote_host));
 		return (-1);
 	}
 	req->major = major;
@@ -1773,7 +2010,7 @@ evhttp_parse_response_line(struct evhttp_request *req, char *line)
 	if (line != NULL)
 		readable = line;
 
-	if (evhttp_parse_http_version(protocol, req) < 0)
+	if (evhttp_parse_http_version(protocol, strlen(protocol), req) < 0)
 		return (-1);
 
 	req->response_code = atoi(number);
@@ -1793,42 +2030,12 @@ evhttp_parse_response_line(struct evhttp_request *req, char *line)
 	return (0);
 }
 
-/* Parse the first line of a HTTP request */
-
-static int
-evhttp_parse_request_line(struct evhttp_request *req, char *line, size_t len)
+enum evhttp_cmd_type
+evhttp_parse_method_(struct evhttp_connection *evcon, const char *method,
+    size_t method_len)
 {
-	char *eos = line + len;
-	char *method;
-	char *uri;
-	char *version;
-	const char *hostname;
-	const char *scheme;
-	size_t method_len;
 	enum evhttp_cmd_type type = 0;
 
-	while (eos > line && *(eos-1) == ' ') {
-		*(eos-1) = '\0';
-		--eos;
-		--len;
-	}
-	if (len < strlen("GET / HTTP/1.0"))
-		return -1;
-
-	/* Parse the request line */
-	method = strsep(&line, " ");
-	if (!line)
-		return -1;
-	uri = line;
-	version = strrchr(uri, ' ');
-	if (!version || uri == version)
-		return -1;
-	*version = '\0';
-	version++;
-
-	method_len = (uri - method) - 1;
-
-	/* First line */
 	switch (method_len) {
 	    case 3:
 		/* The length of the method string is 3, meaning it can only be one of two methods: GET or PUT */
@@ -1995,37 +2202,51 @@ evhttp_parse_request_line(struct evhttp_request *req, char *line, size_t len)
 		 * returns a 0 value.
 		 */
 		struct evhttp_ext_method ext_method;
+		char buf[32];
+		char *name = buf;
 
-		ext_method.method = method;
-		ext_method.type = 0;
-
-		if (req->evcon->ext_method_cmp &&
-		    req->evcon->ext_method_cmp(&ext_method) == 0) {
-			/* TODO: make sure the other fields in ext_method are
-			 * not changed by the callback.
-			 */
-			type = ext_method.type;
+		if (evcon->ext_method_cmp) {
+			if (method_len >= sizeof(buf) &&
+			    (name = mm_malloc(method_len + 1)) == NULL) {
+				event_warn("%s: mm_malloc", __func__);
+				return -1;
+			}
+			memcpy(name, method, method_len);
+			name[method_len] = '\0';
+
+			ext_method.method = name;
+			ext_method.type = 0;
+
+			if (evcon->ext_method_cmp(&ext_method) == 0) {
+				/* TODO: make sure the other fields in
+				 * ext_method are not changed by the
+				 * callback.
+				 */
+				type = ext_method.type;
+			}
+			if (name != buf)
+				mm_free(name);
 		}
 	}
 
-	if (!type) {
-		event_debug(("%s: bad method %s on request %p from %s",
-		            __func__, method, req, req->remote_host));
-		/* No error yet; we'll give a better error later when
-		 * we see that req->type is unsupported. */
-	}
-
-	req->type = type;
+	return type;
+}
 
-	if (evhttp_parse_http_version(version, req) < 0)
-		return -1;
+int
+evhttp_parse_request_target_(struct evhttp_request *req, const char *uri,
+    size_t uri_len)
+{
+	const char *hostname;
+	const char *scheme;
 
-	if ((req->uri = mm_strdup(uri)) == NULL) {
-		event_debug(("%s: mm_strdup", __func__));
+	if ((req->uri = mm_malloc(uri_len + 1)) == NULL) {
+		event_debug(("%s: mm_malloc", __func__));
 		return -1;
 	}
+	memcpy(req->uri, uri, uri_len);
+	req->uri[uri_len] = '\0';
 
-	if (type == EVHTTP_REQ_CONNECT) {
+	if (req->type == EVHTTP_REQ_CONNECT) {
 		if ((req->uri_elems = evhttp_uri_parse_authority(req->uri)) == NULL) {
 			return -1;
 		}
@@ -2050,19 +2271,138 @@ evhttp_parse_request_line(struct evhttp_request *req, char *line, size_t len)
 	return 0;
 }
 
-const char *
-evhttp_find_header(const struct evkeyvalq *headers, const char *key)
+/* Parse the first line of a HTTP request */
+
+static int
+evhttp_parse_request_line(struct evhttp_request *req, const char *line,
+    size_t len)
+{
+	const char *eos = line + len;
+	const char *method;
+	const char *uri;
+	const char *version;
+	size_t method_len, uri_len;
+	enum evhttp_cmd_type type;
+
+	while (eos > line && *(eos-1) == ' ') {
+		--eos;
+		--len;
+	}
+	if (len < strlen("GET / HTTP/1.0"))
+		return -1;
+	if (memchr(line, '\0', len))
+		return -1;
+
+	/* Parse the request line; it stays in the input buffer, so we
+	 * work on (pointer, length) slices of it. */
+	method = line;
+	uri = memchr(line, ' ', len);
+	if (!uri)
+		return -1;
+	++uri;
+	for (version = eos; version > uri && version[-1] != ' '; --version)
+		;
+	if (version - 1 <= uri)
+		return -1;
+
+	method_len = (uri - method) - 1;
+	uri_len = (version - uri) - 1;
+
+	type = evhttp_parse_method_(req->evcon, method, method_len);
+	if (!type) {
+		event_debug(("%s: bad method %.*s on request %p from %s",
+		            __func__, (int)method_len, method, req,
+		            req->remote_host));
+		/* No error yet; we'll give a better error later when
+		 * we see that req->type is unsupported. */
+	}
+
+	req->type = type;
+
+	if (evhttp_parse_http_version(version, eos - version, req) < 0)
+		return -1;
+
+	return evhttp_parse_request_target_(req, uri, uri_len);
+}
+
+/* FNV-1a over the lower-cased name */
+static unsigned
+evhttp_header_hash(const char *key)
+{
+	unsigned h = 2166136261U;
+
+	for (; *key; ++key)
+		h = (h ^ (unsigned char)EVUTIL_TOLOWER_(*key)) * 16777619U;
+	return (h);
+}
+
+/* True iff header was allocated by evhttp_add_header_internal(), rather
+ * than put together by hand.  A hand-built node may be no bigger than a
+ * struct evkeyval, so the rest of struct evhttp_header is only looked at
+ * once the name sits at the odd address we would have put it at: a name
+ * from malloc() or strdup() never does. */
+static inline int
+evhttp_header_is_compact(const struct evkeyval *header)
+{
+	const struct evhttp_header *h = (const struct evhttp_header *)header;
+
+	return (header->key == EVHTTP_HEADER_NAME(h) &&
+	    h->magic == EVHTTP_HEADER_MAGIC);
+}
+
+static void
+evhttp_header_free(struct evkeyval *header)
+{
+	if (evhttp_header_is_compact(header)) {
+		struct evhttp_header *h = (struct evhttp_header *)header;
+		if (h->index) {
+			int i;
+			for (i = 0; i < EVHTTP_HDR_MAX_; ++i) {
+				if (h->index->known[i] == h)
+					h->index->known[i] = NULL;
+			}
+			h->index->stale = 1;
+		}
+		if (header->value != header->key + strlen(header->key) + 1)
+			mm_free(header->value);
+	} else {
+		mm_free(header->key);
+		mm_free(header->value);
+	}
+	mm_free(header);
+}
+
+static struct evkeyval *
+evhttp_find_header_entry(const struct evkeyvalq *headers, const char *key)
 {
 	struct evkeyval *header;
+	unsigned hash = 0;
+	int hashed = 0;
 
 	TAILQ_FOREACH(header, headers, next) {
+		if (evhttp_header_is_compact(header)) {
+			if (!hashed) {
+				hash = evhttp_header_hash(key);
+				hashed = 1;
+			}
+			if (((struct evhttp_header *)header)->hash != hash)
+				continue;
+		}
 		if (evutil_ascii_strcasecmp(header->key, key) == 0)
-			return (header->value);
+			return (header);
 	}
 
 	return (NULL);
 }
 
+const char *
+evhttp_find_header(const struct evkeyvalq *headers, const char *key)
+{
+	struct evkeyval *header = evhttp_find_header_entry(headers, key);
+
+	return (header ? header->value : NULL);
+}
+
 void
 evhttp_clear_headers(struct evkeyvalq *headers)
 {
@@ -2072,9 +2412,7 @@ evhttp_clear_headers(struct evkeyvalq *headers)
 	    header != NULL;
 	    header = TAILQ_FIRST(headers)) {
 		TAILQ_REMOVE(headers, header, next);
-		mm_free(header->key);
-		mm_free(header->value);
-		mm_free(header);
+		evhttp_header_free(header);
 	}
 }
 
@@ -2086,86 +2424,213 @@ evhttp_clear_headers(struct evkeyvalq *headers)
 int
 evhttp_remove_header(struct evkeyvalq *headers, const char *key)
 {
-	struct evkeyval *header;
-
-	TAILQ_FOREACH(header, headers, next) {
-		if (evutil_ascii_strcasecmp(header->key, key) == 0)
-			break;
-	}
+	struct evkeyval *header = evhttp_find_header_entry(headers, key);
 
 	if (header == NULL)
 		return (-1);
 
 	/* Free and remove the header that we found */
 	TAILQ_REMOVE(headers, header, next);
-	mm_free(header->key);
-	mm_free(header->value);
-	mm_free(header);
+	evhttp_header_free(header);
 
 	return (0);
 }
 
+static const char *evhttp_known_header_names[EVHTTP_HDR_MAX_] = {
+	"Connection",
+	"Content-Length",
+	"Expect",
+	"Host",
+	"Proxy-Connection",
+	"Transfer-Encoding",
+	"Upgrade",
+};
+/* evhttp_header_hash() of each of the names above */
+static const unsigned evhttp_known_header_hashes[EVHTTP_HDR_MAX_] = {
+	0x38b99ed9U,
+	0x4df9451dU,
+	0x96da6b58U,
+	0xaffea56fU,
+	0x32c09da6U,
+	0xddb4744cU,
+	0xdc97cc77U,
+};
+
 static int
-evhttp_header_is_valid_value(const char *value)
+evhttp_known_header_id(const struct evhttp_header *h)
+{
+	int i;
+
+	for (i = 0; i < EVHTTP_HDR_MAX_; ++i) {
+		if (evhttp_known_header_hashes[i] == h->hash &&
+		    !evutil_ascii_strcasecmp(evhttp_known_header_names[i],
+			h->kv.key))
+			return (i);
+	}
+	return (-1);
+}
+
+/* Forget the slots of index before it is freed.  The headers they point
+ * at may have been moved to another list, and outlive it. */
+static void
+evhttp_header_index_detach(struct evhttp_header_index *index)
+{
+	int i;
+
+	for (i = 0; i < EVHTTP_HDR_MAX_; ++i) {
+		if (index->known[i] != NULL) {
+			index->known[i]->index = NULL;
+			index->known[i] = NULL;
+		}
+	}
+}
+
+/* Record the header that was just appended to index->headers. */
+static void
+evhttp_header_index_add(struct evhttp_header_index *index)
 {
-	const char *p = value;
+	struct evkeyval *header = TAILQ_LAST(&index->headers, evkeyvalq);
+	struct evhttp_header *h = (struct evhttp_header *)header;
+	int id;
+
+	/* If something else was appended since we last looked, we would
+	 * not know about it; stop trusting the slots. */
+	if (index->indexed_tail != header->next.tqe_prev ||
+	    !evhttp_header_is_compact(header)) {
+		index->stale = 1;
+		return;
+	}
+	index->indexed_tail = index->headers.tqh_last;
+
+	id = evhttp_known_header_id(h);
+	if (id >= 0 && index->known[id] == NULL) {
+		index->known[id] = h;
+		h->index = index;
+	}
+}
 
-	while ((p = strpbrk(p, "\r\n")) != NULL) {
+int
+evhttp_add_input_header_(struct evhttp_request *req,
+    const char *key, size_t key_len, const char *value, size_t value_len)
+{
+	if (evhttp_add_header_n(req->input_headers,
+		key, key_len, value, value_len) == -1)
+		return (-1);
+	evhttp_header_index_add((struct evhttp_header_index *)req->input_headers);
+	return (0);
+}
+
+const char *
+evhttp_find_input_header_(struct evhttp_request *req,
+    enum evhttp_known_header id)
+{
+	struct evhttp_header_index *index =
+	    (struct evhttp_header_index *)req->input_headers;
+
+	if (!index->stale && index->indexed_tail == index->headers.tqh_last)
+		return (index->known[id] ? index->known[id]->kv.value : NULL);
+	return (evhttp_find_header(req->input_headers,
+		evhttp_known_header_names[id]));
+}
+
+static int
+evhttp_header_is_valid_value(const char *value, size_t len)
+{
+	const char *p, *end = value + len;
+
+	for (p = value; p < end; ++p) {
+		if (*p != '\r' && *p != '\n')
+			continue;
 		/* we really expect only one new line */
-		p += strspn(p, "\r\n");
+		while (p < end && (*p == '\r' || *p == '\n'))
+			++p;
 		/* we expect a space or tab for continuation */
-		if (*p != ' ' && *p != '\t')
+		if (p == end || (*p != ' ' && *p != '\t'))
 			return (0);
 	}
 	return (1);
 }
 
-int
-evhttp_add_header(struct evkeyvalq *headers,
-    const char *key, const char *value)
+/* Like evhttp_add_header(), but key and value need not be NUL-terminated. */
+static int
+evhttp_add_header_n(struct evkeyvalq *headers,
+    const char *key, size_t key_len, const char *value, size_t value_len)
 {
-	event_debug(("%s: key: %s val: %s\n", __func__, key, value));
+	event_debug(("%s: key: %.*s val: %.*s\n", __func__,
+		(int)key_len, key, (int)value_len, value));
 
-	if (strchr(key, '\r') != NULL || strchr(key, '\n') != NULL) {
+	if (memchr(key, '\r', key_len) != NULL ||
+	    memchr(key, '\n', key_len) != NULL) {
 		/* drop illegal headers */
 		event_debug(("%s: dropping illegal header key\n", __func__));
 		return (-1);
 	}
 
-	if (!evhttp_header_is_valid_value(value)) {
+	if (!evhttp_header_is_valid_value(value, value_len)) {
 		event_debug(("%s: dropping illegal header value\n", __func__));
 		return (-1);
 	}
 
-	return (evhttp_add_header_internal(headers, key, value));
+	return (evhttp_add_header_internal(headers,
+		key, key_len, value, value_len));
+}
+
+int
+evhttp_add_header(struct evkeyvalq *headers,
+    const char *key, const char *value)
+{
+	return (evhttp_add_header_n(headers,
+		key, strlen(key), value, strlen(value)));
 }
 
 static int
 evhttp_add_header_internal(struct evkeyvalq *headers,
-    const char *key, const char *value)
+    const char *key, size_t key_len, const char *value, size_t value_len)
 {
-	struct evkeyval *header = mm_calloc(1, sizeof(struct evkeyval));
-	if (header == NULL) {
-		event_warn("%s: calloc", __func__);
-		return (-1);
-	}
-	if ((header->key = mm_strdup(key)) == NULL) {
-		mm_free(header);
-		event_warn("%s: strdup", __func__);
+	struct evhttp_header *h;
+
+	if (key_len + value_len > EV_SIZE_MAX - sizeof(*h) - 3) {
+		event_warnx("%s: header too long", __func__);
 		return (-1);
 	}
-	if ((header->value = mm_strdup(value)) == NULL) {
-		mm_free(header->key);
-		mm_free(header);
-		event_warn("%s: strdup", __func__);
+	h = mm_malloc(sizeof(*h) + key_len + value_len + 3);
+	if (h == NULL) {
+		event_warn("%s: malloc", __func__);
 		return (-1);
 	}
+	h->kv.key = EVHTTP_HEADER_NAME(h);
+	h->kv.value = h->kv.key + key_len + 1;
+	memcpy(h->kv.key, key, key_len);
+	h->kv.key[key_len] = '\0';
+	memcpy(h->kv.value, value, value_len);
+	h->kv.value[value_len] = '\0';
+	h->hash = evhttp_header_hash(h->kv.key);
+	h->magic = EVHTTP_HEADER_MAGIC;
+	h->index = NULL;
 
-	TAILQ_INSERT_TAIL(headers, header, next);
+	TAILQ_INSERT_TAIL(headers, &h->kv, next);
 
 	return (0);
 }
 
+/* Find the next line in buffer, ended by CRLF or LF, and return it in
+ * place, without copying it out or removing it.  *len_out is set to the
+ * length of the line and *eol_len_out to the length of its EOL.  The line
+ * is usually contiguous already; if not, it is pulled up.  Returns NULL if
+ * there is no complete line yet. */
+static const char *
+evhttp_peek_line(struct evbuffer *buffer, size_t *len_out,
+    size_t *eol_len_out)
+{
+	struct evbuffer_ptr eol;
+
+	eol = evbuffer_search_eol(buffer, NULL, eol_len_out, EVBUFFER_EOL_CRLF);
+	if (eol.pos < 0)
+		return (NULL);
+	*len_out = eol.pos;
+	return ((const char *)evbuffer_pullup(buffer, eol.pos + *eol_len_out));
+}
+
 /*
  * Parses header lines from a request or a response into the specified
  * request object given an event buffer.
@@ -2179,12 +2644,12 @@ evhttp_add_header_internal(struct evkeyvalq *headers,
 enum message_read_status
 evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 {
-	char *line;
+	const char *line;
+	char *copy;
 	enum message_read_status status = ALL_DATA_READ;
 
-	size_t len;
-	/* XXX try */
-	line = evbuffer_readln(buffer, &len, EVBUFFER_EOL_CRLF);
+	size_t len, eol_len;
+	line = evhttp_peek_line(buffer, &len, &eol_len);
 	if (line == NULL) {
 		if (req->evcon != NULL &&
 		    evbuffer_get_length(buffer) > req->evcon->max_headers_size)
@@ -2194,7 +2659,7 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 	}
 
 	if (req->evcon != NULL && len > req->evcon->max_headers_size) {
-		mm_free(line);
+		evbuffer_drain(buffer, len + eol_len);
 		return (DATA_TOO_LONG);
 	}
 
@@ -2206,23 +2671,33 @@ evhttp_parse_firstline_(struct evhttp_request *req, struct evbuffer *buffer)
 			status = DATA_CORRUPTED;
 		break;
 	case EVHTTP_RESPONSE:
-		if (evhttp_parse_response_line(req, line) == -1)
+		/* evhttp_parse_response_line() wants a string of its own */
+		if ((copy = mm_malloc(len + 1)) == NULL) {
+			event_warn("%s: mm_malloc", __func__);
 			status = DATA_CORRUPTED;
+			break;
+		}
+		memcpy(copy, line, len);
+		copy[len] = '\0';
+		if (evhttp_parse_response_line(req, copy) == -1)
+			status = DATA_CORRUPTED;
+		mm_free(copy);
 		break;
 	default:
 		status = DATA_CORRUPTED;
 	}
 
-	mm_free(line);
+	evbuffer_drain(buffer, len + eol_len);
 	return (status);
 }
 
 static int
-evhttp_append_to_last_header(struct evkeyvalq *headers, char *line)
+evhttp_append_to_last_header(struct evkeyvalq *headers, const char *line,
+    size_t line_len)
 {
 	struct evkeyval *header = TAILQ_LAST(headers, evkeyvalq);
 	char *newval;
-	size_t old_len, line_len;
+	size_t old_len;
 
 	if (header == NULL)
 		return (-1);
@@ -2230,35 +2705,48 @@ evhttp_append_to_last_header(struct evkeyvalq *headers, char *line)
 	old_len = strlen(header->value);
 
 	/* Strip space from start and end of line. */
-	while (*line == ' ' || *line == '\t')
+	while (line_len && (*line == ' ' || *line == '\t')) {
 		++line;
-	evutil_rtrim_lws_(line);
-
-	line_len = strlen(line);
+		--line_len;
+	}
+	while (line_len &&
+	    (line[line_len - 1] == ' ' || line[line_len - 1] == '\t'))
+		--line_len;
 
-	newval = mm_realloc(header->value, old_len + line_len + 2);
-	if (newval == NULL)
-		return (-1);
+	if (evhttp_header_is_compact(header) &&
+	    header->value == header->key + strlen(header->key) + 1) {
+		/* the value shares a block with the node; move it out */
+		newval = mm_malloc(old_len + line_len + 2);
+		if (newval == NULL)
+			return (-1);
+		memcpy(newval, header->value, old_len);
+	} else {
+		newval = mm_realloc(header->value, old_len + line_len + 2);
+		if (newval == NULL)
+			return (-1);
+	}
 
 	newval[old_len] = ' ';
-	memcpy(newval + old_len + 1, line, line_len + 1);
+	memcpy(newval + old_len + 1, line, line_len);
+	newval[old_len + 1 + line_len] = '\0';
 	header->value = newval;
 
 	return (0);
 }
 
+/* Header lines are tokenized where they sit in the input buffer; the only
+ * copy made of each one is the header that is added for it. */
 enum message_read_status
 evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 {
 	enum message_read_status errcode = DATA_CORRUPTED;
-	char *line;
+	const char *line;
 	enum message_read_status status = MORE_DATA_EXPECTED;
 
 	struct evkeyvalq* headers = req->input_headers;
-	size_t len;
-	while ((line = evbuffer_readln(buffer, &len, EVBUFFER_EOL_CRLF))
-	       != NULL) {
-		char *skey, *svalue;
+	size_t len, eol_len;
+	while ((line = evhttp_peek_line(buffer, &len, &eol_len)) != NULL) {
+		const char *colon, *svalue, *eos;
 
 		req->headers_size += len;
 
@@ -2268,33 +2756,41 @@ evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 			goto error;
 		}
 
-		if (*line == '\0') { /* Last header - Done */
+		if (len == 0) { /* Last header - Done */
 			status = ALL_DATA_READ;
-			mm_free(line);
+			evbuffer_drain(buffer, eol_len);
 			break;
 		}
 
+		/* A NUL would silently cut the header short */
+		if (memchr(line, '\0', len) != NULL)
+			goto error;
+
 		/* Check if this is a continuation line */
 		if (*line == ' ' || *line == '\t') {
-			if (evhttp_append_to_last_header(headers, line) == -1)
+			if (evhttp_append_to_last_header(headers, line, len) == -1)
 				goto error;
-			mm_free(line);
+			evbuffer_drain(buffer, len + eol_len);
 			continue;
 		}
 
 		/* Processing of header lines */
-		svalue = line;
-		skey = strsep(&svalue, ":");
-		if (svalue == NULL)
+		colon = memchr(line, ':', len);
+		if (colon == NULL)
 			goto error;
 
-		svalue += strspn(svalue, " ");
-		evutil_rtrim_lws_(svalue);
+		eos = line + len;
+		svalue = colon + 1;
+		while (svalue < eos && *svalue == ' ')
+			++svalue;
+		while (eos > svalue && (eos[-1] == ' ' || eos[-1] == '\t'))
+			--eos;
 
-		if (evhttp_add_header(headers, skey, svalue) == -1)
+		if (evhttp_add_input_header_(req, line, colon - line,
+			svalue, eos - svalue) == -1)
 			goto error;
 
-		mm_free(line);
+		evbuffer_drain(buffer, len + eol_len);
 	}
 
 	if (status == MORE_DATA_EXPECTED) {
@@ -2306,19 +2802,18 @@ evhttp_parse_headers_(struct evhttp_request *req, struct evbuffer* buffer)
 	return (status);
 
  error:
-	mm_free(line);
+	evbuffer_drain(buffer, len + eol_len);
 	return (errcode);
 }
 
 static int
 evhttp_get_body_length(struct evhttp_request *req)
 {
-	struct evkeyvalq *headers = req->input_headers;
 	const char *content_length;
 	const char *connection;
 
-	content_length = evhttp_find_header(headers, "Content-Length");
-	connection = evhttp_find_header(headers, "Connection");
+	content_length = evhttp_find_input_header_(req, EVHTTP_HDR_CONTENT_LENGTH);
+	connection = evhttp_find_input_header_(req, EVHTTP_HDR_CONNECTION);
 
 	if (content_length == NULL && connection == NULL)
 		req->ntoread = -1;
@@ -2365,7 +2860,7 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 		return;
 	}
 	evcon->state = EVCON_READING_BODY;
-	xfer_enc = evhttp_find_header(req->input_headers, "Transfer-Encoding");
+	xfer_enc = evhttp_find_input_header_(req, EVHTTP_HDR_TRANSFER_ENCODING);
 	if (xfer_enc != NULL && evutil_ascii_strcasecmp(xfer_enc, "chunked") == 0) {
 		req->chunked = 1;
 		req->ntoread = -1;
@@ -2399,7 +2894,11 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 						return;
 					}
 				}
-				if (!evbuffer_get_length(bufferevent_get_input(evcon->bufev)))
+				/* Don't mix it into the replies to earlier
+				 * pipelined requests; the client will send
+				 * the body anyway once it gives up waiting. */
+				if (!evbuffer_get_length(bufferevent_get_input(evcon->bufev)) &&
+				    !evhttp_connection_reads_ahead(evcon))
 					evhttp_send_continue(evcon, req);
 			break;
 		case OTHER:
@@ -2412,12 +2911,60 @@ evhttp_get_body(struct evhttp_connection *evcon, struct evhttp_request *req)
 	/* note the request may have been freed in evhttp_read_body */
 }
 
+/* Returns true iff req is the first request on the incoming connection
+ * evcon, and the server would talk HTTP/2 on it instead. */
+static int
+evhttp_connection_may_start_h2(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	return ((evcon->flags & EVHTTP_CON_INCOMING) &&
+	    (evcon->http_server->flags & EVHTTP_SERVER_HTTP2) &&
+	    !(evcon->flags & EVHTTP_CON_SEEN_REQUEST) &&
+	    TAILQ_FIRST(&evcon->requests) == req &&
+	    TAILQ_NEXT(req, next) == NULL);
+}
+
+/* Hands evcon over to the HTTP/2 code.  upgrade is the request that asked
+ * for it with "Upgrade: h2c"; without one, the client sent the HTTP/2
+ * connection preface straight away. */
+static void
+evhttp_connection_start_h2(struct evhttp_connection *evcon,
+    struct evhttp_request *upgrade)
+{
+	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+
+	event_deferred_cb_cancel_(get_deferred_queue(evcon),
+	    &evcon->read_more_deferred_cb);
+	TAILQ_REMOVE(&evcon->requests, req, next);
+	if (upgrade == NULL)
+		evhttp_request_free(req);
+	evcon->state = EVCON_IDLE;
+
+	if (evhttp_h2_start_(evcon, upgrade) == -1) {
+		if (upgrade != NULL)
+			evhttp_request_free(upgrade);
+		evhttp_connection_free(evcon);
+	}
+}
+
 static void
 evhttp_read_firstline(struct evhttp_connection *evcon,
 		      struct evhttp_request *req)
 {
 	enum message_read_status res;
 
+	if (evhttp_connection_may_start_h2(evcon, req)) {
+		switch (evhttp_h2_check_preface_(
+			    bufferevent_get_input(evcon->bufev))) {
+		case 1:
+			evhttp_connection_start_h2(evcon, NULL);
+			return;
+		case -1:
+			/* could still be the HTTP/2 preface */
+			return;
+		}
+	}
+
 	res = evhttp_parse_firstline_(req, bufferevent_get_input(evcon->bufev));
 	if (res == DATA_CORRUPTED || res == DATA_TOO_LONG) {
 		/* Error while reading, terminate */
@@ -2464,6 +3011,12 @@ evhttp_read_header(struct evhttp_connection *evcon,
 	/* Done reading headers, do the real work */
 	switch (req->kind) {
 	case EVHTTP_REQUEST:
+		if (evhttp_connection_may_start_h2(evcon, req) &&
+		    evhttp_h2_wants_upgrade_(req)) {
+			evhttp_connection_start_h2(evcon, req);
+			return;
+		}
+		evcon->flags |= EVHTTP_CON_SEEN_REQUEST;
 		event_debug(("%s: checking for post data on "EV_SOCK_FMT"\n",
 			__func__, EV_SOCK_ARG(fd)));
 		evhttp_get_body(evcon, req);
@@ -2749,6 +3302,8 @@ evhttp_connection_connect_(struct evhttp_connection *evcon)
 		return (0);
 
 	evhttp_connection_reset_(evcon);
+	if (evcon->pool != NULL)
+		event_del(&evcon->expire_ev);
 
 	EVUTIL_ASSERT(!(evcon->flags & EVHTTP_CON_INCOMING));
 	evcon->flags |= EVHTTP_CON_OUTGOING;
@@ -2876,27 +3431,253 @@ evhttp_make_request(struct evhttp_connection *evcon,
 void
 evhttp_cancel_request(struct evhttp_request *req)
 {
-	struct evhttp_connection *evcon = req->evcon;
-	if (evcon != NULL) {
-		/* We need to remove it from the connection */
-		if (TAILQ_FIRST(&evcon->requests) == req) {
-			/* it's currently being worked on, so reset
-			 * the connection.
-			 */
-			evhttp_connection_fail_(evcon,
-			    EVREQ_HTTP_REQUEST_CANCEL);
+	struct evhttp_connection *evcon = req->evcon;
+	if (evcon != NULL) {
+		/* We need to remove it from the connection */
+		if (TAILQ_FIRST(&evcon->requests) == req) {
+			/* it's currently being worked on, so reset
+			 * the connection.
+			 */
+			evhttp_connection_fail_(evcon,
+			    EVREQ_HTTP_REQUEST_CANCEL);
+
+			/* connection fail freed the request */
+			return;
+		} else {
+			/* otherwise, we can just remove it from the
+			 * queue
+			 */
+			TAILQ_REMOVE(&evcon->requests, req, next);
+		}
+	}
+
+	evhttp_request_free_auto(req);
+}
+
+struct evhttp_client *
+evhttp_client_new(struct event_base *base, struct evdns_base *dnsbase)
+{
+	struct evhttp_client *client;
+
+	if ((client = mm_calloc(1, sizeof(*client))) == NULL) {
+		event_warn("%s: calloc failed", __func__);
+		return (NULL);
+	}
+
+	client->base = base;
+	client->dns_base = dnsbase;
+	TAILQ_INIT(&client->hosts);
+	client->max_connections_per_host = 6;
+	evutil_timerclear(&client->timeout);
+
+	return (client);
+}
+
+static void
+evhttp_client_host_free(struct evhttp_client_host *pool)
+{
+	struct evhttp_connection *evcon;
+
+	TAILQ_REMOVE(&pool->client->hosts, pool, next);
+	while ((evcon = TAILQ_FIRST(&pool->connections)) != NULL)
+		evhttp_connection_free(evcon);
+	mm_free(pool->host);
+	mm_free(pool);
+}
+
+void
+evhttp_client_free(struct evhttp_client *client)
+{
+	struct evhttp_client_host *pool;
+
+	while ((pool = TAILQ_FIRST(&client->hosts)) != NULL)
+		evhttp_client_host_free(pool);
+
+	mm_free(client);
+}
+
+void
+evhttp_client_set_max_connections_per_host(struct evhttp_client *client,
+    int max)
+{
+	client->max_connections_per_host = max < 1 ? 1 : max;
+}
+
+void
+evhttp_client_set_timeout_tv(struct evhttp_client *client,
+    const struct timeval *tv)
+{
+	if (tv != NULL)
+		client->timeout = *tv;
+	else
+		evutil_timerclear(&client->timeout);
+}
+
+void
+evhttp_client_set_bevcb(struct evhttp_client *client,
+    struct bufferevent *(*cb)(struct event_base *, const char *,
+	ev_uint16_t, void *),
+    void *arg)
+{
+	client->bevcb = cb;
+	client->bevcbarg = arg;
+}
+
+static struct evhttp_client_host *
+evhttp_client_get_host(struct evhttp_client *client, const char *host,
+    ev_uint16_t port)
+{
+	struct evhttp_client_host *pool;
+
+	TAILQ_FOREACH(pool, &client->hosts, next) {
+		if (pool->port == port && !strcmp(pool->host, host)) {
+			/* keep the busy ones up front */
+			if (pool != TAILQ_FIRST(&client->hosts)) {
+				TAILQ_REMOVE(&client->hosts, pool, next);
+				TAILQ_INSERT_HEAD(&client->hosts, pool, next);
+			}
+			return (pool);
+		}
+	}
+
+	if ((pool = mm_calloc(1, sizeof(*pool))) == NULL) {
+		event_warn("%s: calloc failed", __func__);
+		return (NULL);
+	}
+	if ((pool->host = mm_strdup(host)) == NULL) {
+		event_warn("%s: strdup failed", __func__);
+		mm_free(pool);
+		return (NULL);
+	}
+	pool->client = client;
+	pool->port = port;
+	TAILQ_INIT(&pool->connections);
+	TAILQ_INSERT_HEAD(&client->hosts, pool, next);
+
+	return (pool);
+}
+
+/* Frees a closed connection that no request has come for, and its pool
+ * once that has no connections left. */
+static void
+evhttp_client_expire_cb(evutil_socket_t fd, short what, void *arg)
+{
+	struct evhttp_connection *evcon = arg;
+	struct evhttp_client_host *pool = evcon->pool;
+
+	if (evcon->state != EVCON_DISCONNECTED ||
+	    TAILQ_FIRST(&evcon->requests) != NULL)
+		return;
+
+	evhttp_connection_free(evcon);
+	if (pool->n_connections == 0)
+		evhttp_client_host_free(pool);
+}
+
+static struct evhttp_connection *
+evhttp_client_connection_new(struct evhttp_client_host *pool)
+{
+	struct evhttp_client *client = pool->client;
+	struct bufferevent *bev = NULL;
+	struct evhttp_connection *evcon;
+
+	if (client->bevcb != NULL &&
+	    (bev = (*client->bevcb)(client->base, pool->host, pool->port,
+		client->bevcbarg)) == NULL)
+		return (NULL);
+
+	evcon = evhttp_connection_base_bufferevent_new(client->base,
+	    client->dns_base, bev, pool->host, pool->port);
+	if (evcon == NULL)
+		return (NULL);
+	if (evutil_timerisset(&client->timeout))
+		evhttp_connection_set_timeout_tv(evcon, &client->timeout);
+
+	evcon->pool = pool;
+	evtimer_assign(&evcon->expire_ev, client->base,
+	    evhttp_client_expire_cb, evcon);
+	TAILQ_INSERT_TAIL(&pool->connections, evcon, next);
+	++pool->n_connections;
+
+	return (evcon);
+}
+
+/* Picks the connection of pool for the next request: an open one that is
+ * idle, an idle one that we have to reconnect, a new one, or else the one
+ * with the shortest queue. */
+static struct evhttp_connection *
+evhttp_client_pick_connection(struct evhttp_client_host *pool)
+{
+	struct evhttp_connection *evcon, *idle = NULL, *shortest = NULL;
+	int shortest_len = 0;
+
+	TAILQ_FOREACH(evcon, &pool->connections, next) {
+		struct evhttp_request *req;
+		int len = 0;
+
+		if (TAILQ_EMPTY(&evcon->requests)) {
+			if (evcon->state == EVCON_IDLE)
+				return (evcon);
+			if (idle == NULL)
+				idle = evcon;
+			continue;
+		}
+
+		TAILQ_FOREACH(req, &evcon->requests, next)
+			++len;
+		if (shortest == NULL || len < shortest_len) {
+			shortest = evcon;
+			shortest_len = len;
+		}
+	}
+
+	if (idle != NULL)
+		return (idle);
+	if (pool->n_connections < pool->client->max_connections_per_host ||
+	    shortest == NULL)
+		return (evhttp_client_connection_new(pool));
+	return (shortest);
+}
+
+int
+evhttp_client_make_request(struct evhttp_client *client,
+    struct evhttp_request *req, enum evhttp_cmd_type type,
+    const char *host, ev_uint16_t port, const char *uri)
+{
+	struct evhttp_client_host *pool;
+	struct evhttp_connection *evcon;
 
-			/* connection fail freed the request */
-			return;
-		} else {
-			/* otherwise, we can just remove it from the
-			 * queue
-			 */
-			TAILQ_REMOVE(&evcon->requests, req, next);
+	if ((pool = evhttp_client_get_host(client, host, port)) == NULL)
+		goto error;
+
+	if (evhttp_find_header(req->output_headers, "Host") == NULL) {
+		int default_port = client->bevcb != NULL ? 443 : 80;
+		int ipv6 = strchr(host, ':') != NULL;
+		char *value;
+		size_t len = strlen(host) + 16;
+
+		if ((value = mm_malloc(len)) == NULL)
+			goto error;
+		if (port == default_port)
+			evutil_snprintf(value, len, ipv6 ? "[%s]" : "%s", host);
+		else
+			evutil_snprintf(value, len, ipv6 ? "[%s]:%d" : "%s:%d",
+			    host, (int)port);
+		if (evhttp_add_header(req->output_headers, "Host", value) == -1) {
+			mm_free(value);
+			goto error;
 		}
+		mm_free(value);
 	}
 
+	if ((evcon = evhttp_client_pick_connection(pool)) == NULL)
+		goto error;
+
+	return (evhttp_make_request(evcon, req, type, uri));
+
+ error:
 	evhttp_request_free_auto(req);
+	return (-1);
 }
 
 /*
@@ -2907,7 +3688,9 @@ evhttp_cancel_request(struct evhttp_request *req)
 void
 evhttp_start_read_(struct evhttp_connection *evcon)
 {
-	bufferevent_disable(evcon->bufev, EV_WRITE);
+	/* replies to pipelined requests may still be on their way out */
+	if (!evbuffer_get_length(bufferevent_get_output(evcon->bufev)))
+		bufferevent_disable(evcon->bufev, EV_WRITE);
 	bufferevent_enable(evcon->bufev, EV_READ);
 
 	evcon->state = EVCON_READING_FIRSTLINE;
@@ -2936,21 +3719,105 @@ evhttp_start_write_(struct evhttp_connection *evcon)
 	evhttp_write_buffer(evcon, evhttp_write_connectioncb, NULL);
 }
 
+static void evhttp_send_done(struct evhttp_connection *, void *);
+
+/* Everything written so far for the reply to req is out: run the
+ * callbacks that were given with its chunks, oldest first. */
+static void
+evhttp_run_chunk_cbs(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	struct evhttp_chunk_cbq *cbs = &REQ_UPCAST(req)->chunk_cbs;
+	struct evhttp_chunk_cbq run;
+	struct evhttp_chunk_cb *ccb;
+
+	/* the callbacks may send more chunks, or end the reply */
+	TAILQ_INIT(&run);
+	while ((ccb = TAILQ_FIRST(cbs)) != NULL) {
+		TAILQ_REMOVE(cbs, ccb, next);
+		TAILQ_INSERT_TAIL(&run, ccb, next);
+	}
+	while ((ccb = TAILQ_FIRST(&run)) != NULL) {
+		TAILQ_REMOVE(&run, ccb, next);
+		(*ccb->cb)(evcon, ccb->arg);
+		mm_free(ccb);
+	}
+}
+
+/* Write callback for a reply that is not done yet; the reply being
+ * written is always that to the first request. */
+static void
+evhttp_send_chunk_done(struct evhttp_connection *evcon, void *arg)
+{
+	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+
+	if (req != NULL)
+		evhttp_run_chunk_cbs(evcon, req);
+}
+
+/* Writes out the reply that was queued on req while the replies to
+ * earlier pipelined requests were being sent. */
+static void
+evhttp_send_queued_reply(struct evhttp_connection *evcon,
+    struct evhttp_request *req)
+{
+	req->flags &= ~EVHTTP_REQ_REPLY_QUEUED;
+	evbuffer_add_buffer(bufferevent_get_output(evcon->bufev),
+	    req->output_buffer);
+
+	if (req->userdone)
+		evhttp_write_buffer(evcon, evhttp_send_done, NULL);
+	else
+		evhttp_write_buffer(evcon, evhttp_send_chunk_done, NULL);
+}
+
+/* Called instead of writing the reply to req when replies to earlier
+ * pipelined requests have not been sent yet: renders the reply into
+ * req->output_buffer, where it waits for its turn.  Returns -1 if the
+ * connection had to be freed. */
+static int
+evhttp_queue_reply(struct evhttp_connection *evcon, struct evhttp_request *req)
+{
+	struct evbuffer *buf;
+
+	/* replying to the request we are reading ends the pipeline */
+	if (evhttp_connection_is_reading(evcon) &&
+	    req == TAILQ_LAST(&evcon->requests, evcon_requestq)) {
+		event_deferred_cb_cancel_(get_deferred_queue(evcon),
+		    &evcon->read_more_deferred_cb);
+		bufferevent_setcb(evcon->bufev, NULL, evhttp_write_cb,
+		    evhttp_error_cb, evcon);
+		evcon->state = EVCON_WRITING;
+	}
+
+	if ((buf = evbuffer_new()) == NULL) {
+		event_warn("%s: evbuffer_new", __func__);
+		evhttp_connection_orphan_requests(evcon);
+		evhttp_connection_free(evcon);
+		return (-1);
+	}
+	evhttp_make_header(evcon, req, buf);
+	evbuffer_add_buffer(req->output_buffer, buf);
+	evbuffer_free(buf);
+
+	req->flags |= EVHTTP_REQ_REPLY_QUEUED;
+	return (0);
+}
+
 static void
 evhttp_send_done(struct evhttp_connection *evcon, void *arg)
 {
 	int need_close;
 	struct evhttp_request *req = TAILQ_FIRST(&evcon->requests);
+
+	evhttp_run_chunk_cbs(evcon, req);
 	TAILQ_REMOVE(&evcon->requests, req, next);
 
 	if (req->on_complete_cb != NULL) {
 		req->on_complete_cb(req, req->on_complete_cb_arg);
 	}
 
-	need_close =
-	    (REQ_VERSION_BEFORE(req, 1, 1) &&
-	    !evhttp_is_connection_keepalive(req->input_headers)) ||
-	    evhttp_is_request_connection_close(req);
+	need_close = evhttp_is_last_incoming_request(req);
 
 	EVUTIL_ASSERT(req->flags & EVHTTP_REQ_OWN_CONNECTION);
 	evhttp_request_free(req);
@@ -2960,8 +3827,21 @@ evhttp_send_done(struct evhttp_connection *evcon, void *arg)
 		return;
 	}
 
+	if ((req = TAILQ_FIRST(&evcon->requests)) != NULL) {
+		/* the next pipelined reply may be ready to go */
+		if (req->flags & EVHTTP_REQ_REPLY_QUEUED)
+			evhttp_send_queued_reply(evcon, req);
+		if (evhttp_connection_is_reading(evcon) ||
+		    !evhttp_connection_may_read_ahead(evcon))
+			return;
+	} else if (evcon->flags & EVHTTP_CON_PIPELINE_EOF) {
+		evhttp_connection_free(evcon);
+		return;
+	}
+
 	/* we have a persistent connection; try to accept another request. */
 	if (evhttp_associate_new_request_with_connection(evcon) == -1) {
+		evhttp_connection_orphan_requests(evcon);
 		evhttp_connection_free(evcon);
 	}
 }
@@ -3012,8 +3892,6 @@ evhttp_send(struct evhttp_request *req, struct evbuffer *databuf)
 		return;
 	}
 
-	EVUTIL_ASSERT(TAILQ_FIRST(&evcon->requests) == req);
-
 	/* we expect no more calls form the user on this request */
 	req->userdone = 1;
 
@@ -3021,8 +3899,19 @@ evhttp_send(struct evhttp_request *req, struct evbuffer *databuf)
 	if (databuf != NULL)
 		evbuffer_add_buffer(req->output_buffer, databuf);
 
+	if (evcon->h2) {
+		evhttp_h2_send_reply_(req, 0);
+		return;
+	}
+
+	/* replies to pipelined requests go out in order */
+	if (TAILQ_FIRST(&evcon->requests) != req) {
+		evhttp_queue_reply(evcon, req);
+		return;
+	}
+
 	/* Adds headers to the response */
-	evhttp_make_header(evcon, req);
+	evhttp_make_header(evcon, req, bufferevent_get_output(evcon->bufev));
 
 	evhttp_write_buffer(evcon, evhttp_send_done, NULL);
 }
@@ -3045,6 +3934,11 @@ evhttp_send_reply_start(struct evhttp_request *req, int code,
 	if (req->evcon == NULL)
 		return;
 
+	if (req->evcon->h2) {
+		evhttp_h2_send_reply_(req, 1);
+		return;
+	}
+
 	if (evhttp_find_header(req->output_headers, "Content-Length") == NULL &&
 	    REQ_VERSION_ATLEAST(req, 1, 1) &&
 	    evhttp_response_needs_body(req)) {
@@ -3059,7 +3953,15 @@ evhttp_send_reply_start(struct evhttp_request *req, int code,
 	} else {
 		req->chunked = 0;
 	}
-	evhttp_make_header(req->evcon, req);
+
+	/* replies to pipelined requests go out in order */
+	if (TAILQ_FIRST(&req->evcon->requests) != req) {
+		evhttp_queue_reply(req->evcon, req);
+		return;
+	}
+
+	evhttp_make_header(req->evcon, req,
+	    bufferevent_get_output(req->evcon->bufev));
 	evhttp_write_buffer(req->evcon, NULL, NULL);
 }
 
@@ -3073,7 +3975,15 @@ evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *dat
 	if (evcon == NULL)
 		return;
 
-	output = bufferevent_get_output(evcon->bufev);
+	if (evcon->h2) {
+		evhttp_h2_send_chunk_(req, databuf, cb, arg);
+		return;
+	}
+
+	if (req->flags & EVHTTP_REQ_REPLY_QUEUED)
+		output = req->output_buffer;
+	else
+		output = bufferevent_get_output(evcon->bufev);
 
 	if (evbuffer_get_length(databuf) == 0)
 		return;
@@ -3087,7 +3997,20 @@ evhttp_send_reply_chunk_with_cb(struct evhttp_request *req, struct evbuffer *dat
 	if (req->chunked) {
 		evbuffer_add(output, "\r\n", 2);
 	}
-	evhttp_write_buffer(evcon, cb, arg);
+	if (cb != NULL) {
+		/* every chunk's callback runs, once the chunk is written */
+		struct evhttp_chunk_cb *ccb = mm_malloc(sizeof(*ccb));
+		if (ccb == NULL) {
+			event_warn("%s: malloc", __func__);
+		} else {
+			ccb->cb = cb;
+			ccb->arg = arg;
+			TAILQ_INSERT_TAIL(&REQ_UPCAST(req)->chunk_cbs, ccb, next);
+		}
+	}
+	if (req->flags & EVHTTP_REQ_REPLY_QUEUED)
+		return;
+	evhttp_write_buffer(evcon, evhttp_send_chunk_done, NULL);
 }
 
 void
@@ -3106,11 +4029,25 @@ evhttp_send_reply_end(struct evhttp_request *req)
 		return;
 	}
 
-	output = bufferevent_get_output(evcon->bufev);
-
 	/* we expect no more calls form the user on this request */
 	req->userdone = 1;
 
+	if (evcon->h2) {
+		evhttp_h2_send_end_(req);
+		return;
+	}
+
+	if (req->flags & EVHTTP_REQ_REPLY_QUEUED) {
+		/* sent along with the rest once it is our turn */
+		if (req->chunked) {
+			evbuffer_add(req->output_buffer, "0\r\n\r\n", 5);
+			req->chunked = 0;
+		}
+		return;
+	}
+
+	output = bufferevent_get_output(evcon->bufev);
+
 	if (req->chunked) {
 		evbuffer_add(output, "0\r\n\r\n", 5);
 		evhttp_write_buffer(req->evcon, evhttp_send_done, NULL);
@@ -3482,7 +4419,8 @@ evhttp_parse_query_impl(const char *str, struct evkeyvalq *headers,
 		event_debug(("Query Param: %s -> %s\n", key, decoded_value));
 		if (flags & EVHTTP_URI_QUERY_LAST_VAL)
 			evhttp_remove_header(headers, key);
-		evhttp_add_header_internal(headers, key, decoded_value);
+		evhttp_add_header_internal(headers, key, strlen(key),
+		    decoded_value, strlen(decoded_value));
 		mm_free(decoded_value);
 	}
 
@@ -3514,10 +4452,169 @@ evhttp_parse_query_str_flags(const char *uri, struct evkeyvalq *headers, unsigne
 	return evhttp_parse_query_impl(uri, headers, 0, flags);
 }
 
+static inline unsigned
+hash_evhttp_cb(const struct evhttp_cb *cb)
+{
+	return ht_string_hash_(cb->what);
+}
+
+static inline int
+eq_evhttp_cb(const struct evhttp_cb *a, const struct evhttp_cb *b)
+{
+	return !strcmp(a->what, b->what);
+}
+
+HT_PROTOTYPE(evhttp_cb_map, evhttp_cb, map_node, hash_evhttp_cb,
+    eq_evhttp_cb)
+HT_GENERATE(evhttp_cb_map, evhttp_cb, map_node, hash_evhttp_cb,
+    eq_evhttp_cb, 0.5, mm_malloc, mm_realloc, mm_free)
+
+/*
+ * Prefix callbacks live in a radix tree: every edge is labelled with a run
+ * of bytes, and the children of a node start with distinct bytes.  Looking
+ * up a path costs one step per edge along it, however many prefixes are
+ * registered.
+ */
+struct evhttp_route_node {
+	struct evhttp_route_node *children;
+	struct evhttp_route_node *sibling;
+
+	/* the callback for the prefix that ends at this node, if any */
+	struct evhttp_cb *cb;
+
+	char *label;
+	size_t len;
+};
+
+static struct evhttp_route_node *
+evhttp_route_node_new(const char *label, size_t len)
+{
+	struct evhttp_route_node *node;
+
+	if ((node = mm_calloc(1, sizeof(*node) + len)) == NULL) {
+		event_warn("%s: calloc", __func__);
+		return (NULL);
+	}
+	node->label = (char *)(node + 1);
+	memcpy(node->label, label, len);
+	node->len = len;
+	return (node);
+}
+
+static void
+evhttp_route_node_free(struct evhttp_route_node *node)
+{
+	struct evhttp_route_node *child, *next;
+
+	for (child = node->children; child != NULL; child = next) {
+		next = child->sibling;
+		evhttp_route_node_free(child);
+	}
+	mm_free(node);
+}
+
+/* Returns the node for key below root, splitting edges and adding nodes
+ * as needed. */
+static struct evhttp_route_node *
+evhttp_route_node_get(struct evhttp_route_node *root, const char *key)
+{
+	struct evhttp_route_node *parent = root, *node, *mid;
+	struct evhttp_route_node **link;
+	size_t len = strlen(key), n;
+
+	while (len) {
+		for (link = &parent->children; (node = *link) != NULL;
+		     link = &node->sibling) {
+			if (node->label[0] == key[0])
+				break;
+		}
+		if (node == NULL) {
+			if ((node = evhttp_route_node_new(key, len)) == NULL)
+				return (NULL);
+			*link = node;
+			return (node);
+		}
+
+		for (n = 1; n < node->len && n < len; ++n) {
+			if (node->label[n] != key[n])
+				break;
+		}
+		if (n < node->len) {
+			/* the key leaves this edge halfway; split it */
+			if ((mid = evhttp_route_node_new(key, n)) == NULL)
+				return (NULL);
+			mid->sibling = node->sibling;
+			mid->children = node;
+			node->sibling = NULL;
+			node->label += n;
+			node->len -= n;
+			*link = mid;
+			node = mid;
+		}
+
+		parent = node;
+		key += n;
+		len -= n;
+	}
+
+	return (parent);
+}
+
+/* Returns the callback for the longest registered prefix of path. */
 static struct evhttp_cb *
-evhttp_dispatch_callback(struct httpcbq *callbacks, struct evhttp_request *req)
+evhttp_route_lookup(const struct evhttp_route_node *node, const char *path)
+{
+	struct evhttp_cb *best = node->cb;
+	size_t len = strlen(path);
+
+	while (len) {
+		for (node = node->children; node != NULL; node = node->sibling) {
+			if (node->label[0] == path[0])
+				break;
+		}
+		if (node == NULL || node->len > len ||
+		    memcmp(node->label, path, node->len))
+			break;
+		if (node->cb != NULL)
+			best = node->cb;
+		path += node->len;
+		len -= node->len;
+	}
+
+	return (best);
+}
+
+/* Rebuilds the radix tree of prefix callbacks from http->callbacks,
+ * leaving out skip.  On failure the old tree is kept. */
+static int
+evhttp_route_rebuild(struct evhttp *http, const struct evhttp_cb *skip)
 {
+	struct evhttp_route_node *root, *node;
 	struct evhttp_cb *cb;
+
+	if ((root = evhttp_route_node_new("", 0)) == NULL)
+		return (-1);
+	TAILQ_FOREACH(cb, &http->callbacks, next) {
+		if (!cb->is_prefix || cb == skip)
+			continue;
+		if ((node = evhttp_route_node_get(root, cb->what)) == NULL) {
+			evhttp_route_node_free(root);
+			return (-1);
+		}
+		node->cb = cb;
+	}
+	if (http->prefix_callbacks != NULL)
+		evhttp_route_node_free(http->prefix_callbacks);
+	http->prefix_callbacks = root;
+
+	return (0);
+}
+
+static struct evhttp_cb *
+evhttp_dispatch_callback(struct evhttp *http, struct evhttp_request *req)
+{
+	struct evhttp_cb *cb, key;
+	char buf[256];
 	size_t offset = 0;
 	char *translated;
 	const char *path;
@@ -3525,20 +4622,22 @@ evhttp_dispatch_callback(struct httpcbq *callbacks, struct evhttp_request *req)
 	/* Test for different URLs */
 	path = evhttp_uri_get_path(req->uri_elems);
 	offset = strlen(path);
-	if ((translated = mm_malloc(offset + 1)) == NULL)
+	if (offset < sizeof(buf))
+		translated = buf;
+	else if ((translated = mm_malloc(offset + 1)) == NULL)
 		return (NULL);
 	evhttp_decode_uri_internal(path, offset, translated,
 	    0 /* decode_plus */);
 
-	TAILQ_FOREACH(cb, callbacks, next) {
-		if (!strcmp(cb->what, translated)) {
-			mm_free(translated);
-			return (cb);
-		}
-	}
+	/* exact paths first, then the longest matching prefix */
+	key.what = translated;
+	cb = HT_FIND(evhttp_cb_map, &http->exact_callbacks, &key);
+	if (cb == NULL && http->prefix_callbacks != NULL)
+		cb = evhttp_route_lookup(http->prefix_callbacks, translated);
 
-	mm_free(translated);
-	return (NULL);
+	if (translated != buf)
+		mm_free(translated);
+	return (cb);
 }
 
 
@@ -3654,7 +4753,10 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 	/* we have a new request on which the user needs to take action */
 	req->userdone = 0;
 
-	bufferevent_disable(req->evcon->bufev, EV_READ);
+	/* unless we are reading the next pipelined request, or the other
+	 * streams of an HTTP/2 connection */
+	if (!req->evcon->h2 && !evhttp_connection_is_reading(req->evcon))
+		bufferevent_disable(req->evcon->bufev, EV_READ);
 
 	if (req->uri == NULL) {
 		evhttp_send_error(req, req->response_code, NULL);
@@ -3674,7 +4776,7 @@ evhttp_handle_request(struct evhttp_request *req, void *arg)
 		evhttp_find_vhost(http, &http, hostname);
 	}
 
-	if ((cb = evhttp_dispatch_callback(&http->callbacks, req)) != NULL) {
+	if ((cb = evhttp_dispatch_callback(http, req)) != NULL) {
 		(*cb->cb)(req, cb->cbarg);
 		return;
 	}
@@ -3862,6 +4964,7 @@ evhttp_new_object(void)
 
 	evhttp_set_max_headers_size(http, EV_SIZE_MAX);
 	evhttp_set_max_body_size(http, EV_SIZE_MAX);
+	evhttp_set_max_pipelined_requests(http, 1);
 	evhttp_set_default_content_type(http, "text/html; charset=ISO-8859-1");
 	evhttp_set_allowed_methods(http,
 	    EVHTTP_REQ_GET |
@@ -3872,6 +4975,7 @@ evhttp_new_object(void)
 
 	TAILQ_INIT(&http->sockets);
 	TAILQ_INIT(&http->callbacks);
+	HT_INIT(evhttp_cb_map, &http->exact_callbacks);
 	TAILQ_INIT(&http->connections);
 	TAILQ_INIT(&http->virtualhosts);
 	TAILQ_INIT(&http->aliases);
@@ -3940,6 +5044,9 @@ evhttp_free(struct evhttp* http)
 		mm_free(http_cb->what);
 		mm_free(http_cb);
 	}
+	HT_CLEAR(evhttp_cb_map, &http->exact_callbacks);
+	if (http->prefix_callbacks != NULL)
+		evhttp_route_node_free(http->prefix_callbacks);
 
 	while ((vhost = TAILQ_FIRST(&http->virtualhosts)) != NULL) {
 		TAILQ_REMOVE(&http->virtualhosts, vhost, next_vhost);
@@ -4055,6 +5162,7 @@ int evhttp_set_flags(struct evhttp *http, int flags)
 {
 	int avail_flags = 0;
 	avail_flags |= EVHTTP_SERVER_LINGERING_CLOSE;
+	avail_flags |= EVHTTP_SERVER_HTTP2;
 
 	if (flags & ~avail_flags)
 		return 1;
@@ -4083,6 +5191,14 @@ evhttp_set_max_body_size(struct evhttp* http, ev_ssize_t max_body_size)
 		http->default_max_body_size = max_body_size;
 }
 
+void
+evhttp_set_max_pipelined_requests(struct evhttp *http, int max_requests)
+{
+	if (max_requests < 1)
+		max_requests = 1;
+	http->max_pipelined_requests = max_requests;
+}
+
 void
 evhttp_set_default_content_type(struct evhttp *http,
 	const char *content_type) {
@@ -4101,16 +5217,32 @@ evhttp_set_ext_method_cmp(struct evhttp *http, evhttp_ext_method_cb cmp)
 	http->ext_method_cmp = cmp;
 }
 
-int
-evhttp_set_cb(struct evhttp *http, const char *uri,
-    void (*cb)(struct evhttp_request *, void *), void *cbarg)
+static struct evhttp_cb *
+evhttp_find_cb(struct evhttp *http, const char *uri, int is_prefix)
 {
-	struct evhttp_cb *http_cb;
+	struct evhttp_cb *http_cb, key;
+
+	if (!is_prefix) {
+		key.what = (char *)uri;
+		return (HT_FIND(evhttp_cb_map, &http->exact_callbacks, &key));
+	}
 
 	TAILQ_FOREACH(http_cb, &http->callbacks, next) {
-		if (strcmp(http_cb->what, uri) == 0)
-			return (-1);
+		if (http_cb->is_prefix && strcmp(http_cb->what, uri) == 0)
+			return (http_cb);
 	}
+	return (NULL);
+}
+
+static int
+evhttp_add_cb(struct evhttp *http, const char *uri, int is_prefix,
+    void (*cb)(struct evhttp_request *, void *), void *cbarg)
+{
+	struct evhttp_cb *http_cb;
+	struct evhttp_route_node *node;
+
+	if (evhttp_find_cb(http, uri, is_prefix) != NULL)
+		return (-1);
 
 	if ((http_cb = mm_calloc(1, sizeof(struct evhttp_cb))) == NULL) {
 		event_warn("%s: calloc", __func__);
@@ -4123,26 +5255,49 @@ evhttp_set_cb(struct evhttp *http, const char *uri,
 		mm_free(http_cb);
 		return (-3);
 	}
+	http_cb->is_prefix = is_prefix;
 	http_cb->cb = cb;
 	http_cb->cbarg = cbarg;
 
+	if (is_prefix) {
+		if (http->prefix_callbacks == NULL &&
+		    (http->prefix_callbacks =
+			evhttp_route_node_new("", 0)) == NULL)
+			node = NULL;
+		else
+			node = evhttp_route_node_get(http->prefix_callbacks,
+			    uri);
+		if (node == NULL) {
+			mm_free(http_cb->what);
+			mm_free(http_cb);
+			return (-2);
+		}
+		node->cb = http_cb;
+	} else {
+		HT_INSERT(evhttp_cb_map, &http->exact_callbacks, http_cb);
+	}
+
 	TAILQ_INSERT_TAIL(&http->callbacks, http_cb, next);
 
 	return (0);
 }
 
-int
-evhttp_del_cb(struct evhttp *http, const char *uri)
+static int
+evhttp_remove_cb(struct evhttp *http, const char *uri, int is_prefix)
 {
 	struct evhttp_cb *http_cb;
 
-	TAILQ_FOREACH(http_cb, &http->callbacks, next) {
-		if (strcmp(http_cb->what, uri) == 0)
-			break;
-	}
-	if (http_cb == NULL)
+	if ((http_cb = evhttp_find_cb(http, uri, is_prefix)) == NULL)
 		return (-1);
 
+	if (is_prefix) {
+		if (evhttp_route_rebuild(http, http_cb) == -1) {
+			event_warnx("%s: cannot rebuild routes", __func__);
+			return (-1);
+		}
+	} else {
+		HT_REMOVE(evhttp_cb_map, &http->exact_callbacks, http_cb);
+	}
 	TAILQ_REMOVE(&http->callbacks, http_cb, next);
 	mm_free(http_cb->what);
 	mm_free(http_cb);
@@ -4150,6 +5305,32 @@ evhttp_del_cb(struct evhttp *http, const char *uri)
 	return (0);
 }
 
+int
+evhttp_set_cb(struct evhttp *http, const char *uri,
+    void (*cb)(struct evhttp_request *, void *), void *cbarg)
+{
+	return (evhttp_add_cb(http, uri, 0, cb, cbarg));
+}
+
+int
+evhttp_del_cb(struct evhttp *http, const char *uri)
+{
+	return (evhttp_remove_cb(http, uri, 0));
+}
+
+int
+evhttp_set_prefix_cb(struct evhttp *http, const char *prefix,
+    void (*cb)(struct evhttp_request *, void *), void *cbarg)
+{
+	return (evhttp_add_cb(http, prefix, 1, cb, cbarg));
+}
+
+int
+evhttp_del_prefix_cb(struct evhttp *http, const char *prefix)
+{
+	return (evhttp_remove_cb(http, prefix, 1));
+}
+
 void
 evhttp_set_gencb(struct evhttp *http,
     void (*cb)(struct evhttp_request *, void *), void *cbarg)
@@ -4181,24 +5362,30 @@ evhttp_set_newreqcb(struct evhttp *http,
 struct evhttp_request *
 evhttp_request_new(void (*cb)(struct evhttp_request *, void *), void *arg)
 {
+	struct evhttp_request_private *req_priv;
 	struct evhttp_request *req = NULL;
+	struct evhttp_header_index *index;
 
 	/* Allocate request structure */
-	if ((req = mm_calloc(1, sizeof(struct evhttp_request))) == NULL) {
+	if ((req_priv = mm_calloc(1, sizeof(*req_priv))) == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
 	}
+	req = &req_priv->req;
+	TAILQ_INIT(&req_priv->chunk_cbs);
 
 	req->headers_size = 0;
 	req->body_size = 0;
 
 	req->kind = EVHTTP_RESPONSE;
-	req->input_headers = mm_calloc(1, sizeof(struct evkeyvalq));
-	if (req->input_headers == NULL) {
+	index = mm_calloc(1, sizeof(struct evhttp_header_index));
+	if (index == NULL) {
 		event_warn("%s: calloc", __func__);
 		goto error;
 	}
-	TAILQ_INIT(req->input_headers);
+	TAILQ_INIT(&index->headers);
+	index->indexed_tail = index->headers.tqh_last;
+	req->input_headers = &index->headers;
 
 	req->output_headers = mm_calloc(1, sizeof(struct evkeyvalq));
 	if (req->output_headers == NULL) {
@@ -4231,6 +5418,9 @@ evhttp_request_new(void (*cb)(struct evhttp_request *, void *), void *arg)
 void
 evhttp_request_free(struct evhttp_request *req)
 {
+	struct evhttp_request_private *req_priv = REQ_UPCAST(req);
+	struct evhttp_chunk_cb *ccb;
+
 	if ((req->flags & EVHTTP_REQ_DEFER_FREE) != 0) {
 		req->flags |= EVHTTP_REQ_NEEDS_FREE;
 		return;
@@ -4247,8 +5437,12 @@ evhttp_request_free(struct evhttp_request *req)
 	if (req->host_cache != NULL)
 		mm_free(req->host_cache);
 
-	evhttp_clear_headers(req->input_headers);
-	mm_free(req->input_headers);
+	if (req->input_headers != NULL) {
+		evhttp_header_index_detach(
+		    (struct evhttp_header_index *)req->input_headers);
+		evhttp_clear_headers(req->input_headers);
+		mm_free(req->input_headers);
+	}
 
 	evhttp_clear_headers(req->output_headers);
 	mm_free(req->output_headers);
@@ -4259,7 +5453,12 @@ evhttp_request_free(struct evhttp_request *req)
 	if (req->output_buffer != NULL)
 		evbuffer_free(req->output_buffer);
 
-	mm_free(req);
+	while ((ccb = TAILQ_FIRST(&req_priv->chunk_cbs)) != NULL) {
+		TAILQ_REMOVE(&req_priv->chunk_cbs, ccb, next);
+		mm_free(ccb);
+	}
+
+	mm_free(req_priv);
 }
 
 void
@@ -4348,7 +5547,7 @@ evhttp_request_get_host(struct evhttp_request *req)
 		const char *p;
 		size_t len;
 
-		host = evhttp_find_header(req->input_headers, "Host");
+		host = evhttp_find_input_header_(req, EVHTTP_HDR_HOST);
 		/* The Host: header may include a port. Remove it here
 		   to be consistent with uri_elems case above. */
 		if (host) {
@@ -4458,6 +5657,7 @@ evhttp_get_request_connection(
 
 	evcon->max_headers_size = http->default_max_headers_size;
 	evcon->max_body_size = http->default_max_body_size;
+	evcon->max_pipelined = http->max_pipelined_requests;
 	if (http->flags & EVHTTP_SERVER_LINGERING_CLOSE)
 		evcon->flags |= EVHTTP_CON_LINGERING_CLOSE;
 
@@ -4481,18 +5681,18 @@ err:
 	return (NULL);
 }
 
-static int
-evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
+struct evhttp_request *
+evhttp_new_incoming_request_(struct evhttp_connection *evcon)
 {
 	struct evhttp *http = evcon->http_server;
 	struct evhttp_request *req;
 	if ((req = evhttp_request_new(evhttp_handle_request, http)) == NULL)
-		return (-1);
+		return (NULL);
 
 	if ((req->remote_host = mm_strdup(evcon->address)) == NULL) {
 		event_warn("%s: strdup", __func__);
 		evhttp_request_free(req);
-		return (-1);
+		return (NULL);
 	}
 	req->remote_port = evcon->port;
 
@@ -4509,9 +5709,20 @@ evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
 
 	if (http->newreqcb && http->newreqcb(req, http->newreqcbarg) == -1) {
 		evhttp_request_free(req);
-		return (-1);
+		return (NULL);
 	}
 
+	return (req);
+}
+
+static int
+evhttp_associate_new_request_with_connection(struct evhttp_connection *evcon)
+{
+	struct evhttp_request *req;
+
+	if ((req = evhttp_new_incoming_request_(evcon)) == NULL)
+		return (-1);
+
 	TAILQ_INSERT_TAIL(&evcon->requests, req, next);
 
 	evhttp_start_read_(evcon);
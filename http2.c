@@ -0,0 +1,1827 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+  The server side of HTTP/2 (RFC 9113) for evhttp.
+
+  A connection gets here from http.c, either because the client opened
+  with the HTTP/2 connection preface (prior knowledge, or ALPN "h2" on a
+  TLS bufferevent), or because its first request asked for "Upgrade: h2c".
+  From then on the bufferevent callbacks are ours.  Each stream carries an
+  ordinary struct evhttp_request, which is handed to the same callbacks as
+  an HTTP/1.x request, and whose reply comes back here through
+  evhttp_send_reply() and friends.
+
+  We never push, and we ignore priorities.  The HPACK encoder does not use
+  the dynamic table or Huffman coding; the decoder supports all of it.
+ */
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include <sys/queue.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event2/http.h"
+#include "event2/event.h"
+#include "event2/buffer.h"
+#include "event2/bufferevent.h"
+#include "event2/http_struct.h"
+#include "event2/util.h"
+#include "log-internal.h"
+#include "util-internal.h"
+#include "http-internal.h"
+#include "mm-internal.h"
+
+/* HPACK */
+
+static const struct {
+	const char *name;
+	const char *value;
+} hpack_static_table[] = {
+	/*  1 */ { ":authority", "" },
+	/*  2 */ { ":method", "GET" },
+	/*  3 */ { ":method", "POST" },
+	/*  4 */ { ":path", "/" },
+	/*  5 */ { ":path", "/index.html" },
+	/*  6 */ { ":scheme", "http" },
+	/*  7 */ { ":scheme", "https" },
+	/*  8 */ { ":status", "200" },
+	/*  9 */ { ":status", "204" },
+	/* 10 */ { ":status", "206" },
+	/* 11 */ { ":status", "304" },
+	/* 12 */ { ":status", "400" },
+	/* 13 */ { ":status", "404" },
+	/* 14 */ { ":status", "500" },
+	/* 15 */ { "accept-charset", "" },
+	/* 16 */ { "accept-encoding", "gzip, deflate" },
+	/* 17 */ { "accept-language", "" },
+	/* 18 */ { "accept-ranges", "" },
+	/* 19 */ { "accept", "" },
+	/* 20 */ { "access-control-allow-origin", "" },
+	/* 21 */ { "age", "" },
+	/* 22 */ { "allow", "" },
+	/* 23 */ { "authorization", "" },
+	/* 24 */ { "cache-control", "" },
+	/* 25 */ { "content-disposition", "" },
+	/* 26 */ { "content-encoding", "" },
+	/* 27 */ { "content-language", "" },
+	/* 28 */ { "content-length", "" },
+	/* 29 */ { "content-location", "" },
+	/* 30 */ { "content-range", "" },
+	/* 31 */ { "content-type", "" },
+	/* 32 */ { "cookie", "" },
+	/* 33 */ { "date", "" },
+	/* 34 */ { "etag", "" },
+	/* 35 */ { "expect", "" },
+	/* 36 */ { "expires", "" },
+	/* 37 */ { "from", "" },
+	/* 38 */ { "host", "" },
+	/* 39 */ { "if-match", "" },
+	/* 40 */ { "if-modified-since", "" },
+	/* 41 */ { "if-none-match", "" },
+	/* 42 */ { "if-range", "" },
+	/* 43 */ { "if-unmodified-since", "" },
+	/* 44 */ { "last-modified", "" },
+	/* 45 */ { "link", "" },
+	/* 46 */ { "location", "" },
+	/* 47 */ { "max-forwards", "" },
+	/* 48 */ { "proxy-authenticate", "" },
+	/* 49 */ { "proxy-authorization", "" },
+	/* 50 */ { "range", "" },
+	/* 51 */ { "referer", "" },
+	/* 52 */ { "refresh", "" },
+	/* 53 */ { "retry-after", "" },
+	/* 54 */ { "server", "" },
+	/* 55 */ { "set-cookie", "" },
+	/* 56 */ { "strict-transport-security", "" },
+	/* 57 */ { "transfer-encoding", "" },
+	/* 58 */ { "user-agent", "" },
+	/* 59 */ { "vary", "" },
+	/* 60 */ { "via", "" },
+	/* 61 */ { "www-authenticate", "" },
+};
+
+/* The Huffman code of RFC 7541, Appendix B, is canonical: for each code
+ * length, the codes are consecutive and belong to ascending symbols. */
+static const ev_uint32_t hpack_huff_first[31] = {
+	0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0x14, 0x5c,
+	0xf8, 0x0, 0x3f8, 0x7fa, 0xffa, 0x1ff8, 0x3ffc, 0x7ffc,
+	0x0, 0x0, 0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+	0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0, 0x3ffffffc,
+};
+static const ev_uint16_t hpack_huff_count[31] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0,
+	5, 3, 2, 6, 2, 3, 0, 0, 0, 3,
+	8, 13, 26, 29, 12, 4, 15, 19, 29, 0,
+	4,
+};
+static const ev_uint16_t hpack_huff_offset[31] = {
+	0, 0, 0, 0, 0, 0, 10, 36, 68, 0,
+	74, 79, 82, 84, 90, 92, 0, 0, 0, 95,
+	98, 106, 119, 145, 174, 186, 190, 205, 224, 0,
+	253,
+};
+/* the symbols, ordered by code */
+static const ev_uint16_t hpack_huff_syms[257] = {
+	48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+	45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+	95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+	77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+	106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+	88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+	0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+	6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+	21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+	249, 10, 13, 22, 256,
+};
+
+#define HPACK_STATIC_ENTRIES 61
+/* RFC 7541 section 4.1 */
+#define HPACK_ENTRY_OVERHEAD 32
+
+struct evhttp_hpack_entry {
+	size_t name_len;
+	size_t value_len;
+	/* followed by the name and then the value */
+};
+
+#define HPACK_ENTRY_NAME(e) ((const char *)((e) + 1))
+#define HPACK_ENTRY_VALUE(e) (HPACK_ENTRY_NAME(e) + (e)->name_len)
+
+void
+evhttp_hpack_init_(struct evhttp_hpack *hp, size_t max_size)
+{
+	memset(hp, 0, sizeof(*hp));
+	hp->max_size = hp->max_size_limit = max_size;
+}
+
+void
+evhttp_hpack_clear_(struct evhttp_hpack *hp)
+{
+	size_t i;
+
+	for (i = 0; i < hp->n_entries; ++i)
+		mm_free(hp->entries[i]);
+	if (hp->entries != NULL)
+		mm_free(hp->entries);
+	hp->entries = NULL;
+	hp->n_entries = hp->n_alloc = hp->size = 0;
+}
+
+static void
+hpack_evict(struct evhttp_hpack *hp, size_t max_size)
+{
+	while (hp->size > max_size) {
+		struct evhttp_hpack_entry *e = hp->entries[--hp->n_entries];
+		hp->size -= e->name_len + e->value_len + HPACK_ENTRY_OVERHEAD;
+		mm_free(e);
+	}
+}
+
+/* Adds an entry to the dynamic table.  The name may point into an entry
+ * that this evicts, so we copy it first. */
+static int
+hpack_add(struct evhttp_hpack *hp, const char *name, size_t name_len,
+    const char *value, size_t value_len)
+{
+	size_t size = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	struct evhttp_hpack_entry *e;
+
+	if (size > hp->max_size) {
+		/* not an error: it just empties the table */
+		hpack_evict(hp, 0);
+		return (0);
+	}
+
+	if ((e = mm_malloc(sizeof(*e) + name_len + value_len)) == NULL)
+		return (-1);
+	e->name_len = name_len;
+	e->value_len = value_len;
+	memcpy(e + 1, name, name_len);
+	memcpy((char *)(e + 1) + name_len, value, value_len);
+
+	hpack_evict(hp, hp->max_size - size);
+
+	if (hp->n_entries == hp->n_alloc) {
+		size_t n_alloc = hp->n_alloc ? hp->n_alloc * 2 : 16;
+		struct evhttp_hpack_entry **entries =
+		    mm_realloc(hp->entries, n_alloc * sizeof(*entries));
+		if (entries == NULL) {
+			mm_free(e);
+			return (-1);
+		}
+		hp->entries = entries;
+		hp->n_alloc = n_alloc;
+	}
+	memmove(hp->entries + 1, hp->entries,
+	    hp->n_entries * sizeof(*hp->entries));
+	hp->entries[0] = e;
+	++hp->n_entries;
+	hp->size += size;
+
+	return (0);
+}
+
+static int
+hpack_lookup(struct evhttp_hpack *hp, size_t index,
+    const char **name, size_t *name_len,
+    const char **value, size_t *value_len)
+{
+	const struct evhttp_hpack_entry *e;
+
+	if (index == 0)
+		return (-1);
+	if (index <= HPACK_STATIC_ENTRIES) {
+		*name = hpack_static_table[index - 1].name;
+		*name_len = strlen(*name);
+		*value = hpack_static_table[index - 1].value;
+		*value_len = strlen(*value);
+		return (0);
+	}
+	index -= HPACK_STATIC_ENTRIES + 1;
+	if (index >= hp->n_entries)
+		return (-1);
+	e = hp->entries[index];
+	*name = HPACK_ENTRY_NAME(e);
+	*name_len = e->name_len;
+	*value = HPACK_ENTRY_VALUE(e);
+	*value_len = e->value_len;
+	return (0);
+}
+
+/* RFC 7541 section 5.1; we give up on anything above 2^28 */
+static int
+hpack_decode_int(const unsigned char **pp, const unsigned char *end,
+    int prefix, size_t *out)
+{
+	const unsigned char *p = *pp;
+	size_t max = (1 << prefix) - 1;
+	size_t v;
+	int shift = 0;
+
+	if (p == end)
+		return (-1);
+	v = *p++ & max;
+	if (v == max) {
+		unsigned char b;
+		do {
+			if (p == end || shift > 21)
+				return (-1);
+			b = *p++;
+			v += (size_t)(b & 0x7f) << shift;
+			shift += 7;
+		} while (b & 0x80);
+	}
+
+	*pp = p;
+	*out = v;
+	return (0);
+}
+
+/* Decodes len bytes of Huffman coded data into out, which must have room
+ * for len * 8 / 5 bytes.  Returns the decoded length, or -1 if in is not
+ * properly coded. */
+static ev_ssize_t
+hpack_huff_decode(const unsigned char *in, size_t len, char *out)
+{
+	ev_uint32_t code = 0;
+	int bits = 0;
+	char *o = out;
+	size_t i;
+	int b;
+
+	for (i = 0; i < len; ++i) {
+		for (b = 7; b >= 0; --b) {
+			ev_uint32_t n;
+			code = (code << 1) | ((in[i] >> b) & 1);
+			++bits;
+			n = code - hpack_huff_first[bits];
+			if (n < hpack_huff_count[bits]) {
+				int sym = hpack_huff_syms[
+				    hpack_huff_offset[bits] + n];
+				if (sym == 256)
+					return (-1); /* EOS */
+				*o++ = (char)sym;
+				code = 0;
+				bits = 0;
+			} else if (bits == 30) {
+				return (-1);
+			}
+		}
+	}
+
+	/* what is left over must be a prefix of EOS, i.e. all ones, and
+	 * shorter than a byte */
+	if (bits > 7 || code != (1u << bits) - 1)
+		return (-1);
+
+	return (o - out);
+}
+
+/* Decodes a string literal, RFC 7541 section 5.2.  Raw strings point into
+ * the block; Huffman coded ones are decoded into *to_free. */
+static int
+hpack_decode_string(const unsigned char **pp, const unsigned char *end,
+    const char **str, size_t *len, char **to_free)
+{
+	int huffman;
+	size_t n;
+
+	if (*pp == end)
+		return (-1);
+	huffman = **pp & 0x80;
+	if (hpack_decode_int(pp, end, 7, &n) == -1 ||
+	    n > (size_t)(end - *pp))
+		return (-1);
+
+	if (!huffman) {
+		*str = (const char *)*pp;
+		*len = n;
+	} else {
+		char *buf = mm_malloc(n * 8 / 5 + 1);
+		ev_ssize_t r;
+		if (buf == NULL)
+			return (-1);
+		if ((r = hpack_huff_decode(*pp, n, buf)) == -1) {
+			mm_free(buf);
+			return (-1);
+		}
+		*str = buf;
+		*len = r;
+		*to_free = buf;
+	}
+
+	*pp += n;
+	return (0);
+}
+
+int
+evhttp_hpack_decode_(struct evhttp_hpack *hp,
+    const unsigned char *block, size_t len,
+    void (*cb)(void *, const char *, size_t, const char *, size_t),
+    void *arg)
+{
+	const unsigned char *p = block, *end = block + len;
+	int seen_header = 0;
+
+	while (p < end) {
+		const char *name, *value;
+		size_t name_len, value_len, index;
+		char *name_buf = NULL, *value_buf = NULL;
+		int add;
+
+		if (*p & 0x80) {
+			/* indexed header field */
+			if (hpack_decode_int(&p, end, 7, &index) == -1 ||
+			    hpack_lookup(hp, index, &name, &name_len,
+				&value, &value_len) == -1)
+				return (-1);
+			(*cb)(arg, name, name_len, value, value_len);
+			seen_header = 1;
+			continue;
+		}
+
+		if ((*p & 0xe0) == 0x20) {
+			/* dynamic table size update; only at the start */
+			if (seen_header ||
+			    hpack_decode_int(&p, end, 5, &index) == -1 ||
+			    index > hp->max_size_limit)
+				return (-1);
+			hp->max_size = index;
+			hpack_evict(hp, index);
+			continue;
+		}
+
+		/* a literal, with incremental indexing or not */
+		add = (*p & 0x40) != 0;
+		if (hpack_decode_int(&p, end, add ? 6 : 4, &index) == -1)
+			return (-1);
+		if (index) {
+			if (hpack_lookup(hp, index, &name, &name_len,
+				&value, &value_len) == -1)
+				return (-1);
+		} else if (hpack_decode_string(&p, end, &name, &name_len,
+			&name_buf) == -1) {
+			return (-1);
+		}
+		if (hpack_decode_string(&p, end, &value, &value_len,
+			&value_buf) == -1)
+			goto fail;
+
+		/* before hpack_add(), which may evict what name points to */
+		(*cb)(arg, name, name_len, value, value_len);
+		seen_header = 1;
+		if (add && hpack_add(hp, name, name_len, value, value_len) == -1)
+			goto fail;
+
+		if (name_buf != NULL)
+			mm_free(name_buf);
+		if (value_buf != NULL)
+			mm_free(value_buf);
+		continue;
+	fail:
+		if (name_buf != NULL)
+			mm_free(name_buf);
+		if (value_buf != NULL)
+			mm_free(value_buf);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+hpack_encode_int(struct evbuffer *out, unsigned char first, int prefix,
+    size_t v)
+{
+	unsigned char buf[16];
+	size_t max = (1 << prefix) - 1;
+	size_t n = 0;
+
+	if (v < max) {
+		buf[n++] = first | (unsigned char)v;
+	} else {
+		buf[n++] = first | (unsigned char)max;
+		v -= max;
+		while (v >= 0x80) {
+			buf[n++] = (unsigned char)((v & 0x7f) | 0x80);
+			v >>= 7;
+		}
+		buf[n++] = (unsigned char)v;
+	}
+	evbuffer_add(out, buf, n);
+}
+
+void
+evhttp_hpack_encode_(struct evbuffer *out, const char *name,
+    const char *value)
+{
+	size_t name_len = strlen(name), value_len = strlen(value);
+	char buf[64];
+	size_t i, n;
+
+	/* a literal header field without indexing, RFC 7541 section 6.2.2 */
+	for (i = 0; i < HPACK_STATIC_ENTRIES; ++i) {
+		if (!evutil_ascii_strcasecmp(hpack_static_table[i].name, name))
+			break;
+	}
+	if (i < HPACK_STATIC_ENTRIES) {
+		hpack_encode_int(out, 0x00, 4, i + 1);
+	} else {
+		/* HTTP/2 wants the names in lower case */
+		hpack_encode_int(out, 0x00, 4, 0);
+		hpack_encode_int(out, 0x00, 7, name_len);
+		for (i = 0; i < name_len; i += n) {
+			size_t j;
+			n = name_len - i < sizeof(buf) ? name_len - i : sizeof(buf);
+			for (j = 0; j < n; ++j)
+				buf[j] = EVUTIL_TOLOWER_(name[i + j]);
+			evbuffer_add(out, buf, n);
+		}
+	}
+	hpack_encode_int(out, 0x00, 7, value_len);
+	evbuffer_add(out, value, value_len);
+}
+
+/* HTTP/2 */
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER_LEN 9
+#define H2_DEFAULT_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_DEFAULT_FRAME_SIZE 16384
+#define H2_MAX_FRAME_SIZE 16777215
+#define H2_HEADER_TABLE_SIZE 4096
+#define H2_MAX_STREAMS 100
+/* the most we buffer of a header block that is still being continued */
+#define H2_MAX_HEADER_BLOCK (256 * 1024)
+/* the most decoded header list we accept, whatever max_headers_size says;
+ * HPACK lets a small block expand to far more than H2_MAX_HEADER_BLOCK */
+#define H2_MAX_HEADER_LIST (64 * 1024)
+
+enum h2_frame_type {
+	H2_DATA = 0,
+	H2_HEADERS = 1,
+	H2_PRIORITY = 2,
+	H2_RST_STREAM = 3,
+	H2_SETTINGS = 4,
+	H2_PUSH_PROMISE = 5,
+	H2_PING = 6,
+	H2_GOAWAY = 7,
+	H2_WINDOW_UPDATE = 8,
+	H2_CONTINUATION = 9
+};
+
+#define H2_FLAG_END_STREAM	0x01
+#define H2_FLAG_ACK		0x01
+#define H2_FLAG_END_HEADERS	0x04
+#define H2_FLAG_PADDED		0x08
+#define H2_FLAG_PRIORITY	0x20
+
+enum h2_error {
+	H2_NO_ERROR = 0x0,
+	H2_PROTOCOL_ERROR = 0x1,
+	H2_INTERNAL_ERROR = 0x2,
+	H2_FLOW_CONTROL_ERROR = 0x3,
+	H2_STREAM_CLOSED = 0x5,
+	H2_FRAME_SIZE_ERROR = 0x6,
+	H2_REFUSED_STREAM = 0x7,
+	H2_CANCEL = 0x8,
+	H2_COMPRESSION_ERROR = 0x9,
+	H2_ENHANCE_YOUR_CALM = 0xb
+};
+
+enum h2_setting {
+	H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+	H2_SETTINGS_ENABLE_PUSH = 0x2,
+	H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+	H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+	H2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+	H2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+};
+
+struct evhttp_h2_stream {
+	TAILQ_ENTRY(evhttp_h2_stream) next;
+	struct evhttp_h2 *session;
+	struct evhttp_request *req;
+	ev_uint32_t id;
+
+	/* how much DATA the client lets us send; a SETTINGS frame can make
+	 * this negative */
+	ev_int64_t send_window;
+	/* reply body that flow control is holding back */
+	struct evbuffer *pending;
+	/* from evhttp_send_reply_chunk_with_cb(); called once pending has
+	 * been written */
+	void (*chunk_cb)(struct evhttp_connection *, void *);
+	void *chunk_cb_arg;
+
+	unsigned remote_closed:1;	/* the client sent END_STREAM */
+	unsigned dispatched:1;		/* the request went to the user */
+	unsigned reply_started:1;	/* our HEADERS went out */
+	unsigned no_body:1;		/* the reply must not have a body */
+	unsigned end_queued:1;		/* END_STREAM goes after pending */
+};
+
+TAILQ_HEAD(evhttp_h2_streamq, evhttp_h2_stream);
+
+struct evhttp_h2 {
+	struct evhttp_connection *evcon;
+
+	struct evhttp_h2_streamq streams;
+	int n_streams;
+	/* the highest stream the client opened */
+	ev_uint32_t last_stream_id;
+
+	struct evhttp_hpack decoder;
+
+	/* a header block waiting for its CONTINUATION frames */
+	struct evbuffer *header_block;
+	ev_uint32_t header_block_stream;
+	ev_uint8_t header_block_flags;
+	unsigned header_block_new:1;	/* it opens a stream */
+
+	/* connection level flow control window of what we send */
+	ev_int64_t send_window;
+	/* the client's settings */
+	ev_uint32_t peer_initial_window;
+	ev_uint32_t peer_max_frame_size;
+
+	unsigned want_preface:1;	/* the client preface is still due */
+	unsigned goaway_received:1;
+	unsigned closing:1;		/* free evcon once output is flushed */
+};
+
+static void h2_stream_flush(struct evhttp_h2_stream *stream);
+
+static ev_uint32_t
+h2_get32(const unsigned char *p)
+{
+	return ((ev_uint32_t)p[0] << 24) | ((ev_uint32_t)p[1] << 16) |
+	    ((ev_uint32_t)p[2] << 8) | p[3];
+}
+
+static struct evbuffer *
+h2_output(struct evhttp_h2 *h2)
+{
+	return bufferevent_get_output(h2->evcon->bufev);
+}
+
+static void
+h2_frame_header(struct evbuffer *out, size_t len, enum h2_frame_type type,
+    ev_uint8_t flags, ev_uint32_t stream_id)
+{
+	unsigned char hdr[H2_FRAME_HEADER_LEN];
+
+	hdr[0] = (unsigned char)(len >> 16);
+	hdr[1] = (unsigned char)(len >> 8);
+	hdr[2] = (unsigned char)len;
+	hdr[3] = (unsigned char)type;
+	hdr[4] = flags;
+	hdr[5] = (unsigned char)((stream_id >> 24) & 0x7f);
+	hdr[6] = (unsigned char)(stream_id >> 16);
+	hdr[7] = (unsigned char)(stream_id >> 8);
+	hdr[8] = (unsigned char)stream_id;
+	evbuffer_add(out, hdr, sizeof(hdr));
+}
+
+/* RST_STREAM and WINDOW_UPDATE both carry a single 32 bit value */
+static void
+h2_send_u32(struct evhttp_h2 *h2, enum h2_frame_type type,
+    ev_uint32_t stream_id, ev_uint32_t value)
+{
+	unsigned char buf[4];
+	struct evbuffer *out = h2_output(h2);
+
+	buf[0] = (unsigned char)(value >> 24);
+	buf[1] = (unsigned char)(value >> 16);
+	buf[2] = (unsigned char)(value >> 8);
+	buf[3] = (unsigned char)value;
+	h2_frame_header(out, sizeof(buf), type, 0, stream_id);
+	evbuffer_add(out, buf, sizeof(buf));
+}
+
+/* The largest decoded header list we accept on h2 */
+static size_t
+h2_max_header_list(struct evhttp_h2 *h2)
+{
+	if (h2->evcon->max_headers_size < H2_MAX_HEADER_LIST)
+		return (h2->evcon->max_headers_size);
+	return (H2_MAX_HEADER_LIST);
+}
+
+static void
+h2_send_settings(struct evhttp_h2 *h2)
+{
+	unsigned char buf[12];
+	size_t len = 0;
+	struct evbuffer *out = h2_output(h2);
+	ev_uint32_t max_headers = (ev_uint32_t)h2_max_header_list(h2);
+
+	buf[len++] = 0;
+	buf[len++] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = 0;
+	buf[len++] = H2_MAX_STREAMS;
+	buf[len++] = 0;
+	buf[len++] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+	buf[len++] = (unsigned char)(max_headers >> 24);
+	buf[len++] = (unsigned char)(max_headers >> 16);
+	buf[len++] = (unsigned char)(max_headers >> 8);
+	buf[len++] = (unsigned char)max_headers;
+	h2_frame_header(out, len, H2_SETTINGS, 0, 0);
+	evbuffer_add(out, buf, len);
+}
+
+/* Ends the connection with a GOAWAY; the write callback frees it once
+ * that has gone out. */
+static void
+h2_connection_error(struct evhttp_h2 *h2, enum h2_error code)
+{
+	unsigned char buf[8];
+	struct evbuffer *out;
+
+	if (h2->closing)
+		return;
+	h2->closing = 1;
+
+	out = h2_output(h2);
+	buf[0] = (unsigned char)(h2->last_stream_id >> 24);
+	buf[1] = (unsigned char)(h2->last_stream_id >> 16);
+	buf[2] = (unsigned char)(h2->last_stream_id >> 8);
+	buf[3] = (unsigned char)h2->last_stream_id;
+	buf[4] = buf[5] = buf[6] = 0;
+	buf[7] = (unsigned char)code;
+	h2_frame_header(out, sizeof(buf), H2_GOAWAY, 0, 0);
+	evbuffer_add(out, buf, sizeof(buf));
+
+	bufferevent_disable(h2->evcon->bufev, EV_READ);
+	bufferevent_enable(h2->evcon->bufev, EV_WRITE);
+}
+
+static struct evhttp_h2_stream *
+h2_find_stream(struct evhttp_h2 *h2, ev_uint32_t id)
+{
+	struct evhttp_h2_stream *stream;
+
+	TAILQ_FOREACH(stream, &h2->streams, next) {
+		if (stream->id == id)
+			return (stream);
+	}
+	return (NULL);
+}
+
+static struct evhttp_h2_stream *
+h2_stream_new(struct evhttp_h2 *h2, ev_uint32_t id,
+    struct evhttp_request *req)
+{
+	struct evhttp_h2_stream *stream;
+
+	if ((stream = mm_calloc(1, sizeof(*stream))) == NULL)
+		return (NULL);
+	if ((stream->pending = evbuffer_new()) == NULL) {
+		mm_free(stream);
+		return (NULL);
+	}
+	stream->session = h2;
+	stream->id = id;
+	stream->req = req;
+	stream->send_window = h2->peer_initial_window;
+
+	req->h2_stream = stream;
+	req->major = 2;
+	req->minor = 0;
+
+	TAILQ_INSERT_TAIL(&h2->streams, stream, next);
+	++h2->n_streams;
+
+	return (stream);
+}
+
+/* Forgets about stream.  Its request is freed, unless the user still
+ * holds it; then it loses its connection, as it would on HTTP/1.x. */
+static void
+h2_stream_close(struct evhttp_h2_stream *stream, int completed)
+{
+	struct evhttp_h2 *h2 = stream->session;
+	struct evhttp_request *req = stream->req;
+
+	TAILQ_REMOVE(&h2->streams, stream, next);
+	--h2->n_streams;
+	evbuffer_free(stream->pending);
+	mm_free(stream);
+
+	req->h2_stream = NULL;
+	if (!req->userdone) {
+		req->evcon = NULL;
+	} else {
+		if (completed && req->on_complete_cb != NULL)
+			req->on_complete_cb(req, req->on_complete_cb_arg);
+		evhttp_request_free(req);
+	}
+
+	if (h2->goaway_received && h2->n_streams == 0)
+		h2_connection_error(h2, H2_NO_ERROR);
+}
+
+static void
+h2_stream_reset(struct evhttp_h2_stream *stream, enum h2_error code)
+{
+	h2_send_u32(stream->session, H2_RST_STREAM, stream->id, code);
+	h2_stream_close(stream, 0);
+}
+
+/* Hands the request on stream to the user, now that it is complete. */
+static void
+h2_stream_dispatch(struct evhttp_h2_stream *stream)
+{
+	struct evhttp_request *req = stream->req;
+
+	stream->remote_closed = 1;
+	if (stream->reply_started)
+		return;
+	stream->dispatched = 1;
+	(*req->cb)(req, req->cb_arg);
+}
+
+/* Our END_STREAM has been sent */
+static void
+h2_stream_end_sent(struct evhttp_h2_stream *stream)
+{
+	/* we do not need the rest of the request body */
+	if (!stream->remote_closed)
+		h2_send_u32(stream->session, H2_RST_STREAM, stream->id,
+		    H2_NO_ERROR);
+	h2_stream_close(stream, 1);
+}
+
+static int
+h2_is_connection_header(const char *name, size_t len)
+{
+	static const char *const names[] = {
+		"connection", "keep-alive", "proxy-connection",
+		"transfer-encoding", "upgrade"
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (strlen(names[i]) == len &&
+		    !evutil_ascii_strncasecmp(names[i], name, len))
+			return (1);
+	}
+	return (0);
+}
+
+/* What we learn from a header block while it is being decoded */
+struct h2_header_ctx {
+	/* NULL if we only decode to keep the HPACK state in sync */
+	struct evhttp_request *req;
+	/* as in SETTINGS_MAX_HEADER_LIST_SIZE */
+	size_t size;
+	/* once size goes over this we stop keeping headers */
+	size_t max_size;
+	char *path;
+	size_t path_len;
+	char *authority;
+	size_t authority_len;
+	/* all cookie headers, joined; RFC 9113 section 8.2.3 */
+	char *cookie;
+	size_t cookie_len;
+	size_t cookie_alloc;
+	unsigned has_method:1;
+	unsigned has_scheme:1;
+	unsigned regular_seen:1;
+	unsigned malformed:1;
+	unsigned too_large:1;
+};
+
+static void
+h2_header_ctx_clear(struct h2_header_ctx *ctx)
+{
+	if (ctx->path != NULL)
+		mm_free(ctx->path);
+	if (ctx->authority != NULL)
+		mm_free(ctx->authority);
+	if (ctx->cookie != NULL)
+		mm_free(ctx->cookie);
+}
+
+static char *
+h2_strndup(const char *s, size_t len)
+{
+	char *r = mm_malloc(len + 1);
+	if (r != NULL) {
+		memcpy(r, s, len);
+		r[len] = '\0';
+	}
+	return (r);
+}
+
+static int
+h2_name_is(const char *name, size_t len, const char *what)
+{
+	return (strlen(what) == len && !memcmp(name, what, len));
+}
+
+static void
+h2_header_cb(void *arg, const char *name, size_t name_len,
+    const char *value, size_t value_len)
+{
+	struct h2_header_ctx *ctx = arg;
+	struct evhttp_request *req = ctx->req;
+	size_t i;
+
+	if (req == NULL || ctx->malformed || ctx->too_large)
+		return;
+
+	ctx->size += name_len + value_len + HPACK_ENTRY_OVERHEAD;
+	if (ctx->size > ctx->max_size) {
+		/* keep decoding for the HPACK state, but nothing else */
+		ctx->too_large = 1;
+		return;
+	}
+
+	for (i = 0; i < name_len; ++i) {
+		if ((name[i] >= 'A' && name[i] <= 'Z') || name[i] == '\0')
+			goto malformed;
+	}
+	if (memchr(value, '\0', value_len))
+		goto malformed;
+
+	if (name_len && name[0] == ':') {
+		/* pseudo-headers come first, once each */
+		if (ctx->regular_seen)
+			goto malformed;
+		if (h2_name_is(name, name_len, ":method") && !ctx->has_method) {
+			req->type = evhttp_parse_method_(req->evcon,
+			    value, value_len);
+			ctx->has_method = 1;
+		} else if (h2_name_is(name, name_len, ":scheme") &&
+		    !ctx->has_scheme) {
+			ctx->has_scheme = 1;
+		} else if (h2_name_is(name, name_len, ":path") &&
+		    ctx->path == NULL && value_len) {
+			if ((ctx->path = h2_strndup(value, value_len)) == NULL)
+				goto malformed;
+			ctx->path_len = value_len;
+		} else if (h2_name_is(name, name_len, ":authority") &&
+		    ctx->authority == NULL) {
+			if ((ctx->authority =
+				h2_strndup(value, value_len)) == NULL)
+				goto malformed;
+			ctx->authority_len = value_len;
+		} else {
+			goto malformed;
+		}
+		return;
+	}
+
+	ctx->regular_seen = 1;
+	if (h2_is_connection_header(name, name_len))
+		goto malformed;
+	if (h2_name_is(name, name_len, "te") &&
+	    !(value_len == 8 && !memcmp(value, "trailers", 8)))
+		goto malformed;
+
+	if (h2_name_is(name, name_len, "cookie")) {
+		size_t len = ctx->cookie_len ? ctx->cookie_len + 2 : 0;
+		if (len + value_len + 1 > ctx->cookie_alloc) {
+			/* grow geometrically, so many cookies stay linear */
+			size_t n = ctx->cookie_alloc ? ctx->cookie_alloc : 64;
+			char *cookie;
+			while (n < len + value_len + 1)
+				n <<= 1;
+			if ((cookie = mm_realloc(ctx->cookie, n)) == NULL)
+				goto malformed;
+			ctx->cookie = cookie;
+			ctx->cookie_alloc = n;
+		}
+		if (len)
+			memcpy(ctx->cookie + ctx->cookie_len, "; ", 2);
+		memcpy(ctx->cookie + len, value, value_len);
+		ctx->cookie[len + value_len] = '\0';
+		ctx->cookie_len = len + value_len;
+		return;
+	}
+
+	if (evhttp_add_input_header_(req, name, name_len,
+		value, value_len) == -1)
+		goto malformed;
+	return;
+
+malformed:
+	ctx->malformed = 1;
+}
+
+/* A stream opening header block has been decoded into ctx */
+static void
+h2_stream_headers_done(struct evhttp_h2_stream *stream,
+    struct h2_header_ctx *ctx, int end_stream)
+{
+	struct evhttp_request *req = stream->req;
+	int connect = req->type == EVHTTP_REQ_CONNECT;
+
+	if (ctx->too_large) {
+		/* RFC 6585 section 5 */
+		req->headers_size = ctx->size;
+		evhttp_send_error(req, 431, "Request Header Fields Too Large");
+		return;
+	}
+
+	if (ctx->cookie != NULL &&
+	    evhttp_add_input_header_(req, "cookie", 6,
+		ctx->cookie, ctx->cookie_len) == -1)
+		ctx->malformed = 1;
+
+	if (ctx->malformed || !ctx->has_method ||
+	    (connect && ctx->authority == NULL) ||
+	    (!connect && (!ctx->has_scheme || ctx->path == NULL))) {
+		h2_stream_reset(stream, H2_PROTOCOL_ERROR);
+		return;
+	}
+
+	req->headers_size = ctx->size;
+	if (ctx->authority != NULL &&
+	    evhttp_find_input_header_(req, EVHTTP_HDR_HOST) == NULL &&
+	    evhttp_add_input_header_(req, "host", 4,
+		ctx->authority, ctx->authority_len) == -1) {
+		h2_stream_reset(stream, H2_INTERNAL_ERROR);
+		return;
+	}
+
+	if ((connect ?
+		evhttp_parse_request_target_(req,
+		    ctx->authority, ctx->authority_len) :
+		evhttp_parse_request_target_(req,
+		    ctx->path, ctx->path_len)) == -1) {
+		/* as evhttp_handle_request() would */
+		evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+		return;
+	}
+
+	if (end_stream)
+		h2_stream_dispatch(stream);
+}
+
+static enum h2_error
+h2_end_headers(struct evhttp_h2 *h2)
+{
+	ev_uint32_t id = h2->header_block_stream;
+	int end_stream = (h2->header_block_flags & H2_FLAG_END_STREAM) != 0;
+	size_t len = evbuffer_get_length(h2->header_block);
+	unsigned char *block = evbuffer_pullup(h2->header_block, -1);
+	struct evhttp_h2_stream *stream = NULL;
+	struct h2_header_ctx ctx;
+	int refused = 0;
+	int rv;
+
+	h2->header_block_stream = 0;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.max_size = h2_max_header_list(h2);
+
+	if (len && block == NULL)
+		return (H2_INTERNAL_ERROR);
+
+	if (!h2->header_block_new) {
+		/* trailers, which we do not keep */
+		stream = h2_find_stream(h2, id);
+	} else if (h2->goaway_received || h2->n_streams >= H2_MAX_STREAMS) {
+		refused = 1;
+	} else {
+		struct evhttp_request *req =
+		    evhttp_new_incoming_request_(h2->evcon);
+		if (req == NULL ||
+		    (stream = h2_stream_new(h2, id, req)) == NULL) {
+			if (req != NULL)
+				evhttp_request_free(req);
+			refused = 1;
+		} else {
+			ctx.req = req;
+		}
+	}
+
+	rv = evhttp_hpack_decode_(&h2->decoder, block, len,
+	    h2_header_cb, &ctx);
+	evbuffer_drain(h2->header_block, len);
+	if (rv == -1) {
+		h2_header_ctx_clear(&ctx);
+		return (H2_COMPRESSION_ERROR);
+	}
+
+	if (refused) {
+		h2_send_u32(h2, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+	} else if (ctx.req != NULL) {
+		h2_stream_headers_done(stream, &ctx, end_stream);
+	} else if (stream != NULL) {
+		if (!end_stream)
+			h2_stream_reset(stream, H2_PROTOCOL_ERROR);
+		else if (stream->remote_closed)
+			h2_stream_reset(stream, H2_STREAM_CLOSED);
+		else
+			h2_stream_dispatch(stream);
+	}
+
+	h2_header_ctx_clear(&ctx);
+	return (H2_NO_ERROR);
+}
+
+static int
+h2_strip_padding(ev_uint8_t flags, const unsigned char **p, size_t *len)
+{
+	size_t pad;
+
+	if (!(flags & H2_FLAG_PADDED))
+		return (0);
+	if (*len < 1)
+		return (-1);
+	pad = (*p)[0];
+	++*p;
+	--*len;
+	if (pad > *len)
+		return (-1);
+	*len -= pad;
+	return (0);
+}
+
+static enum h2_error
+h2_handle_headers(struct evhttp_h2 *h2, ev_uint8_t flags, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	if (id == 0 || h2_strip_padding(flags, &p, &len) == -1)
+		return (H2_PROTOCOL_ERROR);
+	if (flags & H2_FLAG_PRIORITY) {
+		/* which we ignore */
+		if (len < 5)
+			return (H2_PROTOCOL_ERROR);
+		p += 5;
+		len -= 5;
+	}
+
+	if (id > h2->last_stream_id) {
+		if (!(id & 1))
+			return (H2_PROTOCOL_ERROR);
+		h2->last_stream_id = id;
+		h2->header_block_new = 1;
+	} else {
+		h2->header_block_new = 0;
+	}
+
+	evbuffer_add(h2->header_block, p, len);
+	h2->header_block_stream = id;
+	h2->header_block_flags = flags;
+
+	if (flags & H2_FLAG_END_HEADERS)
+		return h2_end_headers(h2);
+	return (H2_NO_ERROR);
+}
+
+static enum h2_error
+h2_handle_continuation(struct evhttp_h2 *h2, ev_uint8_t flags,
+    ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	if (id == 0 || id != h2->header_block_stream)
+		return (H2_PROTOCOL_ERROR);
+	if (evbuffer_get_length(h2->header_block) + len > H2_MAX_HEADER_BLOCK)
+		return (H2_ENHANCE_YOUR_CALM);
+
+	evbuffer_add(h2->header_block, p, len);
+
+	if (flags & H2_FLAG_END_HEADERS)
+		return h2_end_headers(h2);
+	return (H2_NO_ERROR);
+}
+
+static enum h2_error
+h2_handle_data(struct evhttp_h2 *h2, ev_uint8_t flags, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	size_t frame_len = len;
+	struct evhttp_h2_stream *stream;
+	struct evhttp_request *req;
+
+	if (id == 0 || id > h2->last_stream_id ||
+	    h2_strip_padding(flags, &p, &len) == -1)
+		return (H2_PROTOCOL_ERROR);
+
+	/* We give the credit back right away; max_body_size is what limits
+	 * the size of a request. */
+	if (frame_len)
+		h2_send_u32(h2, H2_WINDOW_UPDATE, 0, (ev_uint32_t)frame_len);
+
+	if ((stream = h2_find_stream(h2, id)) == NULL)
+		return (H2_NO_ERROR); /* we reset it already */
+	if (stream->remote_closed) {
+		h2_stream_reset(stream, H2_STREAM_CLOSED);
+		return (H2_NO_ERROR);
+	}
+
+	req = stream->req;
+	if (req->body_size + len > h2->evcon->max_body_size) {
+		evhttp_send_error(req, HTTP_ENTITYTOOLARGE, NULL);
+		return (H2_NO_ERROR);
+	}
+	evbuffer_add(req->input_buffer, p, len);
+	req->body_size += len;
+
+	if (flags & H2_FLAG_END_STREAM)
+		h2_stream_dispatch(stream);
+	else if (frame_len)
+		h2_send_u32(h2, H2_WINDOW_UPDATE, id, (ev_uint32_t)frame_len);
+
+	return (H2_NO_ERROR);
+}
+
+static void
+h2_flush_streams(struct evhttp_h2 *h2)
+{
+	struct evhttp_h2_stream *stream, *next;
+
+	for (stream = TAILQ_FIRST(&h2->streams); stream; stream = next) {
+		next = TAILQ_NEXT(stream, next);
+		h2_stream_flush(stream);
+	}
+}
+
+static enum h2_error
+h2_apply_settings(struct evhttp_h2 *h2, const unsigned char *p, size_t len)
+{
+	struct evhttp_h2_stream *stream;
+	size_t i;
+
+	for (i = 0; i + 6 <= len; i += 6) {
+		unsigned id = (p[i] << 8) | p[i + 1];
+		ev_uint32_t value = h2_get32(p + i + 2);
+		ev_int64_t delta;
+
+		switch (id) {
+		case H2_SETTINGS_ENABLE_PUSH:
+			if (value > 1)
+				return (H2_PROTOCOL_ERROR);
+			break;
+		case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+			if (value > H2_MAX_WINDOW)
+				return (H2_FLOW_CONTROL_ERROR);
+			delta = (ev_int64_t)value - h2->peer_initial_window;
+			TAILQ_FOREACH(stream, &h2->streams, next) {
+				stream->send_window += delta;
+				if (stream->send_window > H2_MAX_WINDOW)
+					return (H2_FLOW_CONTROL_ERROR);
+			}
+			h2->peer_initial_window = value;
+			break;
+		case H2_SETTINGS_MAX_FRAME_SIZE:
+			if (value < H2_DEFAULT_FRAME_SIZE ||
+			    value > H2_MAX_FRAME_SIZE)
+				return (H2_PROTOCOL_ERROR);
+			h2->peer_max_frame_size = value;
+			break;
+		default:
+			/* The header table size does not matter to an
+			 * encoder that never indexes. */
+			break;
+		}
+	}
+
+	return (H2_NO_ERROR);
+}
+
+static enum h2_error
+h2_handle_settings(struct evhttp_h2 *h2, ev_uint8_t flags, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	enum h2_error error;
+
+	if (id != 0)
+		return (H2_PROTOCOL_ERROR);
+	if (flags & H2_FLAG_ACK)
+		return (len ? H2_FRAME_SIZE_ERROR : H2_NO_ERROR);
+	if (len % 6)
+		return (H2_FRAME_SIZE_ERROR);
+
+	if ((error = h2_apply_settings(h2, p, len)) != H2_NO_ERROR)
+		return (error);
+	h2_frame_header(h2_output(h2), 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+	h2_flush_streams(h2);
+
+	return (H2_NO_ERROR);
+}
+
+static enum h2_error
+h2_handle_window_update(struct evhttp_h2 *h2, ev_uint32_t id,
+    const unsigned char *p, size_t len)
+{
+	struct evhttp_h2_stream *stream;
+	ev_uint32_t increment;
+
+	if (len != 4)
+		return (H2_FRAME_SIZE_ERROR);
+	increment = h2_get32(p) & 0x7fffffff;
+
+	if (id == 0) {
+		if (increment == 0)
+			return (H2_PROTOCOL_ERROR);
+		h2->send_window += increment;
+		if (h2->send_window > H2_MAX_WINDOW)
+			return (H2_FLOW_CONTROL_ERROR);
+		h2_flush_streams(h2);
+		return (H2_NO_ERROR);
+	}
+
+	if (id > h2->last_stream_id)
+		return (H2_PROTOCOL_ERROR);
+	if ((stream = h2_find_stream(h2, id)) == NULL)
+		return (H2_NO_ERROR);
+	if (increment == 0) {
+		h2_stream_reset(stream, H2_PROTOCOL_ERROR);
+	} else if ((stream->send_window += increment) > H2_MAX_WINDOW) {
+		h2_stream_reset(stream, H2_FLOW_CONTROL_ERROR);
+	} else {
+		h2_stream_flush(stream);
+	}
+
+	return (H2_NO_ERROR);
+}
+
+static enum h2_error
+h2_handle_frame(struct evhttp_h2 *h2, enum h2_frame_type type,
+    ev_uint8_t flags, ev_uint32_t id, const unsigned char *p, size_t len)
+{
+	struct evhttp_h2_stream *stream;
+
+	/* nothing may come between a header block's frames */
+	if (h2->header_block_stream && type != H2_CONTINUATION)
+		return (H2_PROTOCOL_ERROR);
+
+	switch (type) {
+	case H2_DATA:
+		return h2_handle_data(h2, flags, id, p, len);
+	case H2_HEADERS:
+		return h2_handle_headers(h2, flags, id, p, len);
+	case H2_CONTINUATION:
+		return h2_handle_continuation(h2, flags, id, p, len);
+	case H2_PRIORITY:
+		if (id == 0)
+			return (H2_PROTOCOL_ERROR);
+		return (len == 5 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR);
+	case H2_RST_STREAM:
+		if (id == 0 || id > h2->last_stream_id)
+			return (H2_PROTOCOL_ERROR);
+		if (len != 4)
+			return (H2_FRAME_SIZE_ERROR);
+		if ((stream = h2_find_stream(h2, id)) != NULL)
+			h2_stream_close(stream, 0);
+		return (H2_NO_ERROR);
+	case H2_SETTINGS:
+		return h2_handle_settings(h2, flags, id, p, len);
+	case H2_PING:
+		if (id != 0)
+			return (H2_PROTOCOL_ERROR);
+		if (len != 8)
+			return (H2_FRAME_SIZE_ERROR);
+		if (!(flags & H2_FLAG_ACK)) {
+			struct evbuffer *out = h2_output(h2);
+			h2_frame_header(out, 8, H2_PING, H2_FLAG_ACK, 0);
+			evbuffer_add(out, p, 8);
+		}
+		return (H2_NO_ERROR);
+	case H2_GOAWAY:
+		if (id != 0)
+			return (H2_PROTOCOL_ERROR);
+		if (len < 8)
+			return (H2_FRAME_SIZE_ERROR);
+		/* finish what we have, then close */
+		h2->goaway_received = 1;
+		if (h2->n_streams == 0)
+			h2_connection_error(h2, H2_NO_ERROR);
+		return (H2_NO_ERROR);
+	case H2_WINDOW_UPDATE:
+		return h2_handle_window_update(h2, id, p, len);
+	case H2_PUSH_PROMISE:
+		/* clients do not push */
+		return (H2_PROTOCOL_ERROR);
+	default:
+		/* unknown frame types are ignored */
+		return (H2_NO_ERROR);
+	}
+}
+
+static void
+h2_read_cb(struct bufferevent *bev, void *arg)
+{
+	struct evhttp_h2 *h2 = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	if (h2->want_preface) {
+		switch (evhttp_h2_check_preface_(input)) {
+		case -1:
+			return;
+		case 0:
+			h2_connection_error(h2, H2_PROTOCOL_ERROR);
+			return;
+		}
+		evbuffer_drain(input, H2_PREFACE_LEN);
+		h2->want_preface = 0;
+	}
+
+	while (!h2->closing) {
+		unsigned char hdr[H2_FRAME_HEADER_LEN];
+		const unsigned char *frame;
+		enum h2_error error;
+		size_t len;
+
+		if (evbuffer_copyout(input, hdr, sizeof(hdr)) < (ev_ssize_t)sizeof(hdr))
+			break;
+		len = ((size_t)hdr[0] << 16) | (hdr[1] << 8) | hdr[2];
+		if (len > H2_DEFAULT_FRAME_SIZE) {
+			/* we never raise SETTINGS_MAX_FRAME_SIZE */
+			h2_connection_error(h2, H2_FRAME_SIZE_ERROR);
+			break;
+		}
+		if (evbuffer_get_length(input) < sizeof(hdr) + len)
+			break;
+		if ((frame = evbuffer_pullup(input, sizeof(hdr) + len)) == NULL) {
+			h2_connection_error(h2, H2_INTERNAL_ERROR);
+			break;
+		}
+
+		error = h2_handle_frame(h2, (enum h2_frame_type)hdr[3], hdr[4],
+		    h2_get32(hdr + 5) & 0x7fffffff, frame + sizeof(hdr), len);
+		evbuffer_drain(input, sizeof(hdr) + len);
+		if (error != H2_NO_ERROR)
+			h2_connection_error(h2, error);
+	}
+}
+
+static void
+h2_write_cb(struct bufferevent *bev, void *arg)
+{
+	struct evhttp_h2 *h2 = arg;
+	struct evhttp_h2_stream *stream;
+
+	if (h2->closing) {
+		evhttp_connection_free(h2->evcon);
+		return;
+	}
+
+again:
+	TAILQ_FOREACH(stream, &h2->streams, next) {
+		if (stream->chunk_cb != NULL &&
+		    evbuffer_get_length(stream->pending) == 0) {
+			void (*cb)(struct evhttp_connection *, void *) =
+			    stream->chunk_cb;
+			stream->chunk_cb = NULL;
+			(*cb)(h2->evcon, stream->chunk_cb_arg);
+			/* the callback may have closed streams */
+			goto again;
+		}
+	}
+}
+
+static void
+h2_event_cb(struct bufferevent *bev, short what, void *arg)
+{
+	struct evhttp_h2 *h2 = arg;
+	struct evhttp_h2_stream *stream;
+
+	if ((what & BEV_EVENT_TIMEOUT) && (what & BEV_EVENT_READING) &&
+	    !h2->closing) {
+		/* a quiet client may just be waiting for our replies */
+		TAILQ_FOREACH(stream, &h2->streams, next) {
+			if (stream->dispatched) {
+				bufferevent_enable(bev, EV_READ);
+				return;
+			}
+		}
+	}
+
+	evhttp_connection_free(h2->evcon);
+}
+
+/* Sends what flow control allows of the reply body of stream, and its
+ * END_STREAM once that is all out. */
+static void
+h2_stream_flush(struct evhttp_h2_stream *stream)
+{
+	struct evhttp_h2 *h2 = stream->session;
+	struct evbuffer *out = h2_output(h2);
+	size_t left;
+
+	while ((left = evbuffer_get_length(stream->pending)) > 0) {
+		ev_int64_t n = left;
+		ev_uint8_t flags = 0;
+
+		if (n > stream->send_window)
+			n = stream->send_window;
+		if (n > h2->send_window)
+			n = h2->send_window;
+		if (n > h2->peer_max_frame_size)
+			n = h2->peer_max_frame_size;
+		if (n <= 0)
+			return;
+
+		if (stream->end_queued && (size_t)n == left)
+			flags = H2_FLAG_END_STREAM;
+		h2_frame_header(out, (size_t)n, H2_DATA, flags, stream->id);
+		evbuffer_remove_buffer(stream->pending, out, (size_t)n);
+		stream->send_window -= n;
+		h2->send_window -= n;
+
+		if (flags) {
+			h2_stream_end_sent(stream);
+			return;
+		}
+	}
+
+	if (stream->end_queued) {
+		h2_frame_header(out, 0, H2_DATA, H2_FLAG_END_STREAM, stream->id);
+		h2_stream_end_sent(stream);
+	}
+}
+
+/* :status from the static table where it is there */
+static void
+h2_encode_status(struct evbuffer *out, int code)
+{
+	static const int indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+	char buf[16];
+	size_t i;
+
+	for (i = 0; i < sizeof(indexed) / sizeof(indexed[0]); ++i) {
+		if (indexed[i] == code) {
+			hpack_encode_int(out, 0x80, 7, i + 8);
+			return;
+		}
+	}
+	evutil_snprintf(buf, sizeof(buf), "%d", code);
+	evhttp_hpack_encode_(out, ":status", buf);
+}
+
+static int
+h2_send_headers(struct evhttp_h2_stream *stream, int end_stream)
+{
+	struct evhttp_h2 *h2 = stream->session;
+	struct evhttp_request *req = stream->req;
+	struct evbuffer *out = h2_output(h2);
+	struct evbuffer *block;
+	struct evkeyval *header;
+	enum h2_frame_type type = H2_HEADERS;
+	ev_uint8_t flags = end_stream ? H2_FLAG_END_STREAM : 0;
+
+	if ((block = evbuffer_new()) == NULL)
+		return (-1);
+
+	h2_encode_status(block, req->response_code);
+	TAILQ_FOREACH(header, req->output_headers, next) {
+		if (h2_is_connection_header(header->key, strlen(header->key)))
+			continue;
+		evhttp_hpack_encode_(block, header->key, header->value);
+	}
+
+	do {
+		size_t len = evbuffer_get_length(block);
+		if (len > h2->peer_max_frame_size)
+			len = h2->peer_max_frame_size;
+		else
+			flags |= H2_FLAG_END_HEADERS;
+		h2_frame_header(out, len, type, flags, stream->id);
+		evbuffer_remove_buffer(block, out, len);
+		type = H2_CONTINUATION;
+		flags = 0;
+	} while (evbuffer_get_length(block));
+
+	evbuffer_free(block);
+	stream->reply_started = 1;
+	return (0);
+}
+
+void
+evhttp_h2_send_reply_(struct evhttp_request *req, int streaming)
+{
+	struct evhttp_h2_stream *stream = req->h2_stream;
+	int end_now;
+
+	stream->no_body = !evhttp_add_reply_headers_(req, streaming);
+	if (stream->no_body)
+		evbuffer_drain(req->output_buffer,
+		    evbuffer_get_length(req->output_buffer));
+
+	end_now = !streaming &&
+	    evbuffer_get_length(req->output_buffer) == 0;
+	if (h2_send_headers(stream, end_now) == -1) {
+		h2_stream_reset(stream, H2_INTERNAL_ERROR);
+		return;
+	}
+	if (end_now) {
+		h2_stream_end_sent(stream);
+		return;
+	}
+
+	if (!streaming) {
+		evbuffer_add_buffer(stream->pending, req->output_buffer);
+		stream->end_queued = 1;
+		h2_stream_flush(stream);
+	}
+}
+
+void
+evhttp_h2_send_chunk_(struct evhttp_request *req, struct evbuffer *databuf,
+    void (*cb)(struct evhttp_connection *, void *), void *arg)
+{
+	struct evhttp_h2_stream *stream = req->h2_stream;
+
+	if (stream->no_body || evbuffer_get_length(databuf) == 0)
+		return;
+	evbuffer_add_buffer(stream->pending, databuf);
+	stream->chunk_cb = cb;
+	stream->chunk_cb_arg = arg;
+	h2_stream_flush(stream);
+}
+
+void
+evhttp_h2_send_end_(struct evhttp_request *req)
+{
+	struct evhttp_h2_stream *stream = req->h2_stream;
+
+	stream->chunk_cb = NULL;
+	stream->end_queued = 1;
+	h2_stream_flush(stream);
+}
+
+int
+evhttp_h2_check_preface_(struct evbuffer *input)
+{
+	char buf[H2_PREFACE_LEN];
+	size_t len = evbuffer_get_length(input);
+
+	if (len > H2_PREFACE_LEN)
+		len = H2_PREFACE_LEN;
+	if (evbuffer_copyout(input, buf, len) != (ev_ssize_t)len ||
+	    memcmp(buf, H2_PREFACE, len))
+		return (0);
+	return (len == H2_PREFACE_LEN ? 1 : -1);
+}
+
+/* Decodes the unpadded base64url of an HTTP2-Settings header.  Returns the
+ * decoded length, or -1. */
+static ev_ssize_t
+h2_base64url_decode(const char *in, unsigned char *out, size_t out_len)
+{
+	ev_uint32_t acc = 0;
+	int bits = 0;
+	size_t n = 0;
+
+	for (; *in && *in != '='; ++in) {
+		char c = *in;
+		int v;
+
+		if (c >= 'A' && c <= 'Z')
+			v = c - 'A';
+		else if (c >= 'a' && c <= 'z')
+			v = c - 'a' + 26;
+		else if (c >= '0' && c <= '9')
+			v = c - '0' + 52;
+		else if (c == '-')
+			v = 62;
+		else if (c == '_')
+			v = 63;
+		else
+			return (-1);
+
+		acc = (acc << 6) | v;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (n == out_len)
+				return (-1);
+			out[n++] = (unsigned char)(acc >> bits);
+		}
+	}
+
+	return (n);
+}
+
+/* the SETTINGS payload of an upgrade request; we accept up to 16 */
+static ev_ssize_t
+h2_upgrade_settings(struct evhttp_request *req, unsigned char *out,
+    size_t out_len)
+{
+	const char *settings =
+	    evhttp_find_header(req->input_headers, "HTTP2-Settings");
+	ev_ssize_t len;
+
+	if (settings == NULL ||
+	    (len = h2_base64url_decode(settings, out, out_len)) == -1 ||
+	    len % 6)
+		return (-1);
+	return (len);
+}
+
+/* Returns true iff the comma separated list contains token */
+static int
+h2_has_token(const char *list, const char *token)
+{
+	size_t len = strlen(token);
+
+	while (*list) {
+		const char *end;
+		while (*list == ' ' || *list == '\t' || *list == ',')
+			++list;
+		for (end = list; *end && *end != ','; ++end)
+			;
+		while (end > list && (end[-1] == ' ' || end[-1] == '\t'))
+			--end;
+		if ((size_t)(end - list) == len &&
+		    !evutil_ascii_strncasecmp(list, token, len))
+			return (1);
+		for (list = end; *list && *list != ','; ++list)
+			;
+	}
+	return (0);
+}
+
+int
+evhttp_h2_wants_upgrade_(struct evhttp_request *req)
+{
+	unsigned char settings[6 * 16];
+	const char *upgrade =
+	    evhttp_find_input_header_(req, EVHTTP_HDR_UPGRADE);
+	const char *content_length;
+
+	if (upgrade == NULL || !h2_has_token(upgrade, "h2c"))
+		return (0);
+	if (req->major != 1 || req->minor < 1)
+		return (0);
+
+	/* we would have to read the body first */
+	if (evhttp_find_input_header_(req, EVHTTP_HDR_TRANSFER_ENCODING))
+		return (0);
+	content_length =
+	    evhttp_find_input_header_(req, EVHTTP_HDR_CONTENT_LENGTH);
+	if (content_length != NULL && strcmp(content_length, "0"))
+		return (0);
+
+	return (h2_upgrade_settings(req, settings, sizeof(settings)) != -1);
+}
+
+int
+evhttp_h2_start_(struct evhttp_connection *evcon,
+    struct evhttp_request *upgrade)
+{
+	struct bufferevent *bev = evcon->bufev;
+	unsigned char settings[6 * 16];
+	ev_ssize_t settings_len = 0;
+	struct evhttp_h2_stream *stream = NULL;
+	struct evhttp_h2 *h2;
+
+	if (upgrade != NULL &&
+	    (settings_len = h2_upgrade_settings(upgrade, settings,
+		sizeof(settings))) == -1)
+		return (-1);
+
+	if ((h2 = mm_calloc(1, sizeof(*h2))) == NULL)
+		return (-1);
+	if ((h2->header_block = evbuffer_new()) == NULL) {
+		mm_free(h2);
+		return (-1);
+	}
+	h2->evcon = evcon;
+	TAILQ_INIT(&h2->streams);
+	evhttp_hpack_init_(&h2->decoder, H2_HEADER_TABLE_SIZE);
+	h2->send_window = H2_DEFAULT_WINDOW;
+	h2->peer_initial_window = H2_DEFAULT_WINDOW;
+	h2->peer_max_frame_size = H2_DEFAULT_FRAME_SIZE;
+	h2->want_preface = 1;
+
+	if (upgrade != NULL) {
+		if (h2_apply_settings(h2, settings, settings_len) !=
+		    H2_NO_ERROR ||
+		    (stream = h2_stream_new(h2, 1, upgrade)) == NULL) {
+			evbuffer_free(h2->header_block);
+			mm_free(h2);
+			return (-1);
+		}
+		h2->last_stream_id = 1;
+	}
+
+	evcon->h2 = h2;
+	bufferevent_setcb(bev, h2_read_cb, h2_write_cb, h2_event_cb, h2);
+	bufferevent_enable(bev, EV_READ|EV_WRITE);
+
+	if (upgrade != NULL)
+		evbuffer_add_printf(bufferevent_get_output(bev),
+		    "HTTP/1.1 101 Switching Protocols\r\n"
+		    "Connection: Upgrade\r\n"
+		    "Upgrade: h2c\r\n\r\n");
+	h2_send_settings(h2);
+
+	/* the request that asked for the upgrade is stream 1, half closed */
+	if (stream != NULL)
+		h2_stream_dispatch(stream);
+
+	if (!h2->closing && evbuffer_get_length(bufferevent_get_input(bev)))
+		h2_read_cb(bev, h2);
+
+	return (0);
+}
+
+void
+evhttp_h2_free_(struct evhttp_connection *evcon)
+{
+	struct evhttp_h2 *h2 = evcon->h2;
+	struct evhttp_h2_stream *stream;
+
+	/* no GOAWAY from h2_stream_close() */
+	h2->closing = 1;
+	while ((stream = TAILQ_FIRST(&h2->streams)) != NULL)
+		h2_stream_close(stream, 0);
+
+	evhttp_hpack_clear_(&h2->decoder);
+	evbuffer_free(h2->header_block);
+	mm_free(h2);
+	evcon->h2 = NULL;
+}
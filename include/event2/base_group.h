@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_BASE_GROUP_H_INCLUDED_
+#define EVENT2_BASE_GROUP_H_INCLUDED_
+
+/** @file event2/base_group.h
+
+  A group of event_bases, each running its loop in a worker thread of its
+  own, with helpers to shard a listening port across them using
+  SO_REUSEPORT.
+
+  These functions live in the libevent_pthreads library.  Locking must be
+  set up, e.g. with evthread_use_pthreads(), before a group is created.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/visibility.h>
+#include <event2/listener.h>
+
+struct event_base;
+struct event_config;
+struct event_base_group;
+struct sockaddr;
+
+/** Flag: pin the thread of the i'th base to the i'th of the CPUs that the
+ * process may run on when the group is created (modulo the number of those
+ * CPUs), if the platform supports it. */
+#define EVENT_BASE_GROUP_PIN_THREADS	0x01
+/** Flag: have the kernel steer each incoming connection on a group
+ * listener to a base by the CPU that received it: if that is the k'th CPU
+ * the process may run on, counted as for EVENT_BASE_GROUP_PIN_THREADS, to
+ * base k modulo the number of bases, and otherwise to the base whose index
+ * is the number of the CPU, modulo the number of bases.  Combined with
+ * EVENT_BASE_GROUP_PIN_THREADS, this keeps a connection on one CPU from the
+ * network stack to the application.  This uses a classic BPF program
+ * attached with SO_ATTACH_REUSEPORT_CBPF, and is ignored where that is not
+ * available. */
+#define EVENT_BASE_GROUP_STEER_BY_CPU	0x02
+/** Flag: let a base whose loop is idle run callbacks that were posted to a
+ * busy base in the group with event_base_post() and EV_POST_STEALABLE. */
+#define EVENT_BASE_GROUP_WORK_STEALING	0x04
+
+/**
+   Create a group of event_bases, and start one thread running the loop of
+   each.
+
+   The loops run with EVLOOP_NO_EXIT_ON_EMPTY until the group is freed.  Add
+   events to the bases with the usual thread-safe functions.
+
+   @param n_bases The number of bases and threads, or 0 or less for one per
+      online CPU.
+   @param cfg The configuration to create each base with, or NULL for the
+      default.
+   @param flags Any number of EVENT_BASE_GROUP_* flags
+   @return the new group, or NULL on error (including when locking has not
+      been set up).
+ */
+EVENT2_EXPORT_SYMBOL
+struct event_base_group *event_base_group_new(int n_bases,
+    const struct event_config *cfg, unsigned flags);
+
+/**
+   Stop the threads of a group, then free its listeners and bases.
+
+   This must not be called from one of the group's threads.
+ */
+EVENT2_EXPORT_SYMBOL
+void event_base_group_free(struct event_base_group *group);
+
+/** Return the number of bases in a group. */
+EVENT2_EXPORT_SYMBOL
+int event_base_group_get_n_bases(const struct event_base_group *group);
+
+/** Return the i'th base of a group, or NULL if there is no such base. */
+EVENT2_EXPORT_SYMBOL
+struct event_base *event_base_group_get_base(
+    const struct event_base_group *group, int i);
+
+/**
+   Listen on an address with one evconnlistener per base in a group.
+
+   Each listener has its own socket, bound to the same address with
+   SO_REUSEPORT, so that the kernel spreads incoming connections over them.
+   cb runs in the thread of the base whose listener accepted the connection;
+   use evconnlistener_get_base() to find out which one that is.
+
+   If the port in sa is 0, the first listener picks one and the others bind
+   to the same port.
+
+   The listeners belong to the group, and are freed with it.
+
+   @param group The group
+   @param cb A callback to be invoked when a new connection arrives.
+   @param ptr A user-supplied pointer to give to the callback.
+   @param flags Any number of LEV_OPT_* flags; LEV_OPT_REUSEABLE_PORT is
+      always set.
+   @param backlog Passed to the listen() call of each socket; -1 for a
+      reasonable default.
+   @param sa The address to listen for connections on.
+   @param socklen The length of the address.
+   @param listeners_out If not NULL, an array with room for one pointer per
+      base, which receives the listeners.
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_group_listen(struct event_base_group *group,
+    evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
+    const struct sockaddr *sa, int socklen,
+    struct evconnlistener **listeners_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_BASE_GROUP_H_INCLUDED_ */
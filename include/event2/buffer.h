@@ -182,6 +182,141 @@ int evbuffer_set_max_read(struct evbuffer *buf, size_t max);
 EVENT2_EXPORT_SYMBOL
 size_t evbuffer_get_max_read(struct evbuffer *buf);
 
+/**
+  Make evbuffer_read() pick how much to read from recent reads, instead of
+  asking the socket how much is available.
+
+  Each read asks for the current budget, which starts at 4096 bytes (or
+  the nearest bound).  When a read fills its budget, the budget grows
+  fourfold, so bulk transfers quickly move to large reads; after two
+  reads in a row that would have fit in half the budget, it halves, so
+  connections that only trickle in small messages stop getting large
+  buffers.  This also saves evbuffer_read() the FIONREAD call it makes
+  otherwise.
+
+  @param buf pointer to the evbuffer
+  @param min the smallest budget, or 0 for 64 bytes
+  @param max the largest budget, or 0 to turn adaptive reads off and go
+         back to the limit set with evbuffer_set_max_read()
+  @return 0 on success, -1 on failure (if @max > INT_MAX or @min > @max).
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_adaptive_read(struct evbuffer *buf, size_t min, size_t max);
+
+/**
+  Give back memory that an evbuffer holds but does not need for its data.
+
+  Empty chains at the end of the buffer are freed, and data sitting in a
+  chain much larger than itself is moved into a right-sized one, so an
+  empty buffer holds no memory at all.  Chains that are pinned, shared, or
+  that refer to memory the evbuffer does not own are left alone.  The
+  contents of the buffer do not change and no callbacks are run.
+
+  Because data may move, any pointers into the buffer (as from
+  evbuffer_peek() or evbuffer_pullup()) are invalid afterwards.  Do not
+  call this between evbuffer_reserve_space() and evbuffer_commit_space().
+
+  @param buf the evbuffer to shrink
+  @return the number of bytes of buffer space released
+  @see bufferevent_set_idle_shrink()
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_shrink(struct evbuffer *buf);
+
+/**
+   A cache of freed evbuffer chains, sorted by size, that evbuffers can
+   allocate new chains from instead of calling malloc.
+
+   Once traffic on the evbuffers that use a pool settles down, chains freed
+   by draining one buffer are reused for data added to the next one, so
+   nothing gets allocated or freed.  A pool may be shared between threads,
+   but it is cheapest to give each thread (or event_base) its own.
+
+   @see evbuffer_chain_pool_new(), evbuffer_set_chain_pool()
+ */
+struct evbuffer_chain_pool;
+
+/** Counters for an evbuffer_chain_pool.
+    @see evbuffer_chain_pool_get_stats() */
+struct evbuffer_chain_pool_stats {
+	/** Chains allocated from the free lists. */
+	ev_uint64_t n_hits;
+	/** Chains that had to be allocated with malloc. */
+	ev_uint64_t n_misses;
+	/** Freed chains that were put on the free lists. */
+	ev_uint64_t n_recycled;
+	/** Freed chains that were released because the pool was full. */
+	ev_uint64_t n_released;
+	/** Chains on the free lists right now, and their total size. */
+	size_t cached_chains;
+	size_t cached_bytes;
+};
+
+/**
+   Create a new evbuffer_chain_pool.
+
+   @param max_cached_bytes the most memory to keep on the free lists
+   @param max_chain_size the largest chain allocation to keep, or 0 for the
+          largest the pool supports (128KB on 64-bit platforms).  Larger
+          chains are allocated and freed as usual.
+   @return the new pool, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_chain_pool *evbuffer_chain_pool_new(size_t max_cached_bytes,
+    size_t max_chain_size);
+
+struct event_mem_ctx;
+/**
+   Create a new evbuffer_chain_pool that gets its memory from an allocator
+   context instead of malloc.
+
+   Unlike a plain pool, this one allocates chains larger than
+   max_chain_size from the context too; they just aren't cached.
+
+   @param max_cached_bytes the most memory to keep on the free lists
+   @param max_chain_size as for evbuffer_chain_pool_new()
+   @param ctx the allocator context to use
+   @return the new pool, or NULL on failure
+   @see event_mem_ctx_new_arena()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_chain_pool *evbuffer_chain_pool_new_with_mem_ctx(
+    size_t max_cached_bytes, size_t max_chain_size,
+    struct event_mem_ctx *ctx);
+
+/**
+   Free an evbuffer_chain_pool and everything on its free lists.
+
+   Evbuffers that still use the pool, and chains that came from it, keep
+   working; they just stop getting memory from the pool.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_chain_pool_free(struct evbuffer_chain_pool *pool);
+
+/**
+   Make an evbuffer allocate its chains from a pool.
+
+   Chains remember where they came from, so they can move to evbuffers that
+   use another pool, or none.
+
+   @param buf the evbuffer
+   @param pool the pool to use, or NULL to go back to plain malloc
+   @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_set_chain_pool(struct evbuffer *buf,
+    struct evbuffer_chain_pool *pool);
+
+/**
+   Get the counters for an evbuffer_chain_pool.
+
+   @param pool the pool
+   @param stats set to the current counters
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_chain_pool_get_stats(struct evbuffer_chain_pool *pool,
+    struct evbuffer_chain_pool_stats *stats);
+
 /**
    Enable locking on an evbuffer so that it can safely be used by multiple
    threads at the same time.
@@ -229,6 +364,23 @@ void evbuffer_unlock(struct evbuffer *buf);
  */
 #define EVBUFFER_FLAG_DRAINS_TO_FD 1
 
+/** If this flag is set, then large writes from this buffer to a socket
+ * with evbuffer_write_atmost() use MSG_ZEROCOPY where the OS supports it,
+ * so that the kernel sends straight from our memory instead of copying it.
+ *
+ * The memory we sent from stays allocated, and is never moved or
+ * overwritten, until the kernel reports that it is done with it.  Those
+ * reports arrive on the socket's error queue and make the socket readable;
+ * call evbuffer_zerocopy_reap() to collect them.  Socket bufferevents do
+ * this for you, so all you need to do there is set this flag on the output
+ * buffer.
+ *
+ * Writes of less than 16KB are always copied, as is everything once the
+ * kernel reports that it had to copy the data anyway (as it does for
+ * loopback connections).
+ */
+#define EVBUFFER_FLAG_ZEROCOPY 2
+
 /** Change the flags that are set for an evbuffer by adding more.
  *
  * @param buffer the evbuffer that the callback is watching.
@@ -670,6 +822,100 @@ EVENT2_EXPORT_SYMBOL
 int evbuffer_add_file_segment(struct evbuffer *buf,
     struct evbuffer_file_segment *seg, ev_off_t offset, ev_off_t length);
 
+/**
+  An evbuffer_segment is an immutable, reference-counted block of memory
+  that can be appended to any number of evbuffers without copying it.
+
+  It is meant for sending the same message to many connections: build the
+  message once, add the segment to each output buffer, and free your own
+  reference.  The memory is released once the last evbuffer holding the
+  segment has drained or freed it.  Unlike evbuffer_add_buffer_reference(),
+  no source evbuffer needs to stay around.
+ */
+struct evbuffer_segment;
+
+/**
+   Flag for creating evbuffer_segment: Do not allocate a lock for this
+   segment.  If this option is set, then neither the segment nor any
+   evbuffer it is added to may ever be accessed from more than one thread
+   at a time.
+ */
+#define EVBUF_SEG_DISABLE_LOCKING 0x01
+
+/**
+   Create a new evbuffer_segment holding a copy of some data.
+
+   @param data the data to copy
+   @param datlen the number of bytes to copy
+   @param flags any number of the EVBUF_SEG_* flags
+   @return a new evbuffer_segment, or NULL on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_segment *evbuffer_segment_new(const void *data,
+    size_t datlen, unsigned flags);
+
+/**
+   Create a new evbuffer_segment that refers to some data without copying
+   it.
+
+   The data must not be modified or freed until cleanupfn is called, which
+   happens once no more references to the segment exist.
+
+   @param data the data to refer to
+   @param datlen the number of bytes of data
+   @param cleanupfn a function to call when the segment is freed, or NULL
+   @param cleanupfn_arg an argument for cleanupfn
+   @param flags any number of the EVBUF_SEG_* flags
+   @return a new evbuffer_segment, or NULL on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_segment *evbuffer_segment_new_reference(const void *data,
+    size_t datlen, evbuffer_ref_cleanup_cb cleanupfn, void *cleanupfn_arg,
+    unsigned flags);
+
+/**
+   Create a new evbuffer_segment holding all the data in an evbuffer, and
+   remove that data from the evbuffer.
+
+   @param buf the evbuffer to take the data from
+   @param flags any number of the EVBUF_SEG_* flags
+   @return a new evbuffer_segment, or NULL on failure, in which case buf is
+      left as it was.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evbuffer_segment *evbuffer_segment_new_from_buffer(
+    struct evbuffer *buf, unsigned flags);
+
+/**
+   Return the number of bytes in an evbuffer_segment.
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_segment_get_length(const struct evbuffer_segment *seg);
+
+/**
+   Free an evbuffer_segment.
+
+   It is safe to call this function even if the segment has been added to
+   one or more evbuffers.  The evbuffer_segment will not be freed until no
+   more references to it exist.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_segment_free(struct evbuffer_segment *seg);
+
+/**
+   Append all of an evbuffer_segment to the end of an evbuffer, without
+   copying it.
+
+   The evbuffer holds its own reference to the segment until the data has
+   been drained, so the caller may free the segment right away.
+
+   @param buf the evbuffer to append to
+   @param seg the segment to add
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_add_segment(struct evbuffer *buf, struct evbuffer_segment *seg);
+
 /**
   Append a formatted string to the end of an evbuffer.
 
@@ -745,6 +991,29 @@ EVENT2_EXPORT_SYMBOL
 int evbuffer_write_atmost(struct evbuffer *buffer, evutil_socket_t fd,
 						  ev_ssize_t howmuch);
 
+/**
+  Collect the kernel's reports that it has finished sending from memory
+  that an evbuffer with EVBUFFER_FLAG_ZEROCOPY wrote to a socket, and
+  release that memory.
+
+  Call this whenever the socket becomes readable.  The reports are tied to
+  the socket: if you call this with a different socket (such as
+  EVUTIL_INVALID_SOCKET), it keeps collecting reports from the old socket
+  for as long as that is open, and releases the rest of the memory once it
+  has been closed.  Until then, writes to the new socket are copied.
+
+  If the buffer is freed while the old socket is still open, the memory is
+  released by a later call to this function, on any buffer, that finds the
+  reports or finds the socket closed.
+
+  @param buffer the evbuffer that was written with evbuffer_write_atmost()
+  @param fd the socket it was written to
+  @return the number of reports collected, or -1 if an error occurred
+  @see EVBUFFER_FLAG_ZEROCOPY
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_zerocopy_reap(struct evbuffer *buffer, evutil_socket_t fd);
+
 /**
   Read from a file descriptor and store the result in an evbuffer.
 
@@ -878,6 +1147,137 @@ int evbuffer_peek(struct evbuffer *buffer, ev_ssize_t len,
     struct evbuffer_ptr *start_at,
     struct evbuffer_iovec *vec_out, int n_vec);
 
+/**
+   A read position for parsing data in place in an evbuffer.
+
+   A cursor reads across chain boundaries without moving any data, unlike
+   evbuffer_pullup().  Nothing is removed from the buffer until
+   evbuffer_cursor_commit() is called, so a parser can read as far as it
+   can, find that a message is incomplete, and try again from the same
+   place once more data has arrived.
+
+   The cursor stays valid while data is only added to the end of the
+   buffer, even if the buffer moves the data after the cursor into a new
+   chain to make room.  Removing data from the buffer any other way than
+   with evbuffer_cursor_commit(), or adding data to its front, invalidates
+   it.
+
+   ptr may be passed to the functions that take an evbuffer_ptr, such as
+   evbuffer_peek(); ptr.pos is the number of bytes read so far.
+
+   @see evbuffer_cursor_init()
+ */
+struct evbuffer_cursor {
+	struct evbuffer *buffer;
+	struct evbuffer_ptr ptr;
+	/* Do not alter or rely on the value of this field */
+	unsigned chain_gen_;
+};
+
+/**
+   Set up a cursor at the start of an evbuffer.
+ */
+EVENT2_EXPORT_SYMBOL
+void evbuffer_cursor_init(struct evbuffer_cursor *cur, struct evbuffer *buf);
+
+/**
+   Return how many bytes there are in the buffer after the cursor.
+ */
+EVENT2_EXPORT_SYMBOL
+size_t evbuffer_cursor_get_length(struct evbuffer_cursor *cur);
+
+/**
+   Copy out the len bytes after the cursor without moving it.
+
+   @return 0 on success, or -1 if there are fewer than len bytes left.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_peek(struct evbuffer_cursor *cur, void *data_out,
+    size_t len);
+
+/**
+   Copy out the len bytes after the cursor and move it past them.
+
+   @return 0 on success, or -1 if there are fewer than len bytes left, in
+      which case the cursor does not move.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read(struct evbuffer_cursor *cur, void *data_out,
+    size_t len);
+
+/**
+   Move the cursor forward by len bytes.
+
+   @return 0 on success, or -1 if there are fewer than len bytes left, in
+      which case the cursor does not move.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_skip(struct evbuffer_cursor *cur, size_t len);
+
+/**
+   Return a pointer to the bytes after the cursor that are contiguous in
+   memory, without copying them or moving the cursor.
+
+   @param cur the cursor
+   @param len_out set to the number of contiguous bytes
+   @return a pointer to the bytes, or NULL if there are none left.
+ */
+EVENT2_EXPORT_SYMBOL
+const unsigned char *evbuffer_cursor_get_contiguous(
+    struct evbuffer_cursor *cur, size_t *len_out);
+
+/**
+   @name Reading integers
+
+   Read a big-endian (network byte order) integer and move the cursor past
+   it.  Return 0 on success, or -1 if there are not enough bytes left, in
+   which case the cursor does not move.
+
+   @{
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u8(struct evbuffer_cursor *cur, ev_uint8_t *out);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u16(struct evbuffer_cursor *cur, ev_uint16_t *out);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u32(struct evbuffer_cursor *cur, ev_uint32_t *out);
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_u64(struct evbuffer_cursor *cur, ev_uint64_t *out);
+/**@}*/
+
+/**
+   Read an unsigned LEB128 varint, as used by protocol buffers, and move
+   the cursor past it.
+
+   @return the number of bytes read on success, 0 if the buffer ends
+      before the varint does, or -1 if the varint is longer than 10 bytes
+      or does not fit in 64 bits.  The cursor only moves on success.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_read_varint(struct evbuffer_cursor *cur,
+    ev_uint64_t *out);
+
+/**
+   Find the first occurrence of a string after the cursor, without moving
+   it.
+
+   @return how many bytes after the cursor the string starts, or -1 if it
+      was not found.
+   @see evbuffer_search()
+ */
+EVENT2_EXPORT_SYMBOL
+ev_ssize_t evbuffer_cursor_find(struct evbuffer_cursor *cur,
+    const char *what, size_t len);
+
+/**
+   Remove everything before the cursor from the buffer, and move the
+   cursor back to the start of what remains.
+
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int evbuffer_cursor_commit(struct evbuffer_cursor *cur);
+
 
 /** Structure passed to an evbuffer_cb_func evbuffer callback
 
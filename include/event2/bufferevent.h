@@ -769,6 +769,108 @@ int bufferevent_pair_new(struct event_base *base, int options,
 EVENT2_EXPORT_SYMBOL
 struct bufferevent *bufferevent_pair_get_partner(struct bufferevent *bev);
 
+/**
+   @name Proxying
+
+   A bufferevent proxy passes everything read from each of two bufferevents
+   on to the other, as a TCP proxy does.
+
+   When both bufferevents are socket bufferevents and the system has
+   splice(), the data goes from one socket to the other through a pipe and
+   never gets copied to user space.  Otherwise it is moved from one
+   bufferevent's input buffer to the other's output buffer.
+
+   @{
+*/
+
+struct bufferevent_proxy;
+
+/** Don't use splice(), even when it is available. */
+#define BEV_PROXY_NO_SPLICE 0x01
+
+/**
+   A callback for when a proxy is done or has failed.
+
+   what is BEV_EVENT_EOF once both sides have sent EOF and all of their data
+   has been passed on; bev is NULL in that case.  Otherwise bev is the
+   bufferevent that failed and what is its BEV_EVENT_ERROR or
+   BEV_EVENT_TIMEOUT event, along with BEV_EVENT_READING or
+   BEV_EVENT_WRITING.  Either way, the proxy has stopped and should be
+   freed.
+
+   @param proxy the proxy
+   @param bev the bufferevent that failed, or NULL
+   @param what a combination of BEV_EVENT_* flags
+   @param ctx the user-supplied argument given to bufferevent_proxy_new()
+ */
+typedef void (*bufferevent_proxy_event_cb)(struct bufferevent_proxy *proxy,
+    struct bufferevent *bev, short what, void *ctx);
+
+/**
+   Start passing data between two bufferevents.
+
+   Anything already in the input buffer of either bufferevent is passed on
+   first.  When one side sends EOF, the proxy passes on the rest of its
+   data and then shuts down writing on the other side, so that the other
+   direction keeps working until it sees EOF as well.
+
+   The proxy takes over the callbacks and write watermarks of both
+   bufferevents, and turns on reading on them.  Don't read from, write to,
+   or change either bufferevent until the proxy is freed.  Both must use
+   the same event_base.  While data is being spliced, the bufferevents'
+   read timeouts do not apply.
+
+   @param a one bufferevent
+   @param b the other bufferevent
+   @param highmark how many bytes each direction may have read and not yet
+      written before the proxy stops reading, or 0 for 64 KiB
+   @param flags a combination of BEV_PROXY_* flags
+   @param cb a callback for when the proxy is done or has failed, or NULL
+   @param ctx an argument for cb
+   @return a new proxy, or NULL on error
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent_proxy *bufferevent_proxy_new(struct bufferevent *a,
+    struct bufferevent *b, size_t highmark, int flags,
+    bufferevent_proxy_event_cb cb, void *ctx);
+
+/**
+   Stop a proxy and free it.
+
+   This does not free the bufferevents; they are left with no callbacks
+   set.  Data that the proxy has spliced out of one socket and not yet
+   into the other is lost.
+
+   Call this from the thread that runs the proxy's event_base (the proxy's
+   callback is a good place), or while that base is not running: even with
+   thread-safe bufferevents, it is not safe to free a proxy that the event
+   loop may be using at the same time.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_proxy_free(struct bufferevent_proxy *proxy);
+
+/**
+   Report how many bytes a proxy has passed on in each direction.
+
+   If the bufferevents are thread-safe, this may be called from any thread.
+
+   @param proxy the proxy
+   @param a_to_b set to the number of bytes passed from a to b, if not NULL
+   @param b_to_a set to the number of bytes passed from b to a, if not NULL
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_proxy_get_counts(struct bufferevent_proxy *proxy,
+    ev_uint64_t *a_to_b, ev_uint64_t *b_to_a);
+
+/**
+   Return EV_READ if a proxy is splicing from b to a, EV_WRITE if it is
+   splicing from a to b, both, or neither.
+ */
+EVENT2_EXPORT_SYMBOL
+short bufferevent_proxy_get_splicing(struct bufferevent_proxy *proxy);
+
+/**@}*/
+
 /**
    Abstract type used to configure rate-limiting on a bufferevent or a group
    of bufferevents.
@@ -927,6 +1029,94 @@ int bufferevent_set_max_single_read(struct bufferevent *bev, size_t size);
 EVENT2_EXPORT_SYMBOL
 int bufferevent_set_max_single_write(struct bufferevent *bev, size_t size);
 
+/**
+   Let a bufferevent pick the size of each read between min and max,
+   based on how much its recent reads returned.
+
+   This sets the size limit for single read operations to max, and
+   turns on adaptive reads on the input buffer; see
+   evbuffer_set_adaptive_read().  Set max to 0 to turn adaptive reads off
+   again and go back to the default limit.
+
+   Return 0 on success and -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_set_adaptive_read(struct bufferevent *bev, size_t min,
+    size_t max);
+
+/**
+   Give back a bufferevent's unused buffer memory once it has been idle
+   for a while.
+
+   After no data has moved through the bufferevent for the time given by
+   idle, evbuffer_shrink() is called on its input and output buffers, so
+   an idle connection with empty buffers holds no buffer memory at all.
+   The timer is not pushed back on every read or write callback, so this
+   can take up to twice idle.  It starts again with the next read or write
+   callback.
+
+   @param bev the bufferevent
+   @param idle how long to wait, or NULL to stop shrinking idle buffers
+   @return 0 on success, -1 on failure.
+   @see bufferevent_add_to_mem_budget()
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_set_idle_shrink(struct bufferevent *bev,
+    const struct timeval *idle);
+
+struct bufferevent_mem_budget;
+
+/**
+   Create a budget for the buffer memory of a set of bufferevents.
+
+   Each bufferevent in the budget counts the memory its input and output
+   buffers hold, as measured whenever it runs a read or write callback and
+   whenever it shrinks its buffers.  When the total goes over limit, every
+   member is told to shrink its buffers as if it had gone idle.  If the
+   total is still over the limit once all of them have done so, the next
+   round waits until some member's buffers grow again.
+
+   The budget is only as accurate as its last measurements: it does not
+   stop buffers from growing past it.
+
+   @param limit the number of bytes of buffer memory to aim for
+   @return a new budget, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct bufferevent_mem_budget *bufferevent_mem_budget_new(size_t limit);
+
+/**
+   Free a memory budget.  It must not have any members.
+ */
+EVENT2_EXPORT_SYMBOL
+void bufferevent_mem_budget_free(struct bufferevent_mem_budget *budget);
+
+/**
+   Return how much buffer memory the members of a budget were holding
+   when they were last measured.
+ */
+EVENT2_EXPORT_SYMBOL
+size_t bufferevent_mem_budget_get_used(struct bufferevent_mem_budget *budget);
+
+/**
+   Add a bufferevent to a memory budget, removing it from any budget it
+   was in before.
+
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_add_to_mem_budget(struct bufferevent *bev,
+    struct bufferevent_mem_budget *budget);
+
+/**
+   Remove a bufferevent from its memory budget, if it has one.  This
+   happens automatically when the bufferevent is freed.
+
+   @return 0 on success, -1 on failure.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_remove_from_mem_budget(struct bufferevent *bev);
+
 /** Get the current size limit for single read operation. */
 EVENT2_EXPORT_SYMBOL
 ev_ssize_t bufferevent_get_max_single_read(struct bufferevent *bev);
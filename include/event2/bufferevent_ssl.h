@@ -112,6 +112,63 @@ EVENT2_EXPORT_SYMBOL
 void bufferevent_openssl_set_allow_dirty_shutdown(struct bufferevent *bev,
     int allow_dirty_shutdown);
 
+/**
+   Set how much small output an SSL bufferevent packs into one TLS record.
+
+   An SSL bufferevent calls SSL_write() once for each chain of its output
+   buffer, so an output buffer made of many small chains would go out as
+   many small records, each with its own header, MAC, and often system
+   call.  Instead, when the first chain is shorter than size and more data
+   follows it, the bufferevent copies up to size bytes into a buffer of its
+   own and writes them as one record.  Chains of at least size bytes are
+   still written without copying.
+
+   The default is 16384, the largest record TLS allows.
+
+   @param bev An SSL bufferevent
+   @param size The largest record to build from small chains, at most
+      16384, or 0 to write every chain on its own
+   @return 0 on success, or -1 if size is too large, bev is not an SSL
+      bufferevent, or a write is waiting to be retried.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_openssl_set_record_size(struct bufferevent *bev,
+    size_t size);
+
+/**
+   Ask an SSL bufferevent to let the kernel encrypt and decrypt its TLS
+   records (kTLS).
+
+   This sets SSL_OP_ENABLE_KTLS on the SSL, so that when the handshake is
+   done, OpenSSL hands the session keys to the kernel with
+   setsockopt(TLS_TX) and setsockopt(TLS_RX), where the kernel and the
+   negotiated cipher suite allow it.  If the kernel takes over sending, the
+   bufferevent writes its output straight to the socket, and file segments
+   added with evbuffer_add_file() or evbuffer_add_file_segment() after that
+   go out with sendfile() without being copied into userspace.  Incoming
+   data still goes through SSL_read(), which only has to handle records that
+   the kernel has already decrypted.
+
+   Call this before the handshake starts.  Otherwise, it only picks up
+   offload that OpenSSL has already set up.  If the kernel cannot take
+   over, the bufferevent quietly keeps encrypting in userspace.
+
+   @param bev An SSL bufferevent made with bufferevent_openssl_socket_new()
+   @param enable 1 to ask for kTLS, 0 to stop asking
+   @return 0 on success, or -1 if bev is a filtering bufferevent, or if
+      OpenSSL was built without kTLS support.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_openssl_set_ktls(struct bufferevent *bev, int enable);
+
+/**
+   Return EV_WRITE if the kernel encrypts the data an SSL bufferevent sends,
+   and EV_READ if it decrypts the data it receives; 0 if it does neither, or
+   -1 if bev is not an SSL bufferevent.
+ */
+EVENT2_EXPORT_SYMBOL
+int bufferevent_openssl_get_ktls(struct bufferevent *bev);
+
 /** Return the underlying openssl SSL * object for an SSL bufferevent. */
 EVENT2_EXPORT_SYMBOL
 struct ssl_st *
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef EVENT2_DGRAM_H_INCLUDED_
+#define EVENT2_DGRAM_H_INCLUDED_
+
+/** @file event2/dgram.h
+
+  An evdgram reads and writes datagrams on a UDP (or other datagram)
+  socket in batches.
+
+  When the socket becomes readable, an evdgram reads as many datagrams as
+  it can in one recvmmsg() call, into a ring of buffers that it allocated up
+  front, and hands the whole batch to the read callback.  Datagrams queued
+  with evdgram_send() are copied into a second ring, and go out together in
+  one sendmmsg() call once the socket is writable.  Where recvmmsg() and
+  sendmmsg() are missing, the evdgram falls back to one recvfrom() or
+  sendto() per datagram, which still saves the per-datagram callbacks.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <event2/visibility.h>
+#include <event2/util.h>
+
+struct event_base;
+struct evdgram;
+struct sockaddr;
+
+/** One datagram handed to an evdgram_read_cb. */
+struct evdgram_msg {
+	/** The payload.  If the datagram was bigger than the evdgram's
+	 * max_size, only the first max_size bytes are here. */
+	const void *data;
+	size_t len;
+	/** The address the datagram came from, or NULL if the socket is
+	 * connected and the system did not tell us. */
+	const struct sockaddr *addr;
+	int socklen;
+};
+
+/**
+   A callback that we invoke with a batch of datagrams read from an evdgram.
+
+   The datagrams, and the memory they point to, are only valid until the
+   callback returns.  The callback may call evdgram_send() to reply; replies
+   queued from the callback go out together when it is done.
+
+   @param dg The evdgram
+   @param msgs The datagrams, in the order they were read
+   @param n The number of datagrams in msgs; at least 1
+   @param arg the pointer passed to evdgram_setcb()
+ */
+typedef void (*evdgram_read_cb)(struct evdgram *dg,
+    const struct evdgram_msg *msgs, int n, void *arg);
+
+/**
+   A callback that we invoke when reading from or writing to an evdgram
+   fails with a non-retriable error.  Use EVUTIL_SOCKET_ERROR() to find out
+   which one.
+
+   A write error drops the datagram that caused it; the ones after it are
+   still sent.
+
+   @param dg The evdgram
+   @param what EV_READ or EV_WRITE
+   @param arg the pointer passed to evdgram_setcb()
+ */
+typedef void (*evdgram_error_cb)(struct evdgram *dg, short what, void *arg);
+
+/** Flag: Indicates that freeing the evdgram should close the underlying
+ * socket. */
+#define EVDGRAM_OPT_CLOSE_ON_FREE	(1u<<0)
+/** Flag: Indicates that the evdgram should be locked so it's safe to use
+ * from multiple threads at once. */
+#define EVDGRAM_OPT_THREADSAFE		(1u<<1)
+
+/**
+   Allocate a new evdgram on a datagram socket.
+
+   The socket is made nonblocking.  The evdgram does not read until a read
+   callback is set with evdgram_setcb() and it is enabled with
+   evdgram_enable().
+
+   @param base The event base to associate the evdgram with.
+   @param fd The datagram socket.  It should already be bound, and may be
+      connected.
+   @param flags Any number of EVDGRAM_OPT_* flags
+   @param batch_size The largest number of datagrams to read at once, and
+      the number of datagrams evdgram_send() can queue.  Use 0 or less for a
+      reasonable default.
+   @param max_size The largest datagram to receive or send.  Use 0 for a
+      default of 2048 bytes.
+   @return a new evdgram, or NULL on error.
+ */
+EVENT2_EXPORT_SYMBOL
+struct evdgram *evdgram_new(struct event_base *base, evutil_socket_t fd,
+    unsigned flags, int batch_size, size_t max_size);
+
+/**
+   Free an evdgram.
+
+   Any datagrams that are still queued are sent if the socket can take them
+   right away, and dropped otherwise.
+ */
+EVENT2_EXPORT_SYMBOL
+void evdgram_free(struct evdgram *dg);
+
+/** Change the callbacks of an evdgram.  A NULL readcb stops reading. */
+EVENT2_EXPORT_SYMBOL
+void evdgram_setcb(struct evdgram *dg, evdgram_read_cb readcb,
+    evdgram_error_cb errorcb, void *arg);
+
+/** Start reading datagrams from an evdgram. */
+EVENT2_EXPORT_SYMBOL
+int evdgram_enable(struct evdgram *dg);
+
+/** Stop reading datagrams from an evdgram.  Queued datagrams are still
+ * sent. */
+EVENT2_EXPORT_SYMBOL
+int evdgram_disable(struct evdgram *dg);
+
+/**
+   Queue a datagram to send on an evdgram.
+
+   The data is copied, so the caller may reuse its buffer right away.  The
+   datagram goes out with the others that are queued once the socket is
+   writable, or on the next call to evdgram_flush().
+
+   @param dg The evdgram
+   @param data The payload
+   @param len The size of the payload; at most the evdgram's max_size
+   @param addr The destination, or NULL if the socket is connected
+   @param socklen The length of addr
+   @return 0 on success, or -1 if the datagram is too big or the queue is
+      full and the socket cannot take any more right now; in the latter
+      case the socket error is EAGAIN.  Any datagram that has to be dropped
+      while making room is reported to the error callback with EV_WRITE.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_send(struct evdgram *dg, const void *data, size_t len,
+    const struct sockaddr *addr, int socklen);
+
+/**
+   Try to send every queued datagram right away.
+
+   @return the number of datagrams still queued because the socket would
+      block, or -1 if some datagrams were dropped because of an error.
+ */
+EVENT2_EXPORT_SYMBOL
+int evdgram_flush(struct evdgram *dg);
+
+/** Return the socket that an evdgram is using. */
+EVENT2_EXPORT_SYMBOL
+evutil_socket_t evdgram_get_fd(struct evdgram *dg);
+
+/** Return the event base that an evdgram is associated with. */
+EVENT2_EXPORT_SYMBOL
+struct event_base *evdgram_get_base(struct evdgram *dg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENT2_DGRAM_H_INCLUDED_ */
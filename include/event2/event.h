@@ -44,7 +44,7 @@
 
 
   Currently, Libevent supports /dev/poll, kqueue(2), select(2), poll(2),
-  epoll(4), and evports. The internal event mechanism is completely
+  epoll(4), io_uring(7), and evports. The internal event mechanism is completely
   independent of the exposed event API, and a simple update of Libevent can
   provide new functionality without having to redesign the applications. As a
   result, Libevent allows for portable application development and provides
@@ -453,6 +453,22 @@ int event_base_get_num_events(struct event_base *, unsigned int);
 EVENT2_EXPORT_SYMBOL
 int event_base_get_max_events(struct event_base *, unsigned int, int);
 
+/**
+  Report how many times the loop of an event_base has been asked to wake up
+  by other threads.
+
+  A wakeup is only sent when none is already pending; requests that arrive
+  while one is pending are coalesced into it.
+
+  @param eb the event_base structure returned by event_base_new()
+  @param sent if not NULL, set to the number of wakeups that were sent
+  @param coalesced if not NULL, set to the number of wakeup requests that
+         were coalesced into one that was already pending
+ */
+EVENT2_EXPORT_SYMBOL
+void event_base_get_wakeup_counts(struct event_base *eb, ev_uint64_t *sent,
+    ev_uint64_t *coalesced);
+
 /**
    Allocates a new event configuration object.
 
@@ -570,7 +586,24 @@ enum event_base_config_flag {
 	    however, we use less efficient more precise timer, assuming one is
 	    present.
 	 */
-	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20
+	EVENT_BASE_FLAG_PRECISE_TIMER = 0x20,
+
+	/** Keep timeouts in a hierarchical timing wheel instead of a min-heap.
+
+	    Adding, removing and rescheduling a timeout no longer costs
+	    O(log n), which helps when an event_base has a very large
+	    number of pending timeouts (for example, one idle timer per
+	    connection), without having to use common timeouts.  Finding the
+	    next timeout once the earliest one is removed or rescheduled
+	    means a walk over the timers that share its part of the wheel,
+	    though, and for distant timeouts those can be many.  Timeouts
+	    have a granularity of one millisecond: they never fire early,
+	    but may fire up to a millisecond late.
+
+	    This flag can also be activated by setting the EVENT_TIMER_WHEEL
+	    environment variable.
+	 */
+	EVENT_BASE_FLAG_TIMER_WHEEL = 0x40
 };
 
 /**
@@ -952,6 +985,17 @@ int event_base_got_break(struct event_base *);
  * feature flag EV_FEATURE_EARLY_CLOSE.
  **/
 #define EV_CLOSED	0x80
+/**
+ * Lazy timeout: if the event already has a pending timeout, re-adding it
+ * with a timeout that expires no earlier only records the new deadline.
+ * The event is moved in the timeout queue once the old timeout is reached,
+ * instead of on every re-add.
+ *
+ * This makes it cheap to keep pushing back an idle timeout, as with a
+ * persistent read event that is re-added after every read.  The event loop
+ * may wake up once at the old deadline.
+ **/
+#define EV_LAZY_TIMEOUT	0x100
 /**@}*/
 
 /**
@@ -1208,6 +1252,39 @@ int event_free_finalize(unsigned, struct event *, event_finalize_callback_fn);
 EVENT2_EXPORT_SYMBOL
 int event_base_once(struct event_base *, evutil_socket_t, short, event_callback_fn, void *, const struct timeval *);
 
+/** Flag for event_base_post(): if the base is busy, another base in the same
+ * event_base_group that was created with EVENT_BASE_GROUP_WORK_STEALING may
+ * run the callback instead. */
+#define EV_POST_STEALABLE 0x01
+
+/** A callback posted with event_base_post().  Its first argument is the base
+ * whose loop is running it. */
+typedef void (*event_post_callback_fn)(struct event_base *, void *);
+
+/**
+  Run a callback once in the loop of an event_base, from any thread.
+
+  Unlike event_active() or event_base_once(), this does not take the base's
+  lock: the callback goes onto a lock-free queue that the loop empties on
+  each iteration, and the loop is only woken up when the queue was empty.
+  Callbacks run at the default priority.  Those posted from one thread to
+  the same base without EV_POST_STEALABLE run in the order they were posted.
+  Nothing is promised about the order of stealable callbacks, which may run
+  on other bases at the same time, or about their order relative to the
+  others.
+
+  Callbacks that have not run when the base is freed are discarded.
+
+  @param base the event_base to run the callback in
+  @param cb the callback to run
+  @param arg the second argument to pass to cb
+  @param flags 0, or EV_POST_STEALABLE
+  @return 0 if successful, or -1 if an error occurred
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_post(struct event_base *base, event_post_callback_fn cb,
+    void *arg, int flags);
+
 /**
   Add an event to the set of pending events.
 
@@ -1545,6 +1622,130 @@ void event_set_mem_functions(
 #define EVENT_SET_MEM_FUNCTIONS_IMPLEMENTED
 #endif
 
+/**
+   An allocator context: a source of memory for evbuffer chains that can be
+   given to one event_base, instead of the process-wide functions set with
+   event_set_mem_functions().
+
+   Giving each thread's event_base its own context, bound to the NUMA node
+   that thread runs on, keeps the data for its connections in local memory.
+
+   @see event_mem_ctx_new_arena(), event_base_set_mem_ctx()
+ */
+struct event_mem_ctx;
+
+/**
+   Flag for event_mem_ctx_new_arena(): back the arena with 2MB huge pages.
+
+   We use reserved huge pages (MAP_HUGETLB) if there are any, and otherwise
+   ask for transparent huge pages.  If neither works, we quietly use normal
+   pages; event_mem_ctx_get_stats() tells you which you got.
+ */
+#define EVENT_MEM_HUGEPAGES 0x01
+
+/** A function to allocate 'size' bytes for an event_mem_ctx. */
+typedef void *(*event_mem_alloc_cb)(size_t size, void *arg);
+/** A function to release a block from an event_mem_alloc_cb.  'size' is
+    the size that was asked for. */
+typedef void (*event_mem_release_cb)(void *ptr, size_t size, void *arg);
+
+/** Counters for an event_mem_ctx.
+    @see event_mem_ctx_get_stats() */
+struct event_mem_ctx_stats {
+	/** Bytes the arena has mapped from the kernel. */
+	size_t mapped_bytes;
+	/** Bytes handed out and not yet released. */
+	size_t allocated_bytes;
+	/** EVENT_MEM_HUGEPAGES if any of the arena is on huge pages. */
+	unsigned flags;
+	/** The NUMA node the arena is bound to, or -1. */
+	int numa_node;
+};
+
+/**
+   Create an allocator context that calls your own functions.
+
+   @param alloc_fn a function to allocate memory
+   @param release_fn a function to release memory from alloc_fn
+   @param arg an argument to pass to both functions
+   @return the new context, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+struct event_mem_ctx *event_mem_ctx_new(event_mem_alloc_cb alloc_fn,
+    event_mem_release_cb release_fn, void *arg);
+
+/**
+   Create an allocator context that carves memory out of 2MB arenas.
+
+   Arenas are never returned to the kernel until the context is freed, so
+   once a program's memory use stops growing, it stops making system calls
+   to allocate memory.
+
+   @param numa_node the NUMA node to allocate memory on, or -1 to leave it
+          to the kernel.  This only works on Linux.
+   @param flags zero or more EVENT_MEM_* flags
+   @return the new context, or NULL on failure, including if the memory
+          could not be bound to numa_node.
+ */
+EVENT2_EXPORT_SYMBOL
+struct event_mem_ctx *event_mem_ctx_new_arena(int numa_node, unsigned flags);
+
+/**
+   Free an allocator context.
+
+   Event bases and evbuffer_chain_pools that use the context keep it alive
+   until they are done with it.
+ */
+EVENT2_EXPORT_SYMBOL
+void event_mem_ctx_free(struct event_mem_ctx *ctx);
+
+/**
+   Allocate memory from an allocator context.
+
+   @return size bytes, or NULL on failure
+ */
+EVENT2_EXPORT_SYMBOL
+void *event_mem_ctx_alloc(struct event_mem_ctx *ctx, size_t size);
+
+/**
+   Give memory from event_mem_ctx_alloc() back to its context.
+
+   @param ctx the context the memory came from
+   @param ptr the memory
+   @param size the size that was passed to event_mem_ctx_alloc()
+ */
+EVENT2_EXPORT_SYMBOL
+void event_mem_ctx_release(struct event_mem_ctx *ctx, void *ptr, size_t size);
+
+/**
+   Get the counters for an allocator context.
+ */
+EVENT2_EXPORT_SYMBOL
+void event_mem_ctx_get_stats(struct event_mem_ctx *ctx,
+    struct event_mem_ctx_stats *stats);
+
+/**
+   Make an event_base allocate evbuffer memory from an allocator context.
+
+   Bufferevents created on the base after this call allocate the chains
+   for their input and output buffers from ctx.  To do the same for an
+   evbuffer of your own, give it a pool from
+   evbuffer_chain_pool_new_with_mem_ctx().
+
+   @param base the event_base
+   @param ctx the context to use, or NULL to go back to the default
+   @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int event_base_set_mem_ctx(struct event_base *base,
+    struct event_mem_ctx *ctx);
+
+/**
+   Return the allocator context of an event_base, or NULL if it has none.
+ */
+EVENT2_EXPORT_SYMBOL
+struct event_mem_ctx *event_base_get_mem_ctx(struct event_base *base);
+
 /**
    Writes a human-readable description of all inserted and/or active
    events to a provided stdio stream.
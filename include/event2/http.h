@@ -223,6 +223,26 @@ void evhttp_set_max_headers_size(struct evhttp* http, ev_ssize_t max_headers_siz
 EVENT2_EXPORT_SYMBOL
 void evhttp_set_max_body_size(struct evhttp* http, ev_ssize_t max_body_size);
 
+/**
+  Set how many requests may be outstanding on a single connection.
+
+  By default the server reads one request, waits for the reply to it to be
+  written, and only then reads the next one.  With a limit greater than one,
+  requests that a client pipelines are parsed and handed to the callbacks
+  while earlier replies are still being generated.  The replies may be sent
+  in any order; they are queued on the connection and written in the order
+  the requests arrived.
+
+  Requests that close the connection, CONNECT requests and protocol upgrades
+  end the pipeline.
+
+  @param http the http server on which to set the limit
+  @param max_requests the number of requests, including the one being
+    answered; values below 1 are treated as 1
+*/
+EVENT2_EXPORT_SYMBOL
+void evhttp_set_max_pipelined_requests(struct evhttp *http, int max_requests);
+
 /**
   Set the value to use for the Content-Type header when none was provided. If
   the content type string is NULL, the Content-Type header will not be
@@ -286,6 +306,34 @@ int evhttp_set_cb(struct evhttp *http, const char *path,
 EVENT2_EXPORT_SYMBOL
 int evhttp_del_cb(struct evhttp *, const char *);
 
+/**
+   Set a callback for all paths that start with a given prefix
+
+   A callback set with evhttp_set_cb() for the exact path takes precedence.
+   Otherwise, the callback whose prefix is the longest match for the path is
+   invoked.  Prefixes are compared byte by byte against the decoded path, so
+   "/static" also matches "/staticfile"; use "/static/" to match only the
+   paths below it.
+
+   @param http the http sever on which to set the callback
+   @param prefix the path prefix for which to invoke the callback
+   @param cb the callback function that gets invoked on matching paths
+   @param cb_arg an additional context argument for the callback
+   @return 0 on success, -1 if the callback existed already, -2 on failure
+   @see evhttp_del_prefix_cb()
+*/
+EVENT2_EXPORT_SYMBOL
+int evhttp_set_prefix_cb(struct evhttp *http, const char *prefix,
+    void (*cb)(struct evhttp_request *, void *), void *cb_arg);
+
+/** Removes a callback set with evhttp_set_prefix_cb()
+
+   @return 0 on success, -1 if there is no such callback or memory ran out,
+     in which case every prefix callback is left in place
+*/
+EVENT2_EXPORT_SYMBOL
+int evhttp_del_prefix_cb(struct evhttp *http, const char *prefix);
+
 /**
     Set a callback for all requests that are not caught by specific callbacks
 
@@ -439,6 +487,17 @@ void evhttp_set_write_timeout_tv(struct evhttp *http, const struct timeval* tv);
 /* Read all the clients body, and only after this respond with an error if the
  * clients body exceed max_body_size */
 #define EVHTTP_SERVER_LINGERING_CLOSE	0x0001
+/* Also speak HTTP/2 (RFC 9113), without TLS ("h2c"): to clients that start
+ * with the HTTP/2 connection preface, and to clients that ask for it with
+ * "Upgrade: h2c" on a first request that has no body.  Each stream becomes
+ * an evhttp_request that is dispatched to the usual callbacks, and the
+ * replies sent through evhttp_send_reply() and friends go out as HTTP/2
+ * frames.  For HTTP/2 over TLS, have the SSL_CTX used by the bevcb select
+ * "h2" during ALPN; the client then sends the preface over the TLS
+ * connection and is treated the same way.  Header lists are limited to
+ * the smaller of max_headers_size and 64 KiB, and larger ones are answered
+ * with 431.  Server push and stream priorities are not supported. */
+#define EVHTTP_SERVER_HTTP2	0x0002
 /**
  * Set connection flags for HTTP server.
  *
@@ -960,6 +1019,102 @@ int evhttp_make_request(struct evhttp_connection *evcon,
 EVENT2_EXPORT_SYMBOL
 void evhttp_cancel_request(struct evhttp_request *req);
 
+/**
+ * A client that keeps persistent connections to each host:port it talks to,
+ * so that requests do not have to wait for a new TCP (and TLS) handshake.
+ *
+ * evhttp_client_make_request() sends a request over an idle connection to
+ * its host when there is one; otherwise it opens a new connection, until
+ * the host has as many as evhttp_client_set_max_connections_per_host()
+ * allows, after which the request waits behind those of the connection
+ * with the fewest requests.  Connections stay open between requests until
+ * the server closes them or their read timeout passes.  A closed connection
+ * is freed if no request comes for it within another read timeout, and so
+ * is the client's state for a host once it has no connections left.
+ *
+ * A server may close an idle connection just as a request goes out on it.
+ * If that happens before any of the response has arrived, an idempotent
+ * request (GET, HEAD, PUT, DELETE, OPTIONS or TRACE) is sent once more, on
+ * a new connection, instead of failing.
+ */
+struct evhttp_client;
+
+/**
+ * Create a new client.
+ *
+ * @param base the event_base to use for its connections
+ * @param dnsbase the dns_base to use for resolving host names; if not
+ *     specified host name resolution will block.
+ * @return a new evhttp_client, or NULL on error
+ * @see evhttp_client_free()
+ */
+EVENT2_EXPORT_SYMBOL
+struct evhttp_client *evhttp_client_new(struct event_base *base,
+    struct evdns_base *dnsbase);
+
+/**
+ * Free a client, and all of its connections.
+ *
+ * Requests still in flight are freed without their callbacks being run,
+ * as with evhttp_connection_free().  This must not be called from one of
+ * the client's request callbacks.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_client_free(struct evhttp_client *client);
+
+/**
+ * Set how many connections the client may have open to one host:port at a
+ * time; the default is 6.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_client_set_max_connections_per_host(struct evhttp_client *client,
+    int max);
+
+/**
+ * Set the timeout of the connections that the client opens from now on,
+ * as evhttp_connection_set_timeout_tv() does.  The read timeout also bounds
+ * how long an idle connection is kept.
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_client_set_timeout_tv(struct evhttp_client *client,
+    const struct timeval *tv);
+
+/**
+ * Set a callback that creates the bufferevent of each new connection, e.g.
+ * a TLS one that verifies host.  Without one, plain socket bufferevents are
+ * used.
+ *
+ * @param client the evhttp_client
+ * @param cb the callback; it gets the host and port being connected to,
+ *     and returns a bufferevent without an fd, or NULL on error
+ * @param arg an extra argument for the callback
+ */
+EVENT2_EXPORT_SYMBOL
+void evhttp_client_set_bevcb(struct evhttp_client *client,
+    struct bufferevent *(*cb)(struct event_base *, const char *host,
+	ev_uint16_t port, void *),
+    void *arg);
+
+/**
+ * Make an HTTP request to host:port, over one of the client's connections.
+ *
+ * Unless req has a Host header already, one is added for host and port.
+ * As with evhttp_make_request(), the client gets ownership of the request;
+ * on failure it has been freed.
+ *
+ * @param client the evhttp_client
+ * @param req the previously created and configured request object
+ * @param type the request type EVHTTP_REQ_GET, EVHTTP_REQ_POST, etc.
+ * @param host the host name or address of the server
+ * @param port the port of the server
+ * @param uri the URI associated with the request
+ * @return 0 on success, -1 on failure
+ */
+EVENT2_EXPORT_SYMBOL
+int evhttp_client_make_request(struct evhttp_client *client,
+    struct evhttp_request *req, enum evhttp_cmd_type type,
+    const char *host, ev_uint16_t port, const char *uri);
+
 /**
  * A structure to hold a parsed URI or Relative-Ref conforming to RFC3986.
  */
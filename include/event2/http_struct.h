@@ -49,6 +49,8 @@ extern "C" {
 /* For int types. */
 #include <event2/util.h>
 
+struct evhttp_h2_stream;
+
 /**
  * the request structure that a server receives.
  * WARNING: expect this structure to change.  I will try to provide
@@ -77,6 +79,10 @@ struct {
 #define EVHTTP_REQ_DEFER_FREE		0x0008
 /** The request should be freed upstack */
 #define EVHTTP_REQ_NEEDS_FREE		0x0010
+/** The reply is waiting in output_buffer for earlier pipelined replies */
+#define EVHTTP_REQ_REPLY_QUEUED		0x0020
+/** The request has been sent again after its connection went stale */
+#define EVHTTP_REQ_RETRIED		0x0040
 
 	struct evkeyvalq *input_headers;
 	struct evkeyvalq *output_headers;
@@ -142,6 +148,9 @@ struct {
 	 */
 	void (*on_complete_cb)(struct evhttp_request *, void *);
 	void *on_complete_cb_arg;
+
+	/* The HTTP/2 stream that the request arrived on, if any */
+	struct evhttp_h2_stream *h2_stream;
 };
 
 #ifdef __cplusplus
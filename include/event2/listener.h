@@ -49,6 +49,22 @@ struct evconnlistener;
  */
 typedef void (*evconnlistener_cb)(struct evconnlistener *, evutil_socket_t, struct sockaddr *, int socklen, void *);
 
+/**
+   A callback that we invoke with a batch of new connections, when one has
+   been set with evconnlistener_set_batch_cb().
+
+   The callback takes ownership of every fd it is given.  The arrays are
+   only valid until it returns.
+
+   @param listener The evconnlistener
+   @param fds The new file descriptors
+   @param addrs The source addresses of the connections
+   @param socklens The lengths of the addresses in addrs
+   @param n The number of connections in the batch; at least 1
+   @param user_arg the pointer passed to evconnlistener_set_batch_cb()
+ */
+typedef void (*evconnlistener_batch_cb)(struct evconnlistener *, evutil_socket_t *fds, struct sockaddr **addrs, int *socklens, int n, void *);
+
 /**
    A callback that we invoke when a listener encounters a non-retriable error.
 
@@ -180,6 +196,31 @@ EVENT2_EXPORT_SYMBOL
 void evconnlistener_set_cb(struct evconnlistener *lev,
     evconnlistener_cb cb, void *arg);
 
+/**
+   Make an evconnlistener hand new connections to cb in batches.
+
+   When the listening socket becomes readable, the listener accepts
+   connections until none are left, and calls cb each time it has
+   batch_size of them, then once more with any left over.  This saves the
+   per-connection callback and locking overhead when many connections arrive
+   at once.
+
+   This replaces any callback set with evconnlistener_set_cb() or passed to
+   evconnlistener_new(); calling evconnlistener_set_cb() later switches back
+   to one connection at a time.
+
+   @param lev The evconnlistener
+   @param cb The batch callback.  If NULL, the listener will be treated as
+      disabled until a callback is set.
+   @param batch_size The largest number of connections to pass to cb at once.
+      Use 0 or less for a reasonable default.  Values over 64 are treated as
+      64.
+   @param arg A user-supplied pointer to give to the callback.
+ */
+EVENT2_EXPORT_SYMBOL
+void evconnlistener_set_batch_cb(struct evconnlistener *lev,
+    evconnlistener_batch_cb cb, int batch_size, void *arg);
+
 /** Set an evconnlistener's error callback. */
 EVENT2_EXPORT_SYMBOL
 void evconnlistener_set_error_cb(struct evconnlistener *lev,
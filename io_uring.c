@@ -0,0 +1,715 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#ifdef EVENT__HAVE_IO_URING
+
+/*
+  An io_uring backend.
+
+  We don't use io_uring for the I/O itself: we use it as a better epoll.
+  Every fd with pending events gets a poll request on the ring.  All the
+  changes from the changelist are turned into POLL_ADD and POLL_REMOVE
+  submissions, and they get sent to the kernel by the same io_uring_enter()
+  call that waits for completions, so a loop iteration costs one syscall no
+  matter how many fds changed.
+
+  Poll requests on io_uring are one-shot, which gives us level-triggered
+  behavior for free: whenever a request completes we re-arm it on the next
+  call to dispatch, and the kernel reports it again immediately if the fd is
+  still ready.  Edge-triggered events use multishot polls instead, which stay
+  armed and only report new wakeups.
+
+  Unlike epoll, a pending poll holds a reference to the file, so closing an
+  fd does not remove it.  The changelist turns "delete, close, reopen, add"
+  into an add for events that were already set; we treat that as a request
+  to throw away the old poll and arm a fresh one.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef EVENT__HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <sys/queue.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <endian.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "event-internal.h"
+#include "evsignal-internal.h"
+#include "event2/thread.h"
+#include "evthread-internal.h"
+#include "log-internal.h"
+#include "evmap-internal.h"
+#include "changelist-internal.h"
+#include "time-internal.h"
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0
+#define EARLY_CLOSE_IF_HAVE_RDHUP 0
+#else
+#define EARLY_CLOSE_IF_HAVE_RDHUP EV_FEATURE_EARLY_CLOSE
+#endif
+
+/* Number of submission queue entries.  When a dispatch has more changes than
+ * this, we flush the queue early; it costs an extra syscall, nothing more. */
+#define URING_SQ_ENTRIES 256
+/* Number of completion queue entries.  The kernel buffers overflowing
+ * completions for us (IORING_FEAT_NODROP), so this is a size hint, not a
+ * limit. */
+#define URING_CQ_ENTRIES 4096
+
+/* user_data for requests whose completions we don't care about. */
+#define URING_UDATA_IGNORE (~(ev_uint64_t)0)
+
+#define URING_UDATA(fd, gen) \
+	(((ev_uint64_t)(gen) << 32) | (ev_uint32_t)(fd))
+#define URING_UDATA_FD(u) ((int)(ev_uint32_t)((u) & 0xffffffff))
+#define URING_UDATA_GEN(u) ((ev_uint32_t)((u) >> 32))
+
+/* Per-fd state for the backend. */
+struct uring_fd {
+	/* Generation of the currently armed poll request.  Completions from
+	 * older requests are ignored. */
+	ev_uint32_t gen;
+	/* The events that the evmap wants on this fd (EV_READ, EV_WRITE,
+	 * EV_CLOSED, EV_ET). */
+	short want;
+	/* The events we have a poll request armed for, or 0 if none. */
+	short armed;
+	/* True if this fd is on the rearm list. */
+	ev_uint8_t pending;
+	/* True if we must replace the armed poll even if 'want' is unchanged,
+	 * since the fd may have been closed and reopened. */
+	ev_uint8_t force;
+};
+
+struct uringop {
+	int ring_fd;
+
+	/* Submission ring. */
+	void *sq_ptr;
+	size_t sq_ring_sz;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_flags;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+	unsigned sq_entries;
+	/* Number of sqes filled in but not yet handed to the kernel. */
+	unsigned to_submit;
+
+	/* Completion ring.  May share a mapping with the submission ring. */
+	void *cq_ptr;
+	size_t cq_ring_sz;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Per-fd state, indexed by fd. */
+	struct uring_fd *fds;
+	int nfds;
+
+	/* List of fds whose poll request needs to be (re)armed or removed
+	 * before we next wait. */
+	int *rearm;
+	int n_rearm;
+	int rearm_size;
+};
+
+static void *uring_init(struct event_base *);
+static int uring_dispatch(struct event_base *, struct timeval *);
+static void uring_dealloc(struct event_base *);
+static int uring_probe_multishot(struct uringop *);
+
+const struct eventop uringops = {
+	"io_uring",
+	uring_init,
+	event_changelist_add_,
+	event_changelist_del_,
+	uring_dispatch,
+	uring_dealloc,
+	1, /* need reinit */
+	EV_FEATURE_ET|EV_FEATURE_O1|EARLY_CLOSE_IF_HAVE_RDHUP,
+	EVENT_CHANGELIST_FDINFO_SIZE
+};
+
+static int
+sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, const void *arg, size_t argsz)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, arg, argsz);
+}
+
+static void
+uring_unmap(struct uringop *uop)
+{
+	if (uop->sqes && uop->sqes != MAP_FAILED)
+		munmap(uop->sqes, uop->sqes_sz);
+	if (uop->cq_ptr && uop->cq_ptr != MAP_FAILED &&
+	    uop->cq_ptr != uop->sq_ptr)
+		munmap(uop->cq_ptr, uop->cq_ring_sz);
+	if (uop->sq_ptr && uop->sq_ptr != MAP_FAILED)
+		munmap(uop->sq_ptr, uop->sq_ring_sz);
+	uop->sqes = NULL;
+	uop->cq_ptr = uop->sq_ptr = NULL;
+}
+
+static void *
+uring_init(struct event_base *base)
+{
+	struct io_uring_params p;
+	struct uringop *uop;
+	int fd;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+
+	if ((fd = sys_io_uring_setup(URING_SQ_ENTRIES, &p)) < 0) {
+		/* ENOSYS: old kernel.  EPERM: io_uring disabled by sysctl
+		 * or by a seccomp filter.  Either way, let the next backend
+		 * have a go. */
+		if (errno != ENOSYS && errno != EPERM)
+			event_warn("io_uring_setup");
+		return (NULL);
+	}
+	evutil_make_socket_closeonexec(fd);
+
+	/* We need the extended argument to io_uring_enter so that we can
+	 * wait with a timeout without burning a submission on it, and we
+	 * need the kernel not to drop completions on overflow. */
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		event_debug(("%s: kernel io_uring is too old (features 0x%x)",
+			__func__, p.features));
+		close(fd);
+		return (NULL);
+	}
+
+	if (!(uop = mm_calloc(1, sizeof(struct uringop)))) {
+		close(fd);
+		return (NULL);
+	}
+	uop->ring_fd = fd;
+
+	uop->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	uop->cq_ring_sz = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uop->cq_ring_sz > uop->sq_ring_sz)
+			uop->sq_ring_sz = uop->cq_ring_sz;
+		uop->cq_ring_sz = uop->sq_ring_sz;
+	}
+
+	uop->sq_ptr = mmap(NULL, uop->sq_ring_sz, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (uop->sq_ptr == MAP_FAILED) {
+		event_warn("mmap(IORING_OFF_SQ_RING)");
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		uop->cq_ptr = uop->sq_ptr;
+	} else {
+		uop->cq_ptr = mmap(NULL, uop->cq_ring_sz,
+		    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd,
+		    IORING_OFF_CQ_RING);
+		if (uop->cq_ptr == MAP_FAILED) {
+			event_warn("mmap(IORING_OFF_CQ_RING)");
+			goto err;
+		}
+	}
+	uop->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	uop->sqes = mmap(NULL, uop->sqes_sz, PROT_READ|PROT_WRITE,
+	    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uop->sqes == MAP_FAILED) {
+		event_warn("mmap(IORING_OFF_SQES)");
+		goto err;
+	}
+
+	sq = uop->sq_ptr;
+	uop->sq_head = (unsigned *)(sq + p.sq_off.head);
+	uop->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	uop->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	uop->sq_flags = (unsigned *)(sq + p.sq_off.flags);
+	uop->sq_array = (unsigned *)(sq + p.sq_off.array);
+	uop->sq_entries = p.sq_entries;
+
+	cq = uop->cq_ptr;
+	uop->cq_head = (unsigned *)(cq + p.cq_off.head);
+	uop->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	uop->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	uop->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if (!uring_probe_multishot(uop)) {
+		event_debug(("%s: kernel io_uring has no multishot poll",
+			__func__));
+		goto err;
+	}
+
+	evsig_init_(base);
+
+	return (uop);
+err:
+	uring_unmap(uop);
+	close(fd);
+	mm_free(uop);
+	return (NULL);
+}
+
+/* Hand every sqe that we have filled in to the kernel, without waiting for
+ * anything. */
+static int
+uring_flush(struct uringop *uop)
+{
+	while (uop->to_submit) {
+		int r = sys_io_uring_enter(uop->ring_fd, uop->to_submit, 0, 0,
+		    NULL, 0);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EBUSY)
+				return (0);
+			event_warn("io_uring_enter");
+			return (-1);
+		}
+		uop->to_submit -= r;
+	}
+	return (0);
+}
+
+/* Return a zeroed sqe to fill in, flushing the submission queue first if it
+ * is full.  Returns NULL on failure. */
+static struct io_uring_sqe *
+uring_get_sqe(struct uringop *uop)
+{
+	unsigned head, tail = *uop->sq_tail;
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	head = __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head >= uop->sq_entries) {
+		if (uring_flush(uop) < 0)
+			return (NULL);
+		head = __atomic_load_n(uop->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head >= uop->sq_entries)
+			return (NULL);
+	}
+
+	idx = tail & *uop->sq_mask;
+	sqe = &uop->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	uop->sq_array[idx] = idx;
+	__atomic_store_n(uop->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++uop->to_submit;
+	return (sqe);
+}
+
+static int
+uring_queue_poll_add(struct uringop *uop, int fd, short events,
+    ev_uint32_t gen)
+{
+	struct io_uring_sqe *sqe;
+	ev_uint32_t mask = 0;
+
+	if (events & EV_READ)
+		mask |= POLLIN;
+	if (events & EV_WRITE)
+		mask |= POLLOUT;
+	if (events & EV_CLOSED)
+		mask |= POLLRDHUP;
+
+	if (!(sqe = uring_get_sqe(uop)))
+		return (-1);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	mask = (mask << 16) | (mask >> 16);
+#endif
+	sqe->poll32_events = mask;
+	if (events & EV_ET)
+		sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = URING_UDATA(fd, gen);
+	return (0);
+}
+
+static int
+uring_queue_poll_remove(struct uringop *uop, int fd, ev_uint32_t gen)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!(sqe = uring_get_sqe(uop)))
+		return (-1);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = URING_UDATA(fd, gen);
+	sqe->user_data = URING_UDATA_IGNORE;
+	return (0);
+}
+
+/* Return true if the kernel supports multishot polls, which we need for
+ * edge-triggered events.  They arrived in 5.13, two releases after the
+ * extended io_uring_enter() argument, and earlier kernels reject the flag
+ * with EINVAL.  We find out by arming one on a pipe that is always
+ * writable. */
+static int
+uring_probe_multishot(struct uringop *uop)
+{
+	struct io_uring_sqe *sqe;
+	const struct io_uring_cqe *cqe;
+	ev_uint32_t mask = POLLOUT;
+	unsigned head, tail;
+	int fds[2], ok = 0;
+
+	if (pipe(fds) < 0)
+		return (0);
+	if (!(sqe = uring_get_sqe(uop)))
+		goto done;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fds[1];
+#if __BYTE_ORDER == __BIG_ENDIAN
+	mask = (mask << 16) | (mask >> 16);
+#endif
+	sqe->poll32_events = mask;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = URING_UDATA_IGNORE;
+
+	if (sys_io_uring_enter(uop->ring_fd, uop->to_submit, 1,
+		IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+		goto done;
+	uop->to_submit = 0;
+
+	head = *uop->cq_head;
+	tail = __atomic_load_n(uop->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		goto done;
+	cqe = &uop->cqes[head & *uop->cq_mask];
+	ok = cqe->res >= 0 && (cqe->flags & IORING_CQE_F_MORE);
+	__atomic_store_n(uop->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	if (ok) {
+		/* The poll stays armed, and holds on to the pipe after we
+		 * close it.  Its last completions are ignored like those of
+		 * any other removal. */
+		if (!(sqe = uring_get_sqe(uop)))
+			goto done;
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = URING_UDATA_IGNORE;
+		sqe->user_data = URING_UDATA_IGNORE;
+		if (uring_flush(uop) < 0)
+			ok = 0;
+	}
+done:
+	close(fds[0]);
+	close(fds[1]);
+	return (ok);
+}
+
+/* Make sure that uop->fds has a slot for 'fd'. */
+static int
+uring_grow_fds(struct uringop *uop, int fd)
+{
+	struct uring_fd *tmp;
+	int n = uop->nfds ? uop->nfds : 32;
+
+	if (fd < uop->nfds)
+		return (0);
+	while (n <= fd)
+		n <<= 1;
+	if (!(tmp = mm_realloc(uop->fds, n * sizeof(struct uring_fd))))
+		return (-1);
+	memset(tmp + uop->nfds, 0, (n - uop->nfds) * sizeof(struct uring_fd));
+	uop->fds = tmp;
+	uop->nfds = n;
+	return (0);
+}
+
+/* Put 'fd' on the list of fds to look at before we next wait. */
+static int
+uring_mark_pending(struct uringop *uop, int fd)
+{
+	struct uring_fd *st = &uop->fds[fd];
+
+	if (st->pending)
+		return (0);
+	if (uop->n_rearm == uop->rearm_size) {
+		int n = uop->rearm_size ? uop->rearm_size * 2 : 64;
+		int *tmp = mm_realloc(uop->rearm, n * sizeof(int));
+		if (!tmp)
+			return (-1);
+		uop->rearm = tmp;
+		uop->rearm_size = n;
+	}
+	uop->rearm[uop->n_rearm++] = fd;
+	st->pending = 1;
+	return (0);
+}
+
+static int
+uring_apply_one_change(struct uringop *uop, const struct event_change *ch)
+{
+	struct uring_fd *st;
+	short want = ch->old_events & (EV_READ|EV_WRITE|EV_CLOSED);
+	int force = 0;
+
+	if (ch->fd < 0 || uring_grow_fds(uop, ch->fd) < 0)
+		return (-1);
+	st = &uop->fds[ch->fd];
+
+#define APPLY(change, ev) do {					\
+		if ((change) & EV_CHANGE_ADD) {			\
+			if (want & (ev))			\
+				force = 1;			\
+			want |= (ev);				\
+		} else if ((change) & EV_CHANGE_DEL) {		\
+			want &= ~(ev);				\
+		}						\
+	} while (0)
+	APPLY(ch->read_change, EV_READ);
+	APPLY(ch->write_change, EV_WRITE);
+	APPLY(ch->close_change, EV_CLOSED);
+#undef APPLY
+
+	if (want && ((ch->read_change | ch->write_change | ch->close_change)
+		& EV_CHANGE_ET))
+		want |= EV_ET;
+	else if (want)
+		want |= st->want & EV_ET;
+
+	if (want == st->want && !force)
+		return (0);
+	st->want = want;
+	st->force |= force;
+	return uring_mark_pending(uop, ch->fd);
+}
+
+/* Bring the poll request for 'fd' in line with what the evmap wants.  If
+ * we can't queue the poll, 'fd' stays pending so that we try again. */
+static int
+uring_rearm_one(struct uringop *uop, int fd)
+{
+	struct uring_fd *st = &uop->fds[fd];
+	int r = 0;
+
+	if (st->armed && (st->armed != st->want || st->force)) {
+		if (uring_queue_poll_remove(uop, fd, st->gen) < 0)
+			r = -1;
+		st->armed = 0;
+		++st->gen;
+	}
+	st->force = 0;
+	if (!st->armed && st->want) {
+		if (uring_queue_poll_add(uop, fd, st->want, st->gen) < 0)
+			return (-1);
+		st->armed = st->want;
+	}
+	st->pending = 0;
+	return (r);
+}
+
+static void
+uring_process_cqe(struct event_base *base, struct uringop *uop,
+    const struct io_uring_cqe *cqe)
+{
+	struct uring_fd *st;
+	int fd, res = cqe->res;
+	short ev = 0;
+
+	if (cqe->user_data == URING_UDATA_IGNORE)
+		return;
+	fd = URING_UDATA_FD(cqe->user_data);
+	if (fd >= uop->nfds)
+		return;
+	st = &uop->fds[fd];
+	if (URING_UDATA_GEN(cqe->user_data) != st->gen || !st->armed)
+		return;
+
+	if (!(cqe->flags & IORING_CQE_F_MORE)) {
+		/* The request is finished; it will need to be re-armed. */
+		st->armed = 0;
+		++st->gen;
+		if (res >= 0 && st->want)
+			uring_mark_pending(uop, fd);
+	}
+
+	if (res < 0) {
+		/* Probably EBADF: the fd was closed without being deleted
+		 * first.  There is nothing to report, and re-arming would
+		 * spin, so wait until the fd is changed again. */
+		if (res != -ECANCELED)
+			event_debug(("%s: poll on fd %d failed: %s",
+				__func__, fd, strerror(-res)));
+		return;
+	}
+
+	if (res & (POLLHUP|POLLERR|POLLNVAL)) {
+		ev = EV_READ | EV_WRITE;
+	} else {
+		if (res & POLLIN)
+			ev |= EV_READ;
+		if (res & POLLOUT)
+			ev |= EV_WRITE;
+		if (res & POLLRDHUP)
+			ev |= EV_CLOSED;
+	}
+	if (!ev)
+		return;
+
+	evmap_io_active_(base, fd, ev | EV_ET);
+}
+
+/* Process every completion in the completion ring. */
+static void
+uring_reap(struct event_base *base, struct uringop *uop)
+{
+	unsigned head = *uop->cq_head;
+	unsigned tail;
+
+	for (;;) {
+		tail = __atomic_load_n(uop->cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			break;
+		while (head != tail) {
+			uring_process_cqe(base, uop,
+			    &uop->cqes[head & *uop->cq_mask]);
+			++head;
+		}
+		__atomic_store_n(uop->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+static int
+uring_dispatch(struct event_base *base, struct timeval *tv)
+{
+	struct uringop *uop = base->evbase;
+	struct event_changelist *changelist = &base->changelist;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned min_complete = 1;
+	int i, res, n_rearm;
+
+	for (i = 0; i < changelist->n_changes; ++i) {
+		const struct event_change *ch = &changelist->changes[i];
+		if (uring_apply_one_change(uop, ch) < 0)
+			event_warn("%s: can't record change on fd %d",
+			    __func__, (int)ch->fd);
+	}
+	event_changelist_remove_all_(changelist, base);
+
+	/* uring_rearm_one() can't add to the list.  An fd it couldn't arm
+	 * is still pending and goes back on the list, at or before the slot
+	 * we took it from, so that the next dispatch tries again. */
+	n_rearm = uop->n_rearm;
+	uop->n_rearm = 0;
+	for (i = 0; i < n_rearm; ++i) {
+		int fd = uop->rearm[i];
+		if (uring_rearm_one(uop, fd) < 0)
+			event_warn("%s: can't arm poll on fd %d",
+			    __func__, fd);
+		if (uop->fds[fd].pending)
+			uop->rearm[uop->n_rearm++] = fd;
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	if (tv != NULL) {
+		if (tv->tv_sec == 0 && tv->tv_usec == 0)
+			min_complete = 0;
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = tv->tv_usec * 1000;
+		arg.ts = (ev_uint64_t)(uintptr_t)&ts;
+	}
+
+	EVBASE_RELEASE_LOCK(base, th_base_lock);
+
+	res = sys_io_uring_enter(uop->ring_fd, uop->to_submit, min_complete,
+	    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	EVBASE_ACQUIRE_LOCK(base, th_base_lock);
+
+	if (res >= 0) {
+		uop->to_submit -= res;
+	} else if (errno != EINTR && errno != ETIME && errno != EBUSY &&
+	    errno != EAGAIN) {
+		event_warn("io_uring_enter");
+		return (-1);
+	}
+
+	uring_reap(base, uop);
+
+	if (__atomic_load_n(uop->sq_flags, __ATOMIC_RELAXED) &
+	    IORING_SQ_CQ_OVERFLOW) {
+		/* The kernel is holding on to completions that didn't fit;
+		 * ask for them and look again. */
+		sys_io_uring_enter(uop->ring_fd, 0, 0,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+		uring_reap(base, uop);
+	}
+
+	return (0);
+}
+
+static void
+uring_dealloc(struct event_base *base)
+{
+	struct uringop *uop = base->evbase;
+
+	evsig_dealloc_(base);
+	uring_unmap(uop);
+	if (uop->ring_fd >= 0)
+		close(uop->ring_fd);
+	if (uop->fds)
+		mm_free(uop->fds);
+	if (uop->rearm)
+		mm_free(uop->rearm);
+
+	memset(uop, 0, sizeof(struct uringop));
+	mm_free(uop);
+}
+
+#endif /* EVENT__HAVE_IO_URING */
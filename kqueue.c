@@ -65,6 +65,7 @@
 #include "event2/thread.h"
 #include "event2/util.h"
 #include "evthread-internal.h"
+#include "evatomic-internal.h"
 #include "changelist-internal.h"
 
 #include "kqueue-internal.h"
@@ -402,7 +403,7 @@ kq_dispatch(struct event_base *base, struct timeval *tv)
 			which |= EV_SIGNAL;
 #ifdef EVFILT_USER
 		} else if (events[i].filter == EVFILT_USER) {
-			base->is_notify_pending = 0;
+			evatomic_int_store_(&base->is_notify_pending, 0);
 #endif
 		}
 
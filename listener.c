@@ -76,11 +76,13 @@ struct evconnlistener {
 	const struct evconnlistener_ops *ops;
 	void *lock;
 	evconnlistener_cb cb;
+	evconnlistener_batch_cb batch_cb;
 	evconnlistener_errorcb errorcb;
 	void *user_data;
 	unsigned flags;
 	short refcnt;
 	int accept4_flags;
+	int batch_size;
 	unsigned enabled : 1;
 };
 
@@ -105,6 +107,12 @@ struct evconnlistener_iocp {
 #define LOCK(listener) EVLOCK_LOCK((listener)->lock, 0)
 #define UNLOCK(listener) EVLOCK_UNLOCK((listener)->lock, 0)
 
+/* Largest number of connections we hand to a batch callback at once; the
+ * buffers for them live on the stack. */
+#define LISTENER_MAX_BATCH 64
+/* Batch size to use if the user doesn't pick one. */
+#define LISTENER_DEFAULT_BATCH 16
+
 struct evconnlistener *
 evconnlistener_new_async(struct event_base *base,
     evconnlistener_cb cb, void *ptr, unsigned flags, int backlog,
@@ -270,6 +278,7 @@ evconnlistener_free(struct evconnlistener *lev)
 {
 	LOCK(lev);
 	lev->cb = NULL;
+	lev->batch_cb = NULL;
 	lev->errorcb = NULL;
 	if (lev->ops->shutdown)
 		lev->ops->shutdown(lev);
@@ -294,7 +303,7 @@ evconnlistener_enable(struct evconnlistener *lev)
 	int r;
 	LOCK(lev);
 	lev->enabled = 1;
-	if (lev->cb)
+	if (lev->cb || lev->batch_cb)
 		r = lev->ops->enable(lev);
 	else
 		r = 0;
@@ -371,9 +380,31 @@ evconnlistener_set_cb(struct evconnlistener *lev,
 {
 	int enable = 0;
 	LOCK(lev);
-	if (lev->enabled && !lev->cb)
+	if (lev->enabled && !lev->cb && !lev->batch_cb)
 		enable = 1;
 	lev->cb = cb;
+	lev->batch_cb = NULL;
+	lev->user_data = arg;
+	if (enable)
+		evconnlistener_enable(lev);
+	UNLOCK(lev);
+}
+
+void
+evconnlistener_set_batch_cb(struct evconnlistener *lev,
+    evconnlistener_batch_cb cb, int batch_size, void *arg)
+{
+	int enable = 0;
+	if (batch_size <= 0)
+		batch_size = LISTENER_DEFAULT_BATCH;
+	else if (batch_size > LISTENER_MAX_BATCH)
+		batch_size = LISTENER_MAX_BATCH;
+	LOCK(lev);
+	if (lev->enabled && !lev->cb && !lev->batch_cb)
+		enable = 1;
+	lev->cb = NULL;
+	lev->batch_cb = cb;
+	lev->batch_size = batch_size;
 	lev->user_data = arg;
 	if (enable)
 		evconnlistener_enable(lev);
@@ -389,15 +420,104 @@ evconnlistener_set_error_cb(struct evconnlistener *lev,
 	UNLOCK(lev);
 }
 
+/* Called with the lock held after accept() on 'fd' failed with 'err':
+ * report the error if it is a real one, and unlock 'lev'. */
+static void
+listener_accept_error(struct evconnlistener *lev, evutil_socket_t fd, int err)
+{
+	evconnlistener_errorcb errorcb;
+	void *user_data;
+
+	if (EVUTIL_ERR_ACCEPT_RETRIABLE(err)) {
+		UNLOCK(lev);
+		return;
+	}
+	if (lev->errorcb != NULL) {
+		++lev->refcnt;
+		errorcb = lev->errorcb;
+		user_data = lev->user_data;
+		UNLOCK(lev);
+		EVUTIL_SET_SOCKET_ERROR(err);
+		errorcb(lev, user_data);
+		LOCK(lev);
+		listener_decref_and_unlock(lev);
+	} else {
+		EVUTIL_SET_SOCKET_ERROR(err);
+		event_sock_warn(fd, "Error from accept() call");
+		UNLOCK(lev);
+	}
+}
+
+/* Called with the lock held from listener_read_cb when 'lev' has a batch
+ * callback: accept connections until accept() would block, handing them to
+ * the callback batch_size at a time.  Unlocks 'lev'. */
+static void
+listener_read_batch(struct evconnlistener *lev, evutil_socket_t fd)
+{
+	struct sockaddr_storage ss[LISTENER_MAX_BATCH];
+	struct sockaddr *addrs[LISTENER_MAX_BATCH];
+	evutil_socket_t fds[LISTENER_MAX_BATCH];
+	int socklens[LISTENER_MAX_BATCH];
+	evconnlistener_batch_cb cb;
+	void *user_data;
+	int n = 0, err = 0;
+
+	while (1) {
+		ev_socklen_t socklen = sizeof(ss[n]);
+		evutil_socket_t new_fd = evutil_accept4_(fd,
+		    (struct sockaddr*)&ss[n], &socklen, lev->accept4_flags);
+		if (new_fd < 0) {
+			err = evutil_socket_geterror(fd);
+			if (n == 0)
+				break;
+		} else if (socklen == 0) {
+			/* See listener_read_cb. */
+			evutil_closesocket(new_fd);
+			continue;
+		} else {
+			fds[n] = new_fd;
+			addrs[n] = (struct sockaddr*)&ss[n];
+			socklens[n] = (int)socklen;
+			if (++n < lev->batch_size)
+				continue;
+		}
+
+		++lev->refcnt;
+		cb = lev->batch_cb;
+		user_data = lev->user_data;
+		UNLOCK(lev);
+		cb(lev, fds, addrs, socklens, n, user_data);
+		LOCK(lev);
+		if (lev->refcnt == 1) {
+			int freed = listener_decref_and_unlock(lev);
+			EVUTIL_ASSERT(freed);
+			return;
+		}
+		--lev->refcnt;
+		if (err)
+			break;
+		if (!lev->enabled || !lev->batch_cb) {
+			/* the callback could have disabled the listener, or
+			 * switched it back to one connection at a time */
+			UNLOCK(lev);
+			return;
+		}
+		n = 0;
+	}
+	listener_accept_error(lev, fd, err);
+}
+
 static void
 listener_read_cb(evutil_socket_t fd, short what, void *p)
 {
 	struct evconnlistener *lev = p;
-	int err;
 	evconnlistener_cb cb;
-	evconnlistener_errorcb errorcb;
 	void *user_data;
 	LOCK(lev);
+	if (lev->batch_cb) {
+		listener_read_batch(lev, fd);
+		return;
+	}
 	while (1) {
 		struct sockaddr_storage ss;
 		ev_socklen_t socklen = sizeof(ss);
@@ -429,29 +549,14 @@ listener_read_cb(evutil_socket_t fd, short what, void *p)
 			return;
 		}
 		--lev->refcnt;
-		if (!lev->enabled) {
-			/* the callback could have disabled the listener */
+		if (!lev->enabled || lev->batch_cb) {
+			/* the callback could have disabled the listener, or
+			 * switched it to batch mode */
 			UNLOCK(lev);
 			return;
 		}
 	}
-	err = evutil_socket_geterror(fd);
-	if (EVUTIL_ERR_ACCEPT_RETRIABLE(err)) {
-		UNLOCK(lev);
-		return;
-	}
-	if (lev->errorcb != NULL) {
-		++lev->refcnt;
-		errorcb = lev->errorcb;
-		user_data = lev->user_data;
-		UNLOCK(lev);
-		errorcb(lev, user_data);
-		LOCK(lev);
-		listener_decref_and_unlock(lev);
-	} else {
-		event_sock_warn(fd, "Error from accept() call");
-		UNLOCK(lev);
-	}
+	listener_accept_error(lev, fd, evutil_socket_geterror(fd));
 }
 
 #ifdef _WIN32
@@ -613,6 +718,7 @@ accepted_socket_invoke_user_cb(struct event_callback *dcb, void *arg)
 	evutil_socket_t sock=-1;
 	void *data;
 	evconnlistener_cb cb=NULL;
+	evconnlistener_batch_cb batch_cb=NULL;
 	evconnlistener_errorcb errorcb=NULL;
 	int error;
 
@@ -639,6 +745,7 @@ accepted_socket_invoke_user_cb(struct event_callback *dcb, void *arg)
 			&socklen_remote);
 		sock = as->s;
 		cb = lev->cb;
+		batch_cb = lev->batch_cb;
 		as->s = EVUTIL_INVALID_SOCKET;
 
 		/* We need to call this so getsockname, getpeername, and
@@ -657,6 +764,9 @@ accepted_socket_invoke_user_cb(struct event_callback *dcb, void *arg)
 		errorcb(lev, data);
 	} else if (cb) {
 		cb(lev, sock, sa_remote, socklen_remote, data);
+	} else if (batch_cb) {
+		/* AcceptEx hands us one socket at a time. */
+		batch_cb(lev, &sock, &sa_remote, &socklen_remote, 1, data);
 	}
 
 	LOCK(lev);
@@ -85,6 +85,12 @@ void event_mm_free_(void *p);
 #define mm_free(p) free(p)
 #endif
 
+struct event_mem_ctx;
+/** Take a reference to an allocator context, or drop one, freeing it once
+ * the last one is gone. */
+void event_mem_ctx_incref_(struct event_mem_ctx *ctx);
+void event_mem_ctx_decref_(struct event_mem_ctx *ctx);
+
 #ifdef __cplusplus
 }
 #endif
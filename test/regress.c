@@ -817,6 +817,193 @@ end:
 	data->base = NULL;
 }
 
+struct lazy_timeout_info {
+	struct common_timeout_info *info;
+	const struct timeval *ms_100;
+	struct timeval pending_tv[2];
+	int pending[2];
+};
+
+static void
+lazy_timeout_push_cb(evutil_socket_t fd, short event, void *arg)
+{
+	struct lazy_timeout_info *lti = arg;
+	struct timeval tv = { 0, 200*1000 };
+
+	/* Both of these are later than the current timeouts. */
+	event_add(&lti->info[0].ev, &tv);
+	event_add(&lti->info[1].ev, lti->ms_100);
+	lti->pending[0] = event_pending(&lti->info[0].ev, EV_TIMEOUT,
+	    &lti->pending_tv[0]);
+	lti->pending[1] = event_pending(&lti->info[1].ev, EV_TIMEOUT,
+	    &lti->pending_tv[1]);
+}
+
+static void
+test_lazy_timeout(void *ptr)
+{
+	struct basic_test_data *data = ptr;
+	struct event_base *base = data->base;
+	struct common_timeout_info info[3];
+	struct lazy_timeout_info lti;
+	struct event *push = NULL;
+	struct timeval start;
+	struct timeval tmp_100_ms = { 0, 100*1000 };
+	struct timeval tmp_300_ms = { 0, 300*1000 };
+	struct timeval tmp_50_ms = { 0, 50*1000 };
+	struct timeval tmp_400_ms = { 0, 400*1000 };
+	int i;
+
+	memset(info, 0, sizeof(info));
+	memset(&lti, 0, sizeof(lti));
+	lti.info = info;
+	lti.ms_100 = event_base_init_common_timeout(base, &tmp_100_ms);
+	tt_assert(lti.ms_100);
+
+	for (i = 0; i < 3; ++i) {
+		info[i].which = i;
+		event_assign(&info[i].ev, base, -1, EV_LAZY_TIMEOUT,
+		    common_timeout_cb, &info[i]);
+	}
+	push = evtimer_new(base, lazy_timeout_push_cb, &lti);
+	tt_assert(push);
+
+	evutil_gettimeofday(&start, NULL);
+	/* Pushed back to 250 msec at 50 msec. */
+	event_add(&info[0].ev, &tmp_100_ms);
+	/* Pushed back to 150 msec at 50 msec, on a common timeout. */
+	event_add(&info[1].ev, lti.ms_100);
+	/* Moving a timeout earlier takes effect at once. */
+	event_add(&info[2].ev, &tmp_300_ms);
+	event_add(&info[2].ev, &tmp_100_ms);
+	event_add(push, &tmp_50_ms);
+	event_base_assert_ok_(base);
+
+	event_base_loopexit(base, &tmp_400_ms);
+	event_base_dispatch(base);
+	event_base_assert_ok_(base);
+
+	tt_assert(lti.pending[0]);
+	tt_assert(lti.pending[1]);
+	test_timeval_diff_eq(&start, &lti.pending_tv[0], 250);
+	test_timeval_diff_eq(&start, &lti.pending_tv[1], 150);
+
+	for (i = 0; i < 3; ++i)
+		tt_int_op(info[i].count, ==, 1);
+	test_timeval_diff_eq(&start, &info[0].called_at, 250);
+	test_timeval_diff_eq(&start, &info[1].called_at, 150);
+	test_timeval_diff_eq(&start, &info[2].called_at, 100);
+
+end:
+	if (push)
+		event_free(push);
+}
+
+struct timer_wheel_info {
+	struct event ev;
+	struct timeval deadline;
+	int fired;
+	int early;
+};
+
+static void
+timer_wheel_cb(evutil_socket_t fd, short event, void *arg)
+{
+	struct timer_wheel_info *ti = arg;
+	struct timeval now;
+	event_base_gettimeofday_cached(event_get_base(&ti->ev), &now);
+	++ti->fired;
+	if (evutil_timercmp(&now, &ti->deadline, <))
+		++ti->early;
+}
+
+static int
+timer_wheel_count_cb(const struct event_base *base, const struct event *ev,
+    void *arg)
+{
+	if (event_get_callback(ev) == timer_wheel_cb)
+		++*(int *)arg;
+	return 0;
+}
+
+static void
+test_timer_wheel(void *ptr)
+{
+	struct event_base *base = NULL;
+	struct event_config *cfg = NULL;
+	struct timer_wheel_info info[300];
+	struct timeval tv, now;
+	int i, n;
+
+	cfg = event_config_new();
+	tt_assert(cfg);
+	tt_int_op(event_config_set_flag(cfg, EVENT_BASE_FLAG_TIMER_WHEEL),
+	    ==, 0);
+	/* The coarse monotonic clock can lag the wall clock we check the
+	 * deadlines against by a whole kernel tick. */
+	tt_int_op(event_config_set_flag(cfg, EVENT_BASE_FLAG_PRECISE_TIMER),
+	    ==, 0);
+	base = event_base_new_with_config(cfg);
+	tt_assert(base);
+
+	memset(info, 0, sizeof(info));
+	event_base_gettimeofday_cached(base, &now);
+	for (i = 0; i < 300; ++i) {
+		event_assign(&info[i].ev, base, -1, 0, timer_wheel_cb,
+		    &info[i]);
+		if (i < 290) {
+			/* Spread these over several wheel levels' worth of
+			 * ticks, with some sub-millisecond values. */
+			tv.tv_sec = 0;
+			tv.tv_usec = (i * 1031) % 300000;
+		} else {
+			/* These need cascading down from the high levels. */
+			tv.tv_sec = 3600 * (i - 289);
+			tv.tv_usec = 0;
+		}
+		event_add(&info[i].ev, &tv);
+		evutil_timeradd(&now, &tv, &info[i].deadline);
+	}
+	/* Rescheduling and removing must work too. */
+	tv.tv_sec = 0;
+	tv.tv_usec = 1000;
+	event_add(&info[10].ev, &tv);
+	evutil_timeradd(&now, &tv, &info[10].deadline);
+	event_del(&info[11].ev);
+
+	n = 0;
+	event_base_foreach_event(base, timer_wheel_count_cb, &n);
+	tt_int_op(n, ==, 299);
+	tt_int_op(event_base_get_num_events(base, EVENT_BASE_COUNT_ADDED),
+	    ==, 299);
+	event_base_assert_ok_(base);
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 400000;
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	event_base_assert_ok_(base);
+
+	for (i = 0; i < 290; ++i) {
+		TT_BLATHER(("%d: %d", i, info[i].fired));
+		tt_int_op(info[i].fired, ==, (i == 11) ? 0 : 1);
+		tt_int_op(info[i].early, ==, 0);
+	}
+	for (i = 290; i < 300; ++i) {
+		tt_int_op(info[i].fired, ==, 0);
+		tt_assert(event_pending(&info[i].ev, EV_TIMEOUT, NULL));
+	}
+	tt_int_op(event_base_get_num_events(base, EVENT_BASE_COUNT_ADDED),
+	    ==, 10);
+
+end:
+	/* Freeing the base must clean out the timers that are left. */
+	if (base)
+		event_base_free(base);
+	if (cfg)
+		event_config_free(cfg);
+}
+
 #ifndef _WIN32
 
 #define current_base event_global_current_base_
@@ -3459,6 +3646,9 @@ struct testcase_t main_testcases[] = {
 	BASIC(priority_active_inversion, TT_FORK|TT_NEED_BASE),
 	{ "common_timeout", test_common_timeout, TT_FORK|TT_NEED_BASE,
 	  &basic_setup, NULL },
+	{ "timer_wheel", test_timer_wheel, TT_FORK, NULL, NULL },
+	{ "lazy_timeout", test_lazy_timeout, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
 
 	/* These legacy tests may not all need all of these flags. */
 	LEGACY(simpleread, TT_ISOLATED),
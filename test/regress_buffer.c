@@ -1280,6 +1280,521 @@ test_evbuffer_add_file(void *ptr)
 	}
 }
 
+static void
+test_evbuffer_chain_pool(void *ptr)
+{
+	struct evbuffer_chain_pool *pool = NULL;
+	struct evbuffer *a = NULL, *b = NULL, *c = NULL;
+	struct evbuffer_chain_pool_stats st;
+	char data[3000];
+	char *big = NULL;
+	int i;
+
+	memset(data, 'x', sizeof(data));
+	/* Room for one 4KB chain. */
+	pool = evbuffer_chain_pool_new(4096, 0);
+	tt_assert(pool);
+	a = evbuffer_new();
+	b = evbuffer_new();
+	c = evbuffer_new();
+	tt_assert(a && b && c);
+	tt_int_op(evbuffer_set_chain_pool(a, pool), ==, 0);
+	tt_int_op(evbuffer_set_chain_pool(b, pool), ==, 0);
+
+	/* In steady state, every chain comes from the pool. */
+	for (i = 0; i < 100; ++i) {
+		tt_int_op(evbuffer_add(a, data, sizeof(data)), ==, 0);
+		tt_assert(a->first->flags & EVBUFFER_POOLED);
+		evbuffer_validate(a);
+		tt_int_op(evbuffer_drain(a, sizeof(data)), ==, 0);
+	}
+	evbuffer_chain_pool_get_stats(pool, &st);
+	tt_int_op(st.n_misses, ==, 1);
+	tt_int_op(st.n_hits, ==, 99);
+	tt_int_op(st.n_recycled, ==, 100);
+	tt_int_op(st.n_released, ==, 0);
+	tt_int_op(st.cached_chains, ==, 1);
+	tt_int_op(st.cached_bytes, ==, 4096);
+
+	/* Chains go back to the pool from buffers that don't use it, and
+	 * only as many as fit are kept. */
+	tt_int_op(evbuffer_add(a, data, sizeof(data)), ==, 0);
+	tt_int_op(evbuffer_add(b, data, sizeof(data)), ==, 0);
+	tt_int_op(evbuffer_add_buffer(c, a), ==, 0);
+	tt_int_op(evbuffer_add_buffer(c, b), ==, 0);
+	evbuffer_validate(c);
+	tt_int_op(evbuffer_drain(c, 2 * sizeof(data)), ==, 0);
+	evbuffer_chain_pool_get_stats(pool, &st);
+	tt_int_op(st.n_misses, ==, 2);
+	tt_int_op(st.n_hits, ==, 100);
+	tt_int_op(st.n_recycled, ==, 101);
+	tt_int_op(st.n_released, ==, 1);
+	tt_int_op(st.cached_chains, ==, 1);
+
+	/* Allocations too big for the pool bypass it. */
+	big = malloc(256 * 1024);
+	tt_assert(big);
+	memset(big, 'y', 256 * 1024);
+	tt_int_op(evbuffer_add(a, big, 256 * 1024), ==, 0);
+	tt_assert(!(a->last->flags & EVBUFFER_POOLED));
+	evbuffer_chain_pool_get_stats(pool, &st);
+	tt_int_op(st.n_misses, ==, 2);
+	tt_int_op(st.n_hits, ==, 100);
+
+	/* Buffers and chains outlive the pool. */
+	tt_int_op(evbuffer_add(b, data, sizeof(data)), ==, 0);
+	evbuffer_chain_pool_free(pool);
+	pool = NULL;
+	tt_int_op(evbuffer_add(b, big, 256 * 1024), ==, 0);
+	tt_int_op(evbuffer_drain(b, sizeof(data)), ==, 0);
+	tt_int_op(evbuffer_add(b, data, sizeof(data)), ==, 0);
+	tt_int_op(evbuffer_set_chain_pool(b, NULL), ==, 0);
+	evbuffer_validate(b);
+
+end:
+	if (a)
+		evbuffer_free(a);
+	if (b)
+		evbuffer_free(b);
+	if (c)
+		evbuffer_free(c);
+	if (pool)
+		evbuffer_chain_pool_free(pool);
+	if (big)
+		free(big);
+}
+
+struct mem_ctx_counts {
+	int n_alloc;
+	int n_release;
+	size_t outstanding;
+};
+
+static void *
+counting_alloc(size_t size, void *arg)
+{
+	struct mem_ctx_counts *counts = arg;
+	++counts->n_alloc;
+	counts->outstanding += size;
+	return malloc(size);
+}
+
+static void
+counting_release(void *ptr, size_t size, void *arg)
+{
+	struct mem_ctx_counts *counts = arg;
+	++counts->n_release;
+	counts->outstanding -= size;
+	free(ptr);
+}
+
+static void
+test_evbuffer_mem_ctx(void *ptr)
+{
+	struct mem_ctx_counts counts = { 0, 0, 0 };
+	struct event_mem_ctx *ctx = NULL, *arena = NULL, *numa = NULL;
+	struct evbuffer_chain_pool *pool = NULL;
+	struct evbuffer *buf = NULL;
+	struct event_mem_ctx_stats st;
+	char data[3000];
+	char *big = NULL, *p, *q;
+	int i;
+
+	memset(data, 'x', sizeof(data));
+	big = malloc(256 * 1024);
+	tt_assert(big);
+	memset(big, 'y', 256 * 1024);
+
+	/* With a context, even chains too big to cache come from it. */
+	ctx = event_mem_ctx_new(counting_alloc, counting_release, &counts);
+	tt_assert(ctx);
+	pool = evbuffer_chain_pool_new_with_mem_ctx(0, 0, ctx);
+	tt_assert(pool);
+	event_mem_ctx_free(ctx);
+	ctx = NULL;
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_chain_pool(buf, pool), ==, 0);
+	tt_int_op(evbuffer_add(buf, data, sizeof(data)), ==, 0);
+	tt_int_op(evbuffer_add(buf, big, 256 * 1024), ==, 0);
+	tt_assert(buf->first->flags & EVBUFFER_POOLED);
+	tt_assert(buf->last->flags & EVBUFFER_POOLED);
+	evbuffer_validate(buf);
+	tt_int_op(counts.n_alloc, ==, 2);
+	tt_assert(counts.outstanding > 256 * 1024);
+	tt_int_op(evbuffer_drain(buf, sizeof(data) + 256 * 1024), ==, 0);
+	tt_int_op(counts.n_release, ==, 2);
+	tt_int_op(counts.outstanding, ==, 0);
+	evbuffer_free(buf);
+	buf = NULL;
+	evbuffer_chain_pool_free(pool);
+	pool = NULL;
+
+	/* An arena reuses blocks of the same size, and unmaps big ones. */
+	arena = event_mem_ctx_new_arena(-1, 0);
+	tt_assert(arena);
+	p = event_mem_ctx_alloc(arena, 100);
+	tt_assert(p);
+	memset(p, 1, 100);
+	event_mem_ctx_release(arena, p, 100);
+	q = event_mem_ctx_alloc(arena, 128);
+	tt_ptr_op(p, ==, q);
+	event_mem_ctx_get_stats(arena, &st);
+	tt_int_op(st.allocated_bytes, ==, 128);
+	tt_int_op(st.mapped_bytes, ==, 2 * 1024 * 1024);
+	tt_int_op(st.numa_node, ==, -1);
+	p = event_mem_ctx_alloc(arena, 3 * 1024 * 1024);
+	tt_assert(p);
+	memset(p, 2, 3 * 1024 * 1024);
+	event_mem_ctx_get_stats(arena, &st);
+	tt_int_op(st.mapped_bytes, ==, 6 * 1024 * 1024);
+	event_mem_ctx_release(arena, p, 3 * 1024 * 1024);
+	event_mem_ctx_release(arena, q, 128);
+	event_mem_ctx_get_stats(arena, &st);
+	tt_int_op(st.mapped_bytes, ==, 2 * 1024 * 1024);
+	tt_int_op(st.allocated_bytes, ==, 0);
+
+	/* Fill more than one arena through a pool. */
+	pool = evbuffer_chain_pool_new_with_mem_ctx(64 * 1024, 0, arena);
+	tt_assert(pool);
+	buf = evbuffer_new();
+	tt_assert(buf);
+	tt_int_op(evbuffer_set_chain_pool(buf, pool), ==, 0);
+	for (i = 0; i < 3000; ++i)
+		tt_int_op(evbuffer_add_reference(buf, big + (i % 256) * 1000,
+			1000, NULL, NULL), ==, 0);
+	for (p = big; p < big + 256 * 1024; p += 4096)
+		tt_int_op(evbuffer_add(buf, p, 4000), ==, 0);
+	evbuffer_validate(buf);
+	event_mem_ctx_get_stats(arena, &st);
+	tt_assert(st.mapped_bytes > 2 * 1024 * 1024);
+	evbuffer_free(buf);
+	buf = NULL;
+	evbuffer_chain_pool_free(pool);
+	pool = NULL;
+	event_mem_ctx_get_stats(arena, &st);
+	tt_int_op(st.allocated_bytes, ==, 0);
+
+	/* Huge pages fall back to normal ones if there are none. */
+	event_mem_ctx_free(arena);
+	arena = event_mem_ctx_new_arena(-1, EVENT_MEM_HUGEPAGES);
+	tt_assert(arena);
+	p = event_mem_ctx_alloc(arena, 64 * 1024);
+	tt_assert(p);
+	memset(p, 3, 64 * 1024);
+	event_mem_ctx_release(arena, p, 64 * 1024);
+
+	/* Binding to a node only works where the kernel does NUMA. */
+	numa = event_mem_ctx_new_arena(0, 0);
+	if (numa) {
+		event_mem_ctx_get_stats(numa, &st);
+		tt_int_op(st.numa_node, ==, 0);
+	}
+	tt_assert(!event_mem_ctx_new_arena(-2, 0));
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (pool)
+		evbuffer_chain_pool_free(pool);
+	if (ctx)
+		event_mem_ctx_free(ctx);
+	if (arena)
+		event_mem_ctx_free(arena);
+	if (numa)
+		event_mem_ctx_free(numa);
+	if (big)
+		free(big);
+}
+
+static void
+test_evbuffer_adaptive_read(void *ptr)
+{
+	evutil_socket_t pair[2] = { -1, -1 };
+	struct evbuffer *buf = NULL;
+	char data[4096 + 16384];
+	int i;
+
+	memset(data, 'a', sizeof(data));
+	if (evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("socketpair failed");
+	evutil_make_socket_nonblocking(pair[1]);
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	tt_int_op(evbuffer_set_adaptive_read(buf, 2048, 1024), ==, -1);
+	tt_int_op(evbuffer_set_adaptive_read(buf, 1024, 65536), ==, 0);
+	tt_int_op(buf->read_next, ==, 4096);
+
+	/* Reads that fill the budget make it grow. */
+	tt_int_op(send(pair[0], data, sizeof(data), 0), ==, sizeof(data));
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 4096);
+	tt_int_op(buf->read_next, ==, 16384);
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 16384);
+	tt_int_op(buf->read_next, ==, 65536);
+	evbuffer_validate(buf);
+
+	/* Asking for less than the budget tells us nothing. */
+	tt_int_op(send(pair[0], data, 100, 0), ==, 100);
+	tt_int_op(evbuffer_read(buf, pair[1], 100), ==, 100);
+	tt_int_op(buf->read_next, ==, 65536);
+
+	/* Two small reads in a row halve it, down to the minimum. */
+	for (i = 0; i < 2; ++i) {
+		tt_int_op(send(pair[0], data, 100, 0), ==, 100);
+		tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 100);
+	}
+	tt_int_op(buf->read_next, ==, 32768);
+	for (i = 0; i < 20; ++i) {
+		tt_int_op(send(pair[0], data, 100, 0), ==, 100);
+		tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 100);
+	}
+	tt_int_op(buf->read_next, ==, 1024);
+	tt_int_op(evbuffer_get_length(buf), ==, sizeof(data) + 2300);
+	evbuffer_validate(buf);
+
+	/* Turning it off goes back to max_read. */
+	tt_int_op(evbuffer_set_adaptive_read(buf, 0, 0), ==, 0);
+	tt_int_op(send(pair[0], data, sizeof(data), 0), ==, sizeof(data));
+	tt_int_op(evbuffer_read(buf, pair[1], -1), ==, 4096);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+}
+
+static void
+test_evbuffer_shrink(void *ptr)
+{
+	static const char ref[] = "referenced data";
+	struct evbuffer *buf = NULL;
+	struct evbuffer_chain *pinned;
+	struct evbuffer_iovec v[4];
+	char *data = NULL;
+	size_t i, len;
+
+	data = malloc(65536);
+	tt_assert(data);
+	for (i = 0; i < 65536; ++i)
+		data[i] = (char)i;
+	buf = evbuffer_new();
+	tt_assert(buf);
+
+	/* Nothing to do on an empty buffer. */
+	tt_int_op(evbuffer_shrink(buf), ==, 0);
+
+	/* Space we expanded into but never used is given back. */
+	tt_int_op(evbuffer_expand(buf, 65536), ==, 0);
+	tt_int_op(evbuffer_shrink(buf), >=, 65536);
+	tt_ptr_op(buf->first, ==, NULL);
+	tt_ptr_op(buf->last, ==, NULL);
+	evbuffer_validate(buf);
+
+	/* So is the space around a little data left in a big chain. */
+	evbuffer_add(buf, data, 65536);
+	evbuffer_drain(buf, 65536 - 100);
+	tt_int_op(evbuffer_shrink(buf), >, 60000);
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, 100);
+	tt_int_op(buf->first->buffer_len, <, MIN_BUFFER_SIZE);
+	tt_assert(!memcmp(evbuffer_pullup(buf, -1), data + 65536 - 100, 100));
+	tt_int_op(evbuffer_shrink(buf), ==, 0);
+
+	/* Chains we don't own stay where they are. */
+	evbuffer_add_reference(buf, ref, sizeof(ref), NULL, NULL);
+	evbuffer_add(buf, data, 65536);
+	evbuffer_drain(buf, 100 + sizeof(ref) + 65536 - 10);
+	evbuffer_add_reference(buf, ref, sizeof(ref), NULL, NULL);
+	evbuffer_expand(buf, 4096);
+	tt_int_op(evbuffer_shrink(buf), >, 60000);
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, 10 + sizeof(ref));
+	tt_ptr_op(buf->last->buffer, ==, ref);
+	tt_assert(!memcmp(evbuffer_pullup(buf, -1), data + 65536 - 10, 10));
+	evbuffer_free(buf);
+
+	/* An empty chain that is pinned, as for a read in flight, stays
+	 * linked in, even behind an empty one that goes. */
+	buf = evbuffer_new();
+	tt_assert(buf);
+	evbuffer_add(buf, data, 100);
+	tt_int_op(evbuffer_reserve_space(buf, 4096, v, 3), >, 0);
+	tt_int_op(evbuffer_reserve_space(buf, 16384, v, 3), >, 0);
+	pinned = buf->last;
+	tt_ptr_op(pinned, !=, buf->first->next);
+	tt_int_op(pinned->off, ==, 0);
+	pinned->flags |= EVBUFFER_MEM_PINNED_R;
+	tt_int_op(evbuffer_reserve_space(buf, 65536, v, 4), >, 0);
+	tt_ptr_op(buf->last, !=, pinned);
+	/* only the two unpinned empty chains are given back */
+	len = buf->first->next->buffer_len + buf->last->buffer_len;
+	tt_int_op(evbuffer_shrink(buf), ==, len);
+	tt_ptr_op(buf->first->next, ==, pinned);
+	tt_ptr_op(buf->last, ==, pinned);
+	tt_ptr_op(pinned->next, ==, NULL);
+	pinned->flags &= ~EVBUFFER_MEM_PINNED_R;
+	evbuffer_validate(buf);
+	tt_int_op(evbuffer_get_length(buf), ==, 100);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+	if (data)
+		free(data);
+}
+
+static void
+zerocopy_reference_cleanup(const void *data, size_t len, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+test_evbuffer_zerocopy(void *ptr)
+{
+	evutil_socket_t pair[2] = { -1, -1 };
+	struct evbuffer *src = NULL, *dest = NULL;
+	const size_t datalen = 256 * 1024;
+	char *data = NULL, *compare;
+	struct timeval tv = { 0, 10000 };
+	size_t i;
+	int n, tries, cleaned = 0;
+
+	/* MSG_ZEROCOPY works on TCP, not on AF_UNIX. */
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	data = malloc(datalen);
+	tt_assert(data);
+	for (i = 0; i < datalen; ++i)
+		data[i] = (char)(i + i / 251);
+
+	src = evbuffer_new();
+	dest = evbuffer_new();
+	tt_assert(src);
+	tt_assert(dest);
+	evbuffer_set_flags(src, EVBUFFER_FLAG_ZEROCOPY);
+
+	/* The kernel may read from this after we drain it, so it must not
+	 * be cleaned up until the send is reported as completed. */
+	tt_int_op(evbuffer_add_reference(src, data, 65536,
+		zerocopy_reference_cleanup, &cleaned), ==, 0);
+	tt_int_op(evbuffer_add(src, data + 65536, datalen - 65536), ==, 0);
+
+	n = evbuffer_write_atmost(src, pair[0], 65536);
+	tt_int_op(n, >, 0);
+	if (!src->zerocopy || src->zerocopy->disabled)
+		tt_skip();
+	tt_int_op(src->zerocopy->next_seq, ==, 1);
+	tt_assert(src->zerocopy->n_pins > src->zerocopy->pins_head);
+	tt_int_op(cleaned, ==, 0);
+	tt_int_op(evbuffer_get_length(src), ==, datalen - n);
+	evbuffer_validate(src);
+
+	for (tries = 0; tries < 1000; ++tries) {
+		if (evbuffer_get_length(src))
+			evbuffer_write(src, pair[0]);
+		evbuffer_read(dest, pair[1], -1);
+		tt_int_op(evbuffer_zerocopy_reap(src, pair[0]), >=, 0);
+		evbuffer_validate(src);
+		if (evbuffer_get_length(dest) == datalen &&
+		    src->zerocopy->done_seq == src->zerocopy->next_seq)
+			break;
+		if (!evbuffer_get_length(src))
+			evutil_usleep_(&tv);
+	}
+	tt_int_op(evbuffer_get_length(src), ==, 0);
+	tt_int_op(evbuffer_get_length(dest), ==, datalen);
+	tt_int_op(src->zerocopy->done_seq, ==, src->zerocopy->next_seq);
+	tt_int_op(src->zerocopy->n_pins, ==, 0);
+	tt_int_op(cleaned, ==, 1);
+
+	compare = (char *)evbuffer_pullup(dest, datalen);
+	tt_assert(compare);
+	tt_assert(!memcmp(compare, data, datalen));
+
+end:
+	if (src)
+		evbuffer_free(src);
+	if (dest)
+		evbuffer_free(dest);
+	if (data)
+		free(data);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+}
+
+static void
+test_evbuffer_zerocopy_free(void *ptr)
+{
+	evutil_socket_t pair[2] = { -1, -1 };
+	struct evbuffer *src = NULL, *dest = NULL;
+	const size_t datalen = 64 * 1024;
+	char *data = NULL;
+	struct timeval tv = { 0, 10000 };
+	int close_it = ptr != NULL;
+	int tries, cleaned = 0;
+
+	if (evutil_ersatz_socketpair_(AF_INET, SOCK_STREAM, 0, pair) == -1)
+		tt_abort_msg("ersatz_socketpair failed");
+	evutil_make_socket_nonblocking(pair[0]);
+	evutil_make_socket_nonblocking(pair[1]);
+
+	data = calloc(1, datalen);
+	tt_assert(data);
+	src = evbuffer_new();
+	dest = evbuffer_new();
+	tt_assert(src);
+	tt_assert(dest);
+	evbuffer_set_flags(src, EVBUFFER_FLAG_ZEROCOPY);
+
+	tt_int_op(evbuffer_add_reference(src, data, datalen,
+		zerocopy_reference_cleanup, &cleaned), ==, 0);
+	tt_int_op(evbuffer_write(src, pair[0]), >, 0);
+	if (!src->zerocopy || src->zerocopy->disabled)
+		tt_skip();
+
+	/* Nobody has read the data, so the kernel still holds on to it, and
+	 * freeing the buffer must not release it. */
+	evbuffer_free(src);
+	src = NULL;
+	tt_int_op(cleaned, ==, 0);
+	tt_int_op(evbuffer_zerocopy_reap(dest, pair[0]), ==, 0);
+	tt_int_op(cleaned, ==, 0);
+
+	if (close_it) {
+		evutil_closesocket(pair[0]);
+		pair[0] = -1;
+	}
+	for (tries = 0; tries < 1000 && !cleaned; ++tries) {
+		evbuffer_read(dest, pair[1], -1);
+		evbuffer_zerocopy_reap(dest, EVUTIL_INVALID_SOCKET);
+		if (!cleaned)
+			evutil_usleep_(&tv);
+	}
+	tt_int_op(cleaned, ==, 1);
+
+end:
+	if (src)
+		evbuffer_free(src);
+	if (dest)
+		evbuffer_free(dest);
+	if (data)
+		free(data);
+	if (pair[0] >= 0)
+		evutil_closesocket(pair[0]);
+	if (pair[1] >= 0)
+		evutil_closesocket(pair[1]);
+}
+
 static int file_segment_cleanup_cb_called_count = 0;
 static struct evbuffer_file_segment const* file_segment_cleanup_cb_called_with = NULL;
 static int file_segment_cleanup_cb_called_with_flags = 0;
@@ -1890,6 +2405,318 @@ end:
 		evbuffer_free(tmp);
 }
 
+/* Return the offset of the first match of what in s, or -1. */
+static ev_ssize_t
+naive_search(const char *s, size_t n, const char *what, size_t len)
+{
+	size_t i;
+	for (i = 0; i + len <= n; ++i) {
+		if (!memcmp(s + i, what, len))
+			return i;
+	}
+	return -1;
+}
+
+static void
+test_evbuffer_search_kernels(void *ptr)
+{
+	static const char alphabet[] = "ab\r\n";
+	struct evutil_weakrand_state seed = { 4242U };
+	struct evbuffer *buf = NULL;
+	struct evbuffer_ptr pos;
+	char data[600];
+	size_t i, n, len, off;
+	int level, k;
+
+	for (level = EVBUFFER_SCAN_SCALAR; level <= EVBUFFER_SCAN_AVX2;
+	    ++level) {
+		if (evbuffer_scan_set_level_(level) != level)
+			continue;
+		for (k = 0; k < 300; ++k) {
+			const unsigned char *p;
+			ev_ssize_t expect, got, lf;
+
+			n = evutil_weakrand_range_(&seed, sizeof(data) - 64);
+			for (i = 0; i < sizeof(data); ++i)
+				data[i] = alphabet[evutil_weakrand_range_(&seed,
+					k & 1 ? 2 : 4)];
+			off = evutil_weakrand_range_(&seed, 32);
+			len = 1 + evutil_weakrand_range_(&seed, 40);
+			/* Sometimes plant the needle near the end. */
+			if (k % 3 == 0 && n > 2 * len)
+				memcpy(data + off + n - len, data, len);
+
+			expect = naive_search(data + off, n, data, len);
+			p = evbuffer_find_needle_(
+			    (const unsigned char *)data + off, n,
+			    (const unsigned char *)data, len);
+			got = p ? (p - (const unsigned char *)data) -
+			    (ev_ssize_t)off : -1;
+			tt_int_op(got, ==, expect);
+
+			expect = naive_search(data + off, n, "\r", 1);
+			lf = naive_search(data + off, n, "\n", 1);
+			if (expect < 0 || (lf >= 0 && lf < expect))
+				expect = lf;
+			p = evbuffer_find_eol_char_(
+			    (const unsigned char *)data + off, n);
+			got = p ? (p - (const unsigned char *)data) -
+			    (ev_ssize_t)off : -1;
+			tt_int_op(got, ==, expect);
+		}
+
+		/* The same, through an evbuffer made of many small chains. */
+		for (k = 0; k < 100; ++k) {
+			ev_ssize_t expect;
+			size_t eol_len;
+
+			buf = evbuffer_new();
+			tt_assert(buf);
+			n = sizeof(data);
+			for (i = 0; i < n; ++i)
+				data[i] = alphabet[evutil_weakrand_range_(&seed,
+					k & 1 ? 2 : 4)];
+			for (i = 0; i < n; i += len) {
+				len = 1 + evutil_weakrand_range_(&seed, 48);
+				if (len > n - i)
+					len = n - i;
+				evbuffer_add_reference(buf, data + i, len,
+				    NULL, NULL);
+			}
+			off = evutil_weakrand_range_(&seed, 300);
+			len = 2 + evutil_weakrand_range_(&seed, 30);
+			tt_assert(!evbuffer_ptr_set(buf, &pos, off,
+				EVBUFFER_PTR_SET));
+			expect = naive_search(data + off, n - off, data + 500,
+			    len);
+			pos = evbuffer_search(buf, data + 500, len, &pos);
+			if (expect >= 0)
+				expect += off;
+			tt_int_op(pos.pos, ==, expect);
+
+			expect = naive_search(data, n, "\r\n", 2);
+			pos = evbuffer_search_eol(buf, NULL, &eol_len,
+			    EVBUFFER_EOL_CRLF_STRICT);
+			tt_int_op(pos.pos, ==, expect);
+
+			evbuffer_free(buf);
+			buf = NULL;
+		}
+	}
+
+end:
+	evbuffer_scan_set_level_(-1);
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+test_evbuffer_cursor(void *ptr)
+{
+	/* u16 0x0102, u32 0x03040506, u64, varints 300 and 2^63, "END\r\n" */
+	static const unsigned char msg[] = {
+		0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+		0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+		0xac, 0x02,
+		0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01,
+		'E', 'N', 'D', '\r', '\n'
+	};
+	static const unsigned char bad_varint[] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02
+	};
+	struct evbuffer *buf = evbuffer_new();
+	struct evbuffer_cursor cur;
+	ev_uint8_t u8;
+	ev_uint16_t u16;
+	ev_uint32_t u32;
+	ev_uint64_t u64;
+	const unsigned char *p;
+	struct evbuffer_chain *old;
+	size_t i, n;
+	char tmp[10];
+
+	tt_assert(buf);
+	evbuffer_cursor_init(&cur, buf);
+	tt_int_op(evbuffer_cursor_get_length(&cur), ==, 0);
+	tt_assert(!evbuffer_cursor_get_contiguous(&cur, &n));
+	tt_int_op(n, ==, 0);
+	tt_int_op(evbuffer_cursor_read_u8(&cur, &u8), ==, -1);
+	tt_int_op(evbuffer_cursor_read_varint(&cur, &u64), ==, 0);
+
+	/* One byte per chain, so every value spans chains.  Stop just short
+	 * of the end of the second varint. */
+	for (i = 0; i < 25; ++i)
+		evbuffer_add_reference(buf, msg + i, 1, NULL, NULL);
+	tt_int_op(evbuffer_peek(buf, -1, NULL, NULL, 0), ==, 25);
+	tt_int_op(evbuffer_cursor_get_length(&cur), ==, 25);
+
+	tt_int_op(evbuffer_cursor_read_u16(&cur, &u16), ==, 0);
+	tt_int_op(u16, ==, 0x0102);
+	tt_int_op(evbuffer_cursor_read_u32(&cur, &u32), ==, 0);
+	tt_int_op(u32, ==, 0x03040506);
+	tt_int_op(evbuffer_cursor_read_u64(&cur, &u64), ==, 0);
+	tt_assert(u64 == (((ev_uint64_t)0x11223344 << 32) | 0x55667788));
+	tt_int_op(evbuffer_cursor_read_varint(&cur, &u64), ==, 2);
+	tt_assert(u64 == 300);
+	tt_int_op(cur.ptr.pos, ==, 16);
+
+	/* Incomplete: nothing moves. */
+	tt_int_op(evbuffer_cursor_read_varint(&cur, &u64), ==, 0);
+	tt_int_op(evbuffer_cursor_read(&cur, tmp, 10), ==, -1);
+	tt_int_op(evbuffer_cursor_find(&cur, "\x01", 1), ==, -1);
+	tt_int_op(cur.ptr.pos, ==, 16);
+
+	/* Commit what we parsed; nothing was pulled up. */
+	tt_int_op(evbuffer_cursor_commit(&cur), ==, 0);
+	tt_int_op(cur.ptr.pos, ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, 9);
+	tt_int_op(evbuffer_peek(buf, -1, NULL, NULL, 0), ==, 9);
+
+	/* Read up to the end, then add the rest: the cursor resumes. */
+	tt_int_op(evbuffer_cursor_skip(&cur, 9), ==, 0);
+	tt_int_op(evbuffer_cursor_skip(&cur, 1), ==, -1);
+	evbuffer_add(buf, msg + 25, sizeof(msg) - 25);
+	tt_int_op(evbuffer_cursor_get_length(&cur), ==, sizeof(msg) - 25);
+	tt_int_op(evbuffer_cursor_skip(&cur, 0), ==, 0);
+	evbuffer_cursor_init(&cur, buf);
+	tt_int_op(evbuffer_cursor_read_varint(&cur, &u64), ==, 10);
+	tt_assert(u64 == (ev_uint64_t)1 << 63);
+
+	tt_int_op(evbuffer_cursor_find(&cur, "\r\n", 2), ==, 3);
+	p = evbuffer_cursor_get_contiguous(&cur, &n);
+	tt_assert(p);
+	tt_int_op(n, ==, sizeof(msg) - 26);
+	tt_assert(!memcmp(p, "END\r\n", 5));
+	tt_int_op(evbuffer_cursor_peek(&cur, tmp, 3), ==, 0);
+	tt_assert(!memcmp(tmp, "END", 3));
+	tt_int_op(evbuffer_cursor_read(&cur, tmp, 5), ==, 0);
+	tt_int_op(evbuffer_cursor_get_length(&cur), ==, 0);
+	tt_int_op(evbuffer_cursor_commit(&cur), ==, 0);
+	tt_int_op(evbuffer_get_length(buf), ==, 0);
+
+	/* After draining everything, appended data is still found. */
+	evbuffer_add(buf, bad_varint, sizeof(bad_varint));
+	tt_int_op(evbuffer_cursor_read_varint(&cur, &u64), ==, -1);
+	tt_int_op(cur.ptr.pos, ==, 0);
+	tt_int_op(evbuffer_cursor_read_u8(&cur, &u8), ==, 0);
+	tt_int_op(u8, ==, 0xff);
+
+	/* Growing the buffer can move the data after the cursor to a new
+	 * chain; the cursor follows it. */
+	old = buf->first;
+	tt_int_op(evbuffer_expand(buf, 65536), ==, 0);
+	tt_ptr_op(buf->first, !=, old);
+	p = evbuffer_cursor_get_contiguous(&cur, &n);
+	tt_assert(p);
+	tt_int_op(n, ==, sizeof(bad_varint) - 1);
+	tt_assert(!memcmp(p, bad_varint + 1, n));
+	tt_int_op(evbuffer_cursor_read_u8(&cur, &u8), ==, 0);
+	tt_int_op(u8, ==, 0xff);
+
+end:
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+segment_cleanup(const void *data, size_t len, void *arg)
+{
+	int *n_cleanups = arg;
+	tt_assert(!memcmp(data, "broadcast", len));
+	++*n_cleanups;
+end:
+	;
+}
+
+static void
+test_evbuffer_segment(void *ptr)
+{
+	static const char msg[] = "broadcast";
+	struct evbuffer *bufs[100];
+	struct evbuffer *src = NULL, *ref = NULL;
+	struct evbuffer_segment *seg = NULL;
+	char tmp[32];
+	int i, n_cleanups = 0;
+
+	memset(bufs, 0, sizeof(bufs));
+	seg = evbuffer_segment_new_reference(msg, 9, segment_cleanup,
+	    &n_cleanups, 0);
+	tt_assert(seg);
+	tt_int_op(evbuffer_segment_get_length(seg), ==, 9);
+
+	for (i = 0; i < 100; ++i) {
+		bufs[i] = evbuffer_new();
+		tt_assert(bufs[i]);
+		evbuffer_add(bufs[i], "<", 1);
+		tt_int_op(evbuffer_add_segment(bufs[i], seg), ==, 0);
+		tt_int_op(evbuffer_add_segment(bufs[i], seg), ==, 0);
+		evbuffer_add(bufs[i], ">", 1);
+	}
+	/* The buffers hold their own references. */
+	evbuffer_segment_free(seg);
+	seg = NULL;
+
+	/* Every buffer points at the same memory. */
+	for (i = 0; i < 100; ++i) {
+		struct evbuffer_iovec v[4];
+		tt_int_op(evbuffer_peek(bufs[i], -1, NULL, v, 4), ==, 4);
+		tt_ptr_op(v[1].iov_base, ==, msg);
+		tt_ptr_op(v[2].iov_base, ==, msg);
+		tt_int_op(evbuffer_get_length(bufs[i]), ==, 20);
+	}
+
+	/* A frozen buffer refuses the segment. */
+	evbuffer_freeze(bufs[0], 0);
+	seg = evbuffer_segment_new(msg, 9, EVBUF_SEG_DISABLE_LOCKING);
+	tt_assert(seg);
+	tt_int_op(evbuffer_add_segment(bufs[0], seg), ==, -1);
+	evbuffer_unfreeze(bufs[0], 0);
+	evbuffer_segment_free(seg);
+	seg = NULL;
+
+	/* Writers drain at their own pace; the segment goes with the last. */
+	for (i = 0; i < 100; ++i) {
+		tt_int_op(evbuffer_remove(bufs[i], tmp, sizeof(tmp)), ==, 20);
+		tt_assert(!memcmp(tmp, "<broadcastbroadcast>", 20));
+		if (i < 99) {
+			tt_int_op(n_cleanups, ==, 0);
+		}
+		evbuffer_free(bufs[i]);
+		bufs[i] = NULL;
+	}
+	tt_int_op(n_cleanups, ==, 1);
+
+	/* Build a segment from a buffer, then multicast a buffer holding it. */
+	src = evbuffer_new();
+	ref = evbuffer_new();
+	tt_assert(src && ref);
+	evbuffer_add_printf(src, "%s-%d", "msg", 42);
+	seg = evbuffer_segment_new_from_buffer(src, 0);
+	tt_assert(seg);
+	tt_int_op(evbuffer_get_length(src), ==, 0);
+	tt_int_op(evbuffer_segment_get_length(seg), ==, 6);
+	tt_int_op(evbuffer_add_segment(src, seg), ==, 0);
+	evbuffer_segment_free(seg);
+	seg = NULL;
+	tt_int_op(evbuffer_add_buffer_reference(ref, src), ==, 0);
+	evbuffer_free(src);
+	src = NULL;
+	tt_int_op(evbuffer_remove(ref, tmp, sizeof(tmp)), ==, 6);
+	tt_assert(!memcmp(tmp, "msg-42", 6));
+
+end:
+	for (i = 0; i < 100; ++i) {
+		if (bufs[i])
+			evbuffer_free(bufs[i]);
+	}
+	if (seg)
+		evbuffer_segment_free(seg);
+	if (src)
+		evbuffer_free(src);
+	if (ref)
+		evbuffer_free(ref);
+}
+
 static void
 log_change_callback(struct evbuffer *buffer,
     const struct evbuffer_cb_info *cbinfo,
@@ -2739,6 +3566,9 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "find", test_evbuffer_find, 0, NULL, NULL },
 	{ "ptr_set", test_evbuffer_ptr_set, 0, NULL, NULL },
 	{ "search", test_evbuffer_search, 0, NULL, NULL },
+	{ "search_kernels", test_evbuffer_search_kernels, 0, NULL, NULL },
+	{ "cursor", test_evbuffer_cursor, 0, NULL, NULL },
+	{ "segment", test_evbuffer_segment, 0, NULL, NULL },
 	{ "callbacks", test_evbuffer_callbacks, 0, NULL, NULL },
 	{ "add_reference", test_evbuffer_add_reference, 0, NULL, NULL },
 	{ "multicast", test_evbuffer_multicast, 0, NULL, NULL },
@@ -2753,6 +3583,14 @@ struct testcase_t evbuffer_testcases[] = {
 	{ "add_iovec", test_evbuffer_add_iovec, 0, NULL, NULL},
 	{ "copyout", test_evbuffer_copyout, 0, NULL, NULL},
 	{ "file_segment_add_cleanup_cb", test_evbuffer_file_segment_add_cleanup_cb, 0, NULL, NULL },
+	{ "chain_pool", test_evbuffer_chain_pool, 0, NULL, NULL },
+	{ "mem_ctx", test_evbuffer_mem_ctx, 0, NULL, NULL },
+	{ "adaptive_read", test_evbuffer_adaptive_read, 0, NULL, NULL },
+	{ "shrink", test_evbuffer_shrink, 0, NULL, NULL },
+	{ "zerocopy", test_evbuffer_zerocopy, TT_FORK, NULL, NULL },
+	{ "zerocopy_free", test_evbuffer_zerocopy_free, TT_FORK, NULL, NULL },
+	{ "zerocopy_free_close", test_evbuffer_zerocopy_free, TT_FORK, NULL,
+	  (void *)"close" },
 
 #define ADDFILE_TEST(name, parameters)					\
 	{ name, test_evbuffer_add_file, TT_FORK|TT_NEED_BASE,		\
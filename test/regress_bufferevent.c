@@ -68,6 +68,7 @@
 #include "event2/event_compat.h"
 #include "event2/tag.h"
 #include "event2/buffer.h"
+#include "event2/buffer_compat.h"
 #include "event2/bufferevent.h"
 #include "event2/bufferevent_compat.h"
 #include "event2/bufferevent_struct.h"
@@ -75,6 +76,7 @@
 #include "event2/util.h"
 
 #include "bufferevent-internal.h"
+#include "evbuffer-internal.h"
 #include "evthread-internal.h"
 #include "util-internal.h"
 #ifdef _WIN32
@@ -1326,6 +1328,421 @@ end:
 		bufferevent_free(filter);
 }
 
+static void
+shrink_drain_readcb(struct bufferevent *bev, void *arg)
+{
+	struct evbuffer *input = bufferevent_get_input(bev);
+	size_t len = evbuffer_get_length(input);
+	/* Leave a little data behind in a big chain. */
+	if (len > 10)
+		evbuffer_drain(input, len - 10);
+}
+
+static void
+test_bufferevent_idle_shrink(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct timeval idle = { 0, 100000 };
+	struct timeval wait = { 0, 300000 };
+	struct evbuffer *input;
+	char *payload = NULL;
+
+	tt_assert(payload = calloc(1, 65536));
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, pair));
+	input = bufferevent_get_input(pair[1]);
+	bufferevent_setcb(pair[1], shrink_drain_readcb, NULL, NULL, NULL);
+	bufferevent_enable(pair[1], EV_READ);
+	tt_int_op(bufferevent_set_idle_shrink(pair[1], &idle), ==, 0);
+
+	tt_int_op(bufferevent_write(pair[0], payload, 65536), ==, 0);
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(evbuffer_get_length(input), ==, 10);
+	tt_int_op(input->first->buffer_len, >=, 65536);
+
+	/* Once we've been idle for a while, the big chain goes away. */
+	event_base_loopexit(data->base, &wait);
+	event_base_dispatch(data->base);
+	tt_int_op(evbuffer_get_length(input), ==, 10);
+	tt_int_op(input->first->buffer_len, <, MIN_BUFFER_SIZE);
+
+	/* Turning it off means it stays. */
+	tt_int_op(bufferevent_set_idle_shrink(pair[1], NULL), ==, 0);
+	tt_int_op(bufferevent_write(pair[0], payload, 65536), ==, 0);
+	event_base_loopexit(data->base, &wait);
+	event_base_dispatch(data->base);
+	tt_int_op(evbuffer_get_length(input), ==, 10);
+	tt_int_op(input->last->buffer_len, >=, 65536);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	free(payload);
+}
+
+static void
+test_bufferevent_mem_budget(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *pair1[2] = { NULL, NULL };
+	struct bufferevent *pair2[2] = { NULL, NULL };
+	struct bufferevent_mem_budget *budget = NULL;
+	struct timeval wait = { 0, 100000 };
+	char *payload = NULL;
+
+	tt_assert(payload = calloc(1, 65536));
+	tt_assert(budget = bufferevent_mem_budget_new(8192));
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, pair1));
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, pair2));
+	bufferevent_setcb(pair1[1], shrink_drain_readcb, NULL, NULL, NULL);
+	bufferevent_setcb(pair2[1], shrink_drain_readcb, NULL, NULL, NULL);
+	bufferevent_enable(pair1[1], EV_READ);
+	bufferevent_enable(pair2[1], EV_READ);
+	tt_int_op(bufferevent_add_to_mem_budget(pair1[1], budget), ==, 0);
+	tt_int_op(bufferevent_add_to_mem_budget(pair2[1], budget), ==, 0);
+	tt_int_op(bufferevent_mem_budget_get_used(budget), ==, 0);
+
+	/* Going over the limit makes every member shrink. */
+	tt_int_op(bufferevent_write(pair1[0], payload, 65536), ==, 0);
+	tt_int_op(bufferevent_write(pair2[0], payload, 65536), ==, 0);
+	event_base_loopexit(data->base, &wait);
+	event_base_dispatch(data->base);
+	tt_int_op(bufferevent_mem_budget_get_used(budget), >, 0);
+	tt_int_op(bufferevent_mem_budget_get_used(budget), <=, 8192);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(pair1[1])), ==, 10);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(pair2[1])), ==, 10);
+
+	/* Leaving the budget takes our share out of it. */
+	tt_int_op(bufferevent_remove_from_mem_budget(pair1[1]), ==, 0);
+	bufferevent_free(pair2[1]);
+	pair2[1] = NULL;
+	tt_int_op(bufferevent_mem_budget_get_used(budget), ==, 0);
+
+end:
+	if (pair1[0])
+		bufferevent_free(pair1[0]);
+	if (pair1[1])
+		bufferevent_free(pair1[1]);
+	if (pair2[0])
+		bufferevent_free(pair2[0]);
+	if (pair2[1])
+		bufferevent_free(pair2[1]);
+	if (budget)
+		bufferevent_mem_budget_free(budget);
+	free(payload);
+}
+
+static void
+test_bufferevent_mem_budget_stuck(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct bufferevent_mem_budget *budget = NULL;
+	struct timeval wait = { 0, 500000 };
+	char *payload = NULL;
+	size_t used;
+
+	tt_assert(payload = calloc(1, 20000));
+	tt_assert(budget = bufferevent_mem_budget_new(8192));
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, pair));
+	bufferevent_enable(pair[1], EV_READ);
+	tt_int_op(bufferevent_add_to_mem_budget(pair[1], budget), ==, 0);
+
+	/* Nobody reads the data, so shrinking can't bring us under the
+	 * limit.  That must not keep the loop busy forever. */
+	tt_int_op(bufferevent_write(pair[0], payload, 20000), ==, 0);
+	event_base_loopexit(data->base, &wait);
+	tt_int_op(event_base_dispatch(data->base), ==, 0);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(pair[1])), ==, 20000);
+	used = bufferevent_mem_budget_get_used(budget);
+	tt_int_op(used, >, 8192);
+
+	/* Still over the limit, but nothing grew: no new round. */
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(bufferevent_mem_budget_get_used(budget), ==, used);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (budget)
+		bufferevent_mem_budget_free(budget);
+	free(payload);
+}
+
+struct proxy_test {
+	struct event_base *base;
+	/* ends[0] talks to the proxy's a side, ends[1] to its b side. */
+	struct bufferevent *ends[2];
+	size_t to_send[2];
+	size_t n_sent[2];
+	size_t n_recv[2];
+	int bad_data;
+	int eof[2];
+	int shut[2];
+	short done;
+};
+
+#define PROXY_TEST_BYTE(i) ((char)((i) % 251))
+
+static void
+proxy_test_check_done(struct proxy_test *t)
+{
+	if (t->eof[0] && t->eof[1] && t->done)
+		event_base_loopexit(t->base, NULL);
+}
+
+static void
+proxy_test_readcb(struct bufferevent *bev, void *arg)
+{
+	struct proxy_test *t = arg;
+	struct evbuffer *input = bufferevent_get_input(bev);
+	int i = bev == t->ends[1];
+	char buf[4096];
+	size_t n, j;
+
+	while ((n = evbuffer_remove(input, buf, sizeof(buf))) > 0) {
+		for (j = 0; j < n; ++j) {
+			if (buf[j] != PROXY_TEST_BYTE(t->n_recv[i] + j))
+				t->bad_data = 1;
+		}
+		t->n_recv[i] += n;
+	}
+}
+
+static void
+proxy_test_writecb(struct bufferevent *bev, void *arg)
+{
+	struct proxy_test *t = arg;
+	struct evbuffer *output = bufferevent_get_output(bev);
+	int i = bev == t->ends[1];
+	char buf[4096];
+	size_t n, j;
+
+	while (t->n_sent[i] < t->to_send[i] &&
+	    evbuffer_get_length(output) < 65536) {
+		n = t->to_send[i] - t->n_sent[i];
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		for (j = 0; j < n; ++j)
+			buf[j] = PROXY_TEST_BYTE(t->n_sent[i] + j);
+		evbuffer_add(output, buf, n);
+		t->n_sent[i] += n;
+	}
+	if (t->n_sent[i] == t->to_send[i] && !t->shut[i] &&
+	    !evbuffer_get_length(output)) {
+		t->shut[i] = 1;
+		shutdown(bufferevent_getfd(bev), EVUTIL_SHUT_WR);
+	}
+}
+
+static void
+proxy_test_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct proxy_test *t = arg;
+	if (what & BEV_EVENT_EOF) {
+		t->eof[bev == t->ends[1]] = 1;
+		proxy_test_check_done(t);
+	} else {
+		TT_FAIL(("Unexpected event %d on end %d", (int)what,
+			(int)(bev == t->ends[1])));
+		event_base_loopexit(t->base, NULL);
+	}
+}
+
+static void
+proxy_test_proxy_cb(struct bufferevent_proxy *proxy, struct bufferevent *bev,
+    short what, void *arg)
+{
+	struct proxy_test *t = arg;
+	t->done = what;
+	if (what != BEV_EVENT_EOF)
+		event_base_loopexit(t->base, NULL);
+	else
+		proxy_test_check_done(t);
+}
+
+static void
+test_bufferevent_proxy(void *arg)
+{
+	struct basic_test_data *data = arg;
+	const char *params = data->setup_data;
+	struct proxy_test t;
+	struct bufferevent *a = NULL, *b = NULL;
+	struct bufferevent_proxy *proxy = NULL;
+	evutil_socket_t pair1[2] = { -1, -1 }, pair2[2] = { -1, -1 };
+	struct timeval tv = { 10, 0 };
+	int flags = 0;
+	int be_flags = BEV_OPT_CLOSE_ON_FREE;
+	size_t highmark = 0;
+	ev_uint64_t a_to_b, b_to_a;
+	int i;
+
+	if (strstr(params, "nosplice"))
+		flags |= BEV_PROXY_NO_SPLICE;
+	if (strstr(params, "small"))
+		highmark = 4096;
+	if (strstr(params, "lock"))
+		be_flags |= BEV_OPT_THREADSAFE;
+
+	memset(&t, 0, sizeof(t));
+	t.base = data->base;
+	tt_assert(!evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair1));
+	tt_assert(!evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, pair2));
+	for (i = 0; i < 2; ++i) {
+		evutil_make_socket_nonblocking(pair1[i]);
+		evutil_make_socket_nonblocking(pair2[i]);
+	}
+	t.ends[0] = bufferevent_socket_new(data->base, pair1[0],
+	    BEV_OPT_CLOSE_ON_FREE);
+	t.ends[1] = bufferevent_socket_new(data->base, pair2[1],
+	    BEV_OPT_CLOSE_ON_FREE);
+	a = bufferevent_socket_new(data->base, pair1[1], be_flags);
+	b = bufferevent_socket_new(data->base, pair2[0], be_flags);
+	pair1[0] = pair1[1] = pair2[0] = pair2[1] = -1;
+	tt_assert(t.ends[0] && t.ends[1] && a && b);
+
+	/* Leave some data in a's input buffer before the proxy starts. */
+	tt_int_op(bufferevent_write(t.ends[0], "\0\1\2\3\4\5\6\7", 8),
+	    ==, 0);
+	bufferevent_enable(a, EV_READ);
+	while (evbuffer_get_length(bufferevent_get_input(a)) < 8)
+		event_base_loop(data->base, EVLOOP_ONCE);
+	bufferevent_disable(a, EV_READ);
+
+	t.to_send[0] = 1024 * 1024;
+	t.n_sent[0] = 8;
+	t.to_send[1] = 100 * 1024;
+	for (i = 0; i < 2; ++i) {
+		bufferevent_setcb(t.ends[i], proxy_test_readcb,
+		    proxy_test_writecb, proxy_test_eventcb, &t);
+		bufferevent_enable(t.ends[i], EV_READ|EV_WRITE);
+	}
+	proxy = bufferevent_proxy_new(a, b, highmark, flags,
+	    proxy_test_proxy_cb, &t);
+	tt_assert(proxy);
+#if defined(EVENT__HAVE_SPLICE) && defined(__linux__)
+	if (!(flags & BEV_PROXY_NO_SPLICE))
+		tt_int_op(bufferevent_proxy_get_splicing(proxy), ==,
+		    EV_READ|EV_WRITE);
+	else
+#endif
+		tt_int_op(bufferevent_proxy_get_splicing(proxy), ==, 0);
+
+	proxy_test_writecb(t.ends[0], &t);
+	proxy_test_writecb(t.ends[1], &t);
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(t.done, ==, BEV_EVENT_EOF);
+	tt_assert(t.eof[0] && t.eof[1]);
+	tt_assert(!t.bad_data);
+	tt_int_op(t.n_recv[1], ==, 1024 * 1024);
+	tt_int_op(t.n_recv[0], ==, 100 * 1024);
+	bufferevent_proxy_get_counts(proxy, &a_to_b, &b_to_a);
+	tt_int_op(a_to_b, ==, 1024 * 1024);
+	tt_int_op(b_to_a, ==, 100 * 1024);
+
+end:
+	if (proxy)
+		bufferevent_proxy_free(proxy);
+	if (a)
+		bufferevent_free(a);
+	if (b)
+		bufferevent_free(b);
+	for (i = 0; i < 2; ++i) {
+		if (t.ends[i])
+			bufferevent_free(t.ends[i]);
+	}
+	if (pair1[0] >= 0)
+		evutil_closesocket(pair1[0]);
+	if (pair1[1] >= 0)
+		evutil_closesocket(pair1[1]);
+	if (pair2[0] >= 0)
+		evutil_closesocket(pair2[0]);
+	if (pair2[1] >= 0)
+		evutil_closesocket(pair2[1]);
+}
+
+static void *
+mem_ctx_alloc(size_t size, void *arg)
+{
+	size_t *outstanding = arg;
+	*outstanding += size;
+	return malloc(size);
+}
+
+static void
+mem_ctx_release(void *ptr, size_t size, void *arg)
+{
+	size_t *outstanding = arg;
+	*outstanding -= size;
+	free(ptr);
+}
+
+static void
+test_bufferevent_mem_ctx(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *pair[2] = { NULL, NULL };
+	struct bufferevent *plain[2] = { NULL, NULL };
+	struct event_mem_ctx *ctx = NULL;
+	struct timeval wait = { 0, 100000 };
+	size_t outstanding = 0, before;
+	char *payload = NULL;
+
+	tt_assert(payload = calloc(1, 65536));
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, plain));
+	tt_assert(ctx = event_mem_ctx_new(mem_ctx_alloc, mem_ctx_release,
+		&outstanding));
+	tt_int_op(event_base_set_mem_ctx(data->base, ctx), ==, 0);
+	tt_ptr_op(event_base_get_mem_ctx(data->base), ==, ctx);
+	/* The base keeps its own reference. */
+	event_mem_ctx_free(ctx);
+	ctx = NULL;
+
+	/* Bufferevents made from now on allocate from the context. */
+	tt_assert(0 == bufferevent_pair_new(data->base, 0, pair));
+	bufferevent_setcb(pair[1], shrink_drain_readcb, NULL, NULL, NULL);
+	bufferevent_enable(pair[1], EV_READ);
+	tt_int_op(bufferevent_write(pair[0], payload, 65536), ==, 0);
+	tt_int_op(outstanding, >=, 65536);
+	event_base_loopexit(data->base, &wait);
+	event_base_dispatch(data->base);
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(pair[1])), ==, 10);
+
+	/* Those made before don't. */
+	before = outstanding;
+	tt_int_op(bufferevent_write(plain[0], payload, 65536), ==, 0);
+	tt_int_op(outstanding, ==, before);
+
+	bufferevent_free(pair[0]);
+	bufferevent_free(pair[1]);
+	pair[0] = pair[1] = NULL;
+	/* Let the finalizers run. */
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(outstanding, ==, 0);
+	tt_int_op(event_base_set_mem_ctx(data->base, NULL), ==, 0);
+	tt_ptr_op(event_base_get_mem_ctx(data->base), ==, NULL);
+
+end:
+	if (pair[0])
+		bufferevent_free(pair[0]);
+	if (pair[1])
+		bufferevent_free(pair[1]);
+	if (plain[0])
+		bufferevent_free(plain[0]);
+	if (plain[1])
+		bufferevent_free(plain[1]);
+	if (ctx)
+		event_mem_ctx_free(ctx);
+	if (payload)
+		free(payload);
+}
+
 struct testcase_t bufferevent_testcases[] = {
 
 	LEGACY(bufferevent, TT_ISOLATED),
@@ -1401,6 +1818,25 @@ struct testcase_t bufferevent_testcases[] = {
 	{ "bufferevent_filter_data_stuck",
 	  test_bufferevent_filter_data_stuck,
 	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_idle_shrink", test_bufferevent_idle_shrink,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_mem_budget", test_bufferevent_mem_budget,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_mem_budget_stuck",
+	  test_bufferevent_mem_budget_stuck,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_mem_ctx", test_bufferevent_mem_ctx,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "bufferevent_proxy", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"" },
+	{ "bufferevent_proxy_small", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"small" },
+	{ "bufferevent_proxy_lock", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_THREADS, &basic_setup, (void*)"lock" },
+	{ "bufferevent_proxy_nosplice", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"nosplice" },
+	{ "bufferevent_proxy_nosplice_small", test_bufferevent_proxy,
+	  TT_FORK|TT_NEED_BASE, &basic_setup, (void*)"nosplice small" },
 
 	END_OF_TESTCASES,
 };
@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "util-internal.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#endif
+
+#include <sys/types.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "event2/dgram.h"
+#include "event2/event.h"
+#include "event2/util.h"
+
+#include "regress.h"
+#include "tinytest.h"
+#include "tinytest_macros.h"
+
+/* Make a UDP socket bound to a random port on 127.0.0.1, and store its
+ * address in sin. */
+static evutil_socket_t
+dgram_bound_socket(struct sockaddr_in *sin)
+{
+	ev_socklen_t slen = sizeof(*sin);
+	evutil_socket_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd == EVUTIL_INVALID_SOCKET)
+		return fd;
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(0x7f000001);
+	if (bind(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)sin, &slen) < 0) {
+		evutil_closesocket(fd);
+		return EVUTIL_INVALID_SOCKET;
+	}
+	return fd;
+}
+
+struct dgram_echo_state {
+	struct event_base *base;
+	int n_echoed;
+	int n_batches;
+	int biggest_batch;
+	int n_received;
+	int seen[64];
+};
+
+static void
+dgram_echo_readcb(struct evdgram *dg, const struct evdgram_msg *msgs, int n,
+    void *arg)
+{
+	struct dgram_echo_state *st = arg;
+	int i;
+
+	++st->n_batches;
+	if (n > st->biggest_batch)
+		st->biggest_batch = n;
+	for (i = 0; i < n; ++i) {
+		if (evdgram_send(dg, msgs[i].data, msgs[i].len,
+			msgs[i].addr, msgs[i].socklen) == 0)
+			++st->n_echoed;
+	}
+}
+
+static void
+dgram_client_readcb(struct evdgram *dg, const struct evdgram_msg *msgs,
+    int n, void *arg)
+{
+	struct dgram_echo_state *st = arg;
+	int i, idx;
+	char buf[32];
+
+	for (i = 0; i < n; ++i) {
+		if (msgs[i].len >= sizeof(buf))
+			continue;
+		memcpy(buf, msgs[i].data, msgs[i].len);
+		buf[msgs[i].len] = '\0';
+		if (sscanf(buf, "dgram %d", &idx) == 1 && idx >= 0 && idx < 64)
+			++st->seen[idx];
+		++st->n_received;
+	}
+	if (st->n_received == 20)
+		event_base_loopexit(st->base, NULL);
+}
+
+static void
+test_dgram_echo(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdgram *server = NULL, *client = NULL;
+	struct sockaddr_in server_sin, client_sin;
+	struct dgram_echo_state server_st, client_st;
+	struct timeval tv = { 5, 0 };
+	evutil_socket_t sfd, cfd;
+	char buf[32], big[600];
+	int i;
+
+	memset(&server_st, 0, sizeof(server_st));
+	memset(&client_st, 0, sizeof(client_st));
+	client_st.base = base;
+
+	sfd = dgram_bound_socket(&server_sin);
+	tt_assert(sfd != EVUTIL_INVALID_SOCKET);
+	cfd = dgram_bound_socket(&client_sin);
+	if (cfd == EVUTIL_INVALID_SOCKET) {
+		evutil_closesocket(sfd);
+		tt_abort_msg("socket failed");
+	}
+
+	server = evdgram_new(base, sfd, EVDGRAM_OPT_CLOSE_ON_FREE, 8, 512);
+	client = evdgram_new(base, cfd, EVDGRAM_OPT_CLOSE_ON_FREE, 8, 512);
+	tt_assert(server);
+	tt_assert(client);
+	tt_int_op(evdgram_get_fd(server), ==, sfd);
+	tt_ptr_op(evdgram_get_base(server), ==, base);
+	evdgram_setcb(server, dgram_echo_readcb, NULL, &server_st);
+	evdgram_setcb(client, dgram_client_readcb, NULL, &client_st);
+	tt_int_op(evdgram_enable(server), ==, 0);
+	tt_int_op(evdgram_enable(client), ==, 0);
+
+	/* Too big for the evdgram. */
+	memset(big, 'x', sizeof(big));
+	tt_int_op(evdgram_send(client, big, 513,
+		(struct sockaddr *)&server_sin, sizeof(server_sin)), ==, -1);
+
+	/* More than the queue holds: the ninth send flushes the first
+	 * eight. */
+	for (i = 0; i < 20; ++i) {
+		int len = evutil_snprintf(buf, sizeof(buf), "dgram %d", i);
+		tt_int_op(evdgram_send(client, buf, len,
+			(struct sockaddr *)&server_sin, sizeof(server_sin)),
+		    ==, 0);
+	}
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+
+	tt_int_op(server_st.n_echoed, ==, 20);
+	tt_int_op(client_st.n_received, ==, 20);
+	for (i = 0; i < 20; ++i)
+		tt_int_op(client_st.seen[i], ==, 1);
+	/* They were all waiting for the server by the time it read, so it
+	 * should have got more than one at a time. */
+	tt_int_op(server_st.biggest_batch, >, 1);
+	tt_int_op(server_st.n_batches, <, 20);
+
+end:
+	if (server)
+		evdgram_free(server);
+	if (client)
+		evdgram_free(client);
+}
+
+static void
+dgram_free_readcb(struct evdgram *dg, const struct evdgram_msg *msgs, int n,
+    void *arg)
+{
+	int *count = arg;
+	*count += n;
+	event_base_loopexit(evdgram_get_base(dg), NULL);
+	evdgram_free(dg);
+}
+
+static void
+test_dgram_free_in_cb(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdgram *dg = NULL;
+	struct sockaddr_in sin, other_sin;
+	struct timeval tv = { 5, 0 };
+	evutil_socket_t fd, other = EVUTIL_INVALID_SOCKET;
+	int count = 0;
+
+	fd = dgram_bound_socket(&sin);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	dg = evdgram_new(base, fd, EVDGRAM_OPT_CLOSE_ON_FREE, 0, 0);
+	tt_assert(dg);
+	evdgram_setcb(dg, dgram_free_readcb, NULL, &count);
+	evdgram_enable(dg);
+
+	other = dgram_bound_socket(&other_sin);
+	tt_assert(other != EVUTIL_INVALID_SOCKET);
+	tt_int_op(sendto(other, "hello", 5, 0, (struct sockaddr *)&sin,
+		sizeof(sin)), ==, 5);
+	/* The callback frees it; this must not be touched again. */
+	dg = NULL;
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+	tt_int_op(count, ==, 1);
+
+end:
+	if (dg)
+		evdgram_free(dg);
+	if (other != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(other);
+}
+
+#ifndef _WIN32
+struct dgram_error_state {
+	int n_errors;
+	short what;
+	int err;
+};
+
+static void
+dgram_errorcb(struct evdgram *dg, short what, void *arg)
+{
+	struct dgram_error_state *st = arg;
+
+	++st->n_errors;
+	st->what = what;
+	st->err = EVUTIL_SOCKET_ERROR();
+}
+
+static void
+test_dgram_send_errors(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evdgram *dg = NULL;
+	struct dgram_error_state st;
+	struct sockaddr_in sin, other_sin;
+	struct sockaddr_in6 bad;
+	evutil_socket_t fd, other = EVUTIL_INVALID_SOCKET;
+	evutil_socket_t pair[2] = { EVUTIL_INVALID_SOCKET, EVUTIL_INVALID_SOCKET };
+	char buf[64];
+	int i, r = 0;
+
+	memset(&st, 0, sizeof(st));
+	memset(&bad, 0, sizeof(bad));
+	memset(buf, 'x', sizeof(buf));
+	bad.sin6_family = AF_INET6;
+
+	fd = dgram_bound_socket(&sin);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	dg = evdgram_new(base, fd, EVDGRAM_OPT_CLOSE_ON_FREE, 4, 0);
+	tt_assert(dg);
+	evdgram_setcb(dg, NULL, dgram_errorcb, &st);
+	other = dgram_bound_socket(&other_sin);
+	tt_assert(other != EVUTIL_INVALID_SOCKET);
+
+	/* An IPv4 socket can't send these; making room for one more drops
+	 * them, and says so. */
+	for (i = 0; i < 4; ++i)
+		tt_int_op(evdgram_send(dg, buf, sizeof(buf),
+			(struct sockaddr *)&bad, sizeof(bad)), ==, 0);
+	tt_int_op(st.n_errors, ==, 0);
+	tt_int_op(evdgram_send(dg, buf, sizeof(buf),
+		(struct sockaddr *)&other_sin, sizeof(other_sin)), ==, 0);
+	tt_int_op(st.n_errors, ==, 1);
+	tt_int_op(st.what, ==, EV_WRITE);
+	tt_int_op(st.err, ==, EAFNOSUPPORT);
+	evdgram_free(dg);
+	dg = NULL;
+
+	/* Nobody reads the other end, so the queue fills up for good. */
+	tt_int_op(evutil_socketpair(AF_UNIX, SOCK_DGRAM, 0, pair), ==, 0);
+	dg = evdgram_new(base, pair[0], EVDGRAM_OPT_CLOSE_ON_FREE, 4, 0);
+	tt_assert(dg);
+	pair[0] = EVUTIL_INVALID_SOCKET;
+	evdgram_setcb(dg, NULL, dgram_errorcb, &st);
+	for (i = 0; i < 100000; ++i) {
+		if ((r = evdgram_send(dg, buf, sizeof(buf), NULL, 0)) < 0)
+			break;
+	}
+	tt_int_op(r, ==, -1);
+	tt_int_op(EVUTIL_SOCKET_ERROR(), ==, EAGAIN);
+	tt_int_op(st.n_errors, ==, 1);
+
+end:
+	if (dg)
+		evdgram_free(dg);
+	if (other != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(other);
+	if (pair[0] != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(pair[0]);
+	if (pair[1] != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(pair[1]);
+}
+#endif
+
+struct testcase_t dgram_testcases[] = {
+	{ "echo", test_dgram_echo, TT_FORK|TT_NEED_BASE, &basic_setup, NULL },
+	{ "free_in_cb", test_dgram_free_in_cb, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+#ifndef _WIN32
+	{ "send_errors", test_dgram_send_errors, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL },
+#endif
+	END_OF_TESTCASES,
+};
@@ -2083,6 +2083,127 @@ http_request_empty_done(struct evhttp_request *req, void *arg)
 	event_base_loopexit(arg, NULL);
 }
 
+/*
+ * Routing to exact and prefix callbacks
+ */
+
+static void
+http_route_cb(struct evhttp_request *req, void *arg)
+{
+	struct evbuffer *evb = evbuffer_new();
+	evbuffer_add_printf(evb, "%s", (const char *)arg);
+	evhttp_send_reply(req, HTTP_OK, "OK", evb);
+	evbuffer_free(evb);
+}
+
+static void
+http_route_done(struct evhttp_request *req, void *arg)
+{
+	struct evbuffer *routes = arg;
+
+	if (req == NULL || evhttp_request_get_response_code(req) != HTTP_OK) {
+		evbuffer_add_printf(routes, "ERR|");
+	} else {
+		evbuffer_add_buffer(routes, evhttp_request_get_input_buffer(req));
+		evbuffer_add_printf(routes, "|");
+	}
+	if (++test_ok >= 6)
+		event_base_loopexit(exit_base, NULL);
+}
+
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+static void *
+http_failing_malloc(size_t how_much)
+{
+	errno = ENOMEM;
+	return NULL;
+}
+#endif
+
+static void
+http_route_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	ev_uint16_t port = 0;
+	struct evhttp_connection *evcon = NULL;
+	struct evhttp *http = evhttp_new(data->base);
+	struct evbuffer *routes = evbuffer_new();
+	const char *paths[] = {
+		"/a/b", "/a/bcd", "/a/bx", "/q", "/x%79", "/route/17", "/a/bx"
+	};
+	char path[32];
+	int i;
+
+	exit_base = data->base;
+	test_ok = 0;
+
+	tt_assert(http);
+	tt_int_op(http_bind(http, &port, 0), ==, 0);
+
+	/* plenty of exact routes that must not get in the way */
+	for (i = 0; i < 300; ++i) {
+		evutil_snprintf(path, sizeof(path), "/route/%d", i);
+		tt_int_op(evhttp_set_cb(http, path, http_route_cb,
+			    (void *)"route"), ==, 0);
+	}
+	tt_int_op(evhttp_set_cb(http, "/route/5", http_route_cb, NULL), ==, -1);
+	tt_int_op(evhttp_set_cb(http, "/a/b", http_route_cb, (void *)"exact"),
+	    ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/", http_route_cb, (void *)"root"),
+	    ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/a/", http_route_cb, (void *)"a"),
+	    ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/a/bc", http_route_cb,
+		(void *)"abc"), ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/x", http_route_cb, (void *)"x"),
+	    ==, 0);
+	/* the same string may be both an exact path and a prefix */
+	tt_int_op(evhttp_set_prefix_cb(http, "/a/b", http_route_cb,
+		(void *)"ab"), ==, 0);
+	tt_int_op(evhttp_set_prefix_cb(http, "/a/b", http_route_cb, NULL),
+	    ==, -1);
+	tt_int_op(evhttp_del_prefix_cb(http, "/a/b"), ==, 0);
+	tt_int_op(evhttp_del_prefix_cb(http, "/a/b"), ==, -1);
+#ifndef EVENT__DISABLE_MM_REPLACEMENT
+	/* a removal that runs out of memory keeps every prefix route */
+	event_set_mem_functions(http_failing_malloc, realloc, free);
+	tt_int_op(evhttp_del_prefix_cb(http, "/x"), ==, -1);
+	event_set_mem_functions(malloc, realloc, free);
+#endif
+
+	evcon = evhttp_connection_base_new(data->base, NULL, "127.0.0.1", port);
+	tt_assert(evcon);
+
+	for (i = 0; i < 6; ++i) {
+		struct evhttp_request *req =
+		    evhttp_request_new(http_route_done, routes);
+		tt_assert(req);
+		tt_int_op(evhttp_make_request(evcon, req, EVHTTP_REQ_GET,
+			    paths[i]), ==, 0);
+	}
+	event_base_dispatch(data->base);
+	tt_int_op(test_ok, ==, 6);
+
+	/* with "/a/" gone, "/a/bx" falls back to the root prefix */
+	tt_int_op(evhttp_del_prefix_cb(http, "/a/"), ==, 0);
+	tt_int_op(evhttp_make_request(evcon,
+		    evhttp_request_new(http_route_done, routes),
+		    EVHTTP_REQ_GET, paths[6]), ==, 0);
+	event_base_dispatch(data->base);
+
+	tt_int_op(test_ok, ==, 7);
+	tt_int_op(evbuffer_get_length(routes), ==, 30);
+	tt_int_op(evbuffer_datacmp(routes, "exact|abc|a|root|x|route|root|"),
+	    ==, 0);
+
+ end:
+	if (evcon)
+		evhttp_connection_free(evcon);
+	if (http)
+		evhttp_free(http);
+	evbuffer_free(routes);
+}
+
 /*
  * HTTP DISPATCHER test
  */
@@ -2638,6 +2759,280 @@ http_bad_header_test(void *ptr)
 	evhttp_clear_headers(&headers);
 }
 
+/* a node put together by hand, as callers of keyvalq_struct.h may do */
+static struct evkeyval *
+http_hand_built_header(const char *key, const char *value)
+{
+	struct evkeyval *header = calloc(1, sizeof(*header));
+
+	if (header) {
+		header->key = strdup(key);
+		header->value = strdup(value);
+	}
+	return (header);
+}
+
+static void
+http_hand_built_header_test(void *ptr)
+{
+	struct evhttp_request *req = NULL;
+	struct evkeyvalq headers, *input;
+	struct evkeyval *header;
+	int i;
+
+	TAILQ_INIT(&headers);
+	req = evhttp_request_new(NULL, NULL);
+	tt_assert(req);
+	input = evhttp_request_get_input_headers(req);
+
+	/* Allocate several, so that some key is likely to land right after
+	 * its node; none may be taken for one of ours. */
+	for (i = 0; i < 16; ++i) {
+		tt_int_op(evhttp_add_header(&headers, "Built", "by us"), ==, 0);
+		header = http_hand_built_header("X-Hand", "made");
+		tt_assert(header);
+		TAILQ_INSERT_TAIL(&headers, header, next);
+		header = http_hand_built_header("Host", "example.com");
+		tt_assert(header);
+		TAILQ_INSERT_TAIL(input, header, next);
+	}
+
+	tt_str_op(evhttp_find_header(&headers, "x-hand"), ==, "made");
+	tt_str_op(evhttp_find_header(&headers, "built"), ==, "by us");
+	tt_int_op(evhttp_remove_header(&headers, "X-Hand"), ==, 0);
+	tt_str_op(evhttp_find_header(input, "HOST"), ==, "example.com");
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_HOST), ==,
+	    "example.com");
+	tt_int_op(evhttp_remove_header(input, "Host"), ==, 0);
+
+ end:
+	evhttp_clear_headers(&headers);
+	if (req)
+		evhttp_request_free(req);
+}
+
+static void
+http_header_index_test(void *ptr)
+{
+	struct evhttp_request *req = NULL;
+	struct evbuffer *buf = NULL;
+	struct evkeyvalq *headers, moved;
+	struct evkeyval *header;
+
+	TAILQ_INIT(&moved);
+	req = evhttp_request_new(NULL, NULL);
+	buf = evbuffer_new();
+	tt_assert(req);
+	tt_assert(buf);
+	headers = evhttp_request_get_input_headers(req);
+
+	evbuffer_add_printf(buf,
+	    "host: example.com\r\n"
+	    "Content-Length: 12\r\n"
+	    "X-Folded: one\r\n"
+	    "  two\r\n"
+	    "CONTENT-LENGTH: 13\r\n"
+	    "Connection: keep-alive\r\n"
+	    "\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, ALL_DATA_READ);
+
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_HOST), ==,
+	    "example.com");
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_CONTENT_LENGTH),
+	    ==, "12");
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_CONNECTION), ==,
+	    "keep-alive");
+	tt_assert(!evhttp_find_input_header_(req, EVHTTP_HDR_EXPECT));
+	tt_str_op(evhttp_find_header(headers, "x-FOLDED"), ==, "one two");
+	tt_str_op(evhttp_find_header(headers, "Host"), ==, "example.com");
+
+	/* the index must not hide changes made through the list */
+	tt_int_op(evhttp_remove_header(headers, "content-length"), ==, 0);
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_CONTENT_LENGTH),
+	    ==, "13");
+	tt_int_op(evhttp_add_header(headers, "Expect", "100-continue"), ==, 0);
+	tt_str_op(evhttp_find_input_header_(req, EVHTTP_HDR_EXPECT), ==,
+	    "100-continue");
+	tt_int_op(evhttp_remove_header(headers, "Host"), ==, 0);
+	tt_assert(!evhttp_find_input_header_(req, EVHTTP_HDR_HOST));
+	tt_int_op(evhttp_remove_header(headers, "Host"), ==, -1);
+
+	/* an indexed header moved to another list outlives the request */
+	TAILQ_FOREACH(header, headers, next) {
+		if (!strcmp(header->key, "Connection"))
+			break;
+	}
+	tt_assert(header);
+	TAILQ_REMOVE(headers, header, next);
+	TAILQ_INSERT_TAIL(&moved, header, next);
+	evhttp_request_free(req);
+	req = NULL;
+	tt_str_op(evhttp_find_header(&moved, "connection"), ==, "keep-alive");
+
+ end:
+	if (req)
+		evhttp_request_free(req);
+	evhttp_clear_headers(&moved);
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+http_parse_in_place_test(void *ptr)
+{
+	struct evhttp_request *req = NULL;
+	struct evbuffer *buf = NULL;
+	struct evkeyvalq *headers;
+	/* Every piece is a read-only chain of its own, so lines span chains
+	 * and must not be written to. */
+	static const char *pieces[] = {
+		"HTTP/1.1 2", "04 No Content\r\nHo", "st: exa", "mple.com  \r",
+		"\nX-Long:", " one\r\n", "\t two \r\n", "Empty:\r\n\r", "\nbody"
+	};
+	size_t i;
+
+	req = evhttp_request_new(NULL, NULL);
+	buf = evbuffer_new();
+	tt_assert(req);
+	tt_assert(buf);
+	headers = evhttp_request_get_input_headers(req);
+
+	tt_int_op(evhttp_parse_firstline_(req, buf), ==, MORE_DATA_EXPECTED);
+	for (i = 0; i < 2; ++i)
+		evbuffer_add_reference(buf, pieces[i], strlen(pieces[i]),
+		    NULL, NULL);
+	tt_int_op(evhttp_parse_firstline_(req, buf), ==, ALL_DATA_READ);
+	tt_int_op(evhttp_request_get_response_code(req), ==, 204);
+	tt_str_op(evhttp_request_get_response_code_line(req), ==, "No Content");
+
+	for (; i < sizeof(pieces)/sizeof(pieces[0]); ++i) {
+		enum message_read_status st;
+		evbuffer_add_reference(buf, pieces[i], strlen(pieces[i]),
+		    NULL, NULL);
+		st = evhttp_parse_headers_(req, buf);
+		tt_int_op(st, ==, i == 8 ? ALL_DATA_READ : MORE_DATA_EXPECTED);
+	}
+	tt_str_op(evhttp_find_header(headers, "Host"), ==, "example.com");
+	tt_str_op(evhttp_find_header(headers, "X-Long"), ==, "one two");
+	tt_str_op(evhttp_find_header(headers, "Empty"), ==, "");
+	tt_int_op(evbuffer_get_length(buf), ==, 4);
+
+	/* NULs and stray CRs are not let through */
+	evbuffer_drain(buf, 4);
+	evbuffer_add(buf, "X-Bad: a\0b\r\n", 12);
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, DATA_CORRUPTED);
+	evbuffer_add_printf(buf, "X-Bad: a\r\r\n");
+	tt_int_op(evhttp_parse_headers_(req, buf), ==, DATA_CORRUPTED);
+	tt_assert(!evhttp_find_header(headers, "X-Bad"));
+
+ end:
+	if (req)
+		evhttp_request_free(req);
+	if (buf)
+		evbuffer_free(buf);
+}
+
+static void
+http_hpack_collect_cb(void *arg, const char *name, size_t name_len,
+    const char *value, size_t value_len)
+{
+	evbuffer_add_printf(arg, "%.*s: %.*s\n", (int)name_len, name,
+	    (int)value_len, value);
+}
+
+static void
+http_hpack_test(void *ptr)
+{
+	/* RFC 7541, appendix C.3 and, Huffman coded, C.4 */
+	static const char *blocks[2][3] = { {
+		"828684410f7777772e6578616d706c652e636f6d",
+		"828684be58086e6f2d6361636865",
+		"828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"
+	}, {
+		"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+		"828684be5886a8eb10649cbf",
+		"828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"
+	} };
+	static const char *expected[3] = {
+		":method: GET\n:scheme: http\n:path: /\n"
+		":authority: www.example.com\n",
+		":method: GET\n:scheme: http\n:path: /\n"
+		":authority: www.example.com\ncache-control: no-cache\n",
+		":method: GET\n:scheme: https\n:path: /index.html\n"
+		":authority: www.example.com\ncustom-key: custom-value\n"
+	};
+	static const size_t table_size[3] = { 57, 110, 164 };
+	struct evhttp_hpack hp;
+	struct evbuffer *out = evbuffer_new();
+	unsigned char block[64];
+	size_t i, j, k, len;
+
+	evhttp_hpack_init_(&hp, 4096);
+	tt_assert(out);
+	for (i = 0; i < 2; ++i) {
+		for (j = 0; j < 3; ++j) {
+			const char *hex = blocks[i][j];
+			len = strlen(hex) / 2;
+			for (k = 0; k < len; ++k) {
+				unsigned v;
+				sscanf(hex + 2 * k, "%2x", &v);
+				block[k] = (unsigned char)v;
+			}
+			evbuffer_drain(out, evbuffer_get_length(out));
+			tt_int_op(evhttp_hpack_decode_(&hp, block, len,
+				http_hpack_collect_cb, out), ==, 0);
+			evbuffer_add(out, "", 1);
+			tt_str_op((char *)evbuffer_pullup(out, -1), ==, expected[j]);
+			tt_int_op(hp.size, ==, table_size[j]);
+		}
+		/* the most recent entry is index 62 */
+		block[0] = 0x80 | 62;
+		evbuffer_drain(out, evbuffer_get_length(out));
+		tt_int_op(evhttp_hpack_decode_(&hp, block, 1,
+			http_hpack_collect_cb, out), ==, 0);
+		evbuffer_add(out, "", 1);
+		tt_str_op((char *)evbuffer_pullup(out, -1), ==,
+		    "custom-key: custom-value\n");
+		/* and there is no index 66 */
+		block[0] = 0x80 | 66;
+		tt_int_op(evhttp_hpack_decode_(&hp, block, 1,
+			http_hpack_collect_cb, out), ==, -1);
+		evhttp_hpack_clear_(&hp);
+		evhttp_hpack_init_(&hp, 4096);
+	}
+
+	/* what we encode decodes */
+	evbuffer_drain(out, evbuffer_get_length(out));
+	evhttp_hpack_encode_(out, "Content-Type", "text/plain");
+	evhttp_hpack_encode_(out, "X-Foo", "bar");
+	len = evbuffer_get_length(out);
+	tt_int_op(len, <=, sizeof(block));
+	evbuffer_remove(out, block, len);
+	tt_int_op(evhttp_hpack_decode_(&hp, block, len,
+		http_hpack_collect_cb, out), ==, 0);
+	evbuffer_add(out, "", 1);
+	tt_str_op((char *)evbuffer_pullup(out, -1), ==,
+	    "content-type: text/plain\nx-foo: bar\n");
+	tt_int_op(hp.size, ==, 0);
+
+	/* a size update is only allowed first, and within the limit */
+	memcpy(block, "\x82\x20", 2);
+	tt_int_op(evhttp_hpack_decode_(&hp, block, 2,
+		http_hpack_collect_cb, out), ==, -1);
+	memcpy(block, "\x3f\xe2\x1f", 3);
+	tt_int_op(evhttp_hpack_decode_(&hp, block, 3,
+		http_hpack_collect_cb, out), ==, -1);
+	/* Huffman padding must be all ones */
+	memcpy(block, "\x40\x81\x00\x00", 4);
+	tt_int_op(evhttp_hpack_decode_(&hp, block, 4,
+		http_hpack_collect_cb, out), ==, -1);
+
+ end:
+	evhttp_hpack_clear_(&hp);
+	if (out)
+		evbuffer_free(out);
+}
+
 static int validate_header(
 	const struct evkeyvalq* headers,
 	const char *key, const char *value)
@@ -4238,6 +4633,426 @@ http_multi_line_header_test(void *arg)
 		evhttp_free(http);
 }
 
+/* number of requests handed to http_pipeline_cb so far, and when the
+ * slow one got its reply */
+static int pipeline_handled, pipeline_handled_at_slow_reply;
+/* number of chunk write callbacks run for /stream */
+static int pipeline_chunk_cbs;
+
+static void
+http_pipeline_chunk_cb(struct evhttp_connection *evcon, void *arg)
+{
+	++pipeline_chunk_cbs;
+}
+
+static void
+http_pipeline_send(struct evhttp_request *req)
+{
+	struct evbuffer *evb = evbuffer_new();
+
+	evbuffer_add_printf(evb, "<%s>", evhttp_request_get_uri(req));
+	evhttp_send_reply(req, HTTP_OK, "OK", evb);
+	evbuffer_free(evb);
+}
+
+static void
+http_pipeline_slow_reply(evutil_socket_t fd, short what, void *arg)
+{
+	pipeline_handled_at_slow_reply = pipeline_handled;
+	http_pipeline_send(arg);
+}
+
+static void
+http_pipeline_chunked_end(evutil_socket_t fd, short what, void *arg)
+{
+	evhttp_send_reply_end(arg);
+}
+
+static void
+http_pipeline_cb(struct evhttp_request *req, void *arg)
+{
+	struct event_base *base = arg;
+	const char *uri = evhttp_request_get_uri(req);
+	struct timeval tv;
+
+	++pipeline_handled;
+	evutil_timerclear(&tv);
+
+	if (!strcmp(uri, "/slow")) {
+		tv.tv_usec = 100 * 1000;
+		event_base_once(base, -1, EV_TIMEOUT,
+		    http_pipeline_slow_reply, req, &tv);
+	} else if (!strcmp(uri, "/stream")) {
+		/* started while /slow is pending, finished after it */
+		struct evbuffer *evb = evbuffer_new();
+		evhttp_send_reply_start(req, HTTP_OK, "OK");
+		evbuffer_add_printf(evb, "<%s>", uri);
+		evhttp_send_reply_chunk_with_cb(req, evb,
+		    http_pipeline_chunk_cb, NULL);
+		evbuffer_add_printf(evb, ".");
+		evhttp_send_reply_chunk_with_cb(req, evb,
+		    http_pipeline_chunk_cb, NULL);
+		evbuffer_free(evb);
+		tv.tv_usec = 200 * 1000;
+		event_base_once(base, -1, EV_TIMEOUT,
+		    http_pipeline_chunked_end, req, &tv);
+	} else {
+		http_pipeline_send(req);
+	}
+}
+
+static void
+http_pipeline_readcb(struct bufferevent *bev, void *arg)
+{
+	evbuffer_add_buffer(arg, bufferevent_get_input(bev));
+}
+
+static void
+http_pipeline_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	if (what & (BEV_EVENT_EOF|BEV_EVENT_ERROR))
+		event_base_loopexit(bufferevent_get_base(bev), NULL);
+}
+
+static void
+http_pipeline_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	int pipelined = data->setup_data != NULL;
+	struct bufferevent *bev = NULL;
+	struct evbuffer *received = evbuffer_new();
+	evutil_socket_t fd = EVUTIL_INVALID_SOCKET;
+	ev_uint16_t port = 0;
+	struct evhttp *http = http_setup_gencb(&port, data->base, 0,
+	    http_pipeline_cb, data->base);
+	const char *expected[] = {
+		"</slow>", "</fast1>", "</stream>", "</fast2>"
+	};
+	struct evbuffer_ptr last, pos;
+	const char *requests =
+	    "GET /slow HTTP/1.1\r\nHost: somehost\r\n\r\n"
+	    "GET /fast1 HTTP/1.1\r\nHost: somehost\r\n\r\n"
+	    "GET /stream HTTP/1.1\r\nHost: somehost\r\n\r\n"
+	    "GET /fast2 HTTP/1.1\r\nHost: somehost\r\n"
+	    "Connection: close\r\n\r\n";
+	size_t i;
+
+	tt_ptr_op(http, !=, NULL);
+	if (pipelined)
+		evhttp_set_max_pipelined_requests(http, 4);
+	pipeline_handled = pipeline_handled_at_slow_reply = 0;
+	pipeline_chunk_cbs = 0;
+
+	fd = http_connect("127.0.0.1", port);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	bev = bufferevent_socket_new(data->base, fd, 0);
+	tt_ptr_op(bev, !=, NULL);
+	bufferevent_setcb(bev, http_pipeline_readcb, NULL,
+	    http_pipeline_eventcb, received);
+	bufferevent_enable(bev, EV_READ);
+
+	/* all four requests go out in a single write */
+	bufferevent_write(bev, requests, strlen(requests));
+
+	event_base_dispatch(data->base);
+
+	tt_int_op(pipeline_handled, ==, 4);
+	/* with pipelining, the requests behind /slow were handled while it
+	 * was pending; without it, they had to wait for its reply */
+	tt_int_op(pipeline_handled_at_slow_reply, ==, pipelined ? 4 : 1);
+	/* queued or not, the callback of every chunk runs */
+	tt_int_op(pipeline_chunk_cbs, ==, 2);
+
+	/* the replies come back in request order */
+	evbuffer_ptr_set(received, &last, 0, EVBUFFER_PTR_SET);
+	for (i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+		pos = evbuffer_search(received, expected[i],
+		    strlen(expected[i]), &last);
+		tt_int_op(pos.pos, >=, 0);
+		last = pos;
+	}
+	pos = evbuffer_search(received, "Transfer-Encoding: chunked", 26,
+	    NULL);
+	tt_int_op(pos.pos, >=, 0);
+	pos = evbuffer_search(received, "0\r\n\r\nHTTP/1.1 200 OK", 20, NULL);
+	tt_int_op(pos.pos, >=, 0);
+
+ end:
+	if (bev)
+		bufferevent_free(bev);
+	if (fd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(fd);
+	if (http)
+		evhttp_free(http);
+	evbuffer_free(received);
+}
+
+static void
+http_h2_cb(struct evhttp_request *req, void *arg)
+{
+	struct evbuffer *evb = evbuffer_new();
+	const char *uri = evhttp_request_get_uri(req);
+
+	evbuffer_add_printf(evb, "<%s:%d>", uri, (int)evbuffer_get_length(
+	    evhttp_request_get_input_buffer(req)));
+	if (!strcmp(uri, "/h2/stream")) {
+		evhttp_send_reply_start(req, HTTP_OK, "OK");
+		evhttp_send_reply_chunk(req, evb);
+		evhttp_send_reply_end(req);
+	} else {
+		evhttp_send_reply(req, HTTP_OK, "OK", evb);
+	}
+	evbuffer_free(evb);
+}
+
+static void
+http_h2_frame(struct evbuffer *out, int type, int flags, int id,
+    struct evbuffer *payload)
+{
+	size_t len = evbuffer_get_length(payload);
+	unsigned char hdr[9] = { 0 };
+
+	hdr[1] = (unsigned char)(len >> 8);
+	hdr[2] = (unsigned char)len;
+	hdr[3] = (unsigned char)type;
+	hdr[4] = (unsigned char)flags;
+	hdr[8] = (unsigned char)id;
+	evbuffer_add(out, hdr, sizeof(hdr));
+	evbuffer_add_buffer(out, payload);
+}
+
+static void
+http_h2_request(struct evbuffer *out, int id, const char *method,
+    const char *path, const char *body)
+{
+	struct evbuffer *payload = evbuffer_new();
+
+	evhttp_hpack_encode_(payload, ":method", method);
+	evhttp_hpack_encode_(payload, ":scheme", "http");
+	evhttp_hpack_encode_(payload, ":path", path);
+	evhttp_hpack_encode_(payload, ":authority", "somehost");
+	/* HEADERS with END_HEADERS, and END_STREAM unless there is a body */
+	http_h2_frame(out, 1, body ? 0x4 : 0x5, id, payload);
+	if (body) {
+		evbuffer_add(payload, body, strlen(body));
+		http_h2_frame(out, 0, 0x1, id, payload);
+	}
+	evbuffer_free(payload);
+}
+
+static void
+http_h2_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	int upgrade = data->setup_data != NULL;
+	struct bufferevent *bev = NULL;
+	struct evbuffer *received = evbuffer_new();
+	struct evbuffer *out = evbuffer_new();
+	struct evbuffer *headers[4] = { NULL }, *bodies[4] = { NULL };
+	evutil_socket_t fd = EVUTIL_INVALID_SOCKET;
+	ev_uint16_t port = 0;
+	struct evhttp *http = http_setup_gencb(&port, data->base, 0,
+	    http_h2_cb, NULL);
+	static const char *expected[4] = {
+		"</h2/upgrade:0>", "</h2/get:0>", "</h2/post:5>", "</h2/stream:0>"
+	};
+	struct evhttp_hpack hp;
+	int first = upgrade ? 3 : 1;
+	int last_type = -1, n_frames = 0;
+	size_t i;
+
+	evhttp_hpack_init_(&hp, 4096);
+	tt_ptr_op(http, !=, NULL);
+	tt_int_op(evhttp_set_flags(http, EVHTTP_SERVER_HTTP2), ==, 0);
+	for (i = 0; i < 4; ++i) {
+		headers[i] = evbuffer_new();
+		bodies[i] = evbuffer_new();
+	}
+
+	if (upgrade) {
+		evbuffer_add_printf(out,
+		    "GET /h2/upgrade HTTP/1.1\r\nHost: somehost\r\n"
+		    "Connection: Upgrade, HTTP2-Settings\r\n"
+		    "Upgrade: h2c\r\nHTTP2-Settings: AAMAAABkAAQAAP__\r\n\r\n");
+	}
+	evbuffer_add_printf(out, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+	http_h2_frame(out, 4, 0, 0, received);	/* empty SETTINGS */
+	http_h2_request(out, first, "GET", "/h2/get", NULL);
+	http_h2_request(out, first + 2, "POST", "/h2/post", "hello");
+	http_h2_request(out, first + 4, "GET", "/h2/stream", NULL);
+	/* GOAWAY: the server closes once it has answered */
+	evbuffer_add(received, "\0\0\0\0\0\0\0\0", 8);
+	http_h2_frame(out, 7, 0, 0, received);
+
+	fd = http_connect("127.0.0.1", port);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	bev = bufferevent_socket_new(data->base, fd, 0);
+	tt_ptr_op(bev, !=, NULL);
+	bufferevent_setcb(bev, http_pipeline_readcb, NULL,
+	    http_pipeline_eventcb, received);
+	bufferevent_enable(bev, EV_READ);
+	bufferevent_write_buffer(bev, out);
+
+	event_base_dispatch(data->base);
+
+	if (upgrade) {
+		const char *reply = "HTTP/1.1 101 Switching Protocols\r\n";
+		struct evbuffer_ptr pos = evbuffer_search(received,
+		    "\r\n\r\n", 4, NULL);
+		tt_int_op(pos.pos, >, 0);
+		tt_int_op(evbuffer_get_length(received), >, strlen(reply));
+		tt_assert(!memcmp(evbuffer_pullup(received, strlen(reply)),
+			reply, strlen(reply)));
+		evbuffer_drain(received, pos.pos + 4);
+	}
+
+	while (evbuffer_get_length(received) >= 9) {
+		unsigned char *frame = evbuffer_pullup(received, 9);
+		size_t len = (frame[1] << 8) | frame[2];
+		int type = frame[3], id = frame[8];
+		/* stream 1 is the upgrade request, if any */
+		int stream = (id - first) / 2 + 1;
+
+		tt_int_op(evbuffer_get_length(received), >=, 9 + len);
+		frame = evbuffer_pullup(received, 9 + len);
+		if (n_frames++ == 0)
+			tt_int_op(type, ==, 4); /* SETTINGS come first */
+		if (type == 0 || type == 1) {
+			tt_assert(id & 1);
+			tt_int_op(stream, >=, 0);
+			tt_int_op(stream, <, 4);
+		}
+		if (type == 0)
+			evbuffer_add(bodies[stream], frame + 9, len);
+		else if (type == 1)
+			tt_int_op(evhttp_hpack_decode_(&hp, frame + 9, len,
+				http_hpack_collect_cb, headers[stream]), ==, 0);
+		last_type = type;
+		evbuffer_drain(received, 9 + len);
+	}
+	tt_int_op(evbuffer_get_length(received), ==, 0);
+	tt_int_op(last_type, ==, 7);
+
+	for (i = upgrade ? 0 : 1; i < 4; ++i) {
+		struct evbuffer_ptr pos = evbuffer_search(headers[i],
+		    ":status: 200\n", 13, NULL);
+		tt_int_op(pos.pos, ==, 0);
+		evbuffer_add(bodies[i], "", 1);
+		tt_str_op((char *)evbuffer_pullup(bodies[i], -1), ==, expected[i]);
+	}
+	if (!upgrade)
+		tt_int_op(evbuffer_get_length(headers[0]), ==, 0);
+
+ end:
+	evhttp_hpack_clear_(&hp);
+	for (i = 0; i < 4; ++i) {
+		if (headers[i])
+			evbuffer_free(headers[i]);
+		if (bodies[i])
+			evbuffer_free(bodies[i]);
+	}
+	if (bev)
+		bufferevent_free(bev);
+	if (fd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(fd);
+	if (http)
+		evhttp_free(http);
+	evbuffer_free(out);
+	evbuffer_free(received);
+}
+
+static void
+http_h2_large_headers_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev = NULL;
+	struct evbuffer *received = evbuffer_new();
+	struct evbuffer *out = evbuffer_new();
+	struct evbuffer *payload = evbuffer_new();
+	struct evbuffer *headers = evbuffer_new();
+	evutil_socket_t fd = EVUTIL_INVALID_SOCKET;
+	ev_uint16_t port = 0;
+	struct evhttp *http = http_setup_gencb(&port, data->base, 0,
+	    http_h2_cb, NULL);
+	/* a 4000 byte value, added to the dynamic table */
+	static const unsigned char big[] = {
+		0x40, 0x05, 'x', '-', 'b', 'i', 'g', 0x7f, 0xa1, 0x1e
+	};
+	static const unsigned char max_list[] = { 0, 6, 0, 1, 0, 0 };
+	struct evhttp_hpack hp;
+	char value[4000];
+	int n_frames = 0, saw_max_list = 0;
+	size_t i;
+
+	evhttp_hpack_init_(&hp, 4096);
+	tt_ptr_op(http, !=, NULL);
+	tt_int_op(evhttp_set_flags(http, EVHTTP_SERVER_HTTP2), ==, 0);
+
+	evbuffer_add_printf(out, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+	http_h2_frame(out, 4, 0, 0, payload);	/* empty SETTINGS */
+	evhttp_hpack_encode_(payload, ":method", "GET");
+	evhttp_hpack_encode_(payload, ":scheme", "http");
+	evhttp_hpack_encode_(payload, ":path", "/h2/get");
+	evhttp_hpack_encode_(payload, ":authority", "somehost");
+	memset(value, 'a', sizeof(value));
+	evbuffer_add(payload, big, sizeof(big));
+	evbuffer_add(payload, value, sizeof(value));
+	/* ...then refer to it a byte at a time, for about 400K of headers */
+	for (i = 0; i < 100; ++i)
+		evbuffer_add(payload, "\xbe", 1);
+	http_h2_frame(out, 1, 0x5, 1, payload);
+	evbuffer_add(payload, "\0\0\0\0\0\0\0\0", 8);
+	http_h2_frame(out, 7, 0, 0, payload);	/* GOAWAY */
+
+	fd = http_connect("127.0.0.1", port);
+	tt_assert(fd != EVUTIL_INVALID_SOCKET);
+	bev = bufferevent_socket_new(data->base, fd, 0);
+	tt_ptr_op(bev, !=, NULL);
+	bufferevent_setcb(bev, http_pipeline_readcb, NULL,
+	    http_pipeline_eventcb, received);
+	bufferevent_enable(bev, EV_READ);
+	bufferevent_write_buffer(bev, out);
+
+	event_base_dispatch(data->base);
+
+	while (evbuffer_get_length(received) >= 9) {
+		unsigned char *frame = evbuffer_pullup(received, 9);
+		size_t len = (frame[1] << 8) | frame[2];
+		int type = frame[3];
+
+		tt_int_op(evbuffer_get_length(received), >=, 9 + len);
+		frame = evbuffer_pullup(received, 9 + len);
+		if (n_frames++ == 0) {
+			/* we always say how much we take */
+			tt_int_op(type, ==, 4);
+			for (i = 0; i + 6 <= len; i += 6) {
+				if (!memcmp(frame + 9 + i, max_list, 6))
+					saw_max_list = 1;
+			}
+		}
+		if (type == 1)
+			tt_int_op(evhttp_hpack_decode_(&hp, frame + 9, len,
+				http_hpack_collect_cb, headers), ==, 0);
+		evbuffer_drain(received, 9 + len);
+	}
+	tt_assert(saw_max_list);
+	tt_int_op(evbuffer_search(headers, ":status: 431\n", 13, NULL).pos,
+	    ==, 0);
+
+ end:
+	evhttp_hpack_clear_(&hp);
+	if (bev)
+		bufferevent_free(bev);
+	if (fd != EVUTIL_INVALID_SOCKET)
+		evutil_closesocket(fd);
+	if (http)
+		evhttp_free(http);
+	evbuffer_free(headers);
+	evbuffer_free(payload);
+	evbuffer_free(out);
+	evbuffer_free(received);
+}
+
 static void
 http_request_bad(struct evhttp_request *req, void *arg)
 {
@@ -5137,6 +5952,229 @@ http_timeout_read_server_test(void *arg)
 		evhttp_free(http);
 }
 
+struct http_client_state {
+	struct evhttp_client *client;
+	ev_uint16_t port;
+	ev_uint16_t peers[8];
+	int n_peers;
+	int served;
+	struct evhttp_connection *server_evcon;
+	int expected;
+	int done;
+	int ok;
+	int sequential;
+	int drop;
+	enum evhttp_cmd_type type;
+	char body[16];
+};
+
+static void
+http_client_server_cb(struct evhttp_request *req, void *arg)
+{
+	struct http_client_state *state = arg;
+	struct evhttp_connection *evcon = evhttp_request_get_connection(req);
+	struct evbuffer *evb = evbuffer_new();
+	char *address;
+	ev_uint16_t port;
+	int i;
+
+	evhttp_connection_get_peer(evcon, &address, &port);
+	for (i = 0; i < state->n_peers; ++i)
+		if (state->peers[i] == port)
+			break;
+	if (i == state->n_peers &&
+	    i < (int)(sizeof(state->peers) / sizeof(state->peers[0])))
+		state->peers[state->n_peers++] = port;
+	state->server_evcon = evcon;
+	++state->served;
+
+	evbuffer_add_printf(evb, "%d",
+	    (int)evbuffer_get_length(evhttp_request_get_input_buffer(req)));
+	evhttp_send_reply(req, HTTP_OK, "Everything is fine", evb);
+	evbuffer_free(evb);
+}
+
+static void http_client_request(struct http_client_state *state,
+    enum evhttp_cmd_type type);
+
+static void
+http_client_done(struct evhttp_request *req, void *arg)
+{
+	struct http_client_state *state = arg;
+
+	++state->done;
+	if (req != NULL &&
+	    evhttp_request_get_response_code(req) == HTTP_OK) {
+		struct evbuffer *evb = evhttp_request_get_input_buffer(req);
+		size_t len = evbuffer_get_length(evb);
+
+		if (len >= sizeof(state->body))
+			len = sizeof(state->body) - 1;
+		evbuffer_remove(evb, state->body, len);
+		state->body[len] = '\0';
+		++state->ok;
+	}
+
+	if (state->drop && state->done == 1) {
+		/* the server forgets the connection, but the client does
+		 * not get to notice before it sends the next request */
+		evhttp_connection_free(state->server_evcon);
+		http_client_request(state, state->type);
+	} else if (state->sequential && state->done < state->expected) {
+		http_client_request(state, EVHTTP_REQ_GET);
+	}
+
+	if (state->done == state->expected)
+		event_base_loopexit(exit_base, NULL);
+}
+
+static void
+http_client_request(struct http_client_state *state,
+    enum evhttp_cmd_type type)
+{
+	struct evhttp_request *req = evhttp_request_new(http_client_done, state);
+
+	if (type == EVHTTP_REQ_PUT || type == EVHTTP_REQ_POST)
+		evbuffer_add(evhttp_request_get_output_buffer(req), "hello", 5);
+	if (evhttp_client_make_request(state->client, req, type,
+		"127.0.0.1", state->port, "/client") == -1)
+		tt_fail_msg("Couldn't make request");
+}
+
+static void
+http_client_pool_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct http_client_state state;
+	struct evhttp *http;
+	int i;
+
+	memset(&state, 0, sizeof(state));
+	http = http_setup(&state.port, data->base, 0);
+	evhttp_set_cb(http, "/client", http_client_server_cb, &state);
+	exit_base = data->base;
+
+	state.client = evhttp_client_new(data->base, NULL);
+	tt_assert(state.client);
+
+	/* requests one after the other share a single connection */
+	state.expected = 3;
+	state.sequential = 1;
+	http_client_request(&state, EVHTTP_REQ_GET);
+	event_base_dispatch(data->base);
+	tt_int_op(state.ok, ==, 3);
+	tt_int_op(state.served, ==, 3);
+	tt_int_op(state.n_peers, ==, 1);
+	evhttp_client_free(state.client);
+
+	/* concurrent requests queue up once the limit is reached */
+	memset(&state.peers, 0, sizeof(state.peers));
+	state.n_peers = state.served = state.done = state.ok = 0;
+	state.sequential = 0;
+	state.expected = 4;
+	state.client = evhttp_client_new(data->base, NULL);
+	tt_assert(state.client);
+	evhttp_client_set_max_connections_per_host(state.client, 2);
+	for (i = 0; i < 4; ++i)
+		http_client_request(&state, EVHTTP_REQ_GET);
+	event_base_dispatch(data->base);
+	tt_int_op(state.ok, ==, 4);
+	tt_int_op(state.served, ==, 4);
+	tt_int_op(state.n_peers, ==, 2);
+
+ end:
+	if (state.client)
+		evhttp_client_free(state.client);
+	evhttp_free(http);
+}
+
+static void
+http_client_expire_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct http_client_state state;
+	struct evhttp *http;
+	struct evhttp_client_host *pool;
+	struct timeval tv = { 0, 200000 };
+
+	memset(&state, 0, sizeof(state));
+	http = http_setup(&state.port, data->base, 0);
+	evhttp_set_cb(http, "/client", http_client_server_cb, &state);
+	exit_base = data->base;
+
+	state.client = evhttp_client_new(data->base, NULL);
+	tt_assert(state.client);
+	evhttp_client_set_timeout_tv(state.client, &tv);
+
+	state.expected = 1;
+	http_client_request(&state, EVHTTP_REQ_GET);
+	event_base_dispatch(data->base);
+	tt_int_op(state.ok, ==, 1);
+	pool = TAILQ_FIRST(&state.client->hosts);
+	tt_assert(pool);
+	tt_int_op(pool->n_connections, ==, 1);
+
+	/* the idle connection times out and gets closed, then freed along
+	 * with its pool */
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+	tt_assert(TAILQ_EMPTY(&state.client->hosts));
+
+	/* the client still works */
+	state.done = state.ok = 0;
+	http_client_request(&state, EVHTTP_REQ_GET);
+	event_base_dispatch(data->base);
+	tt_int_op(state.ok, ==, 1);
+	tt_int_op(state.served, ==, 2);
+
+ end:
+	if (state.client)
+		evhttp_client_free(state.client);
+	evhttp_free(http);
+}
+
+static void
+http_client_retry_test(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct http_client_state state;
+	struct evhttp *http;
+	int idempotent = data->setup_data != NULL;
+
+	memset(&state, 0, sizeof(state));
+	http = http_setup(&state.port, data->base, 0);
+	evhttp_set_cb(http, "/client", http_client_server_cb, &state);
+	exit_base = data->base;
+
+	state.client = evhttp_client_new(data->base, NULL);
+	tt_assert(state.client);
+
+	state.expected = 2;
+	state.drop = 1;
+	state.type = idempotent ? EVHTTP_REQ_PUT : EVHTTP_REQ_POST;
+	http_client_request(&state, EVHTTP_REQ_GET);
+	event_base_dispatch(data->base);
+
+	tt_int_op(state.done, ==, 2);
+	if (idempotent) {
+		/* sent again on a fresh connection, body included */
+		tt_int_op(state.ok, ==, 2);
+		tt_int_op(state.served, ==, 2);
+		tt_int_op(state.n_peers, ==, 2);
+		tt_str_op(state.body, ==, "5");
+	} else {
+		tt_int_op(state.ok, ==, 1);
+		tt_int_op(state.served, ==, 1);
+	}
+
+ end:
+	if (state.client)
+		evhttp_client_free(state.client);
+	evhttp_free(http);
+}
+
 
 
 
@@ -5192,6 +6230,10 @@ struct testcase_t http_testcases[] = {
 	{ "primitives", http_primitives, 0, NULL, NULL },
 	{ "base", http_base_test, TT_FORK, NULL, NULL },
 	{ "bad_headers", http_bad_header_test, 0, NULL, NULL },
+	{ "header_index", http_header_index_test, 0, NULL, NULL },
+	{ "hand_built_header", http_hand_built_header_test, 0, NULL, NULL },
+	{ "parse_in_place", http_parse_in_place_test, 0, NULL, NULL },
+	{ "hpack", http_hpack_test, 0, NULL, NULL },
 	{ "parse_query", http_parse_query_test, 0, NULL, NULL },
 	{ "parse_query_str", http_parse_query_str_test, 0, NULL, NULL },
 	{ "parse_query_str_flags", http_parse_query_str_flags_test, 0, NULL, NULL },
@@ -5245,7 +6287,17 @@ struct testcase_t http_testcases[] = {
 
 	HTTP(highport),
 	HTTP(dispatcher),
+	HTTP(route),
 	HTTP(multi_line_header),
+	HTTP_N(pipeline, pipeline, 0, NULL),
+	HTTP_N(pipeline_enabled, pipeline, 0, (void *)1),
+	HTTP_N(h2, h2, 0, NULL),
+	HTTP_N(h2_upgrade, h2, 0, (void *)1),
+	HTTP(h2_large_headers),
+	HTTP(client_pool),
+	HTTP(client_expire),
+	HTTP_N(client_retry, client_retry, 0, (void *)1),
+	HTTP_N(client_no_retry, client_retry, 0, NULL),
 	HTTP(negative_content_length),
 	HTTP(chunk_out),
 	HTTP(stream_out),
@@ -144,6 +144,88 @@ end:
 		evconnlistener_free(listener2);
 }
 
+struct batch_accept_info {
+	int calls;
+	int total;
+	int max_n;
+	int bad_addr;
+};
+
+static void
+batch_acceptcb(struct evconnlistener *listener, evutil_socket_t *fds,
+    struct sockaddr **addrs, int *socklens, int n, void *arg)
+{
+	struct batch_accept_info *info = arg;
+	int i;
+
+	++info->calls;
+	info->total += n;
+	if (n > info->max_n)
+		info->max_n = n;
+	for (i = 0; i < n; ++i) {
+		if (addrs[i]->sa_family != AF_INET ||
+		    socklens[i] != (int)sizeof(struct sockaddr_in))
+			++info->bad_addr;
+		evutil_closesocket(fds[i]);
+	}
+	TT_BLATHER(("Got a batch of %d", n));
+
+	if (info->total >= 7)
+		evconnlistener_disable(listener);
+}
+
+static void
+regress_listener_batch(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evconnlistener *listener = NULL;
+	struct batch_accept_info info;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	evutil_socket_t fds[7];
+	int i;
+
+	for (i = 0; i < 7; ++i)
+		fds[i] = EVUTIL_INVALID_SOCKET;
+	memset(&info, 0, sizeof(info));
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
+	sin.sin_port = 0; /* "You pick!" */
+
+	listener = evconnlistener_new_bind(base, acceptcb, NULL,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE|LEV_OPT_DISABLED, -1,
+	    (struct sockaddr *)&sin, sizeof(sin));
+	tt_assert(listener);
+	evconnlistener_set_batch_cb(listener, batch_acceptcb, 3, &info);
+	tt_assert(getsockname(evconnlistener_get_fd(listener),
+		(struct sockaddr*)&ss, &slen) == 0);
+
+	for (i = 0; i < 7; ++i)
+		evutil_socket_connect_(&fds[i], (struct sockaddr*)&ss, slen);
+
+#ifdef _WIN32
+	Sleep(100); /* XXXX this is a stupid stopgap. */
+#endif
+	tt_int_op(evconnlistener_enable(listener), ==, 0);
+	event_base_dispatch(base);
+
+	tt_int_op(info.total, ==, 7);
+	tt_int_op(info.max_n, <=, 3);
+	tt_int_op(info.calls, >=, 3);
+	tt_int_op(info.bad_addr, ==, 0);
+
+end:
+	for (i = 0; i < 7; ++i) {
+		if (fds[i] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(fds[i]);
+	}
+	if (listener)
+		evconnlistener_free(listener);
+}
+
 static void
 errorcb(struct evconnlistener *lis, void *data_)
 {
@@ -312,6 +394,9 @@ struct testcase_t listener_testcases[] = {
 	{ "randport_ts", regress_pick_a_port, TT_FORK|TT_NEED_BASE,
 	  &basic_setup, (char*)"ts"},
 
+	{ "batch", regress_listener_batch, TT_FORK|TT_NEED_BASE,
+	  &basic_setup, NULL},
+
 #ifdef EVENT__HAVE_SETRLIMIT
 	{ "error_unlock", regress_listener_error_unlock,
 	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR|TT_NO_LOGS,
@@ -983,6 +983,238 @@ end:
 	bufferevent_free(server.bev);
 }
 
+struct ktls_context
+{
+	struct event_base *base;
+	struct bufferevent *server;
+	struct evbuffer *got;
+	evutil_socket_t file_fd;
+	size_t file_len;
+	int server_ktls;
+	int client_ktls;
+};
+static void
+ktls_server_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	struct ktls_context *ctx = arg;
+	struct evbuffer *out = bufferevent_get_output(bev);
+
+	if (!(what & BEV_EVENT_CONNECTED))
+		return;
+	ctx->server_ktls = bufferevent_openssl_get_ktls(bev);
+	evbuffer_add(out, "header:", 7);
+	/* evbuffer_add_file takes over the fd. */
+	evbuffer_add_file(out, dup(ctx->file_fd), 0, ctx->file_len);
+	evbuffer_add(out, ":trailer", 8);
+}
+static void
+ktls_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *addr, int socklen, void *arg)
+{
+	struct ktls_context *ctx = arg;
+	SSL *ssl = SSL_new(get_ssl_ctx());
+
+	SSL_use_certificate(ssl, the_cert);
+	SSL_use_PrivateKey(ssl, the_key);
+
+	ctx->server = bufferevent_openssl_socket_new(ctx->base, fd, ssl,
+	    BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_openssl_set_ktls(ctx->server, 1);
+	bufferevent_setcb(ctx->server, NULL, NULL, ktls_server_eventcb, ctx);
+	bufferevent_enable(ctx->server, EV_READ|EV_WRITE);
+	evconnlistener_disable(listener);
+}
+static void
+ktls_client_readcb(struct bufferevent *bev, void *arg)
+{
+	struct ktls_context *ctx = arg;
+
+	ctx->client_ktls = bufferevent_openssl_get_ktls(bev);
+	evbuffer_add_buffer(ctx->got, bufferevent_get_input(bev));
+	if (evbuffer_get_length(ctx->got) >= ctx->file_len + 15)
+		event_base_loopbreak(ctx->base);
+}
+static void
+regress_bufferevent_openssl_ktls(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct event_base *base = data->base;
+	struct evconnlistener *listener = NULL;
+	struct bufferevent *bev = NULL, *filter = NULL;
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss;
+	ev_socklen_t slen = sizeof(ss);
+	struct ktls_context ctx;
+	struct timeval tv = { 10, 0 };
+	char *file_data = NULL, *tmpfilename = NULL;
+	unsigned char *got;
+	size_t i;
+	SSL *ssl;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.base = base;
+	ctx.file_fd = -1;
+	ctx.got = evbuffer_new();
+	ctx.file_len = 200000;
+	file_data = malloc(ctx.file_len);
+	tt_assert(file_data);
+	for (i = 0; i < ctx.file_len; ++i)
+		file_data[i] = (char)(i % 251);
+	ctx.file_fd = regress_make_tmpfile(file_data, ctx.file_len,
+	    &tmpfilename);
+	tt_assert(ctx.file_fd >= 0);
+
+	/* A filtering bufferevent never talks to a socket. */
+	bev = bufferevent_socket_new(base, -1, 0);
+	tt_assert(bev);
+	ssl = SSL_new(get_ssl_ctx());
+	filter = bufferevent_openssl_filter_new(base, bev, ssl,
+	    BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(filter);
+	tt_int_op(bufferevent_openssl_set_ktls(filter, 1), ==, -1);
+	tt_int_op(bufferevent_openssl_get_ktls(filter), ==, 0);
+	tt_int_op(bufferevent_openssl_get_ktls(bev), ==, -1);
+	bufferevent_free(filter);
+	filter = NULL;
+	bev = NULL;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001);
+	listener = evconnlistener_new_bind(base, ktls_acceptcb, &ctx,
+	    LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE,
+	    -1, (struct sockaddr *)&sin, sizeof(sin));
+	tt_assert(listener);
+	tt_assert(getsockname(evconnlistener_get_fd(listener),
+		(struct sockaddr*)&ss, &slen) == 0);
+
+	ssl = SSL_new(get_ssl_ctx());
+	tt_assert(ssl);
+	bev = bufferevent_openssl_socket_new(base, -1, ssl,
+	    BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev);
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	tt_int_op(bufferevent_openssl_set_ktls(bev, 1), ==, 0);
+#else
+	tt_int_op(bufferevent_openssl_set_ktls(bev, 1), ==, -1);
+#endif
+	bufferevent_setcb(bev, ktls_client_readcb, NULL, NULL, &ctx);
+	tt_assert(!bufferevent_socket_connect(bev, (struct sockaddr*)&ss, slen));
+	tt_assert(!bufferevent_enable(bev, EV_READ|EV_WRITE));
+
+	event_base_loopexit(base, &tv);
+	event_base_dispatch(base);
+
+	/* Whether or not the kernel could take over, the data must arrive
+	 * intact. */
+	TT_BLATHER(("kTLS: server %d, client %d",
+		ctx.server_ktls, ctx.client_ktls));
+	tt_int_op(ctx.server_ktls, >=, 0);
+	tt_int_op(ctx.client_ktls, >=, 0);
+	tt_int_op(evbuffer_get_length(ctx.got), ==, ctx.file_len + 15);
+	got = evbuffer_pullup(ctx.got, -1);
+	tt_assert(!memcmp(got, "header:", 7));
+	tt_assert(!memcmp(got + 7, file_data, ctx.file_len));
+	tt_assert(!memcmp(got + 7 + ctx.file_len, ":trailer", 8));
+
+end:
+	if (filter)
+		bufferevent_free(filter);
+	if (bev)
+		bufferevent_free(bev);
+	if (ctx.server)
+		bufferevent_free(ctx.server);
+	if (listener)
+		evconnlistener_free(listener);
+	if (ctx.file_fd >= 0)
+		close(ctx.file_fd);
+	if (tmpfilename) {
+		unlink(tmpfilename);
+		free(tmpfilename);
+	}
+	evbuffer_free(ctx.got);
+	free(file_data);
+}
+
+static int n_app_records;
+static size_t coalesce_expect;
+static void
+count_records_cb(int write_p, int version, int content_type,
+    const void *buf, size_t len, SSL *ssl, void *arg)
+{
+	/* With TLS 1.3, every encrypted record says it's application data
+	 * on the outside; we only count once the handshake is done. */
+	if (write_p && content_type == SSL3_RT_HEADER && len >= 1 &&
+	    ((const unsigned char *)buf)[0] == SSL3_RT_APPLICATION_DATA &&
+	    SSL_is_init_finished(ssl))
+		++n_app_records;
+}
+static void
+coalesce_readcb(struct bufferevent *bev, void *arg)
+{
+	if (evbuffer_get_length(bufferevent_get_input(bev)) >= coalesce_expect)
+		event_base_loopbreak(bufferevent_get_base(bev));
+}
+static void
+coalesce_eventcb(struct bufferevent *bev, short what, void *arg)
+{
+	static const char chunk[100] = "x";
+	struct evbuffer *out = bufferevent_get_output(bev);
+	int i;
+
+	if (!(what & BEV_EVENT_CONNECTED) || !arg)
+		return;
+	/* 64 chains of 100 bytes each. */
+	n_app_records = 0;
+	for (i = 0; i < 64; ++i)
+		evbuffer_add_reference(out, chunk, sizeof(chunk), NULL, NULL);
+}
+static void
+regress_bufferevent_openssl_coalesce(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct bufferevent *bev1 = NULL, *bev2 = NULL;
+	SSL *ssl1, *ssl2;
+	struct timeval tv = { 10, 0 };
+	int no_coalesce = data->setup_data != NULL;
+
+	ssl1 = SSL_new(get_ssl_ctx());
+	ssl2 = SSL_new(get_ssl_ctx());
+	SSL_use_certificate(ssl2, the_cert);
+	SSL_use_PrivateKey(ssl2, the_key);
+	SSL_set_msg_callback(ssl1, count_records_cb);
+
+	bev1 = bufferevent_openssl_socket_new(data->base, data->pair[0], ssl1,
+	    BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE);
+	bev2 = bufferevent_openssl_socket_new(data->base, data->pair[1], ssl2,
+	    BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+	tt_assert(bev1);
+	tt_assert(bev2);
+	tt_int_op(bufferevent_openssl_set_record_size(bev1, 16385), ==, -1);
+	if (no_coalesce)
+		tt_int_op(bufferevent_openssl_set_record_size(bev1, 0), ==, 0);
+	coalesce_expect = 6400;
+	bufferevent_setcb(bev1, NULL, NULL, coalesce_eventcb, bev1);
+	bufferevent_setcb(bev2, coalesce_readcb, NULL, NULL, NULL);
+	bufferevent_enable(bev1, EV_READ|EV_WRITE);
+	bufferevent_enable(bev2, EV_READ|EV_WRITE);
+
+	event_base_loopexit(data->base, &tv);
+	event_base_dispatch(data->base);
+
+	tt_int_op(evbuffer_get_length(bufferevent_get_input(bev2)), ==, 6400);
+	if (no_coalesce)
+		tt_int_op(n_app_records, ==, 64);
+	else
+		tt_int_op(n_app_records, ==, 1);
+
+end:
+	if (bev1)
+		bufferevent_free(bev1);
+	if (bev2)
+		bufferevent_free(bev2);
+}
+
 struct testcase_t ssl_testcases[] = {
 #define T(a) ((void *)(a))
 	{ "bufferevent_socketpair", regress_bufferevent_openssl,
@@ -1067,6 +1299,13 @@ struct testcase_t ssl_testcases[] = {
 	{ "bufferevent_wm_filter_defer", regress_bufferevent_openssl_wm,
 	  TT_FORK|TT_NEED_BASE, &ssl_setup, T(REGRESS_OPENSSL_FILTER|REGRESS_DEFERRED_CALLBACKS) },
 
+	{ "bufferevent_ktls", regress_bufferevent_openssl_ktls,
+	  TT_FORK|TT_NEED_BASE, &ssl_setup, NULL },
+	{ "bufferevent_coalesce", regress_bufferevent_openssl_coalesce,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &ssl_setup, NULL },
+	{ "bufferevent_no_coalesce", regress_bufferevent_openssl_coalesce,
+	  TT_FORK|TT_NEED_BASE|TT_NEED_SOCKETPAIR, &ssl_setup, T(1) },
+
 #undef T
 
 	END_OF_TESTCASES,
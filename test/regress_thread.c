@@ -58,6 +58,10 @@
 #include "event2/event_struct.h"
 #include "event2/thread.h"
 #include "event2/util.h"
+#ifdef EVENT__HAVE_PTHREADS
+#include "event2/base_group.h"
+#include "event2/listener.h"
+#endif
 #include "evthread-internal.h"
 #include "event-internal.h"
 #include "defer-internal.h"
@@ -564,6 +568,302 @@ end:
 	;
 }
 
+#define POST_N_THREADS 4
+#define POST_N_CALLBACKS 1000
+struct post_info {
+	struct event_base *base;
+	int next_seq[POST_N_THREADS];
+	int total;
+	int wrong_base;
+	int out_of_order;
+};
+struct post_item {
+	struct post_info *info;
+	int thread;
+	int seq;
+};
+static struct post_item post_items[POST_N_THREADS][POST_N_CALLBACKS];
+
+static void
+post_cb(struct event_base *base, void *arg)
+{
+	struct post_item *item = arg;
+	struct post_info *info = item->info;
+
+	if (base != info->base)
+		++info->wrong_base;
+	/* Callbacks from one thread must run in the order it posted them. */
+	if (item->seq != info->next_seq[item->thread]++)
+		++info->out_of_order;
+	if (++info->total == POST_N_THREADS * POST_N_CALLBACKS)
+		event_base_loopbreak(base);
+}
+
+static THREAD_FN
+post_thread(void *arg)
+{
+	struct post_item *items = arg;
+	int i;
+	for (i = 0; i < POST_N_CALLBACKS; ++i)
+		event_base_post(items[i].info->base, post_cb, &items[i], 0);
+	THREAD_RETURN();
+}
+
+static void
+thread_post(void *arg)
+{
+	struct basic_test_data *data = arg;
+	struct post_info info;
+	THREAD_T threads[POST_N_THREADS];
+	int i, j;
+
+	memset(&info, 0, sizeof(info));
+	info.base = data->base;
+	for (i = 0; i < POST_N_THREADS; ++i) {
+		for (j = 0; j < POST_N_CALLBACKS; ++j) {
+			post_items[i][j].info = &info;
+			post_items[i][j].thread = i;
+			post_items[i][j].seq = j;
+		}
+	}
+
+	for (i = 0; i < POST_N_THREADS; ++i)
+		THREAD_START(threads[i], post_thread, post_items[i]);
+	event_base_loop(data->base, EVLOOP_NO_EXIT_ON_EMPTY);
+	for (i = 0; i < POST_N_THREADS; ++i)
+		THREAD_JOIN(threads[i]);
+
+	tt_int_op(info.total, ==, POST_N_THREADS * POST_N_CALLBACKS);
+	tt_int_op(info.wrong_base, ==, 0);
+	tt_int_op(info.out_of_order, ==, 0);
+	for (i = 0; i < POST_N_THREADS; ++i)
+		tt_int_op(info.next_seq[i], ==, POST_N_CALLBACKS);
+
+end:
+	;
+}
+
+static void
+wakeup_count_cb(struct event_base *base, void *arg)
+{
+	++*(int *)arg;
+}
+
+static void
+thread_wakeup_counts(void *arg)
+{
+	struct basic_test_data *data = arg;
+	ev_uint64_t sent = 0, coalesced = 0;
+	int i, ran = 0;
+
+	event_base_get_wakeup_counts(data->base, &sent, &coalesced);
+	tt_int_op(sent, ==, 0);
+	tt_int_op(coalesced, ==, 0);
+
+	/* A post onto an empty queue asks for a wakeup, but only the first
+	 * one is sent until the loop has drained it. */
+	tt_int_op(event_base_post(data->base, wakeup_count_cb, &ran, 0), ==, 0);
+	tt_int_op(event_base_post(data->base, wakeup_count_cb, &ran,
+		EV_POST_STEALABLE), ==, 0);
+	for (i = 0; i < 10; ++i) {
+		tt_int_op(event_base_post(data->base, wakeup_count_cb, &ran, 0),
+		    ==, 0);
+	}
+	event_base_get_wakeup_counts(data->base, &sent, NULL);
+	event_base_get_wakeup_counts(data->base, NULL, &coalesced);
+	tt_int_op(sent, ==, 1);
+	tt_int_op(coalesced, ==, 1);
+
+	/* Once the loop drains the notification, the next one is sent. */
+	event_base_loop(data->base, EVLOOP_NONBLOCK);
+	tt_int_op(ran, ==, 12);
+	tt_int_op(event_base_post(data->base, wakeup_count_cb, &ran, 0), ==, 0);
+	event_base_get_wakeup_counts(data->base, &sent, &coalesced);
+	tt_int_op(sent, ==, 2);
+	tt_int_op(coalesced, ==, 1);
+
+end:
+	;
+}
+
+#ifdef EVENT__HAVE_PTHREADS
+struct base_group_info {
+	pthread_mutex_t lock;
+	struct event_base_group *group;
+	int accepted;
+	int wrong_thread;
+};
+
+static void
+base_group_acceptcb(struct evconnlistener *listener, evutil_socket_t fd,
+    struct sockaddr *addr, int socklen, void *arg)
+{
+	struct base_group_info *info = arg;
+	struct event_base *base = evconnlistener_get_base(listener);
+	int i, found = 0;
+
+	for (i = 0; i < event_base_group_get_n_bases(info->group); ++i) {
+		if (event_base_group_get_base(info->group, i) == base)
+			found = 1;
+	}
+	evutil_closesocket(fd);
+
+	pthread_mutex_lock(&info->lock);
+	++info->accepted;
+	if (!found)
+		++info->wrong_thread;
+	pthread_mutex_unlock(&info->lock);
+}
+
+static void
+thread_base_group(void *arg)
+{
+	struct base_group_info info;
+	struct evconnlistener *listeners[2];
+	struct sockaddr_in sin;
+	struct sockaddr_storage ss1, ss2;
+	ev_socklen_t slen1 = sizeof(ss1), slen2 = sizeof(ss2);
+	evutil_socket_t fds[8];
+	int i, accepted = 0;
+
+	memset(&info, 0, sizeof(info));
+	pthread_mutex_init(&info.lock, NULL);
+	for (i = 0; i < 8; ++i)
+		fds[i] = EVUTIL_INVALID_SOCKET;
+
+	info.group = event_base_group_new(2, NULL,
+	    EVENT_BASE_GROUP_PIN_THREADS|EVENT_BASE_GROUP_STEER_BY_CPU);
+	tt_assert(info.group);
+	tt_int_op(event_base_group_get_n_bases(info.group), ==, 2);
+	tt_assert(event_base_group_get_base(info.group, 0));
+	tt_assert(event_base_group_get_base(info.group, 1));
+	tt_ptr_op(event_base_group_get_base(info.group, 2), ==, NULL);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(0x7f000001); /* 127.0.0.1 */
+	sin.sin_port = 0; /* "You pick!" */
+	tt_int_op(event_base_group_listen(info.group, base_group_acceptcb,
+		&info, LEV_OPT_CLOSE_ON_FREE|LEV_OPT_REUSEABLE, -1,
+		(struct sockaddr *)&sin, sizeof(sin), listeners), ==, 0);
+
+	tt_ptr_op(evconnlistener_get_base(listeners[0]), ==,
+	    event_base_group_get_base(info.group, 0));
+	tt_ptr_op(evconnlistener_get_base(listeners[1]), ==,
+	    event_base_group_get_base(info.group, 1));
+	tt_assert(getsockname(evconnlistener_get_fd(listeners[0]),
+		(struct sockaddr*)&ss1, &slen1) == 0);
+	tt_assert(getsockname(evconnlistener_get_fd(listeners[1]),
+		(struct sockaddr*)&ss2, &slen2) == 0);
+	/* Both listeners share the port that the first one picked. */
+	tt_int_op(((struct sockaddr_in*)&ss1)->sin_port, ==,
+	    ((struct sockaddr_in*)&ss2)->sin_port);
+
+	for (i = 0; i < 8; ++i)
+		evutil_socket_connect_(&fds[i], (struct sockaddr*)&ss1, slen1);
+
+	for (i = 0; i < 500 && accepted < 8; ++i) {
+		SLEEP_MS(10);
+		pthread_mutex_lock(&info.lock);
+		accepted = info.accepted;
+		pthread_mutex_unlock(&info.lock);
+	}
+	tt_int_op(accepted, ==, 8);
+	tt_int_op(info.wrong_thread, ==, 0);
+
+end:
+	for (i = 0; i < 8; ++i) {
+		if (fds[i] != EVUTIL_INVALID_SOCKET)
+			evutil_closesocket(fds[i]);
+	}
+	if (info.group)
+		event_base_group_free(info.group);
+	pthread_mutex_destroy(&info.lock);
+}
+
+#define STEAL_N_CALLBACKS 100
+struct steal_info {
+	pthread_mutex_t lock;
+	struct event_base_group *group;
+	int blocking;
+	int ran;
+	int ran_elsewhere;
+};
+
+static void
+steal_block_cb(struct event_base *base, void *arg)
+{
+	struct steal_info *info = arg;
+	int i, ran = 0;
+
+	/* Keep this base busy until the stealable callbacks have all run
+	 * somewhere else, or we give up. */
+	pthread_mutex_lock(&info->lock);
+	info->blocking = 1;
+	pthread_mutex_unlock(&info->lock);
+	for (i = 0; i < 500 && ran < STEAL_N_CALLBACKS; ++i) {
+		SLEEP_MS(10);
+		pthread_mutex_lock(&info->lock);
+		ran = info->ran;
+		pthread_mutex_unlock(&info->lock);
+	}
+}
+
+static void
+steal_cb(struct event_base *base, void *arg)
+{
+	struct steal_info *info = arg;
+	pthread_mutex_lock(&info->lock);
+	++info->ran;
+	if (base != event_base_group_get_base(info->group, 0))
+		++info->ran_elsewhere;
+	pthread_mutex_unlock(&info->lock);
+}
+
+static void
+thread_post_steal(void *arg)
+{
+	struct steal_info info;
+	struct event_base *base;
+	int i, blocking = 0, ran = 0;
+
+	memset(&info, 0, sizeof(info));
+	pthread_mutex_init(&info.lock, NULL);
+
+	info.group = event_base_group_new(2, NULL,
+	    EVENT_BASE_GROUP_WORK_STEALING);
+	tt_assert(info.group);
+	base = event_base_group_get_base(info.group, 0);
+
+	tt_int_op(event_base_post(base, steal_block_cb, &info, 0), ==, 0);
+	for (i = 0; i < 500 && !blocking; ++i) {
+		SLEEP_MS(10);
+		pthread_mutex_lock(&info.lock);
+		blocking = info.blocking;
+		pthread_mutex_unlock(&info.lock);
+	}
+	tt_assert(blocking);
+
+	for (i = 0; i < STEAL_N_CALLBACKS; ++i) {
+		tt_int_op(event_base_post(base, steal_cb, &info,
+			EV_POST_STEALABLE), ==, 0);
+	}
+	for (i = 0; i < 500 && ran < STEAL_N_CALLBACKS; ++i) {
+		SLEEP_MS(10);
+		pthread_mutex_lock(&info.lock);
+		ran = info.ran;
+		pthread_mutex_unlock(&info.lock);
+	}
+	tt_int_op(ran, ==, STEAL_N_CALLBACKS);
+	tt_int_op(info.ran_elsewhere, >, 0);
+
+end:
+	if (info.group)
+		event_base_group_free(info.group);
+	pthread_mutex_destroy(&info.lock);
+}
+#endif
+
 #define TEST(name, f)							\
 	{ #name, thread_##name, TT_FORK|TT_NEED_THREADS|TT_NEED_BASE|(f),	\
 	  &basic_setup, NULL }
@@ -584,6 +884,14 @@ struct testcase_t thread_testcases[] = {
 	 * looking into it now. / ellzey
 	 ******/
 	TEST(no_events, TT_RETRIABLE),
+#endif
+	TEST(post, 0),
+	TEST(wakeup_counts, 0),
+#ifdef EVENT__HAVE_PTHREADS
+	{ "base_group", thread_base_group, TT_FORK|TT_NEED_THREADS,
+	  &basic_setup, NULL },
+	{ "post_steal", thread_post_steal, TT_FORK|TT_NEED_THREADS,
+	  &basic_setup, NULL },
 #endif
 	END_OF_TESTCASES
 };
@@ -1,6 +1,6 @@
 #!/bin/sh
 
-BACKENDS="EVPORT KQUEUE EPOLL DEVPOLL POLL SELECT WIN32"
+BACKENDS="EVPORT KQUEUE EPOLL IO_URING DEVPOLL POLL SELECT WIN32"
 TESTS="test-eof test-closed test-weof test-time test-changelist test-fdleak"
 FAILED=no
 TEST_OUTPUT_FILE=${TEST_OUTPUT_FILE:-/dev/null}
@@ -50,6 +50,7 @@ setup () {
 	done
 	unset EVENT_EPOLL_USE_CHANGELIST
 	unset EVENT_PRECISE_TIMER
+	unset EVENT_TIMER_WHEEL
 }
 
 announce () {
@@ -141,6 +142,8 @@ do_test() {
 	elif test "$2" = "(timerfd+changelist)" ; then
 	    EVENT_EPOLL_USE_CHANGELIST=yes; export EVENT_EPOLL_USE_CHANGELIST
 	    EVENT_PRECISE_TIMER=1; export EVENT_PRECISE_TIMER
+	elif test "$2" = "(timerwheel)" ; then
+	    EVENT_TIMER_WHEEL=1; export EVENT_TIMER_WHEEL
         fi
 
 	run_tests
@@ -153,6 +156,7 @@ usage()
   -t   - run timerfd test
   -c   - run changelist test
   -T   - run timerfd+changelist test
+  -w   - run timer wheel test
 EOL
 }
 main()
@@ -161,13 +165,15 @@ main()
 	timerfd=0
 	changelist=0
 	timerfd_changelist=0
+	timerwheel=0
 
-	while getopts "b:tcT" c; do
+	while getopts "b:tcTw" c; do
 		case "$c" in
 			b) backends="$OPTARG";;
 			t) timerfd=1;;
 			c) changelist=1;;
 			T) timerfd_changelist=1;;
+			w) timerwheel=1;;
 			?*) usage && exit 1;;
 		esac
 	done
@@ -177,6 +183,7 @@ main()
 	[ $timerfd -eq 0 ] || do_test EPOLL "(timerfd)"
 	[ $changelist -eq 0 ] || do_test EPOLL "(changelist)"
 	[ $timerfd_changelist -eq 0 ] || do_test EPOLL "(timerfd+changelist)"
+	[ $timerwheel -eq 0 ] || do_test EPOLL "(timerwheel)"
 	for i in $backends; do
 		do_test $i
 	done
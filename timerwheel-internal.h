@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TIMERWHEEL_INTERNAL_H_INCLUDED_
+#define TIMERWHEEL_INTERNAL_H_INCLUDED_
+
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+#include "event2/event_struct.h"
+#include "event2/util.h"
+
+/*
+  A hierarchical timing wheel, used instead of the min-heap to hold the
+  non-common timeouts of an event_base that was created with
+  EVENT_BASE_FLAG_TIMER_WHEEL.
+
+  Time is counted in ticks of one millisecond.  Each level has
+  TIMER_WHEEL_SLOTS slots, and a slot on level N covers
+  TIMER_WHEEL_SLOTS^N ticks.  An event is filed on the level of the highest
+  digit in which its expiry differs from the wheel's current tick, so adding
+  and removing an event is O(1), and as time passes each event gets moved
+  down at most TIMER_WHEEL_LEVELS times.  Events too far in the future for
+  the top level wait on an overflow list.
+
+  Finding the earliest event is not O(1): the events in a slot are not
+  sorted, so once the cached earliest event goes away, the first occupied
+  slot is walked from end to end.  Slots on the higher levels cover long
+  spans of time and can hold many events.
+
+  Events are linked through ev_timeout_pos.ev_next_with_common_timeout,
+  which no other timeout structure uses while the event is in the wheel.
+
+  Timeouts fire up to one tick late, never early.
+ */
+
+#define TIMER_WHEEL_BITS 8
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer_wheel {
+	/* The tick up to which we have advanced.  Every event with an expiry
+	 * at or before this tick is on the 'expired' list. */
+	ev_uint64_t now;
+	/* Number of events in the wheel. */
+	size_t n;
+	/* Events that have expired but have not been popped yet. */
+	struct event *expired;
+	/* Events too far in the future for the highest level. */
+	struct event *overflow;
+	/* The event with the earliest expiry outside the 'expired' list, if
+	 * 'next_ok' is set.  Found again lazily after it goes away. */
+	struct event *next;
+	int next_ok;
+	/* The slots themselves, as head-less doubly linked lists. */
+	struct event *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	/* One bit per slot, set if the slot may be non-empty.  Bits are
+	 * cleared lazily when we notice an empty slot. */
+	ev_uint64_t occupied[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS / 64];
+};
+
+/** Set up 'w' so that its current time is 'now'. */
+void timer_wheel_ctor_(struct timer_wheel *w, const struct timeval *now);
+/** Add 'ev' to 'w', using its ev_timeout as the expiry time. */
+void timer_wheel_push_(struct timer_wheel *w, struct event *ev);
+/** Remove 'ev' from 'w'. */
+void timer_wheel_erase_(struct timer_wheel *w, struct event *ev);
+/** Move 'ev' after its ev_timeout has changed. */
+void timer_wheel_adjust_(struct timer_wheel *w, struct event *ev);
+/** Advance 'w' to 'now', and return one expired event without removing it,
+ * or NULL if no event has expired. */
+struct event *timer_wheel_top_expired_(struct timer_wheel *w,
+    const struct timeval *now);
+/** Return the earliest expiry of any event in 'w', rounded up to a tick,
+ * in 'tv'.  Returns -1 if the wheel is empty. */
+int timer_wheel_next_(struct timer_wheel *w, struct timeval *tv);
+/** Return some event in 'w', or NULL if it's empty. */
+struct event *timer_wheel_any_(const struct timer_wheel *w);
+/** Call 'fn' on every event in 'w', stopping early if it returns nonzero.
+ * 'fn' must not modify 'w'. */
+int timer_wheel_foreach_(struct timer_wheel *w,
+    int (*fn)(struct event *, void *), void *arg);
+/** For debugging: assert that 'w' is internally consistent. */
+void timer_wheel_assert_ok_(struct timer_wheel *w);
+
+#define timer_wheel_empty_(w) ((w)->n == 0)
+#define timer_wheel_size_(w) ((w)->n)
+
+#endif /* TIMERWHEEL_INTERNAL_H_INCLUDED_ */
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2007-2012 Niels Provos and Nick Mathewson
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "event2/event-config.h"
+#include "evconfig-private.h"
+
+#include <string.h>
+
+#include "event2/event_struct.h"
+#include "event-internal.h"
+#include "timerwheel-internal.h"
+#include "util-internal.h"
+
+#define TW_NEXT(ev) ((ev)->ev_timeout_pos.ev_next_with_common_timeout.tqe_next)
+#define TW_PREVP(ev) ((ev)->ev_timeout_pos.ev_next_with_common_timeout.tqe_prev)
+
+#define TW_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TW_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+/* Number of bits of tick covered by all the levels together. */
+#define TW_TOTAL_BITS (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)
+
+/* The last tick at or after the expiry time in 'tv'. */
+static ev_uint64_t
+tv_to_tick_ceil(const struct timeval *tv)
+{
+	return (ev_uint64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+/* The last tick at or before the time in 'tv'. */
+static ev_uint64_t
+tv_to_tick_floor(const struct timeval *tv)
+{
+	return (ev_uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static void
+tick_to_tv(ev_uint64_t tick, struct timeval *tv)
+{
+	tv->tv_sec = (time_t)(tick / 1000);
+	tv->tv_usec = (long)(tick % 1000) * 1000;
+}
+
+static void
+tw_list_insert(struct event **head, struct event *ev)
+{
+	if ((TW_NEXT(ev) = *head) != NULL)
+		TW_PREVP(*head) = &TW_NEXT(ev);
+	*head = ev;
+	TW_PREVP(ev) = head;
+}
+
+static void
+tw_list_remove(struct event *ev)
+{
+	if (TW_NEXT(ev) != NULL)
+		TW_PREVP(TW_NEXT(ev)) = TW_PREVP(ev);
+	*TW_PREVP(ev) = TW_NEXT(ev);
+	TW_NEXT(ev) = NULL;
+	TW_PREVP(ev) = NULL;
+}
+
+/* Return the position of the highest set bit in 'v', counting from 1, or 0
+ * if 'v' is 0. */
+static int
+tw_fls64(ev_uint64_t v)
+{
+	int r = 0;
+	while (v) {
+		++r;
+		v >>= 1;
+	}
+	return r;
+}
+
+/* Put 'ev' in the right place for its expiry, given the wheel's current
+ * time.  Does not change w->n. */
+static void
+tw_place(struct timer_wheel *w, struct event *ev)
+{
+	ev_uint64_t tick = tv_to_tick_ceil(&ev->ev_timeout);
+	int level, slot;
+
+	if (tick <= w->now) {
+		tw_list_insert(&w->expired, ev);
+		return;
+	}
+	level = (tw_fls64(tick ^ w->now) - 1) / TIMER_WHEEL_BITS;
+	if (level >= TIMER_WHEEL_LEVELS) {
+		tw_list_insert(&w->overflow, ev);
+		return;
+	}
+	slot = (int)((tick >> TW_SHIFT(level)) & TW_MASK);
+	tw_list_insert(&w->slots[level][slot], ev);
+	w->occupied[level][slot / 64] |= ((ev_uint64_t)1) << (slot % 64);
+}
+
+/* Move every event in 'from' onto 'to'. */
+static void
+tw_list_splice(struct event **to, struct event **from)
+{
+	struct event *ev;
+	while ((ev = *from) != NULL) {
+		tw_list_remove(ev);
+		tw_list_insert(to, ev);
+	}
+}
+
+/* Collect the contents of slot 'slot' on 'level' onto the list 'todo'. */
+static void
+tw_take_slot(struct timer_wheel *w, int level, int slot, struct event **todo)
+{
+	w->occupied[level][slot / 64] &= ~(((ev_uint64_t)1) << (slot % 64));
+	tw_list_splice(todo, &w->slots[level][slot]);
+}
+
+/* Move the wheel's time forward to 'tick', filing every event whose slot we
+ * pass over either on the expired list or on a lower level. */
+static void
+tw_advance(struct timer_wheel *w, ev_uint64_t tick)
+{
+	struct event *todo = NULL, *ev;
+	int level;
+
+	if (tick <= w->now)
+		return;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		ev_uint64_t cur = w->now >> TW_SHIFT(level);
+		ev_uint64_t tgt = tick >> TW_SHIFT(level);
+		ev_uint64_t i;
+
+		if (cur == tgt)
+			break;
+		if (tgt - cur >= TIMER_WHEEL_SLOTS) {
+			int slot;
+			for (slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+				if (w->slots[level][slot])
+					tw_take_slot(w, level, slot, &todo);
+			}
+			continue;
+		}
+		for (i = cur + 1; i <= tgt; ++i) {
+			int slot = (int)(i & TW_MASK);
+			if (w->slots[level][slot])
+				tw_take_slot(w, level, slot, &todo);
+		}
+	}
+	if ((w->now >> TW_TOTAL_BITS) != (tick >> TW_TOTAL_BITS))
+		tw_list_splice(&todo, &w->overflow);
+
+	w->now = tick;
+
+	while ((ev = todo) != NULL) {
+		tw_list_remove(ev);
+		tw_place(w, ev);
+	}
+}
+
+void
+timer_wheel_ctor_(struct timer_wheel *w, const struct timeval *now)
+{
+	memset(w, 0, sizeof(*w));
+	w->now = tv_to_tick_floor(now);
+}
+
+/* Note that 'ev' has just been filed, maybe making it the earliest. */
+static void
+tw_note_next(struct timer_wheel *w, struct event *ev)
+{
+	if (w->next_ok && evutil_timercmp(&ev->ev_timeout,
+		&w->next->ev_timeout, <))
+		w->next = ev;
+}
+
+void
+timer_wheel_push_(struct timer_wheel *w, struct event *ev)
+{
+	tw_place(w, ev);
+	++w->n;
+	tw_note_next(w, ev);
+}
+
+void
+timer_wheel_erase_(struct timer_wheel *w, struct event *ev)
+{
+	EVUTIL_ASSERT(TW_PREVP(ev) != NULL);
+	tw_list_remove(ev);
+	--w->n;
+	if (ev == w->next)
+		w->next_ok = 0;
+}
+
+void
+timer_wheel_adjust_(struct timer_wheel *w, struct event *ev)
+{
+	tw_list_remove(ev);
+	tw_place(w, ev);
+	/* If the earliest event got later, something else may be first. */
+	if (ev == w->next)
+		w->next_ok = 0;
+	else
+		tw_note_next(w, ev);
+}
+
+struct event *
+timer_wheel_top_expired_(struct timer_wheel *w, const struct timeval *now)
+{
+	if (!w->n)
+		return NULL;
+	if (!w->expired)
+		tw_advance(w, tv_to_tick_floor(now));
+	return w->expired;
+}
+
+/* Return the lowest non-empty slot on 'level' above 'after', or -1. */
+static int
+tw_next_slot(struct timer_wheel *w, int level, int after)
+{
+	int slot = after + 1;
+
+	while (slot < TIMER_WHEEL_SLOTS) {
+		ev_uint64_t bits = w->occupied[level][slot / 64] >>
+		    (slot % 64);
+		if (!bits) {
+			slot = (slot / 64 + 1) * 64;
+			continue;
+		}
+		while (!(bits & 1)) {
+			bits >>= 1;
+			++slot;
+		}
+		if (w->slots[level][slot])
+			return slot;
+		/* Stale bit: clear it and keep looking. */
+		w->occupied[level][slot / 64] &=
+		    ~(((ev_uint64_t)1) << (slot % 64));
+		++slot;
+	}
+	return -1;
+}
+
+/* Return the event with the earliest expiry on the list 'head', or NULL.
+ * Linear in the length of the list. */
+static struct event *
+tw_list_min(struct event *head)
+{
+	struct event *ev, *min = head;
+	for (ev = head; ev; ev = TW_NEXT(ev)) {
+		if (evutil_timercmp(&ev->ev_timeout, &min->ev_timeout, <))
+			min = ev;
+	}
+	return min;
+}
+
+/* Find the event with the earliest expiry outside the 'expired' list. */
+static struct event *
+tw_find_next(struct timer_wheel *w)
+{
+	int level;
+
+	/* Every event on a level expires later than every event on the
+	 * levels below it, and in a later slot than every event in the
+	 * slots before it, so the first non-empty slot we find holds the
+	 * earliest event. */
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		int cur = (int)((w->now >> TW_SHIFT(level)) & TW_MASK);
+		int slot = tw_next_slot(w, level, cur);
+		if (slot >= 0)
+			return tw_list_min(w->slots[level][slot]);
+	}
+	return tw_list_min(w->overflow);
+}
+
+int
+timer_wheel_next_(struct timer_wheel *w, struct timeval *tv)
+{
+	if (!w->n)
+		return -1;
+	if (w->expired) {
+		tick_to_tv(w->now, tv);
+		return 0;
+	}
+
+	if (!w->next_ok) {
+		w->next = tw_find_next(w);
+		w->next_ok = 1;
+	}
+	EVUTIL_ASSERT(w->next != NULL);
+	tick_to_tv(tv_to_tick_ceil(&w->next->ev_timeout), tv);
+	return 0;
+}
+
+struct event *
+timer_wheel_any_(const struct timer_wheel *w)
+{
+	int level, slot;
+
+	if (!w->n)
+		return NULL;
+	if (w->expired)
+		return w->expired;
+	if (w->overflow)
+		return w->overflow;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+			if (w->slots[level][slot])
+				return w->slots[level][slot];
+		}
+	}
+	return NULL;
+}
+
+static int
+tw_foreach_list(struct event *head, int (*fn)(struct event *, void *),
+    void *arg)
+{
+	struct event *ev, *next;
+	int r;
+	for (ev = head; ev; ev = next) {
+		next = TW_NEXT(ev);
+		if ((r = fn(ev, arg)))
+			return r;
+	}
+	return 0;
+}
+
+int
+timer_wheel_foreach_(struct timer_wheel *w,
+    int (*fn)(struct event *, void *), void *arg)
+{
+	int level, slot, r;
+
+	if ((r = tw_foreach_list(w->expired, fn, arg)))
+		return r;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+			if ((r = tw_foreach_list(w->slots[level][slot],
+				    fn, arg)))
+				return r;
+		}
+	}
+	return tw_foreach_list(w->overflow, fn, arg);
+}
+
+static size_t
+tw_assert_list_ok(struct event **head)
+{
+	struct event *ev;
+	struct event **prevp = head;
+	size_t n = 0;
+	for (ev = *head; ev; ev = TW_NEXT(ev)) {
+		EVUTIL_ASSERT(TW_PREVP(ev) == prevp);
+		EVUTIL_ASSERT(ev->ev_flags & EVLIST_TIMEOUT);
+		prevp = &TW_NEXT(ev);
+		++n;
+	}
+	return n;
+}
+
+void
+timer_wheel_assert_ok_(struct timer_wheel *w)
+{
+	int level, slot;
+	size_t n = 0;
+	struct event *ev;
+
+	n += tw_assert_list_ok(&w->expired);
+	for (ev = w->expired; ev; ev = TW_NEXT(ev))
+		EVUTIL_ASSERT(tv_to_tick_ceil(&ev->ev_timeout) <= w->now);
+	n += tw_assert_list_ok(&w->overflow);
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		int shift = TW_SHIFT(level);
+		for (slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+			struct event **head = &w->slots[level][slot];
+			n += tw_assert_list_ok(head);
+			if (*head)
+				EVUTIL_ASSERT(w->occupied[level][slot / 64] &
+				    (((ev_uint64_t)1) << (slot % 64)));
+			for (ev = *head; ev; ev = TW_NEXT(ev)) {
+				ev_uint64_t tick =
+				    tv_to_tick_ceil(&ev->ev_timeout);
+				EVUTIL_ASSERT(tick > w->now);
+				EVUTIL_ASSERT(((tick >> shift) & TW_MASK) ==
+				    (ev_uint64_t)slot);
+				EVUTIL_ASSERT((tick >> (shift + TIMER_WHEEL_BITS))
+				    == (w->now >> (shift + TIMER_WHEEL_BITS)));
+			}
+		}
+	}
+	EVUTIL_ASSERT(n == w->n);
+
+	if (w->next_ok && !w->expired) {
+		struct event *next = tw_find_next(w);
+		EVUTIL_ASSERT(next != NULL);
+		EVUTIL_ASSERT(!evutil_timercmp(&next->ev_timeout,
+			&w->next->ev_timeout, <));
+	}
+}
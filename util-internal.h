@@ -505,6 +505,37 @@ evutil_socket_t evutil_socket_(int domain, int type, int protocol);
 evutil_socket_t evutil_accept4_(evutil_socket_t sockfd, struct sockaddr *addr,
     ev_socklen_t *addrlen, int flags);
 
+/** One datagram for evutil_recv_datagrams_() or evutil_send_datagrams_(). */
+struct evutil_datagram_ {
+	/** The payload.  On receive, buf holds buflen bytes of space and len
+	 * is set to the size of the datagram. */
+	void *buf;
+	size_t buflen;
+	size_t len;
+	/** The peer address; an addrlen of 0 means that the socket is
+	 * connected and there is none. */
+	struct sockaddr_storage addr;
+	ev_socklen_t addrlen;
+};
+
+/** Largest number of datagrams that evutil_recv_datagrams_() and
+ * evutil_send_datagrams_() move in one system call. */
+#define EVUTIL_DATAGRAM_BATCH_MAX 64
+
+/** Read up to n datagrams from the nonblocking socket fd into dgrams, with
+ * recvmmsg() where we have it.  Return the number of datagrams read, or -1
+ * with the socket error set if none could be. */
+EVENT2_EXPORT_SYMBOL
+int evutil_recv_datagrams_(evutil_socket_t fd,
+    struct evutil_datagram_ *dgrams, int n);
+/** Send up to n datagrams from dgrams on the nonblocking socket fd, with
+ * sendmmsg() where we have it.  Return the number of datagrams sent, which
+ * stops short at the first one that failed, or -1 with the socket error set
+ * if the first one failed. */
+EVENT2_EXPORT_SYMBOL
+int evutil_send_datagrams_(evutil_socket_t fd,
+    const struct evutil_datagram_ *dgrams, int n);
+
     /* used by one of the test programs.. */
 EVENT2_EXPORT_SYMBOL
 int evutil_make_internal_pipe_(evutil_socket_t fd[2]);